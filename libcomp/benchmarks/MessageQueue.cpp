@@ -0,0 +1,110 @@
+/**
+ * @file libcomp/benchmarks/MessageQueue.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Benchmark of the locking and lock-free message queues.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <MessageQueue.h>
+
+// Standard C++11 Includes
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace libcomp;
+
+/**
+ * Time how long it takes for @em producerCount threads to push
+ * @em messageCount messages each to a single consumer.
+ * @returns Average time per message in nanoseconds.
+ */
+template<class Q>
+static double BenchmarkQueue(int producerCount, int messageCount)
+{
+    Q queue;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producers;
+
+    for(int p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&queue, messageCount]()
+        {
+            for(int i = 0; i < messageCount; ++i)
+            {
+                queue.Enqueue(i);
+            }
+        });
+    }
+
+    int received = 0;
+
+    while(received < producerCount * messageCount)
+    {
+        std::list<int> messages;
+        queue.DequeueAll(messages);
+
+        received += (int)messages.size();
+    }
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    return (double)duration.count() / (double)received;
+}
+
+int main(int argc, char *argv[])
+{
+    // Messages sent by each producer (can be given on the command line).
+    int messageCount = 1 < argc ? atoi(argv[1]) : 250000;
+
+    if(0 >= messageCount)
+    {
+        std::cerr << "Usage: " << argv[0] << " [messages per producer]"
+            << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    for(int producerCount : { 1, 2, 4, 8 })
+    {
+        double locking = BenchmarkQueue<LockingMessageQueue<int>>(
+            producerCount, messageCount);
+        double lockFree = BenchmarkQueue<LockFreeMessageQueue<int>>(
+            producerCount, messageCount);
+
+        std::cout << producerCount << " producer(s): locking "
+            << locking << " ns/msg, lock-free " << lockFree
+            << " ns/msg" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
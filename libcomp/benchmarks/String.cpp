@@ -0,0 +1,87 @@
+/**
+ * @file libcomp/benchmarks/String.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Benchmark of String::Format against chained String::Arg calls.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <CString.h>
+
+// Standard C++11 Includes
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace libcomp;
+
+int main(int argc, char *argv[])
+{
+    // Strings to format (can be given on the command line).
+    int iterations = 1 < argc ? atoi(argv[1]) : 200000;
+
+    if(0 >= iterations)
+    {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    String format = "SELECT * FROM `%1` WHERE `%2` = %3 AND `%4` = '%5';";
+
+    auto start = std::chrono::steady_clock::now();
+    size_t total = 0;
+
+    for(int i = 0; i < iterations; ++i)
+    {
+        total += format.Arg("character").Arg("uid").Arg(i).Arg(
+            "name").Arg("test").Size();
+    }
+
+    auto argTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < iterations; ++i)
+    {
+        total -= String::Format(format, "character", "uid", i, "name",
+            "test").Size();
+    }
+
+    auto formatTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    // Both ways must build the same strings.
+    if(0 != total)
+    {
+        std::cerr << "Format and Arg gave different results." << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Arg: " << ((double)iterations * 1000000.0 /
+        (double)argTime.count()) << " strings/s" << std::endl;
+    std::cout << "Format: " << ((double)iterations * 1000000.0 /
+        (double)formatTime.count()) << " strings/s" << std::endl;
+
+    return EXIT_SUCCESS;
+}
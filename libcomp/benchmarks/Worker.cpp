@@ -0,0 +1,249 @@
+/**
+ * @file libcomp/benchmarks/Worker.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Benchmark of the message dispatch of the Worker class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Manager.h>
+#include <MessageShutdown.h>
+#include <Worker.h>
+#include <WorkerPool.h>
+
+// Standard C++11 Includes
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace libcomp;
+
+/// Number of workers in the pool benchmark.
+static const int WORKER_COUNT = 4;
+
+/// Number of mailboxes in the pool benchmark.
+static const int MAILBOX_COUNT = 16;
+
+/**
+ * Message with a type chosen by the benchmark.
+ */
+class BenchmarkMessage : public Message::Message
+{
+public:
+    explicit BenchmarkMessage(libcomp::Message::MessageType type) :
+        mType(type)
+    {
+    }
+
+    libcomp::Message::MessageType GetType() const override
+    {
+        return mType;
+    }
+
+    String Dump() const override
+    {
+        return "Message: Benchmark";
+    }
+
+private:
+    libcomp::Message::MessageType mType;
+};
+
+/**
+ * Manager that counts the messages it is given.
+ */
+class BenchmarkManager : public Manager
+{
+public:
+    explicit BenchmarkManager(const std::list<Message::MessageType>& types) :
+        mTypes(types), mCount(0)
+    {
+    }
+
+    std::list<Message::MessageType> GetSupportedTypes() const override
+    {
+        return mTypes;
+    }
+
+    bool ProcessMessage(const Message::Message *pMessage) override
+    {
+        (void)pMessage;
+
+        mCount++;
+
+        return true;
+    }
+
+    std::list<Message::MessageType> mTypes;
+    std::atomic<int> mCount;
+};
+
+/**
+ * Create a message that alternates between the client and connection
+ * types.
+ * @param i Index of the message.
+ * @returns New message.
+ */
+static Message::Message* CreateMessage(int i)
+{
+    return new BenchmarkMessage(0 == (i % 2) ?
+        Message::MessageType::MESSAGE_TYPE_CLIENT :
+        Message::MessageType::MESSAGE_TYPE_CONNECTION);
+}
+
+/**
+ * Time a single worker draining its own queue.
+ * @param messageCount Number of messages to handle.
+ * @returns Messages handled per second.
+ */
+static double BenchmarkWorker(int messageCount)
+{
+    auto client = std::make_shared<BenchmarkManager>(
+        std::list<Message::MessageType>{
+            Message::MessageType::MESSAGE_TYPE_CLIENT });
+    auto connection = std::make_shared<BenchmarkManager>(
+        std::list<Message::MessageType>{
+            Message::MessageType::MESSAGE_TYPE_CONNECTION });
+
+    Worker worker;
+    worker.AddManager(client);
+    worker.AddManager(connection);
+
+    std::list<Message::Message*> msgs;
+
+    for(int i = 0; i < messageCount; ++i)
+    {
+        msgs.push_back(CreateMessage(i));
+    }
+
+    msgs.push_back(new Message::Shutdown);
+    worker.GetMessageQueue()->Enqueue(msgs);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Runs until the shutdown message is handled.
+    worker.Start("worker", true);
+
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if(client->mCount + connection->mCount != messageCount)
+    {
+        std::cerr << "Not every message was handled." << std::endl;
+    }
+
+    return (double)messageCount * 1000000.0 / (double)duration.count();
+}
+
+/**
+ * Time a pool of workers draining mailboxes that are filled while they
+ * run.
+ * @param messageCount Number of messages to send to each mailbox.
+ * @returns Messages handled per second by each worker.
+ */
+static double BenchmarkPool(int messageCount)
+{
+    auto pool = std::make_shared<WorkerPool>();
+    auto manager = std::make_shared<BenchmarkManager>(
+        std::list<Message::MessageType>{
+            Message::MessageType::MESSAGE_TYPE_CLIENT,
+            Message::MessageType::MESSAGE_TYPE_CONNECTION });
+
+    std::vector<std::shared_ptr<Worker>> workers;
+
+    for(int i = 0; i < WORKER_COUNT; ++i)
+    {
+        auto worker = std::make_shared<Worker>();
+        worker->AddManager(manager);
+        pool->AddWorker(worker);
+        workers.push_back(worker);
+    }
+
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->Start(String("worker%1").Arg(i));
+    }
+
+    std::vector<std::shared_ptr<WorkerMailbox>> mailboxes;
+
+    for(int i = 0; i < MAILBOX_COUNT; ++i)
+    {
+        mailboxes.push_back(pool->CreateMailbox(nullptr));
+    }
+
+    int total = MAILBOX_COUNT * messageCount;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < messageCount; ++i)
+    {
+        for(auto& mailbox : mailboxes)
+        {
+            mailbox->Enqueue(CreateMessage(i));
+        }
+    }
+
+    while(total > manager->mCount)
+    {
+        std::this_thread::yield();
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    for(auto& worker : workers)
+    {
+        worker->Shutdown();
+    }
+
+    for(auto& worker : workers)
+    {
+        worker->Join();
+    }
+
+    return (double)total * 1000000.0 / (double)duration.count() /
+        (double)WORKER_COUNT;
+}
+
+int main(int argc, char *argv[])
+{
+    // Messages to handle (can be given on the command line).
+    int messageCount = 1 < argc ? atoi(argv[1]) : 1000000;
+
+    if(0 >= messageCount)
+    {
+        std::cerr << "Usage: " << argv[0] << " [message count]"
+            << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Worker: " << BenchmarkWorker(messageCount)
+        << " messages/s" << std::endl;
+    std::cout << "Pool (" << WORKER_COUNT << " workers, " << MAILBOX_COUNT
+        << " mailboxes): " << BenchmarkPool(messageCount / MAILBOX_COUNT)
+        << " messages/s per worker" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -37,6 +37,8 @@
 #endif // _WIN32
 
 // libcomp Includes
+#include <CaptureWriter.h>
+#include <ChannelConnection.h>
 #include <DataFile.h>
 #include <DatabaseMariaDB.h>
 #include <DatabaseSQLite3.h>
@@ -54,6 +56,8 @@
 using namespace libcomp;
 
 std::string BaseServer::sConfigPath;
+std::mutex BaseServer::sWriteBehindLock;
+std::list<std::weak_ptr<Database>> BaseServer::sWriteBehindDatabases;
 
 BaseServer::BaseServer(const char *szProgram,
     std::shared_ptr<objects::ServerConfig> config,
@@ -85,6 +89,20 @@ bool BaseServer::Initialize()
         return String("Port: %1\n").Arg(mConfig->GetPort());
     });
 
+    // A value of 0 will use one network thread for each core.
+    SetNetworkThreadCount(mConfig->GetNetworkThreadCount());
+
+    // A value of 0 will do the key exchange on the network threads.
+    SetDiffieHellmanPoolSize(mConfig->GetDiffieHellmanPoolSize());
+
+    // Decide which outgoing client frames are worth compressing.
+    ChannelConnection::CompressionPolicy compressionPolicy;
+    compressionPolicy.level = mConfig->GetCompressionLevel();
+    compressionPolicy.minimumSize = mConfig->GetCompressionThreshold();
+    compressionPolicy.skipCommands = mConfig->GetCompressionSkipCommands();
+
+    ChannelConnection::SetCompressionPolicy(compressionPolicy);
+
     libcomp::String constantsPath = mConfig->GetServerConstantsPath();
     if(constantsPath.IsEmpty())
     {
@@ -153,6 +171,19 @@ bool BaseServer::Initialize()
         }
     }
 
+    // Save compiled scripts so the next start does not compile them again.
+    auto scriptCachePath = mConfig->GetScriptCachePath();
+
+    if(!scriptCachePath.IsEmpty())
+    {
+        ScriptEngine::SetBytecodeStore(&mDataStore, scriptCachePath);
+    }
+
+    // The time budget is configured in milliseconds.
+    ScriptEngine::SetDefaults(mConfig->GetScriptProfiling(),
+        mConfig->GetScriptCallLineBudget(),
+        (uint64_t)mConfig->GetScriptCallTimeBudget() * 1000);
+
     switch(mConfig->GetDatabaseType())
     {
         case objects::ServerConfig::DatabaseType_t::SQLITE3:
@@ -253,6 +284,17 @@ std::shared_ptr<Database> BaseServer::GetDatabase(
         return nullptr;
     }
 
+    // Process queued changes on a background thread if requested.
+    if(configIter->second->GetWriteBehind())
+    {
+        db->StartWriteBehind();
+
+        std::lock_guard<std::mutex> lock(sWriteBehindLock);
+        sWriteBehindDatabases.push_back(db);
+
+        LogServerDebugMsg("Database write-behind enabled.\n");
+    }
+
     return db;
 }
 
@@ -335,6 +377,11 @@ TimerManager* BaseServer::GetTimerManager()
     return &mTimerManager;
 }
 
+std::shared_ptr<libcomp::WorkerPool> BaseServer::GetWorkerPool() const
+{
+    return mWorkerPool;
+}
+
 int BaseServer::Run()
 {
     // Run the asycn worker in its own thread.
@@ -349,6 +396,45 @@ int BaseServer::Run()
     // Stop the network service (this will kill any existing connections).
     mService.stop();
 
+    // Write out anything left in the packet captures.
+    CaptureWriter::StopWriters();
+
+    // Write out anything left in the database write-behind queues.
+    {
+        std::lock_guard<std::mutex> lock(sWriteBehindLock);
+
+        for(auto& weakDatabase : sWriteBehindDatabases)
+        {
+            auto db = weakDatabase.lock();
+
+            if(db)
+            {
+                db->StopWriteBehind();
+            }
+        }
+
+        sWriteBehindDatabases.clear();
+    }
+
+    auto compressionStats = ChannelConnection::GetCompressionStats();
+
+    if(0 < compressionStats.inputBytes)
+    {
+        LogServerInfo([&]()
+        {
+            return String("Compressed %1 of %2 frames (%3 skipped), saving "
+                "%4 of %5 bytes in %6 ms.\n")
+                .Arg(compressionStats.compressedFrames)
+                .Arg(compressionStats.compressedFrames +
+                    compressionStats.rejectedFrames +
+                    compressionStats.skippedFrames)
+                .Arg(compressionStats.skippedFrames)
+                .Arg(compressionStats.savedBytes)
+                .Arg(compressionStats.inputBytes)
+                .Arg(compressionStats.compressNanoseconds / 1000000);
+        });
+    }
+
     return 0;
 }
 
@@ -380,6 +466,11 @@ void BaseServer::Shutdown()
     {
         worker->Shutdown();
     }
+
+    if(mConfig->GetScriptProfiling())
+    {
+        ScriptEngine::LogProfile();
+    }
 }
 
 std::string BaseServer::GetConfigPath()
@@ -553,9 +644,21 @@ void BaseServer::CreateWorkers()
             " worker.\n");
     }
 
+    // Let idle workers take connections from busy workers.
+    if(numberOfWorkers > 1 && mConfig->GetWorkStealing())
+    {
+        mWorkerPool = std::make_shared<WorkerPool>();
+    }
+
     for(unsigned int i = 0; i < numberOfWorkers; i++)
     {
         auto worker = std::shared_ptr<Worker>(new Worker);
+
+        if(mWorkerPool)
+        {
+            mWorkerPool->AddWorker(worker);
+        }
+
         worker->Start(libcomp::String("worker%1").Arg(i));
         mWorkers.push_back(worker);
     }
@@ -575,12 +678,36 @@ bool BaseServer::AssignMessageQueue(const std::shared_ptr<
         return false;
     }
 
-    connection->SetMessageQueue(worker->GetMessageQueue());
+    if(mWorkerPool)
+    {
+        auto mailbox = mWorkerPool->CreateMailbox(worker);
+
+        if(!mailbox)
+        {
+            LogServerCriticalMsg("The server failed to create a mailbox for "
+                "an incoming connection.\n");
+
+            return false;
+        }
+
+        connection->SetMessageQueue(mailbox);
+    }
+    else
+    {
+        connection->SetMessageQueue(worker->GetMessageQueue());
+    }
+
     return true;
 }
 
 std::shared_ptr<libcomp::Worker> BaseServer::GetNextConnectionWorker()
 {
+    // Connections in the pool don't hold a reference to the worker queue.
+    if(mWorkerPool)
+    {
+        return mWorkerPool->GetLeastBusyWorker();
+    }
+
     //By default return the least busy worker by checking shared_ptr message queue use count
     long leastConnections = 0;
     std::shared_ptr<libcomp::Worker> leastBusy = nullptr;
@@ -619,10 +746,9 @@ std::list<libcomp::Message::MessageType> BaseServer::GetSupportedTypes() const
 
 bool BaseServer::ProcessMessage(const libcomp::Message::Message *pMessage)
 {
-    auto msg = dynamic_cast<const libcomp::Message::Init*>(pMessage);
-
     // Check if this is an init message.
-    if(nullptr != msg)
+    if(libcomp::Message::SystemMessageType::SYSTEM_MESSAGE_INIT ==
+        pMessage->GetSystemMessageType())
     {
         FinishInitialize();
 
@@ -38,6 +38,11 @@
 #include "TcpServer.h"
 #include "TimerManager.h"
 #include "Worker.h"
+#include "WorkerPool.h"
+
+// Standard C++11 Includes
+#include <list>
+#include <mutex>
 
 namespace libcomp
 {
@@ -105,7 +110,9 @@ public:
 
     /**
      * Get an open database connection of the database type associated to the
-     * server.
+     * server. If WriteBehind is set in the database config the write-behind
+     * thread is started and it is stopped (writing out what is left in the
+     * queue) when @ref Run returns.
      * @param dbType Database type to use.
      * @param configMap Map of the available database configs by type
      * @return Pointer to the new database connection or nullptr on failure
@@ -142,6 +149,13 @@ public:
      */
     TimerManager* GetTimerManager();
 
+    /**
+     * Get the pool that shares connections between the workers.
+     * @returns Pointer to the worker pool or null if connections are
+     *  assigned to a single worker for their lifetime.
+     */
+    std::shared_ptr<libcomp::WorkerPool> GetWorkerPool() const;
+
     /**
      * Call the Shutdown function on each worker.  This should be called
      * only before preparing to stop the application.
@@ -238,7 +252,8 @@ protected:
      * Retrieve and assign a message queue to use for a new connection.
      * The method of deciding which worker to use is not contained in this
      * function but the actual assignment and starting of workers not yet
-     * running is handled.
+     * running is handled. If there is a worker pool the connection gets its
+     * own mailbox that starts on the chosen worker.
      * @return true on success, false on failure
      */
     bool AssignMessageQueue(const std::shared_ptr<
@@ -295,6 +310,9 @@ protected:
     /// List of workers to handle incoming connection packet based work.
     std::list<std::shared_ptr<libcomp::Worker>> mWorkers;
 
+    /// Pool that lets idle workers take connections from busy workers.
+    std::shared_ptr<libcomp::WorkerPool> mWorkerPool;
+
     /// Data store for the server.
     libcomp::DataStore mDataStore;
 
@@ -303,6 +321,12 @@ protected:
 
     /// Custom config path to use during execution.
     static std::string sConfigPath;
+
+    /// Lock for @ref sWriteBehindDatabases.
+    static std::mutex sWriteBehindLock;
+
+    /// Databases opened by @ref GetDatabase with write-behind enabled.
+    static std::list<std::weak_ptr<Database>> sWriteBehindDatabases;
 };
 
 } // namespace libcomp
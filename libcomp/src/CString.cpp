@@ -26,7 +26,6 @@
 
 #include "CString.h"
 
-#include <regex_ext>
 #include <algorithm>
 #include <functional>
 #include <iostream>
@@ -34,13 +33,180 @@
 #include <numeric>
 #include <iomanip>
 #include <cctype>
+#include <cstring>
 #include <locale>
 #include <regex>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+#define HAVE_SSE2
+#endif // defined(__SSE2__) || defined(_M_X64)
+
 using namespace libcomp;
 
 bool String::mBadArgumentReporting = true;
 
+/**
+ * Mask of the high bit of each byte in a 64-bit word.
+ */
+static const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+/**
+ * Count the bits set in a 64-bit word.
+ * @param value Word to count the bits of.
+ * @returns Number of bits set.
+ */
+static inline size_t PopCount(uint64_t value)
+{
+#if defined(__GNUC__)
+    return (size_t)__builtin_popcountll(value);
+#else // !defined(__GNUC__)
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL) +
+        ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (size_t)((value * 0x0101010101010101ULL) >> 56);
+#endif // defined(__GNUC__)
+}
+
+/**
+ * Count the UTF-8 characters in the data. Every byte that is not a
+ * continuation byte (10xxxxxx) starts a character.
+ * @param pData Data to count the characters of.
+ * @param size Number of bytes of data.
+ * @returns Number of characters.
+ */
+static size_t CountCharacters(const char *pData, size_t size)
+{
+    size_t length = 0;
+    size_t i = 0;
+
+#ifdef HAVE_SSE2
+    // Continuation bytes are -128 to -65 as signed bytes.
+    const __m128i continuation = _mm_set1_epi8(-65);
+
+    for(; (i + 16) <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(pData + i));
+
+        length += PopCount((uint64_t)_mm_movemask_epi8(
+            _mm_cmpgt_epi8(bytes, continuation)));
+    }
+#endif // HAVE_SSE2
+
+    for(; (i + 8) <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, pData + i, sizeof(word));
+
+        // The high bit of each byte is set for a continuation byte (high
+        // bit set and the next bit clear).
+        length += 8 - PopCount(word & ~(word << 1) & HIGH_BITS);
+    }
+
+    for(; i < size; ++i)
+    {
+        if((pData[i] & 0xC0) != 0x80)
+        {
+            length++;
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Find the first byte in the data that is not ASCII.
+ * @param pData Data to search.
+ * @param size Number of bytes of data.
+ * @returns Offset of the first byte that is not ASCII or the size if every
+ *  byte is ASCII.
+ */
+static size_t SkipAscii(const char *pData, size_t size)
+{
+    size_t i = 0;
+
+#ifdef HAVE_SSE2
+    for(; (i + 16) <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(pData + i));
+
+        if(0 != _mm_movemask_epi8(bytes))
+        {
+            break;
+        }
+    }
+#endif // HAVE_SSE2
+
+    for(; (i + 8) <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, pData + i, sizeof(word));
+
+        if(0 != (word & HIGH_BITS))
+        {
+            break;
+        }
+    }
+
+    for(; i < size; ++i)
+    {
+        if(0 != (pData[i] & 0x80))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * Encode a Unicode code point as UTF-8.
+ * @param cp Unicode code point to encode.
+ * @param pOut Buffer of at least 4 bytes for the encoded code point.
+ * @returns Number of bytes written to the buffer.
+ */
+static size_t EncodeCodePoint(String::CodePoint cp, char *pOut)
+{
+    unsigned char *bytes = reinterpret_cast<unsigned char*>(pOut);
+
+    // For the UTF-8 encoding format, see: https://en.wikipedia.org/wiki/UTF-8
+    if(0x80 > cp)
+    {
+        bytes[0] = cp & 0x7F;
+
+        return 1;
+    }
+    else if(0x800 > cp)
+    {
+        bytes[0] = static_cast<unsigned char>(0xC0 | ((cp >> 6) & 0x1F));
+        bytes[1] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+
+        return 2;
+    }
+    else if(0x10000 > cp)
+    {
+        bytes[0] = static_cast<unsigned char>(0xE0 | ((cp >> 12) & 0x0F));
+        bytes[1] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+        bytes[2] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+
+        return 3;
+    }
+    else
+    {
+        bytes[0] = static_cast<unsigned char>(0xF0 | ((cp >> 18) & 0x07));
+        bytes[1] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F));
+        bytes[2] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+        bytes[3] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+
+        return 4;
+    }
+}
+
 /**
  * @internal
  * Shared string data oject.
@@ -304,60 +470,158 @@ String::CodePoint String::At(size_t position) const
     {
         return 0;
     }
-    else
+
+    const std::string& str = d->mString;
+    const char *pData = str.data();
+    const char *pEnd = pData + str.size();
+
+    // Without any continuation bytes (like an ASCII string) each character
+    // starts at the byte with the same index.
+    if(d->mLength == str.size())
     {
-        std::string::const_iterator begin;
+        return *CodePointIterator(pData + position, pEnd);
+    }
 
-        position++;
+    // Skip the ASCII at the start a block at a time.
+    size_t offset = SkipAscii(pData, std::min(position, str.size()));
+    position -= offset;
 
-        for(begin = d->mString.cbegin(); 0 < position &&
-            begin != d->mString.cend(); ++begin)
+    CodePointIterator it(pData + offset, pEnd);
+
+    while(0 < position--)
+    {
+        ++it;
+    }
+
+    return *it;
+}
+
+String::CodePointIterator String::CodePointBegin() const
+{
+    const std::string& str = d->mString;
+
+    return CodePointIterator(str.data(), str.data() + str.size());
+}
+
+String::CodePointIterator String::CodePointEnd() const
+{
+    const std::string& str = d->mString;
+
+    return CodePointIterator(str.data() + str.size(),
+        str.data() + str.size());
+}
+
+bool String::IsAscii() const
+{
+    const std::string& str = d->mString;
+
+    // Any multi-byte character makes the length shorter than the size.
+    return d->mLength == str.size() &&
+        SkipAscii(str.data(), str.size()) == str.size();
+}
+
+bool String::IsValidUtf8() const
+{
+    if(IsAscii())
+    {
+        return true;
+    }
+
+    const std::string& str = d->mString;
+    const uint8_t *pData = reinterpret_cast<const uint8_t*>(str.data());
+    size_t size = str.size();
+    size_t i = 0;
+
+    while(i < size)
+    {
+        i += SkipAscii(str.data() + i, size - i);
+
+        if(i >= size)
         {
-            if((*begin & 0xC0) != 0x80)
-            {
-                position--;
-            }
+            break;
         }
 
-        CodePoint cp = 0;
-
-        char bytes[4];
+        uint8_t lead = pData[i];
 
-        bytes[0] = *(--begin);
+        size_t count;
+        CodePoint cp;
+        CodePoint minimum;
 
-        if(0 == (bytes[0] & 0x80))
+        if(0xC2 <= lead && 0xDF >= lead)
         {
-            cp = bytes[0] & 0x7F;
+            count = 1;
+            cp = lead & 0x1Fu;
+            minimum = 0x80;
         }
-        else if(0xC0 == (bytes[0] & 0xE0))
+        else if(0xE0 <= lead && 0xEF >= lead)
         {
-            bytes[1] = *(++begin);
+            count = 2;
+            cp = lead & 0x0Fu;
+            minimum = 0x800;
+        }
+        else if(0xF0 <= lead && 0xF4 >= lead)
+        {
+            count = 3;
+            cp = lead & 0x07u;
+            minimum = 0x10000;
+        }
+        else
+        {
+            // Continuation byte, overlong lead byte or past U+10FFFF.
+            return false;
+        }
 
-            cp = (CodePoint)(((bytes[0] & 0x1F) << 6) |
-                (bytes[1] & 0x3F));
+        if(count >= (size - i))
+        {
+            return false;
         }
-        else if(0xE0 == (bytes[0] & 0xF0))
+
+        for(size_t j = 1; j <= count; ++j)
         {
-            bytes[1] = *(++begin);
-            bytes[2] = *(++begin);
+            uint8_t byte = pData[i + j];
+
+            if(0x80 != (byte & 0xC0))
+            {
+                return false;
+            }
 
-            cp = (CodePoint)(((bytes[0] & 0x1F) << 12) |
-                ((bytes[1] & 0x3F) << 6) |
-                (bytes[2] & 0x3F));
+            cp = (cp << 6) | (byte & 0x3Fu);
         }
-        else
+
+        if(cp < minimum || 0x10FFFF < cp || (0xD800 <= cp && 0xDFFF >= cp))
         {
-            bytes[1] = *(++begin);
-            bytes[2] = *(++begin);
-            bytes[3] = *(++begin);
-
-            cp = (CodePoint)(((bytes[0] & 0x0F) << 18) |
-                ((bytes[1] & 0x3F) << 12) |
-                ((bytes[2] & 0x3F) << 6) |
-                (bytes[3] & 0x3F));
+            return false;
         }
 
-        return cp;
+        i += count + 1;
+    }
+
+    return true;
+}
+
+String::CodePoint String::CodePointIterator::Decode() const
+{
+    // Missing bytes at the end of the string are treated as 0.
+    auto next = [&](size_t offset) -> CodePoint
+    {
+        return (size_t)(mEnd - mPosition) > offset ? static_cast<uint8_t>(
+            mPosition[offset]) & 0x3Fu : 0;
+    };
+
+    uint8_t lead = static_cast<uint8_t>(*mPosition);
+
+    if(0xC0 == (lead & 0xE0))
+    {
+        return ((lead & 0x1Fu) << 6) | next(1);
+    }
+    else if(0xE0 == (lead & 0xF0))
+    {
+        return ((lead & 0x1Fu) << 12) | (next(1) << 6) | next(2);
+    }
+    else
+    {
+        return ((lead & 0x0Fu) << 18) | (next(1) << 12) | (next(2) << 6) |
+            next(3);
     }
 }
 
@@ -426,6 +690,18 @@ String& String::Append(const String& other)
     return *this;
 }
 
+String& String::AppendCodePoint(CodePoint cp)
+{
+    Detatch();
+
+    char bytes[4];
+
+    d->mString.append(bytes, EncodeCodePoint(cp, bytes));
+    d->mLength++;
+
+    return *this;
+}
+
 String& String::Prepend(const String& other)
 {
     Detatch();
@@ -460,17 +736,7 @@ void String::Detatch()
 
 size_t String::CalculateLength(const std::string& str) const
 {
-    size_t length = 0;
-
-    for(auto it = str.cbegin(); it != str.cend(); ++it)
-    {
-        if((*it & 0xC0) != 0x80)
-        {
-            length++;
-        }
-    }
-
-    return length;
+    return CountCharacters(str.data(), str.size());
 }
 
 size_t String::Length() const
@@ -584,110 +850,322 @@ String String::Replace(const String& _search, const String& _replace) const
 
 String String::Arg(const String& a) const
 {
-    int matchCount = 0;
+    return Substitute(&a, 1);
+}
+
+String String::Arg(int16_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Arg(uint16_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
 
-    auto callback = [&](const std::smatch& match)
+String String::Arg(int32_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Arg(uint32_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Arg(int64_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Arg(uint64_t a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+#ifdef __APPLE__
+String String::Arg(size_t a, int fieldWidth, int base, char fillChar)
+{
+    return Arg((int64_t)a, fieldWidth, base, fillChar);
+}
+#endif // __APPLE__
+
+String String::Arg(float a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Arg(double a, int fieldWidth, int base, char fillChar)
+{
+    String value = ToArgument(a, fieldWidth, base, fillChar);
+
+    return Substitute(&value, 1);
+}
+
+String String::Substitute(const String *pValues, size_t count) const
+{
+    const std::string& source = d->mString;
+
+    size_t reserveSize = source.size();
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        reserveSize += pValues[i].d->mString.size();
+    }
+
+    std::string result;
+    result.reserve(reserveSize);
+
+    // Arguments are ASCII so the length only changes by the values.
+    size_t length = d->mLength;
+
+    // Values that were placed into the string (the vector is only used
+    // when there are too many values for the mask).
+    uint64_t usedMask = 0;
+    std::vector<bool> used(64 < count ? count : 0, false);
+    size_t usedCount = 0;
+
+    size_t start = 0;
+    size_t pos = 0;
+
+    while(std::string::npos != (pos = source.find('%', pos)))
     {
-        int n = std::atoi(match.str(1).c_str());
+        size_t end = pos + 1;
+        uint64_t n = 0;
+
+        while(end < source.size() && '0' <= source[end] && '9' >= source[end])
+        {
+            // Anything this big is not a real argument anyway.
+            if(n < 1000000000ULL)
+            {
+                n = n * 10 + (uint64_t)(source[end] - '0');
+            }
+
+            end++;
+        }
+
+        if((pos + 1) == end)
+        {
+            // Not an argument.
+            pos = end;
 
-        if(1 == n)
+            continue;
+        }
+
+        result.append(source, start, pos - start);
+        length -= end - pos;
+
+        if(1 <= n && count >= n)
         {
-            matchCount++;
+            const String& value = pValues[n - 1];
 
-            return a.d->mString;
+            result.append(value.d->mString);
+            length += value.d->mLength;
+
+            bool wasUsed;
+
+            if(64 < count)
+            {
+                wasUsed = used[n - 1];
+                used[n - 1] = true;
+            }
+            else
+            {
+                wasUsed = 0 != (usedMask & (1ULL << (n - 1)));
+                usedMask |= 1ULL << (n - 1);
+            }
+
+            if(!wasUsed)
+            {
+                usedCount++;
+            }
         }
         else
         {
-            return "%" + std::to_string(n - 1);
+            // Shift the argument down by the number of values. %0 is
+            // only shifted once as "%-1" is not an argument.
+            std::string argument = "%" + std::to_string(0 == n ? -1 :
+                ((int64_t)n - (int64_t)count));
+
+            result.append(argument);
+            length += argument.size();
         }
-    };
 
-    static const std::regex re("\\%([0-9]+)");
-    std::string s = std::regex_replace(d->mString.cbegin(),
-        d->mString.cend(), re, callback);
+        start = pos = end;
+    }
+
+    result.append(source, start, std::string::npos);
 
-    if(0 == matchCount && mBadArgumentReporting)
+    if(usedCount != count && mBadArgumentReporting)
     {
-        std::cerr << "Argument not found in string: " << s << std::endl;
+        std::cerr << "Argument not found in string: " << result << std::endl;
     }
 
-    return String(s);
+    StringData *pData = new StringData;
+    pData->mString = std::move(result);
+    pData->mLength = length;
+
+    return String(pData);
 }
 
-String String::Arg(int16_t a, int fieldWidth, int base, char fillChar)
+/**
+ * Format an integer the same way a std::stringstream would with the given
+ * width, base and fill character set.
+ * @param value Magnitude of the number.
+ * @param negative If the number is negative.
+ * @param fieldWidth Minimum number of characters.
+ * @param base Base of the number (8, 10 or 16).
+ * @param fillChar Character to pad the value with.
+ * @returns Formatted number.
+ */
+static std::string FormatInteger(uint64_t value, bool negative,
+    int fieldWidth, int base, char fillChar)
 {
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    static const char DIGITS[] = "0123456789abcdef";
 
-    ss << std::setbase(base) << a;
+    // Enough for a 64-bit number in octal.
+    char buffer[24];
+    char *pEnd = buffer + sizeof(buffer);
+    char *pStart = pEnd;
 
-    return Arg(String(ss.str()));
-}
+    uint64_t divisor = (uint64_t)base;
 
-String String::Arg(uint16_t a, int fieldWidth, int base, char fillChar)
-{
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    do
+    {
+        *--pStart = DIGITS[value % divisor];
+        value /= divisor;
+    } while(0 != value);
+
+    if(negative)
+    {
+        *--pStart = '-';
+    }
+
+    size_t length = (size_t)(pEnd - pStart);
+
+    std::string s;
+
+    if(0 < fieldWidth && length < (size_t)fieldWidth)
+    {
+        s.reserve((size_t)fieldWidth);
+        s.append((size_t)fieldWidth - length, fillChar);
+    }
 
-    ss << std::setbase(base) << a;
+    s.append(pStart, length);
 
-    return Arg(String(ss.str()));
+    return s;
 }
 
-String String::Arg(int32_t a, int fieldWidth, int base, char fillChar)
+/**
+ * Format a signed integer the same way a std::stringstream would.
+ * @param a Number to format.
+ * @param fieldWidth Minimum number of characters.
+ * @param base Base of the number (8, 10 or 16).
+ * @param fillChar Character to pad the value with.
+ * @returns Formatted number.
+ */
+template<typename T, typename U>
+static std::string FormatSigned(T a, int fieldWidth, int base,
+    char fillChar)
 {
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    // A stream shows the bits of a negative number in octal and hex.
+    if(8 == base || 16 == base)
+    {
+        return FormatInteger((uint64_t)(U)a, false, fieldWidth, base,
+            fillChar);
+    }
 
-    ss << std::setbase(base) << a;
+    bool negative = 0 > a;
+    uint64_t value = negative ? ((uint64_t)0 - (uint64_t)(int64_t)a) :
+        (uint64_t)a;
 
-    return Arg(String(ss.str()));
+    return FormatInteger(value, negative, fieldWidth, 10, fillChar);
 }
 
-String String::Arg(uint32_t a, int fieldWidth, int base, char fillChar)
+/**
+ * Format an unsigned integer the same way a std::stringstream would.
+ * @param a Number to format.
+ * @param fieldWidth Minimum number of characters.
+ * @param base Base of the number (8, 10 or 16).
+ * @param fillChar Character to pad the value with.
+ * @returns Formatted number.
+ */
+static std::string FormatUnsigned(uint64_t a, int fieldWidth, int base,
+    char fillChar)
 {
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    // Any other base is shown as decimal (like a stream).
+    if(8 != base && 16 != base)
+    {
+        base = 10;
+    }
 
-    ss << std::setbase(base) << a;
+    return FormatInteger(a, false, fieldWidth, base, fillChar);
+}
 
-    return Arg(String(ss.str()));
+String String::ToArgument(const String& a)
+{
+    return a;
 }
 
-String String::Arg(int64_t a, int fieldWidth, int base, char fillChar)
+String String::ToArgument(int16_t a, int fieldWidth, int base,
+    char fillChar)
 {
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    return FormatSigned<int16_t, uint16_t>(a, fieldWidth, base, fillChar);
+}
 
-    ss << std::setbase(base) << a;
+String String::ToArgument(uint16_t a, int fieldWidth, int base,
+    char fillChar)
+{
+    return FormatUnsigned(a, fieldWidth, base, fillChar);
+}
 
-    return Arg(String(ss.str()));
+String String::ToArgument(int32_t a, int fieldWidth, int base,
+    char fillChar)
+{
+    return FormatSigned<int32_t, uint32_t>(a, fieldWidth, base, fillChar);
 }
 
-String String::Arg(uint64_t a, int fieldWidth, int base, char fillChar)
+String String::ToArgument(uint32_t a, int fieldWidth, int base,
+    char fillChar)
 {
-    std::stringstream ss;
-    ss.width(fieldWidth);
-    ss.fill(fillChar);
+    return FormatUnsigned(a, fieldWidth, base, fillChar);
+}
 
-    ss << std::setbase(base) << a;
+String String::ToArgument(int64_t a, int fieldWidth, int base,
+    char fillChar)
+{
+    return FormatSigned<int64_t, uint64_t>(a, fieldWidth, base, fillChar);
+}
 
-    return Arg(String(ss.str()));
+String String::ToArgument(uint64_t a, int fieldWidth, int base,
+    char fillChar)
+{
+    return FormatUnsigned(a, fieldWidth, base, fillChar);
 }
 
 #ifdef __APPLE__
-String String::Arg(size_t a, int fieldWidth, int base, char fillChar)
+String String::ToArgument(size_t a, int fieldWidth, int base,
+    char fillChar)
 {
-    return Arg((int64_t)a, fieldWidth, base, fillChar);
+    return ToArgument((int64_t)a, fieldWidth, base, fillChar);
 }
 #endif // __APPLE__
 
-String String::Arg(float a, int fieldWidth, int base, char fillChar)
+String String::ToArgument(float a, int fieldWidth, int base, char fillChar)
 {
     std::stringstream ss;
     ss.width(fieldWidth);
@@ -696,10 +1174,10 @@ String String::Arg(float a, int fieldWidth, int base, char fillChar)
     ss << std::setprecision(std::numeric_limits<float>::max_digits10 + 1)
         << std::setbase(base) << a;
 
-    return Arg(String(ss.str()));
+    return String(ss.str());
 }
 
-String String::Arg(double a, int fieldWidth, int base, char fillChar)
+String String::ToArgument(double a, int fieldWidth, int base, char fillChar)
 {
     std::stringstream ss;
     ss.width(fieldWidth);
@@ -708,7 +1186,7 @@ String String::Arg(double a, int fieldWidth, int base, char fillChar)
     ss << std::setprecision(std::numeric_limits<double>::max_digits10 + 1)
         << std::setbase(base) << a;
 
-    return Arg(String(ss.str()));
+    return String(ss.str());
 }
 
 bool String::Matches(const libcomp::String& expression) const
@@ -781,6 +1259,13 @@ std::vector<char> String::Data(bool nullTerminate) const
     return v;
 }
 
+void String::Reserve(size_t bytes)
+{
+    Detatch();
+
+    d->mString.reserve(bytes);
+}
+
 const char* String::C() const
 {
     return d->mString.c_str();
@@ -845,37 +1330,8 @@ bool libcomp::operator<(const libcomp::String& a, const libcomp::String& b)
 
 String String::FromCodePoint(CodePoint cp)
 {
-    unsigned char bytes[4];
-
-    // For the UTF-8 encoding format, see: https://en.wikipedia.org/wiki/UTF-8
-    if(0x80 > cp)
-    {
-        bytes[0] = cp & 0x7F;
+    char bytes[4];
 
-        return String(reinterpret_cast<char*>(bytes), 1);
-    }
-    else if(0x800 > cp)
-    {
-        bytes[0] = static_cast<unsigned char>(0xC0 | ((cp >> 6) & 0x1F));
-        bytes[1] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
-
-        return String(reinterpret_cast<char*>(bytes), 2);
-    }
-    else if(0x10000 > cp)
-    {
-        bytes[0] = static_cast<unsigned char>(0xE0 | ((cp >> 12) & 0x0F));
-        bytes[1] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
-        bytes[2] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
-
-        return String(reinterpret_cast<char*>(bytes), 3);
-    }
-    else
-    {
-        bytes[0] = static_cast<unsigned char>(0xF0 | ((cp >> 18) & 0x07));
-        bytes[1] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F));
-        bytes[2] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
-        bytes[3] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
-
-        return String(reinterpret_cast<char*>(bytes), 4);
-    }
+    return String(new StringData(std::string(bytes,
+        EncodeCodePoint(cp, bytes)), 1));
 }
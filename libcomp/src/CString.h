@@ -52,6 +52,92 @@ public:
      */
     typedef uint32_t CodePoint;
 
+    /**
+     * Forward iterator over the Unicode code points of a string. The
+     * iterator is invalidated by any change to the string.
+     */
+    class CodePointIterator
+    {
+    public:
+        /**
+         * Create an iterator.
+         * @param pPosition First byte of the code point to start at.
+         *  Continuation bytes at this position belong to the previous code
+         *  point and are skipped.
+         * @param pEnd End of the string data.
+         */
+        CodePointIterator(const char *pPosition, const char *pEnd) :
+            mPosition(pPosition), mEnd(pEnd)
+        {
+            while(mPosition != mEnd &&
+                0x80 == (static_cast<uint8_t>(*mPosition) & 0xC0))
+            {
+                ++mPosition;
+            }
+        }
+
+        /**
+         * Get the code point the iterator is at.
+         * @returns Unicode code point.
+         */
+        CodePoint operator*() const
+        {
+            uint8_t lead = static_cast<uint8_t>(*mPosition);
+
+            return 0 == (lead & 0x80) ? lead : Decode();
+        }
+
+        /**
+         * Move to the next code point.
+         * @returns Reference to the iterator.
+         */
+        CodePointIterator& operator++()
+        {
+            // Every byte that is not a continuation byte starts a new code
+            // point (this matches how the length is counted).
+            do
+            {
+                ++mPosition;
+            } while(mPosition != mEnd &&
+                0x80 == (static_cast<uint8_t>(*mPosition) & 0xC0));
+
+            return *this;
+        }
+
+        /**
+         * Check if two iterators are at the same position.
+         * @param other Iterator to compare to.
+         * @returns true if the iterators are at the same position.
+         */
+        bool operator==(const CodePointIterator& other) const
+        {
+            return mPosition == other.mPosition;
+        }
+
+        /**
+         * Check if two iterators are at different positions.
+         * @param other Iterator to compare to.
+         * @returns true if the iterators are at different positions.
+         */
+        bool operator!=(const CodePointIterator& other) const
+        {
+            return mPosition != other.mPosition;
+        }
+
+    private:
+        /**
+         * Decode a multi-byte code point.
+         * @returns Unicode code point.
+         */
+        CodePoint Decode() const;
+
+        /// First byte of the current code point.
+        const char *mPosition;
+
+        /// End of the string data.
+        const char *mEnd;
+    };
+
     /**
      * Construct an empty string.
      */
@@ -160,6 +246,33 @@ public:
      */
     CodePoint At(size_t position) const;
 
+    /**
+     * Get an iterator to the first code point of the string. Use this
+     * instead of calling @ref At in a loop as @ref At has to walk the
+     * string from the start unless it only contains ASCII.
+     * @returns Iterator to the first code point.
+     */
+    CodePointIterator CodePointBegin() const;
+
+    /**
+     * Get an iterator past the last code point of the string.
+     * @returns Iterator past the last code point.
+     */
+    CodePointIterator CodePointEnd() const;
+
+    /**
+     * Check if the string only contains ASCII characters.
+     * @returns true if every character is ASCII.
+     */
+    bool IsAscii() const;
+
+    /**
+     * Check if the string is valid UTF-8 (no overlong encodings, surrogates
+     * or code points past U+10FFFF).
+     * @returns true if the string is valid UTF-8.
+     */
+    bool IsValidUtf8() const;
+
     /**
      * Split a string by a delimiter.
      * @param delimiter Sub-string to split the string by.
@@ -218,6 +331,13 @@ public:
      */
     std::vector<char> Data(bool nullTerminate = true) const;
 
+    /**
+     * Reserve space for the string data so it can grow without being
+     * reallocated.
+     * @param bytes Number of bytes of string data to reserve space for.
+     */
+    void Reserve(size_t bytes);
+
     /**
      * Return a pointer to the string data for use in C-style string functions.
      * A null terminator will be added to the end of the buffer.
@@ -270,6 +390,28 @@ public:
      */
     String Arg(const String& a) const;
 
+    /**
+     * Replace every argument of the format string (%1, %2, ...) with the
+     * matching value in a single pass. This gives the same result as
+     * calling @ref Arg once for each value except that text placed into
+     * the string is never scanned for arguments again. Arguments with a
+     * higher number than the number of values are shifted down by the
+     * number of values.
+     *
+     * @param format String with the arguments to replace.
+     * @param args Values to place into the string. These may be strings
+     *  or numbers (which are formatted like the default @ref Arg call).
+     * @returns String with the arguments added.
+     */
+    template<typename... Args>
+    static String Format(const String& format, const Args&... args)
+    {
+        // The first element is only there so the array is never empty.
+        const String values[] = { String(), ToArgument(args)... };
+
+        return format.Substitute(values + 1, sizeof...(args));
+    }
+
     /**
      * Convert the string into lowercase.
      * @returns Copy of the string in lowercase.
@@ -448,6 +590,13 @@ public:
      */
     String& Append(const String& other);
 
+    /**
+     * Append a Unicode code point to the end of this string.
+     * @param cp Unicode code point to append.
+     * @returns Reference to this string (to chain with other calls).
+     */
+    String& AppendCodePoint(CodePoint cp);
+
     /**
      * Prepend another string to the beginning of this one.
      * @param other String to prepend to the beginning of this one.
@@ -646,6 +795,135 @@ private:
      */
     size_t CalculateLength(const std::string& str) const;
 
+    /**
+     * @internal
+     * Replace the arguments of the string with the values in one pass.
+     * @param pValues Values to place into the string.
+     * @param count Number of values.
+     * @returns String with the arguments added.
+     * @sa Arg
+     * @sa Format
+     */
+    String Substitute(const String *pValues, size_t count) const;
+
+    /**
+     * @internal
+     * Convert a value passed to @ref Format into a string.
+     * @param a Value to convert.
+     * @returns Value as a string.
+     */
+    static String ToArgument(const String& a);
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(int16_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(uint16_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(int32_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(uint32_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(int64_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(uint64_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+#ifdef __APPLE__
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(size_t a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+#endif // __APPLE__
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(float a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
+    /**
+     * @internal
+     * Convert a number passed to @ref Format or @ref Arg into a string.
+     * @param a Number to convert.
+     * @param fieldWidth Minimum number of characters.
+     * @param base Base of the number (8, 10 or 16).
+     * @param fillChar Character to pad the value with.
+     * @returns Number as a string.
+     */
+    static String ToArgument(double a, int fieldWidth = 0, int base = 10,
+        char fillChar = ' ');
+
     /**
      * @internal
      * Shared pointer to the string data.
@@ -0,0 +1,379 @@
+/**
+ * @file libcomp/src/CaptureReader.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Memory mapped reader for packet capture files.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CaptureReader.h"
+
+// libcomp Includes
+#include "Compress.h"
+#include "Constants.h"
+#include "Endian.h"
+
+// Standard C++11 Includes
+#include <cstring>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else // !WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // WIN32
+
+using namespace libcomp;
+
+namespace
+{
+
+/// Size of the header of each record (source, stamp, microtime and size).
+const uint64_t CAPTURE_RECORD_HEADER_SIZE = sizeof(uint8_t) +
+    2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+/// Size of the padded and real sizes at the start of each packet.
+const uint32_t PACKET_SIZES_SIZE = 2 * sizeof(uint32_t);
+
+/// Size of the channel compression header ("gzip", the uncompressed and
+/// compressed sizes and "lv6").
+const uint32_t CHANNEL_COMPRESSION_SIZE = 4 * sizeof(uint32_t);
+
+/**
+ * Read a value from the file mapping (which may not be aligned).
+ * @param pData Data to read the value from.
+ * @returns Value read.
+ */
+template<typename T>
+T ReadValue(const char *pData)
+{
+    T value;
+
+    memcpy(&value, pData, sizeof(value));
+
+    return value;
+}
+
+} // namespace
+
+CaptureReader::CaptureReader() : mData(nullptr), mSize(0), mFirstRecord(0),
+    mOffset(0), mStamp(0)
+#if defined(_WIN32) || defined(_WIN64)
+    , mMapFile(nullptr)
+#endif // WIN32
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    Close();
+}
+
+bool CaptureReader::Open(const String& path)
+{
+    Close();
+
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file = CreateFileA(path.C(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(INVALID_HANDLE_VALUE == file)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if(!GetFileSizeEx(file, &fileSize) || 0 == fileSize.QuadPart)
+    {
+        CloseHandle(file);
+
+        return false;
+    }
+
+    mMapFile = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0,
+        nullptr);
+
+    // The mapping keeps the file open.
+    CloseHandle(file);
+
+    if(nullptr == mMapFile)
+    {
+        return false;
+    }
+
+    mData = reinterpret_cast<const char*>(MapViewOfFile(mMapFile,
+        FILE_MAP_READ, 0, 0, 0));
+
+    if(nullptr == mData)
+    {
+        CloseHandle(mMapFile);
+        mMapFile = nullptr;
+
+        return false;
+    }
+
+    mSize = static_cast<uint64_t>(fileSize.QuadPart);
+#else // !WIN32
+    int fd = open(path.C(), O_RDONLY);
+
+    if(0 > fd)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+
+    if(0 != fstat(fd, &fileStat) || 0 >= fileStat.st_size)
+    {
+        close(fd);
+
+        return false;
+    }
+
+    void *pMapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size),
+        PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps the file open.
+    close(fd);
+
+    if(MAP_FAILED == pMapping)
+    {
+        return false;
+    }
+
+    // The records are read once from start to end.
+    madvise(pMapping, static_cast<size_t>(fileStat.st_size),
+        MADV_SEQUENTIAL);
+
+    mData = reinterpret_cast<const char*>(pMapping);
+    mSize = static_cast<uint64_t>(fileStat.st_size);
+#endif // WIN32
+
+    // Read the header: magic, version, stamp and the remote address.
+    uint64_t headerSize = 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+    if(mSize < headerSize ||
+        HACK_FORMAT_MAGIC != ReadValue<uint32_t>(mData) ||
+        HACK_FORMAT_VER2 != ReadValue<uint32_t>(mData + sizeof(uint32_t)))
+    {
+        Close();
+
+        return false;
+    }
+
+    mStamp = ReadValue<uint64_t>(mData + 2 * sizeof(uint32_t));
+
+    uint32_t addressSize = ReadValue<uint32_t>(mData + 2 *
+        sizeof(uint32_t) + sizeof(uint64_t));
+
+    if((mSize - headerSize) < addressSize)
+    {
+        Close();
+
+        return false;
+    }
+
+    mRemoteAddress = String(mData + headerSize, addressSize);
+    mFirstRecord = mOffset = headerSize + addressSize;
+
+    return true;
+}
+
+void CaptureReader::Close()
+{
+    if(nullptr != mData)
+    {
+#if defined(_WIN32) || defined(_WIN64)
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapFile);
+        mMapFile = nullptr;
+#else // !WIN32
+        munmap(const_cast<char*>(mData), static_cast<size_t>(mSize));
+#endif // WIN32
+    }
+
+    mData = nullptr;
+    mSize = 0;
+    mFirstRecord = 0;
+    mOffset = 0;
+    mStamp = 0;
+    mRemoteAddress.Clear();
+}
+
+bool CaptureReader::IsOpen() const
+{
+    return nullptr != mData;
+}
+
+uint64_t CaptureReader::GetStamp() const
+{
+    return mStamp;
+}
+
+String CaptureReader::GetRemoteAddress() const
+{
+    return mRemoteAddress;
+}
+
+bool CaptureReader::Next(Record& record)
+{
+    if(nullptr == mData || (mSize - mOffset) < CAPTURE_RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const char *pRecord = mData + mOffset;
+
+    uint32_t size = ReadValue<uint32_t>(pRecord + sizeof(uint8_t) +
+        2 * sizeof(uint64_t));
+
+    if((mSize - mOffset - CAPTURE_RECORD_HEADER_SIZE) < size)
+    {
+        return false;
+    }
+
+    record.source = ReadValue<uint8_t>(pRecord);
+    record.stamp = ReadValue<uint64_t>(pRecord + sizeof(uint8_t));
+    record.microTime = ReadValue<uint64_t>(pRecord + sizeof(uint8_t) +
+        sizeof(uint64_t));
+    record.pData = pRecord + CAPTURE_RECORD_HEADER_SIZE;
+    record.size = size;
+
+    mOffset += CAPTURE_RECORD_HEADER_SIZE + size;
+
+    return true;
+}
+
+void CaptureReader::Rewind()
+{
+    mOffset = mFirstRecord;
+}
+
+bool CaptureReader::AtEnd() const
+{
+    return mOffset == mSize;
+}
+
+bool CaptureReader::GetCommands(const Record& record, bool channel,
+    std::vector<Command>& commands, std::vector<char>& scratch)
+{
+    commands.clear();
+
+    if(PACKET_SIZES_SIZE > record.size)
+    {
+        return false;
+    }
+
+    uint32_t paddedSize = be32toh(ReadValue<uint32_t>(record.pData));
+    uint32_t realSize = be32toh(ReadValue<uint32_t>(record.pData +
+        sizeof(uint32_t)));
+
+    if(realSize > paddedSize || (record.size - PACKET_SIZES_SIZE) !=
+        paddedSize)
+    {
+        return false;
+    }
+
+    const char *pData = record.pData + PACKET_SIZES_SIZE;
+    uint32_t size = paddedSize;
+    uint32_t padding = paddedSize - realSize;
+
+    if(channel)
+    {
+        if(CHANNEL_COMPRESSION_SIZE > realSize ||
+            0 != memcmp(pData, "gzip", 4) ||
+            0 != memcmp(pData + 3 * sizeof(uint32_t), "lv6", 4))
+        {
+            return false;
+        }
+
+        int32_t uncompressedSize = static_cast<int32_t>(le32toh(
+            ReadValue<uint32_t>(pData + sizeof(uint32_t))));
+        int32_t compressedSize = static_cast<int32_t>(le32toh(
+            ReadValue<uint32_t>(pData + 2 * sizeof(uint32_t))));
+
+        pData += CHANNEL_COMPRESSION_SIZE;
+        size -= CHANNEL_COMPRESSION_SIZE;
+
+        if(0 > uncompressedSize || 0 > compressedSize ||
+            size != (static_cast<uint32_t>(compressedSize) + padding))
+        {
+            return false;
+        }
+
+        // Only decompress if the sizes are not the same.
+        if(compressedSize != uncompressedSize)
+        {
+            scratch.resize(static_cast<size_t>(uncompressedSize));
+
+            if(uncompressedSize != Compress::Decompress(
+                const_cast<char*>(pData), scratch.data(), compressedSize,
+                uncompressedSize))
+            {
+                return false;
+            }
+
+            // There is no padding anymore.
+            pData = scratch.data();
+            size = static_cast<uint32_t>(uncompressedSize);
+            padding = 0;
+        }
+    }
+
+    uint32_t offset = 0;
+
+    // Each command is a big endian size, a little endian size (which
+    // includes itself and the code), the code and then the data.
+    while((size - offset) > padding)
+    {
+        if((size - offset) < 3 * sizeof(uint16_t))
+        {
+            return false;
+        }
+
+        uint32_t commandStart = offset + static_cast<uint32_t>(
+            sizeof(uint16_t));
+        uint16_t commandSize = le16toh(ReadValue<uint16_t>(pData +
+            commandStart));
+
+        if(commandSize < 2 * sizeof(uint16_t) ||
+            (size - commandStart) < commandSize)
+        {
+            return false;
+        }
+
+        Command command;
+        command.code = le16toh(ReadValue<uint16_t>(pData + commandStart +
+            sizeof(uint16_t)));
+        command.pData = pData + commandStart + 2 * sizeof(uint16_t);
+        command.size = commandSize - 2 * static_cast<uint32_t>(
+            sizeof(uint16_t));
+
+        commands.push_back(command);
+
+        offset = commandStart + commandSize;
+    }
+
+    return (size - offset) == padding;
+}
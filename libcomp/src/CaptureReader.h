@@ -0,0 +1,186 @@
+/**
+ * @file libcomp/src/CaptureReader.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Memory mapped reader for packet capture files.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_CAPTUREREADER_H
+#define LIBCOMP_SRC_CAPTUREREADER_H
+
+// libcomp Includes
+#include "CString.h"
+
+// Standard C++11 Includes
+#include <vector>
+
+namespace libcomp
+{
+
+/**
+ * Reads packet capture (.hack) files written by @ref CaptureWriter. The
+ * file is memory mapped and each record points straight into the mapping
+ * so reading a capture does not copy or allocate anything. The pointers
+ * are valid until the reader is closed.
+ */
+class CaptureReader
+{
+public:
+    /**
+     * Single packet read from a capture file.
+     */
+    struct Record
+    {
+        /// HACK_SOURCE_CLIENT or HACK_SOURCE_SERVER.
+        uint8_t source;
+
+        /// Time the packet was captured (seconds since the epoch).
+        uint64_t stamp;
+
+        /// Time the packet was captured (steady clock microseconds).
+        uint64_t microTime;
+
+        /// Decrypted packet: the padded and real sizes followed by the
+        /// padded packet data.
+        const char *pData;
+
+        /// Size of the packet.
+        uint32_t size;
+    };
+
+    /**
+     * Single command inside of a captured packet.
+     */
+    struct Command
+    {
+        /// Command code.
+        uint16_t code;
+
+        /// Command data (after the code).
+        const char *pData;
+
+        /// Size of the command data.
+        uint32_t size;
+    };
+
+    /**
+     * Create a reader with no file open.
+     */
+    CaptureReader();
+
+    /**
+     * Close the file if one is open.
+     */
+    ~CaptureReader();
+
+    /**
+     * Map a capture file and read the header.
+     * @param path Path to the capture file.
+     * @returns true if the file is a capture file; false otherwise.
+     */
+    bool Open(const String& path);
+
+    /**
+     * Unmap the capture file. Any records or commands read from it are no
+     * longer valid.
+     */
+    void Close();
+
+    /**
+     * Check if a capture file is open.
+     * @returns true if a capture file is open; false otherwise.
+     */
+    bool IsOpen() const;
+
+    /**
+     * Get the time the capture was started.
+     * @returns Time the capture was started (seconds since the epoch).
+     */
+    uint64_t GetStamp() const;
+
+    /**
+     * Get the address of the remote end of the captured connection.
+     * @returns Address of the remote end of the captured connection.
+     */
+    String GetRemoteAddress() const;
+
+    /**
+     * Read the next record in the file.
+     * @param record Record to fill in.
+     * @returns true if a record was read; false at the end of the file or
+     *   if the rest of the file is truncated.
+     */
+    bool Next(Record& record);
+
+    /**
+     * Go back to the first record in the file.
+     */
+    void Rewind();
+
+    /**
+     * Check if every record in the file has been read. This is false after
+     * @ref Next fails on a truncated record.
+     * @returns true if every record in the file has been read.
+     */
+    bool AtEnd() const;
+
+    /**
+     * Split a captured packet into the commands inside of it.
+     * @param record Record to split.
+     * @param channel If the packet has the channel compression header.
+     * @param commands Commands found in the packet. The command data
+     *   points into the record or into @em scratch.
+     * @param scratch Buffer used to decompress the packet into. It must
+     *   not change while the commands are used.
+     * @returns true if the packet is valid; false otherwise.
+     */
+    static bool GetCommands(const Record& record, bool channel,
+        std::vector<Command>& commands, std::vector<char>& scratch);
+
+private:
+    /// Start of the file mapping.
+    const char *mData;
+
+    /// Size of the file.
+    uint64_t mSize;
+
+    /// Offset of the first record.
+    uint64_t mFirstRecord;
+
+    /// Offset of the next record to read.
+    uint64_t mOffset;
+
+    /// Time the capture was started.
+    uint64_t mStamp;
+
+    /// Address of the remote end of the captured connection.
+    String mRemoteAddress;
+
+#if defined(_WIN32) || defined(_WIN64)
+    /// Handle of the file mapping.
+    void *mMapFile;
+#endif // WIN32
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_CAPTUREREADER_H
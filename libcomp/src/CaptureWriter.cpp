@@ -0,0 +1,536 @@
+/**
+ * @file libcomp/src/CaptureWriter.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Background writer for packet capture files.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CaptureWriter.h"
+
+// libcomp Includes
+#include "Constants.h"
+#include "Log.h"
+
+// Standard C++11 Includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+using namespace libcomp;
+
+/// Size of the header written before each packet in a capture file.
+static const uint64_t CAPTURE_RECORD_HEADER_SIZE = sizeof(uint8_t) +
+    2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+/// Amount of data to collect for a file before it is written even if more
+/// records are waiting.
+static const size_t CAPTURE_WRITE_SIZE = 1024 * 1024;
+
+/**
+ * State of a single capture kept by the writer thread.
+ */
+class CaptureWriter::CaptureFile
+{
+public:
+    CaptureFile() : stamp(0), part(0), size(0), headerSize(0), failed(false)
+    {
+    }
+
+    /// Path of the first file without the extension.
+    String basePath;
+
+    /// Address of the remote end of the connection.
+    String remoteAddress;
+
+    /// Time the capture started (seconds since the epoch).
+    uint64_t stamp;
+
+    /// Number of the current file (starting from 1).
+    uint32_t part;
+
+    /// Current file.
+    std::ofstream file;
+
+    /// Data waiting to be written to the file.
+    std::vector<char> pending;
+
+    /// Size of the current file including the pending data.
+    uint64_t size;
+
+    /// Size of the header at the start of each file.
+    uint64_t headerSize;
+
+    /// Set if the file could not be written.
+    bool failed;
+};
+
+/**
+ * Append a value to a buffer in host order like the old capture code.
+ * @param buffer Buffer to append to.
+ * @param value Value to append.
+ */
+template<typename T>
+static void AppendValue(std::vector<char>& buffer, T value)
+{
+    const char *pValue = reinterpret_cast<const char*>(&value);
+
+    buffer.insert(buffer.end(), pValue, pValue + sizeof(value));
+}
+
+CaptureRecord::CaptureRecord(RecordType_t type, uint32_t captureID) :
+    mType(type), mSource(0), mCaptureID(captureID), mStamp(0),
+    mMicroTime(0), mSize(0)
+{
+}
+
+char* CaptureRecord::Data()
+{
+    return mBuffer ? reinterpret_cast<char*>(mBuffer->Data()) : nullptr;
+}
+
+uint32_t CaptureRecord::Size() const
+{
+    return mSize;
+}
+
+CaptureWriter::CaptureWriter(const String& path, uint64_t maxFileSize,
+    uint32_t sampleRate) : mPath(path), mMaxFileSize(maxFileSize),
+    mSampleRate(sampleRate), mConnectionCount(0), mLastCaptureID(0),
+    mStopped(false), mCaptures(0), mSkippedCaptures(0), mPackets(0),
+    mBytes(0), mWrites(0), mRotations(0), mDroppedPackets(0)
+{
+    mThread = std::thread([this]()
+    {
+#if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+        pthread_setname_np(pthread_self(), "capture");
+#endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+
+        Run();
+    });
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Stop();
+
+    // Anything queued while the writer was stopping is dropped.
+    std::list<CaptureRecord*> records;
+    mRecords.DequeueAny(records);
+
+    for(auto pRecord : records)
+    {
+        delete pRecord;
+    }
+}
+
+/**
+ * Writers created by @ref CaptureWriter::GetWriter.
+ */
+struct CaptureWriterRegistry
+{
+    /// Lock for the writers.
+    std::mutex lock;
+
+    /// Writer for each capture directory.
+    std::unordered_map<std::string, std::shared_ptr<CaptureWriter>> writers;
+};
+
+/**
+ * Get the registry of writers.
+ * @returns Registry of writers.
+ */
+static CaptureWriterRegistry& GetRegistry()
+{
+    static CaptureWriterRegistry registry;
+
+    return registry;
+}
+
+std::shared_ptr<CaptureWriter> CaptureWriter::GetWriter(const String& path,
+    uint64_t maxFileSize, uint32_t sampleRate)
+{
+    auto& registry = GetRegistry();
+
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    auto& writer = registry.writers[path.ToUtf8()];
+
+    if(!writer)
+    {
+        writer = std::make_shared<CaptureWriter>(path, maxFileSize,
+            sampleRate);
+    }
+
+    return writer;
+}
+
+void CaptureWriter::StopWriters()
+{
+    std::unordered_map<std::string, std::shared_ptr<CaptureWriter>> writers;
+
+    {
+        auto& registry = GetRegistry();
+
+        std::lock_guard<std::mutex> guard(registry.lock);
+        writers.swap(registry.writers);
+    }
+
+    for(auto& writer : writers)
+    {
+        writer.second->Stop();
+    }
+}
+
+uint32_t CaptureWriter::OpenCapture(const String& remoteAddress)
+{
+    if(mStopped)
+    {
+        return 0;
+    }
+
+    if(1 < mSampleRate && 0 != (mConnectionCount++ % mSampleRate))
+    {
+        mSkippedCaptures++;
+
+        return 0;
+    }
+
+    uint32_t captureID = ++mLastCaptureID;
+
+    // Zero means no capture so skip it if the IDs wrap around.
+    if(0 == captureID)
+    {
+        captureID = ++mLastCaptureID;
+    }
+
+    uint32_t addrlen = static_cast<uint32_t>(std::min<size_t>(
+        remoteAddress.Size(), PACKET_BUFFER_SMALL_SIZE));
+
+    CaptureRecord *pRecord = new CaptureRecord(
+        CaptureRecord::RecordType_t::OPEN, captureID);
+    pRecord->mStamp = static_cast<uint64_t>(std::time(nullptr));
+    pRecord->mBuffer = PacketBufferPool::Allocate(addrlen);
+    pRecord->mSize = addrlen;
+
+    memcpy(pRecord->Data(), remoteAddress.C(), addrlen);
+
+    mCaptures++;
+
+    QueueRecord(pRecord);
+
+    return captureID;
+}
+
+void CaptureWriter::CloseCapture(uint32_t captureID)
+{
+    if(0 != captureID)
+    {
+        QueueRecord(new CaptureRecord(CaptureRecord::RecordType_t::CLOSE,
+            captureID));
+    }
+}
+
+CaptureRecord* CaptureWriter::CreateRecord(uint32_t captureID,
+    uint8_t source, uint32_t size)
+{
+    if(0 == captureID || MAX_PACKET_SIZE < size)
+    {
+        return nullptr;
+    }
+
+    CaptureRecord *pRecord = new CaptureRecord(
+        CaptureRecord::RecordType_t::PACKET, captureID);
+    pRecord->mSource = source;
+    pRecord->mStamp = static_cast<uint64_t>(std::time(nullptr));
+    pRecord->mMicroTime = static_cast<uint64_t>(
+        std::chrono::time_point_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now()
+        ).time_since_epoch().count());
+    pRecord->mBuffer = PacketBufferPool::Allocate(size);
+    pRecord->mSize = size;
+
+    return pRecord;
+}
+
+void CaptureWriter::QueueRecord(CaptureRecord *pRecord)
+{
+    if(nullptr == pRecord)
+    {
+        return;
+    }
+
+    if(mStopped)
+    {
+        if(CaptureRecord::RecordType_t::PACKET == pRecord->mType)
+        {
+            mDroppedPackets++;
+        }
+
+        delete pRecord;
+
+        return;
+    }
+
+    mRecords.Enqueue(pRecord);
+}
+
+void CaptureWriter::Stop()
+{
+    std::lock_guard<std::mutex> guard(mStopLock);
+
+    if(mStopped.exchange(true))
+    {
+        return;
+    }
+
+    // This goes straight on the queue since new records are now dropped.
+    mRecords.Enqueue(new CaptureRecord(CaptureRecord::RecordType_t::STOP,
+        0));
+
+    mThread.join();
+}
+
+CaptureWriter::Stats CaptureWriter::GetStats() const
+{
+    Stats stats;
+    stats.captures = mCaptures;
+    stats.skippedCaptures = mSkippedCaptures;
+    stats.packets = mPackets;
+    stats.bytes = mBytes;
+    stats.writes = mWrites;
+    stats.rotations = mRotations;
+    stats.droppedPackets = mDroppedPackets;
+
+    return stats;
+}
+
+void CaptureWriter::Run()
+{
+    std::unordered_map<uint32_t, std::unique_ptr<CaptureFile>> files;
+
+    bool running = true;
+
+    while(running)
+    {
+        std::list<CaptureRecord*> records;
+        mRecords.DequeueAll(records);
+
+        for(auto pRecord : records)
+        {
+            std::unique_ptr<CaptureRecord> record(pRecord);
+
+            if(CaptureRecord::RecordType_t::STOP == record->mType)
+            {
+                running = false;
+
+                continue;
+            }
+
+            if(CaptureRecord::RecordType_t::OPEN == record->mType)
+            {
+                std::time_t now = static_cast<std::time_t>(record->mStamp);
+                std::tm *pTM = std::localtime(&now);
+
+                char szTimeStamp[32];
+                std::memset(szTimeStamp, 0, sizeof(szTimeStamp));
+
+                std::strftime(szTimeStamp, sizeof(szTimeStamp),
+                    "%Y%m%d%H%M%S", pTM);
+
+                std::unique_ptr<CaptureFile> file(new CaptureFile);
+                file->remoteAddress = String(record->Data(), record->mSize);
+                file->basePath = String("%1/%2-%3-%4").Arg(mPath).Arg(
+                    szTimeStamp).Arg(file->remoteAddress).Arg(rand());
+                file->stamp = record->mStamp;
+
+                OpenFile(*file);
+
+                files[record->mCaptureID] = std::move(file);
+
+                continue;
+            }
+
+            auto it = files.find(record->mCaptureID);
+
+            if(files.end() == it)
+            {
+                if(CaptureRecord::RecordType_t::PACKET == record->mType)
+                {
+                    mDroppedPackets++;
+                }
+
+                continue;
+            }
+
+            CaptureFile& file = *it->second;
+
+            if(CaptureRecord::RecordType_t::CLOSE == record->mType)
+            {
+                WriteFile(file);
+
+                files.erase(it);
+
+                continue;
+            }
+
+            if(file.failed)
+            {
+                mDroppedPackets++;
+
+                continue;
+            }
+
+            uint64_t recordSize = CAPTURE_RECORD_HEADER_SIZE + record->mSize;
+
+            // Continue in a new file if this one is full. A file always
+            // gets at least one packet so a huge packet can't loop.
+            if(0 != mMaxFileSize && file.headerSize < file.size &&
+                mMaxFileSize < (file.size + recordSize))
+            {
+                WriteFile(file);
+
+                if(!OpenFile(file))
+                {
+                    mDroppedPackets++;
+
+                    continue;
+                }
+
+                mRotations++;
+            }
+
+            AppendValue(file.pending, record->mSource);
+            AppendValue(file.pending, record->mStamp);
+            AppendValue(file.pending, record->mMicroTime);
+            AppendValue(file.pending, record->mSize);
+
+            const char *pData = record->Data();
+
+            file.pending.insert(file.pending.end(), pData,
+                pData + record->mSize);
+            file.size += recordSize;
+
+            mPackets++;
+
+            if(CAPTURE_WRITE_SIZE <= file.pending.size())
+            {
+                WriteFile(file);
+            }
+        }
+
+        // Write everything collected from this batch.
+        for(auto& file : files)
+        {
+            WriteFile(*file.second);
+        }
+    }
+
+    // Files are closed when they are destroyed here.
+}
+
+bool CaptureWriter::OpenFile(CaptureFile& file)
+{
+    if(file.file.is_open())
+    {
+        file.file.close();
+    }
+
+    file.part++;
+
+    auto captureFilePath = 1 == file.part ? String("%1.hack").Arg(
+        file.basePath) : String("%1-%2.hack").Arg(file.basePath).Arg(
+        file.part);
+
+    file.file.open(captureFilePath.C(), std::ofstream::binary);
+    file.pending.clear();
+    file.size = 0;
+
+    if(!file.file.good())
+    {
+        file.failed = true;
+
+        LogConnectionCritical([&]()
+        {
+            return String("Failed to open capture file: %1\n")
+                .Arg(captureFilePath);
+        });
+
+        return false;
+    }
+
+    uint32_t magic = HACK_FORMAT_MAGIC;
+    uint32_t version = HACK_FORMAT_VER2;
+    uint32_t addrlen = static_cast<uint32_t>(file.remoteAddress.Size());
+
+    // Queue the header.
+    AppendValue(file.pending, magic);
+    AppendValue(file.pending, version);
+    AppendValue(file.pending, file.stamp);
+    AppendValue(file.pending, addrlen);
+
+    file.pending.insert(file.pending.end(), file.remoteAddress.C(),
+        file.remoteAddress.C() + addrlen);
+
+    file.size = file.headerSize = file.pending.size();
+
+    LogConnectionDebug([&]()
+    {
+        return String("Started capture: %1\n").Arg(captureFilePath);
+    });
+
+    return true;
+}
+
+void CaptureWriter::WriteFile(CaptureFile& file)
+{
+    if(file.pending.empty() || file.failed)
+    {
+        file.pending.clear();
+
+        return;
+    }
+
+    file.file.write(&file.pending[0], static_cast<std::streamsize>(
+        file.pending.size()));
+    file.file.flush();
+
+    mBytes += file.pending.size();
+    mWrites++;
+
+    file.pending.clear();
+
+    if(!file.file.good())
+    {
+        file.failed = true;
+
+        LogConnectionCritical([&]()
+        {
+            return String("Failed to write capture file: %1\n")
+                .Arg(file.basePath);
+        });
+    }
+}
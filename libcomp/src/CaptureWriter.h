@@ -0,0 +1,298 @@
+/**
+ * @file libcomp/src/CaptureWriter.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Background writer for packet capture files.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_CAPTUREWRITER_H
+#define LIBCOMP_SRC_CAPTUREWRITER_H
+
+// libcomp Includes
+#include "CString.h"
+#include "LockFreeMessageQueue.h"
+#include "PacketBufferPool.h"
+
+// Standard C++11 Includes
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace libcomp
+{
+
+class CaptureWriter;
+
+/**
+ * Single packet to write to a capture file. A record is created by
+ * @ref CaptureWriter::CreateRecord, filled in by the connection and then
+ * handed back with @ref CaptureWriter::QueueRecord.
+ */
+class CaptureRecord
+{
+public:
+    /**
+     * Get the buffer to copy the packet data into.
+     * @returns Pointer to the packet data.
+     */
+    char* Data();
+
+    /**
+     * Get the size of the packet data.
+     * @returns Size of the packet data.
+     */
+    uint32_t Size() const;
+
+private:
+    friend class CaptureWriter;
+
+    /**
+     * Type of record.
+     */
+    enum class RecordType_t : uint8_t
+    {
+        OPEN,   //!< Open a new capture file.
+        PACKET, //!< Write a packet to a capture file.
+        CLOSE,  //!< Close a capture file.
+        STOP,   //!< Stop the writer thread.
+    };
+
+    /**
+     * Create a record. Only the writer creates records.
+     * @param type Type of record.
+     * @param captureID Capture the record belongs to.
+     */
+    CaptureRecord(RecordType_t type, uint32_t captureID);
+
+    /// Type of record.
+    RecordType_t mType;
+
+    /// HACK_SOURCE_CLIENT or HACK_SOURCE_SERVER.
+    uint8_t mSource;
+
+    /// Capture the record belongs to.
+    uint32_t mCaptureID;
+
+    /// Time the packet was captured (seconds since the epoch).
+    uint64_t mStamp;
+
+    /// Time the packet was captured (steady clock microseconds).
+    uint64_t mMicroTime;
+
+    /// Pooled buffer holding the packet data (or the remote address for
+    /// an OPEN record).
+    std::shared_ptr<PacketBuffer> mBuffer;
+
+    /// Size of the packet data.
+    uint32_t mSize;
+};
+
+/**
+ * Writes packet capture (.hack) files on a background thread. Connections
+ * queue records on a lock-free queue and never touch the files. The thread
+ * collects every record that is waiting and writes each file with a single
+ * large write. A file that grows past the size limit is closed and the
+ * capture continues in a new file with its own header so every file can
+ * be read on its own. Only every Nth connection is captured when a sample
+ * rate is set.
+ */
+class CaptureWriter
+{
+public:
+    /**
+     * Counters for the writer.
+     */
+    struct Stats
+    {
+        /// Number of connections captured.
+        uint64_t captures;
+
+        /// Number of connections skipped by the sample rate.
+        uint64_t skippedCaptures;
+
+        /// Number of packets written.
+        uint64_t packets;
+
+        /// Number of bytes written.
+        uint64_t bytes;
+
+        /// Number of write calls made.
+        uint64_t writes;
+
+        /// Number of files started because of the size limit.
+        uint64_t rotations;
+
+        /// Number of packets dropped because the file could not be written.
+        uint64_t droppedPackets;
+    };
+
+    /**
+     * Create the writer and start the writer thread.
+     * @param path Directory to write the capture files to.
+     * @param maxFileSize Size in bytes a capture file may reach before the
+     *   capture continues in a new file (0 for no limit).
+     * @param sampleRate Capture every Nth connection (0 or 1 to capture
+     *   every connection).
+     */
+    CaptureWriter(const String& path, uint64_t maxFileSize = 0,
+        uint32_t sampleRate = 1);
+
+    /**
+     * Write out anything still queued and stop the writer thread.
+     */
+    ~CaptureWriter();
+
+    /**
+     * Get the writer for a capture directory, creating it on first use.
+     * The size limit and sample rate given the first time are kept.
+     * @param path Directory to write the capture files to.
+     * @param maxFileSize Size in bytes a capture file may reach.
+     * @param sampleRate Capture every Nth connection.
+     * @returns Shared writer for the directory.
+     */
+    static std::shared_ptr<CaptureWriter> GetWriter(const String& path,
+        uint64_t maxFileSize, uint32_t sampleRate);
+
+    /**
+     * Stop every writer created by @ref GetWriter. Any queued records are
+     * written first. Connections that still hold a writer can keep queueing
+     * records but they are dropped.
+     */
+    static void StopWriters();
+
+    /**
+     * Start a capture for a new connection.
+     * @param remoteAddress Address of the remote end of the connection.
+     * @returns ID of the capture or 0 if the connection was not sampled.
+     */
+    uint32_t OpenCapture(const String& remoteAddress);
+
+    /**
+     * Finish a capture. The file is closed after every packet queued
+     * before this is written.
+     * @param captureID ID of the capture to close.
+     */
+    void CloseCapture(uint32_t captureID);
+
+    /**
+     * Create a record for a packet. The caller fills in the data and then
+     * passes the record to @ref QueueRecord.
+     * @param captureID ID of the capture the packet belongs to.
+     * @param source HACK_SOURCE_CLIENT or HACK_SOURCE_SERVER.
+     * @param size Size of the packet data.
+     * @returns Record to fill in or null if the packet is too big.
+     */
+    CaptureRecord* CreateRecord(uint32_t captureID, uint8_t source,
+        uint32_t size);
+
+    /**
+     * Queue a record created by @ref CreateRecord to be written. The writer
+     * takes ownership of the record.
+     * @param pRecord Record to queue.
+     */
+    void QueueRecord(CaptureRecord *pRecord);
+
+    /**
+     * Stop the writer thread after writing anything still queued.
+     */
+    void Stop();
+
+    /**
+     * Get the counters for the writer.
+     * @returns Counters for the writer.
+     */
+    Stats GetStats() const;
+
+private:
+    class CaptureFile;
+
+    /**
+     * Main loop of the writer thread.
+     */
+    void Run();
+
+    /**
+     * Open the next file of a capture and queue its header.
+     * @param file Capture to open the file for.
+     * @returns true if the file was opened; false otherwise.
+     */
+    bool OpenFile(CaptureFile& file);
+
+    /**
+     * Write the data queued for a capture file.
+     * @param file Capture to write.
+     */
+    void WriteFile(CaptureFile& file);
+
+    /// Directory to write the capture files to.
+    String mPath;
+
+    /// Size a file may reach before the capture continues in a new file.
+    uint64_t mMaxFileSize;
+
+    /// Capture every Nth connection.
+    uint32_t mSampleRate;
+
+    /// Number of connections seen (for the sample rate).
+    std::atomic<uint32_t> mConnectionCount;
+
+    /// Last capture ID handed out.
+    std::atomic<uint32_t> mLastCaptureID;
+
+    /// Set once the writer has been stopped.
+    std::atomic<bool> mStopped;
+
+    /// Lock held while stopping the writer.
+    std::mutex mStopLock;
+
+    /// Records waiting for the writer thread.
+    LockFreeMessageQueue<CaptureRecord*> mRecords;
+
+    /// Writer thread.
+    std::thread mThread;
+
+    /// Number of connections captured.
+    std::atomic<uint64_t> mCaptures;
+
+    /// Number of connections skipped by the sample rate.
+    std::atomic<uint64_t> mSkippedCaptures;
+
+    /// Number of packets written.
+    std::atomic<uint64_t> mPackets;
+
+    /// Number of bytes written.
+    std::atomic<uint64_t> mBytes;
+
+    /// Number of write calls made.
+    std::atomic<uint64_t> mWrites;
+
+    /// Number of files started because of the size limit.
+    std::atomic<uint64_t> mRotations;
+
+    /// Number of packets dropped.
+    std::atomic<uint64_t> mDroppedPackets;
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_CAPTUREWRITER_H
@@ -28,11 +28,44 @@
 
 // libcomp Includes
 #include "Constants.h"
+#include "CaptureWriter.h"
 #include "Crypto.h"
+#include "Endian.h"
 #include "Log.h"
 
+// Standard C++11 Includes
+#include <atomic>
+#include <chrono>
+
 using namespace libcomp;
 
+namespace
+{
+
+/// Compression policy shared by every channel connection. Null until a
+/// policy is set which is the same as the default policy.
+std::shared_ptr<const ChannelConnection::CompressionPolicy> gPolicy;
+
+/// Number of frames sent compressed.
+std::atomic<uint64_t> gCompressedFrames(0);
+
+/// Number of frames that did not get smaller when compressed.
+std::atomic<uint64_t> gRejectedFrames(0);
+
+/// Number of frames the policy sent uncompressed without trying.
+std::atomic<uint64_t> gSkippedFrames(0);
+
+/// Packet data passed to zlib.
+std::atomic<uint64_t> gInputBytes(0);
+
+/// Bytes saved by the frames that were sent compressed.
+std::atomic<uint64_t> gSavedBytes(0);
+
+/// Time spent compressing.
+std::atomic<uint64_t> gCompressNanoseconds(0);
+
+} // namespace
+
 ChannelConnection::ChannelConnection(asio::io_service& io_service) :
     libcomp::EncryptedConnection(io_service)
 {
@@ -48,160 +81,192 @@ ChannelConnection::~ChannelConnection()
 {
 }
 
-void ChannelConnection::PreparePackets(std::list<ReadOnlyPacket>& packets)
+void ChannelConnection::SetCompressionPolicy(
+    const CompressionPolicy& policy)
+{
+    std::atomic_store(&gPolicy, std::shared_ptr<const CompressionPolicy>(
+        std::make_shared<CompressionPolicy>(policy)));
+}
+
+ChannelConnection::CompressionPolicy ChannelConnection::GetCompressionPolicy()
+{
+    auto policy = std::atomic_load(&gPolicy);
+
+    return policy ? *policy : CompressionPolicy();
+}
+
+ChannelConnection::CompressionStats ChannelConnection::GetCompressionStats()
 {
-    static const uint32_t headerSize = GetHeaderSize();
+    CompressionStats stats;
+    stats.compressedFrames = gCompressedFrames;
+    stats.rejectedFrames = gRejectedFrames;
+    stats.skippedFrames = gSkippedFrames;
+    stats.inputBytes = gInputBytes;
+    stats.savedBytes = gSavedBytes;
+    stats.compressNanoseconds = gCompressNanoseconds;
+
+    return stats;
+}
 
-    if(STATUS_ENCRYPTED == mStatus)
+bool ChannelConnection::SkipCompression(const CompressionPolicy& policy,
+    const std::list<ReadOnlyPacket>& packets, uint32_t dataSize)
+{
+    if(dataSize < policy.minimumSize || 0 == policy.level)
     {
-        int retryCount = 0;
-        bool packetOK = false;
+        return true;
+    }
 
-        Packet finalPacket;
+    if(policy.skipCommands.empty())
+    {
+        return false;
+    }
 
-        // We will do this 1-2 times depending on if it compressed right.
-        while(!packetOK && 2 > retryCount++)
+    // Only skip if every packet is one that does not compress.
+    for(auto& packet : packets)
+    {
+        if(sizeof(uint16_t) > packet.Size())
         {
-            // Reserve space for the sizes.
-            finalPacket.WriteBlank(headerSize);
-
-            // Now add the packet data.
-            for(auto& packet : packets)
-            {
-                finalPacket.WriteU16Big((uint16_t)(packet.Size() + 2));
-                finalPacket.WriteU16Little((uint16_t)(packet.Size() + 2));
-                finalPacket.WriteArray(packet.ConstData(), packet.Size());
-            }
-
-            int32_t originalSize = static_cast<int32_t>(
-                finalPacket.Size() - headerSize);
-            int compressedSize;
-
-            // Compress the packet if this is the first try.
-            if(1 == retryCount)
-            {
-                finalPacket.Seek(headerSize);
-
-                // Attempt to compress the packet.
-                compressedSize = finalPacket.Compress(originalSize);
-
-                // If they are equal, this packet might be confused with an
-                // uncompressed one. In such a case, do not compress.
-                if(compressedSize < originalSize && 0 < compressedSize)
-                {
-                    // Packet is OK.
-                    packetOK = true;
-                }
-                else
-                {
-                    // Erase the final packet and create it again.
-                    finalPacket.Clear();
-                    finalPacket.Rewind();
-                }
-            }
-            else
-            {
-                // Same as the uncompressed size.
-                compressedSize = originalSize;
-
-                // Packet is OK.
-                packetOK = true;
-            }
-
-            // Write the uncompressed and compressed sizes.
-            if(packetOK)
-            {
-                // Move to where the uncompressed and compressed sizes are.
-                finalPacket.Seek(2 * sizeof(uint32_t));
-
-                // Write the sizes.
-                finalPacket.WriteArray("gzip", 4);
-                finalPacket.WriteS32Little(originalSize);
-                finalPacket.WriteS32Little(compressedSize);
-                finalPacket.WriteArray("lv6", 4);
-            }
+            return false;
         }
 
-        // If the packet is OK, encrypt and complete the procedure.
-        if(packetOK)
+        const uint8_t *pData = reinterpret_cast<const uint8_t*>(
+            packet.ConstData());
+
+        // The command code is little endian.
+        uint16_t commandCode = static_cast<uint16_t>(pData[0] |
+            (pData[1] << 8));
+
+        if(policy.skipCommands.end() == policy.skipCommands.find(
+            commandCode))
         {
-            // Save the packet to the capture.
-            if(nullptr != mCaptureFile)
-            {
-                // Copy the packet and format it for the capture.
-                libcomp::Packet capturePacket(finalPacket.ConstData(),
-                    finalPacket.Size());
-
-                uint32_t realSize = capturePacket.Size() - 2 *
-                    static_cast<uint32_t>(sizeof(uint32_t));
-
-                // Write the real size.
-                capturePacket.Seek(sizeof(uint32_t));
-                capturePacket.WriteU32Big(realSize);
-
-                // Round up the size of the packet to a multiple of
-                // BLOWFISH_BLOCK_SIZE.
-                uint32_t paddedSize = static_cast<uint32_t>(((realSize +
-                    BLOWFISH_BLOCK_SIZE - 1) / BLOWFISH_BLOCK_SIZE) *
-                    BLOWFISH_BLOCK_SIZE);
-
-                // Make sure the packet is padded.
-                if(realSize != paddedSize)
-                {
-                    capturePacket.End();
-                    capturePacket.WriteBlank(paddedSize - realSize);
-                }
-
-                // Write the padded size.
-                capturePacket.Rewind();
-                capturePacket.WriteU32Big(paddedSize);
-
-                std::time_t now = std::time(nullptr);
-
-                uint8_t source = HACK_SOURCE_SERVER;
-                uint64_t stamp = static_cast<uint64_t>(now);
-                uint64_t microtime = static_cast<uint64_t>(
-                    std::chrono::time_point_cast<std::chrono::microseconds>(
-                        std::chrono::steady_clock::now()
-                    ).time_since_epoch().count());
-                uint32_t size = capturePacket.Size();
-
-                mCaptureFile->write(reinterpret_cast<char*>(&source),
-                    sizeof(source));
-                mCaptureFile->write(reinterpret_cast<char*>(&stamp),
-                    sizeof(stamp));
-                mCaptureFile->write(reinterpret_cast<char*>(&microtime),
-                    sizeof(microtime));
-                mCaptureFile->write(reinterpret_cast<char*>(&size),
-                    sizeof(size));
-                mCaptureFile->write(capturePacket.ConstData(),
-                    size);
-
-                if(!mCaptureFile->good())
-                {
-                    LogConnectionCriticalMsg("Failed to write capture file.\n");
-
-                    delete mCaptureFile;
-                    mCaptureFile = nullptr;
-                }
-            }
-
-            // Encrypt the packet
-            mEncryptionKey.EncryptPacket(finalPacket);
-
-            mOutgoing = finalPacket;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ChannelConnection::BuildFrame(std::list<ReadOnlyPacket>& packets,
+    Packet& frame)
+{
+    uint32_t headerSize = GetHeaderSize();
+
+    if(STATUS_ENCRYPTED != mStatus)
+    {
+        return false;
+    }
+
+    auto policy = std::atomic_load(&gPolicy);
+
+    // Allocate a buffer big enough for the uncompressed packet so it is
+    // never grown while writing.
+    frame.Allocate(GetFrameCapacity(headerSize, packets));
+
+    // Reserve space for the sizes.
+    frame.WriteBlank(headerSize);
+
+    // Now add the packet data.
+    for(auto& packet : packets)
+    {
+        frame.WriteU16Big((uint16_t)(packet.Size() + 2));
+        frame.WriteU16Little((uint16_t)(packet.Size() + 2));
+        frame.WriteArray(packet.ConstData(), packet.Size());
+    }
+
+    int32_t originalSize = static_cast<int32_t>(
+        frame.Size() - headerSize);
+
+    // Same as the uncompressed size unless the compression helps.
+    int32_t compressedSize = originalSize;
+
+    if(policy && SkipCompression(*policy, packets, static_cast<uint32_t>(
+        originalSize)))
+    {
+        gSkippedFrames++;
+    }
+    else
+    {
+        frame.Seek(headerSize);
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Attempt to compress the packet. The frame is left as it is if
+        // the compressed data is not any smaller.
+        int32_t sz = frame.Compress(originalSize,
+            policy ? policy->level : -1);
+
+        gCompressNanoseconds += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        gInputBytes += static_cast<uint64_t>(originalSize);
+
+        // If they are equal, this packet might be confused with an
+        // uncompressed one. In such a case, do not compress.
+        if(sz < originalSize && 0 < sz)
+        {
+            compressedSize = sz;
+
+            gCompressedFrames++;
+            gSavedBytes += static_cast<uint64_t>(originalSize - sz);
         }
         else
         {
-            // We should never get here.
-            SocketError();
+            gRejectedFrames++;
         }
     }
-    else
+
+    // Move to where the uncompressed and compressed sizes are.
+    frame.Seek(2 * sizeof(uint32_t));
+
+    // Write the sizes.
+    frame.WriteArray("gzip", 4);
+    frame.WriteS32Little(originalSize);
+    frame.WriteS32Little(compressedSize);
+    frame.WriteArray("lv6", 4);
+
+    return true;
+}
+
+void ChannelConnection::FinishFrame(Packet& frame)
+{
+    // Save the packet to the capture.
+    if(mCaptureWriter)
     {
-        // Just use the base class code.
-        EncryptedConnection::PreparePackets(packets);
+        uint32_t realSize = frame.Size() - 2 *
+            static_cast<uint32_t>(sizeof(uint32_t));
+
+        // Round up the size of the packet to a multiple of
+        // BLOWFISH_BLOCK_SIZE.
+        uint32_t paddedSize = static_cast<uint32_t>(((realSize +
+            BLOWFISH_BLOCK_SIZE - 1) / BLOWFISH_BLOCK_SIZE) *
+            BLOWFISH_BLOCK_SIZE);
+
+        CaptureRecord *pRecord = mCaptureWriter->CreateRecord(mCaptureID,
+            HACK_SOURCE_SERVER, paddedSize + 2 *
+            static_cast<uint32_t>(sizeof(uint32_t)));
+
+        if(nullptr != pRecord)
+        {
+            // Format the frame the way the client sees it after decryption:
+            // the padded and real sizes followed by the padded data.
+            char *pData = pRecord->Data();
+
+            uint32_t paddedSizeBig = htobe32(paddedSize);
+            uint32_t realSizeBig = htobe32(realSize);
+
+            memcpy(pData, &paddedSizeBig, sizeof(uint32_t));
+            memcpy(pData + sizeof(uint32_t), &realSizeBig, sizeof(uint32_t));
+            memcpy(pData + 2 * sizeof(uint32_t), frame.ConstData() +
+                2 * sizeof(uint32_t), realSize);
+            memset(pData + 2 * sizeof(uint32_t) + realSize, 0,
+                paddedSize - realSize);
+
+            mCaptureWriter->QueueRecord(pRecord);
+        }
     }
+
+    // Encrypt the packet
+    EncryptedConnection::FinishFrame(frame);
 }
 
 bool ChannelConnection::DecompressPacket(libcomp::Packet& packet,
@@ -30,6 +30,9 @@
 // libcomp Includes
 #include "EncryptedConnection.h"
 
+// Standard C++11 Includes
+#include <set>
+
 namespace libcomp
 {
 
@@ -40,6 +43,51 @@ namespace libcomp
 class ChannelConnection : public libcomp::EncryptedConnection
 {
 public:
+    /**
+     * Settings that decide if and how outgoing frames are compressed.
+     */
+    struct CompressionPolicy
+    {
+        CompressionPolicy() : level(-1), minimumSize(64)
+        {
+        }
+
+        /// zlib compression level from 0 to 9 or -1 for the default level.
+        int32_t level;
+
+        /// Frames with less packet data than this are sent uncompressed
+        /// (the default matches the CompressionThreshold server setting).
+        uint32_t minimumSize;
+
+        /// Command codes that don't compress well. A frame made up of only
+        /// these packets is sent uncompressed.
+        std::set<uint16_t> skipCommands;
+    };
+
+    /**
+     * Counters for the compression of outgoing frames.
+     */
+    struct CompressionStats
+    {
+        /// Number of frames sent compressed.
+        uint64_t compressedFrames;
+
+        /// Number of frames that did not get smaller when compressed.
+        uint64_t rejectedFrames;
+
+        /// Number of frames the policy sent uncompressed without trying.
+        uint64_t skippedFrames;
+
+        /// Packet data passed to zlib (before compression).
+        uint64_t inputBytes;
+
+        /// Bytes saved by the frames that were sent compressed.
+        uint64_t savedBytes;
+
+        /// Time spent compressing (including rejected frames).
+        uint64_t compressNanoseconds;
+    };
+
     /**
      * Create a new channel connection.
      * @param io_service ASIO service to manage this connection.
@@ -59,13 +107,45 @@ public:
      */
     virtual ~ChannelConnection();
 
+    /**
+     * Set the compression policy used by every channel connection.
+     * @param policy Compression policy to use.
+     */
+    static void SetCompressionPolicy(const CompressionPolicy& policy);
+
+    /**
+     * Get the compression policy used by every channel connection.
+     * @returns Compression policy in use.
+     */
+    static CompressionPolicy GetCompressionPolicy();
+
+    /**
+     * Get the compression counters of every channel connection.
+     * @returns Compression counters.
+     */
+    static CompressionStats GetCompressionStats();
+
 protected:
-    virtual void PreparePackets(std::list<ReadOnlyPacket>& packets);
+    virtual bool BuildFrame(std::list<ReadOnlyPacket>& packets,
+        Packet& frame);
+
+    virtual void FinishFrame(Packet& frame);
 
     virtual bool DecompressPacket(libcomp::Packet& packet,
         uint32_t& paddedSize, uint32_t& realSize, uint32_t& dataStart);
 
     virtual uint32_t GetHeaderSize();
+
+private:
+    /**
+     * Check if the policy says to send a frame without compressing it.
+     * @param policy Compression policy to check.
+     * @param packets Packets in the frame.
+     * @param dataSize Size of the packet data in the frame.
+     * @returns true if the frame should not be compressed.
+     */
+    static bool SkipCompression(const CompressionPolicy& policy,
+        const std::list<ReadOnlyPacket>& packets, uint32_t dataSize);
 };
 
 } // namespace libcomp
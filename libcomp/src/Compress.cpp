@@ -31,6 +31,129 @@
 
 using namespace libcomp;
 
+namespace
+{
+
+/**
+ * zlib streams kept by each thread. Setting up a stream allocates the
+ * compression state so the streams are only reset between calls.
+ */
+class StreamCache
+{
+public:
+    StreamCache() : mDeflateReady(false), mDeflateLevel(0),
+        mInflateReady(false)
+    {
+    }
+
+    ~StreamCache()
+    {
+        EndDeflate();
+        EndInflate();
+    }
+
+    /**
+     * Get the deflate stream ready to compress at a given level.
+     * @param level zlib compression level.
+     * @returns Stream to use or null if it could not be initialized.
+     */
+    z_stream* GetDeflate(int level)
+    {
+        // Changing the level part way through is not worth the trouble.
+        if(mDeflateReady && level != mDeflateLevel)
+        {
+            EndDeflate();
+        }
+
+        if(!mDeflateReady)
+        {
+            mDeflate.zalloc = Z_NULL;
+            mDeflate.zfree = Z_NULL;
+            mDeflate.opaque = Z_NULL;
+
+            if(Z_OK != deflateInit(&mDeflate, level))
+            {
+                return nullptr;
+            }
+
+            mDeflateReady = true;
+            mDeflateLevel = level;
+        }
+
+        return &mDeflate;
+    }
+
+    /**
+     * Get the inflate stream.
+     * @returns Stream to use or null if it could not be initialized.
+     */
+    z_stream* GetInflate()
+    {
+        if(!mInflateReady)
+        {
+            mInflate.zalloc = Z_NULL;
+            mInflate.zfree = Z_NULL;
+            mInflate.opaque = Z_NULL;
+            mInflate.avail_in = 0;
+            mInflate.next_in = Z_NULL;
+
+            if(Z_OK != inflateInit(&mInflate))
+            {
+                return nullptr;
+            }
+
+            mInflateReady = true;
+        }
+
+        return &mInflate;
+    }
+
+    /**
+     * Free the deflate stream so it is set up again on the next call. This
+     * is done after an error so a broken stream is never reused.
+     */
+    void EndDeflate()
+    {
+        if(mDeflateReady)
+        {
+            deflateEnd(&mDeflate);
+            mDeflateReady = false;
+        }
+    }
+
+    /**
+     * Free the inflate stream so it is set up again on the next call.
+     */
+    void EndInflate()
+    {
+        if(mInflateReady)
+        {
+            inflateEnd(&mInflate);
+            mInflateReady = false;
+        }
+    }
+
+private:
+    /// Stream used to compress.
+    z_stream mDeflate;
+
+    /// Indicates @ref mDeflate has been initialized.
+    bool mDeflateReady;
+
+    /// Compression level @ref mDeflate was initialized with.
+    int mDeflateLevel;
+
+    /// Stream used to decompress.
+    z_stream mInflate;
+
+    /// Indicates @ref mInflate has been initialized.
+    bool mInflateReady;
+};
+
+thread_local StreamCache tStreamCache;
+
+} // namespace
+
 int32_t Compress::Compress(void *pIn, void *pOut, int32_t inSize,
     int32_t outSize, int32_t compLvl)
 {
@@ -48,40 +171,39 @@ int32_t Compress::Compress(void *pIn, void *pOut, int32_t inSize,
         compLvl = Z_DEFAULT_COMPRESSION;
     }
 
-    // Allocate the zlib stream object to store the state of the compression.
-    z_stream strm;
-
-    // Initialize the unset variables to null.
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
+    // Get the zlib stream object of this thread.
+    z_stream *pStrm = tStreamCache.GetDeflate(compLvl);
 
     // Make sure the zlib stream initializes properly.
-    if(Z_OK != deflateInit(&strm, compLvl))
+    if(nullptr == pStrm)
     {
         return -2;
     }
 
     // Tell zlib about the input buffer and how many bytes it contains.
-    strm.avail_in = (uInt)inSize;
-    strm.next_in = (Bytef*)pIn;
+    pStrm->avail_in = (uInt)inSize;
+    pStrm->next_in = (Bytef*)pIn;
 
     // Tell zlib about the output buffer and how many bytes it contains.
-    strm.avail_out = (uInt)outSize;
-    strm.next_out = (Bytef*)pOut;
+    pStrm->avail_out = (uInt)outSize;
+    pStrm->next_out = (Bytef*)pOut;
 
     // Attempt to compress the data and return if an error occured.
-    if(Z_STREAM_END != deflate(&strm, Z_FINISH))
+    if(Z_STREAM_END != deflate(pStrm, Z_FINISH))
     {
+        tStreamCache.EndDeflate();
+
         return -3;
     }
 
     // Save how many bytes of the output buffer were written to.
-    int32_t written = (int32_t)strm.total_out;
+    int32_t written = (int32_t)pStrm->total_out;
 
-    // Cleanup the zlib stream object (so it may free memory).
-    if(Z_OK != deflateEnd(&strm))
+    // Reset the zlib stream object so it can be used again.
+    if(Z_OK != deflateReset(pStrm))
     {
+        tStreamCache.EndDeflate();
+
         return -4;
     }
 
@@ -99,40 +221,39 @@ int32_t Compress::Decompress(void *pIn, void *pOut,
         return -1;
     }
 
-    // Allocate the zlib stream object to store the state of the decompression.
-    z_stream strm;
-
-    // Initialize the unset variables to null.
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-
-    // Tell zlib about the input buffer and how many bytes it contains.
-    strm.avail_in = (uInt)inSize;
-    strm.next_in = (Bytef*)pIn;
+    // Get the zlib stream object of this thread.
+    z_stream *pStrm = tStreamCache.GetInflate();
 
     // Make sure the zlib stream initializes properly.
-    if(Z_OK != inflateInit(&strm))
+    if(nullptr == pStrm)
     {
         return -2;
     }
 
+    // Tell zlib about the input buffer and how many bytes it contains.
+    pStrm->avail_in = (uInt)inSize;
+    pStrm->next_in = (Bytef*)pIn;
+
     // Tell zlib about the output buffer and how many bytes it contains.
-    strm.avail_out = (uInt)outSize;
-    strm.next_out = (Bytef*)pOut;
+    pStrm->avail_out = (uInt)outSize;
+    pStrm->next_out = (Bytef*)pOut;
 
     // Attempt to decompress the data and return if an error occured.
-    if(Z_STREAM_END != inflate(&strm, Z_FINISH))
+    if(Z_STREAM_END != inflate(pStrm, Z_FINISH))
     {
+        tStreamCache.EndInflate();
+
         return -3;
     }
 
     // Save how many bytes of the output buffer were written to.
-    int32_t written = (int32_t)strm.total_out;
+    int32_t written = (int32_t)pStrm->total_out;
 
-    // Cleanup the zlib stream object (so it may free memory).
-    if(Z_OK != inflateEnd(&strm))
+    // Reset the zlib stream object so it can be used again.
+    if(Z_OK != inflateReset(pStrm))
     {
+        tStreamCache.EndInflate();
+
         return -4;
     }
 
@@ -33,7 +33,9 @@ namespace libcomp
 {
 
 /**
- * Routines to compress and decompress data using zlib.
+ * Routines to compress and decompress data using zlib. Each thread keeps
+ * its own zlib streams and resets them between calls instead of setting
+ * them up every time.
  */
 namespace Compress
 {
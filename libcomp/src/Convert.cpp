@@ -95,9 +95,16 @@ static String FromCP1252Encoding(const uint8_t *szString, int size)
     const uint16_t *pMappingTo = (uint16_t*)LookupTableCP1252;
     const uint16_t *pMappingFrom = pMappingTo + 65536;
 
-    // String to store the converted string into.
+    // String to store the converted string into. Reserve enough space for
+    // most strings. A byte may become up to 3 bytes of UTF-8 but most
+    // bytes are ASCII and stay 1 byte.
     String final;
 
+    if(INT_MAX != size)
+    {
+        final.Reserve((size_t)size * 2);
+    }
+
     // Loop over the string until the null terminator has been or the
     // requested size has been reached.
     while(0 < size-- && 0 != *szString)
@@ -117,7 +124,7 @@ static String FromCP1252Encoding(const uint8_t *szString, int size)
         }
 
         // Append the mapped code point to the string.
-        final += String::FromCodePoint(unicode);
+        final.AppendCodePoint(unicode);
     }
 
     // Return the converted string.
@@ -145,9 +152,16 @@ static String FromCP932Encoding(const uint8_t *szString, int size)
     const uint16_t *pMappingTo = (uint16_t*)LookupTableCP932;
     const uint16_t *pMappingFrom = pMappingTo + 65536;
 
-    // String to store the converted string into.
+    // String to store the converted string into. Reserve enough space for
+    // most strings. A byte may become up to 3 bytes of UTF-8 (half-width
+    // katakana) but a 2 byte character is 3 bytes and ASCII stays 1 byte.
     String final;
 
+    if(INT_MAX != size)
+    {
+        final.Reserve((size_t)size * 2);
+    }
+
     // Loop over the string until the null terminator has been or the
     // requested size has been reached.
     while(0 < size-- && 0 != *szString)
@@ -189,7 +203,7 @@ static String FromCP932Encoding(const uint8_t *szString, int size)
         }
 
         // Append the mapped code point to the string.
-        final += String::FromCodePoint(unicode);
+        final.AppendCodePoint(unicode);
     }
 
     // Return the converted string.
@@ -206,17 +220,21 @@ static std::vector<char> ToCP1252Encoding(const String& str,
     // Used to add a null terminator to the end of the byte array.
     char zero = 0;
 
-    // String to store the converted string into.
+    // String to store the converted string into. Each character is one
+    // byte.
     std::vector<char> final;
+    final.reserve(str.Length() + 1);
 
     // Loop over every character in the source string.
-    for(size_t i = 0; i < str.Length(); ++i)
+    for(auto it = str.CodePointBegin(); it != str.CodePointEnd(); ++it)
     {
         // Get the Unicode code point for the current character.
-        String::CodePoint unicode = str.At(i);
+        String::CodePoint unicode = *it;
 
-        // Find the mapped code point for the desired encoding.
-        uint16_t cp1252 = pMappingTo[unicode];
+        // Find the mapped code point for the desired encoding. Code points
+        // outside of the table are not mapped.
+        uint16_t cp1252 = (String::CodePoint)0xFFFF < unicode ? 0 :
+            pMappingTo[unicode];
 
         // Add the converted character to the final string.
         final.push_back((char)(cp1252 & 0xFF));
@@ -242,14 +260,19 @@ static std::vector<char> ToCP932Encoding(const String& str,
     // Used to add a null terminator to the end of the byte array.
     char zero = 0;
 
-    // String to store the converted string into.
+    // String to store the converted string into. A character is never
+    // more bytes than it is in UTF-8.
     std::vector<char> final;
+    final.reserve(str.Size() + 1);
+
+    // Index of the current character (for error messages).
+    size_t i = 0;
 
     // Loop over every character in the source string.
-    for(size_t i = 0; i < str.Length(); ++i)
+    for(auto it = str.CodePointBegin(); it != str.CodePointEnd(); ++it, ++i)
     {
         // Get the Unicode code point for the current character.
-        String::CodePoint unicode = str.At(i);
+        String::CodePoint unicode = *it;
 
         // Sanity check the code point is inside the array.
         if(ARRAY_SIZE(LookupTableCP932) <= unicode ||
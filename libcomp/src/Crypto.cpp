@@ -37,6 +37,11 @@
 #include <mbedtls/blowfish.h>
 #include <mbedtls/dhm.h>
 #include <mbedtls/md.h>
+
+// Older versions of mbedtls do not mark the private members.
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif // MBEDTLS_PRIVATE
 #else
 #include <openssl/blowfish.h>
 #include <openssl/bn.h>
@@ -61,6 +66,7 @@
 #undef EncryptFile
 #endif // _WIN32
 
+#include <atomic>
 #include <cassert>
 #include <fstream>
 #include <iomanip>
@@ -531,104 +537,64 @@ void Crypto::Blowfish::SetKey(const void *pData, size_t dataSize)
         (uint32_t)(dataSize * 8));
 }
 
-void Crypto::Blowfish::Encrypt(void *pVoidData, uint32_t dataSize)
+/**
+ * Encrypt blocks one at a time with mbedtls.
+ * @param d Private data with the key.
+ * @param pData Data to encrypt.
+ * @param blockCount Number of blocks to encrypt.
+ */
+static void LibraryEncryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
 {
-    // Make room for the padded block.
-    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
+    for(size_t i = 0; i < blockCount; ++i)
     {
-        char *pData = reinterpret_cast<char *>(pVoidData);
-
-        // Encrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= dataSize)
-        {
-            SwapOpenSSL(pData);
-            mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_ENCRYPT,
-                reinterpret_cast<uint8_t *>(pData),
-                reinterpret_cast<uint8_t *>(pData));
-            SwapOpenSSL(pData);
-            pData += BLOWFISH_BLOCK_SIZE;
-            dataSize -= static_cast<uint32_t>(BLOWFISH_BLOCK_SIZE);
-        }
+        SwapOpenSSL(pData);
+        mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_ENCRYPT,
+            reinterpret_cast<uint8_t *>(pData),
+            reinterpret_cast<uint8_t *>(pData));
+        SwapOpenSSL(pData);
+        pData += BLOWFISH_BLOCK_SIZE;
     }
 }
 
-void Crypto::Blowfish::Encrypt(std::vector<char> &data)
+/**
+ * Decrypt blocks one at a time with mbedtls.
+ * @param d Private data with the key.
+ * @param pData Data to decrypt.
+ * @param blockCount Number of blocks to decrypt.
+ */
+static void LibraryDecryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
 {
-    std::vector<char>::size_type size = data.size();
-
-    // Make room for the padded block.
-    if(0 != (size % BLOWFISH_BLOCK_SIZE))
-    {
-        // Round up to a multiple of the block size.
-        size = ((size + BLOWFISH_BLOCK_SIZE - 1) / BLOWFISH_BLOCK_SIZE) *
-               BLOWFISH_BLOCK_SIZE;
-
-        // Resize the data vector.
-        data.resize(size, 0);
-    }
-
-    char *pData = &data[0];
-
-    // Encrypt each full block.
-    while(BLOWFISH_BLOCK_SIZE <= size)
+    for(size_t i = 0; i < blockCount; ++i)
     {
         SwapOpenSSL(pData);
-        mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_ENCRYPT,
+        mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_DECRYPT,
             reinterpret_cast<uint8_t *>(pData),
             reinterpret_cast<uint8_t *>(pData));
         SwapOpenSSL(pData);
         pData += BLOWFISH_BLOCK_SIZE;
-        size -= BLOWFISH_BLOCK_SIZE;
     }
 }
 
-void Crypto::Blowfish::Decrypt(void *pVoidData, uint32_t dataSize)
+/**
+ * Get the P-array of the expanded key.
+ * @param d Private data with the key.
+ * @returns Pointer to the 18 words of the P-array.
+ */
+static inline const uint32_t* BlowfishKeyP(const Crypto::BlowfishPrivate *d)
 {
-    // Make room for the padded block.
-    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
-    {
-        char *pData = reinterpret_cast<char *>(pVoidData);
-
-        // Decrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= dataSize)
-        {
-            SwapOpenSSL(pData);
-            mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_DECRYPT,
-                reinterpret_cast<uint8_t *>(pData),
-                reinterpret_cast<uint8_t *>(pData));
-            SwapOpenSSL(pData);
-            pData += BLOWFISH_BLOCK_SIZE;
-            dataSize -= static_cast<uint32_t>(BLOWFISH_BLOCK_SIZE);
-        }
-    }
+    return d->ctx.MBEDTLS_PRIVATE(P);
 }
 
-void Crypto::Blowfish::Decrypt(
-    std::vector<char> &data, std::vector<char>::size_type realSize)
+/**
+ * Get the S-boxes of the expanded key.
+ * @param d Private data with the key.
+ * @returns Pointer to the 4 S-boxes of 256 words each.
+ */
+static inline const uint32_t* BlowfishKeyS(const Crypto::BlowfishPrivate *d)
 {
-    std::vector<char>::size_type size = data.size();
-    char *pData = &data[0];
-
-    if((0 == realSize || realSize <= size) && 0 == (size % BLOWFISH_BLOCK_SIZE))
-    {
-        // Decrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= size)
-        {
-            SwapOpenSSL(pData);
-            mbedtls_blowfish_crypt_ecb(&d->ctx, MBEDTLS_BLOWFISH_DECRYPT,
-                reinterpret_cast<uint8_t *>(pData),
-                reinterpret_cast<uint8_t *>(pData));
-            SwapOpenSSL(pData);
-            pData += BLOWFISH_BLOCK_SIZE;
-            size -= BLOWFISH_BLOCK_SIZE;
-        }
-    }
-
-    // Resize the data if requested.
-    if(0 != realSize)
-    {
-        data.resize(realSize);
-    }
+    return &d->ctx.MBEDTLS_PRIVATE(S)[0][0];
 }
 
 void Crypto::Blowfish::EncryptCbc(
@@ -1130,88 +1096,59 @@ void Crypto::Blowfish::SetKey(const void *pData, size_t dataSize)
         &d->key, (int)dataSize, reinterpret_cast<const unsigned char *>(pData));
 }
 
-void Crypto::Blowfish::Encrypt(void *pVoidData, uint32_t dataSize)
+/**
+ * Encrypt blocks one at a time with OpenSSL.
+ * @param d Private data with the key.
+ * @param pData Data to encrypt.
+ * @param blockCount Number of blocks to encrypt.
+ */
+static void LibraryEncryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
 {
-    // Make room for the padded block.
-    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
+    for(size_t i = 0; i < blockCount; ++i)
     {
-        char *pData = reinterpret_cast<char *>(pVoidData);
-
-        // Encrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= dataSize)
-        {
-            BF_encrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
-            pData += BLOWFISH_BLOCK_SIZE;
-            dataSize -= static_cast<uint32_t>(BLOWFISH_BLOCK_SIZE);
-        }
+        BF_encrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
+        pData += BLOWFISH_BLOCK_SIZE;
     }
 }
 
-void Crypto::Blowfish::Encrypt(std::vector<char> &data)
+/**
+ * Decrypt blocks one at a time with OpenSSL.
+ * @param d Private data with the key.
+ * @param pData Data to decrypt.
+ * @param blockCount Number of blocks to decrypt.
+ */
+static void LibraryDecryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
 {
-    std::vector<char>::size_type size = data.size();
-
-    // Make room for the padded block.
-    if(0 != (size % BLOWFISH_BLOCK_SIZE))
-    {
-        // Round up to a multiple of the block size.
-        size = ((size + BLOWFISH_BLOCK_SIZE - 1) / BLOWFISH_BLOCK_SIZE) *
-               BLOWFISH_BLOCK_SIZE;
-
-        // Resize the data vector.
-        data.resize(size, 0);
-    }
-
-    char *pData = &data[0];
-
-    // Encrypt each full block.
-    while(BLOWFISH_BLOCK_SIZE <= size)
+    for(size_t i = 0; i < blockCount; ++i)
     {
-        BF_encrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
+        BF_decrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
         pData += BLOWFISH_BLOCK_SIZE;
-        size -= BLOWFISH_BLOCK_SIZE;
     }
 }
 
-void Crypto::Blowfish::Decrypt(void *pVoidData, uint32_t dataSize)
+/**
+ * Get the P-array of the expanded key.
+ * @param d Private data with the key.
+ * @returns Pointer to the 18 words of the P-array.
+ */
+static inline const uint32_t* BlowfishKeyP(const Crypto::BlowfishPrivate *d)
 {
-    // Make room for the padded block.
-    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
-    {
-        char *pData = reinterpret_cast<char *>(pVoidData);
+    static_assert(sizeof(BF_LONG) == sizeof(uint32_t),
+        "BF_LONG must be 32 bits");
 
-        // Decrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= dataSize)
-        {
-            BF_decrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
-            pData += BLOWFISH_BLOCK_SIZE;
-            dataSize -= static_cast<uint32_t>(BLOWFISH_BLOCK_SIZE);
-        }
-    }
+    return reinterpret_cast<const uint32_t*>(d->key.P);
 }
 
-void Crypto::Blowfish::Decrypt(
-    std::vector<char> &data, std::vector<char>::size_type realSize)
+/**
+ * Get the S-boxes of the expanded key.
+ * @param d Private data with the key.
+ * @returns Pointer to the 4 S-boxes of 256 words each.
+ */
+static inline const uint32_t* BlowfishKeyS(const Crypto::BlowfishPrivate *d)
 {
-    std::vector<char>::size_type size = data.size();
-    char *pData = &data[0];
-
-    if((0 == realSize || realSize <= size) && 0 == (size % BLOWFISH_BLOCK_SIZE))
-    {
-        // Decrypt each full block.
-        while(BLOWFISH_BLOCK_SIZE <= size)
-        {
-            BF_decrypt(reinterpret_cast<BF_LONG *>(pData), &d->key);
-            pData += BLOWFISH_BLOCK_SIZE;
-            size -= BLOWFISH_BLOCK_SIZE;
-        }
-    }
-
-    // Resize the data if requested.
-    if(0 != realSize)
-    {
-        data.resize(realSize);
-    }
+    return reinterpret_cast<const uint32_t*>(d->key.S);
 }
 
 void Crypto::Blowfish::EncryptCbc(
@@ -1651,6 +1588,268 @@ std::shared_ptr<Crypto::DiffieHellman> Crypto::DiffieHellman::Generate()
 }
 #endif // USE_MBED_TLS
 
+/// Use the interleaved Blowfish kernel instead of the library functions.
+static std::atomic<bool> gBlowfishInterleaved(true);
+
+/// Number of blocks the interleaved Blowfish kernel works on at once.
+static const size_t BLOWFISH_LANES = 4;
+
+/**
+ * Blowfish round function.
+ * @param pS S-boxes of the expanded key.
+ * @param x Half of a block.
+ * @returns Value to mix into the other half of the block.
+ */
+static inline uint32_t BlowfishF(const uint32_t *pS, uint32_t x)
+{
+    return ((pS[x >> 24] + pS[256 + ((x >> 16) & 0xFF)]) ^
+        pS[512 + ((x >> 8) & 0xFF)]) + pS[768 + (x & 0xFF)];
+}
+
+/**
+ * Load a block as two words in host order like BF_encrypt.
+ * @param pData Block to load.
+ * @param l Left half of the block.
+ * @param r Right half of the block.
+ */
+static inline void BlowfishLoad(const char *pData, uint32_t& l, uint32_t& r)
+{
+    memcpy(&l, pData, sizeof(uint32_t));
+    memcpy(&r, pData + sizeof(uint32_t), sizeof(uint32_t));
+}
+
+/**
+ * Store a block after the final swap of the two halves.
+ * @param pData Block to store.
+ * @param l Left half of the block.
+ * @param r Right half of the block.
+ */
+static inline void BlowfishStore(char *pData, uint32_t l, uint32_t r)
+{
+    memcpy(pData, &r, sizeof(uint32_t));
+    memcpy(pData + sizeof(uint32_t), &l, sizeof(uint32_t));
+}
+
+/**
+ * Encrypt or decrypt a single block.
+ * @param pP P-array of the expanded key (reversed to decrypt).
+ * @param step 1 to encrypt or -1 to decrypt.
+ * @param pS S-boxes of the expanded key.
+ * @param pData Block to encrypt or decrypt.
+ */
+static inline void BlowfishBlock(const uint32_t *pP, ptrdiff_t step,
+    const uint32_t *pS, char *pData)
+{
+    uint32_t l, r;
+
+    BlowfishLoad(pData, l, r);
+
+    l ^= pP[0];
+
+    for(int i = 0; i < 8; ++i)
+    {
+        pP += step;
+        r ^= *pP ^ BlowfishF(pS, l);
+        pP += step;
+        l ^= *pP ^ BlowfishF(pS, r);
+    }
+
+    pP += step;
+    r ^= *pP;
+
+    BlowfishStore(pData, l, r);
+}
+
+/**
+ * Encrypt or decrypt four independent blocks at once. Each round is done
+ * for every block before the next round so the S-box lookups of one block
+ * overlap with the others instead of waiting on each other. The lanes are
+ * kept in separate variables so they all stay in registers.
+ * @param pP P-array of the expanded key (reversed to decrypt).
+ * @param step 1 to encrypt or -1 to decrypt.
+ * @param pS S-boxes of the expanded key.
+ * @param pData Blocks to encrypt or decrypt.
+ */
+static inline void BlowfishBlocks4(const uint32_t *pP, ptrdiff_t step,
+    const uint32_t *pS, char *pData)
+{
+    uint32_t l0, r0, l1, r1, l2, r2, l3, r3;
+
+    BlowfishLoad(pData, l0, r0);
+    BlowfishLoad(pData + BLOWFISH_BLOCK_SIZE, l1, r1);
+    BlowfishLoad(pData + 2 * BLOWFISH_BLOCK_SIZE, l2, r2);
+    BlowfishLoad(pData + 3 * BLOWFISH_BLOCK_SIZE, l3, r3);
+
+    uint32_t k = pP[0];
+    l0 ^= k;
+    l1 ^= k;
+    l2 ^= k;
+    l3 ^= k;
+
+    for(int i = 0; i < 8; ++i)
+    {
+        pP += step;
+        k = *pP;
+        r0 ^= k ^ BlowfishF(pS, l0);
+        r1 ^= k ^ BlowfishF(pS, l1);
+        r2 ^= k ^ BlowfishF(pS, l2);
+        r3 ^= k ^ BlowfishF(pS, l3);
+
+        pP += step;
+        k = *pP;
+        l0 ^= k ^ BlowfishF(pS, r0);
+        l1 ^= k ^ BlowfishF(pS, r1);
+        l2 ^= k ^ BlowfishF(pS, r2);
+        l3 ^= k ^ BlowfishF(pS, r3);
+    }
+
+    pP += step;
+    k = *pP;
+    r0 ^= k;
+    r1 ^= k;
+    r2 ^= k;
+    r3 ^= k;
+
+    BlowfishStore(pData, l0, r0);
+    BlowfishStore(pData + BLOWFISH_BLOCK_SIZE, l1, r1);
+    BlowfishStore(pData + 2 * BLOWFISH_BLOCK_SIZE, l2, r2);
+    BlowfishStore(pData + 3 * BLOWFISH_BLOCK_SIZE, l3, r3);
+}
+
+/**
+ * Encrypt or decrypt blocks with the interleaved kernel.
+ * @param pP P-array of the expanded key (reversed to decrypt).
+ * @param step 1 to encrypt or -1 to decrypt.
+ * @param pS S-boxes of the expanded key.
+ * @param pData Blocks to encrypt or decrypt.
+ * @param blockCount Number of blocks.
+ */
+static void BlowfishInterleaved(const uint32_t *pP, ptrdiff_t step,
+    const uint32_t *pS, char *pData, size_t blockCount)
+{
+    for(; BLOWFISH_LANES <= blockCount; blockCount -= BLOWFISH_LANES)
+    {
+        BlowfishBlocks4(pP, step, pS, pData);
+        pData += BLOWFISH_LANES * BLOWFISH_BLOCK_SIZE;
+    }
+
+    for(; 0 < blockCount; --blockCount)
+    {
+        BlowfishBlock(pP, step, pS, pData);
+        pData += BLOWFISH_BLOCK_SIZE;
+    }
+}
+
+/**
+ * Encrypt blocks with the selected Blowfish implementation.
+ * @param d Private data with the key.
+ * @param pData Data to encrypt.
+ * @param blockCount Number of blocks to encrypt.
+ */
+static void EncryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
+{
+    if(!gBlowfishInterleaved.load(std::memory_order_relaxed))
+    {
+        LibraryEncryptBlocks(d, pData, blockCount);
+
+        return;
+    }
+
+    BlowfishInterleaved(BlowfishKeyP(d), 1, BlowfishKeyS(d), pData,
+        blockCount);
+}
+
+/**
+ * Decrypt blocks with the selected Blowfish implementation.
+ * @param d Private data with the key.
+ * @param pData Data to decrypt.
+ * @param blockCount Number of blocks to decrypt.
+ */
+static void DecryptBlocks(Crypto::BlowfishPrivate *d, char *pData,
+    size_t blockCount)
+{
+    if(!gBlowfishInterleaved.load(std::memory_order_relaxed))
+    {
+        LibraryDecryptBlocks(d, pData, blockCount);
+
+        return;
+    }
+
+    // Decryption is the same with the P-array used backwards.
+    BlowfishInterleaved(BlowfishKeyP(d) + 17, -1, BlowfishKeyS(d), pData,
+        blockCount);
+}
+
+void Crypto::Blowfish::SetInterleaved(bool interleaved)
+{
+    gBlowfishInterleaved = interleaved;
+}
+
+bool Crypto::Blowfish::IsInterleaved()
+{
+    return gBlowfishInterleaved;
+}
+
+void Crypto::Blowfish::Encrypt(void *pVoidData, uint32_t dataSize)
+{
+    // Only whole blocks can be encrypted.
+    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
+    {
+        EncryptBlocks(d, reinterpret_cast<char *>(pVoidData),
+            dataSize / BLOWFISH_BLOCK_SIZE);
+    }
+}
+
+void Crypto::Blowfish::Encrypt(std::vector<char> &data)
+{
+    std::vector<char>::size_type size = data.size();
+
+    // Make room for the padded block.
+    if(0 != (size % BLOWFISH_BLOCK_SIZE))
+    {
+        // Round up to a multiple of the block size.
+        size = ((size + BLOWFISH_BLOCK_SIZE - 1) / BLOWFISH_BLOCK_SIZE) *
+               BLOWFISH_BLOCK_SIZE;
+
+        // Resize the data vector.
+        data.resize(size, 0);
+    }
+
+    if(!data.empty())
+    {
+        EncryptBlocks(d, &data[0], size / BLOWFISH_BLOCK_SIZE);
+    }
+}
+
+void Crypto::Blowfish::Decrypt(void *pVoidData, uint32_t dataSize)
+{
+    // Only whole blocks can be decrypted.
+    if(0 == (dataSize % BLOWFISH_BLOCK_SIZE))
+    {
+        DecryptBlocks(d, reinterpret_cast<char *>(pVoidData),
+            dataSize / BLOWFISH_BLOCK_SIZE);
+    }
+}
+
+void Crypto::Blowfish::Decrypt(
+    std::vector<char> &data, std::vector<char>::size_type realSize)
+{
+    std::vector<char>::size_type size = data.size();
+
+    if(!data.empty() && (0 == realSize || realSize <= size) &&
+        0 == (size % BLOWFISH_BLOCK_SIZE))
+    {
+        DecryptBlocks(d, &data[0], size / BLOWFISH_BLOCK_SIZE);
+    }
+
+    // Resize the data if requested.
+    if(0 != realSize)
+    {
+        data.resize(realSize);
+    }
+}
+
 void Crypto::Blowfish::SetKey(const std::vector<char> &key)
 {
     SetKey(&key[0], key.size());
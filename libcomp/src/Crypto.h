@@ -253,6 +253,21 @@ public:
      */
     Blowfish& operator=(const Blowfish& other) = delete;
 
+    /**
+     * Select the implementation used by @ref Encrypt and @ref Decrypt. The
+     * interleaved kernel works on several blocks at once and is used by
+     * default. Otherwise each block is passed to the crypto library.
+     * @param interleaved true to use the interleaved kernel.
+     */
+    static void SetInterleaved(bool interleaved);
+
+    /**
+     * Check if the interleaved kernel is used by @ref Encrypt and
+     * @ref Decrypt.
+     * @returns true if the interleaved kernel is used.
+     */
+    static bool IsInterleaved();
+
     /**
      * Set the blowfish key.
      * @param pData Pointer to the buffer with the key.
@@ -30,19 +30,40 @@
 
 // libcomp Includes
 #include "BaseServer.h"
+#include "DatabaseBind.h"
 #include "DataStore.h"
 #include "Log.h"
 #include "ScriptEngine.h"
 
+// Standard C++11 Includes
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
 using namespace libcomp;
 
-Database::Database(const std::shared_ptr<objects::DatabaseConfig>& config)
+Database::Database(const std::shared_ptr<objects::DatabaseConfig>& config) :
+    mTransactionQueueSize(0), mWriteBehindRunning(false)
 {
     mConfig = config;
+
+    memset(&mClosedStatementCacheStats, 0,
+        sizeof(mClosedStatementCacheStats));
+    memset(&mWriteBehindStats, 0, sizeof(mWriteBehindStats));
 }
 
 Database::~Database()
 {
+    // Derived classes stop the thread when they are closed so anything
+    // left in the queue can still be written. Make sure it is not left
+    // running if they did not.
+    StopWriteBehind();
+
+    if(mWriteBehindThread.joinable())
+    {
+        // The write-behind thread destroyed the database itself.
+        mWriteBehindThread.detach();
+    }
 }
 
 bool Database::Execute(const String& query)
@@ -60,6 +81,44 @@ std::shared_ptr<objects::DatabaseConfig> Database::GetConfig() const
     return mConfig;
 }
 
+void Database::ClearStatementCache()
+{
+    std::list<std::shared_ptr<DatabaseStatementCache>> caches;
+
+    {
+        std::lock_guard<std::mutex> lock(mStatementCacheLock);
+
+        for(auto& pair : mStatementCaches)
+        {
+            caches.push_back(pair.second);
+        }
+    }
+
+    for(auto& cache : caches)
+    {
+        cache->Clear();
+    }
+}
+
+DatabaseStatementCache::Stats Database::GetStatementCacheStats()
+{
+    std::lock_guard<std::mutex> lock(mStatementCacheLock);
+
+    DatabaseStatementCache::Stats stats = mClosedStatementCacheStats;
+
+    for(auto& pair : mStatementCaches)
+    {
+        auto cacheStats = pair.second->GetStats();
+
+        stats.hits += cacheStats.hits;
+        stats.misses += cacheStats.misses;
+        stats.evictions += cacheStats.evictions;
+        stats.size += cacheStats.size;
+    }
+
+    return stats;
+}
+
 bool Database::TableHasRows(const String& table)
 {
     libcomp::DatabaseQuery query = Prepare(String(
@@ -149,13 +208,32 @@ bool Database::QueueChangeSet(const std::shared_ptr<
 
         if(standardChanges)
         {
-            std::lock_guard<std::mutex> lock(mTransactionLock);
-            auto queueEntry = mTransactionQueue[key];
+            std::unique_lock<std::mutex> lock(mTransactionLock);
+
+            // Apply back-pressure while the write-behind thread catches up
+            // (unless this is the write-behind thread).
+            size_t maxSize = mConfig->GetWriteBehindMaxQueueSize();
+            if(mWriteBehindRunning && 0 != maxSize &&
+                mTransactionQueueSize >= maxSize &&
+                std::this_thread::get_id() != mWriteBehindThread.get_id())
+            {
+                mWriteBehindStats.blocked++;
+
+                mTransactionCondition.wait(lock, [&]()
+                {
+                    return !mWriteBehindRunning ||
+                        mTransactionQueueSize < maxSize;
+                });
+            }
+
+            auto& queueEntry = mTransactionQueue[key];
             if(queueEntry == nullptr)
             {
                 queueEntry = std::make_shared<DBStandardChangeSet>(uuid);
             }
 
+            size_t previousCount = queueEntry->GetChangeCount();
+
             for(auto obj : standardChanges->GetInserts())
             {
                 queueEntry->Insert(obj);
@@ -171,7 +249,28 @@ bool Database::QueueChangeSet(const std::shared_ptr<
                 queueEntry->Delete(obj);
             }
 
-            mTransactionQueue[key] = queueEntry;
+            size_t count = standardChanges->GetChangeCount();
+            size_t added = queueEntry->GetChangeCount() - previousCount;
+
+            mWriteBehindStats.queued += count;
+            mWriteBehindStats.coalesced += count - added;
+
+            bool wasEmpty = 0 == mTransactionQueueSize;
+
+            if(wasEmpty && 0 != added)
+            {
+                mTransactionQueueTime = std::chrono::steady_clock::now();
+            }
+
+            mTransactionQueueSize += added;
+
+            // Wake the write-behind thread to start timing the queue or to
+            // process it if it is full enough.
+            if(mWriteBehindRunning && 0 != added && (wasEmpty ||
+                mTransactionQueueSize >= mConfig->GetWriteBehindFlushSize()))
+            {
+                mTransactionCondition.notify_all();
+            }
 
             return true;
         }
@@ -194,10 +293,15 @@ std::list<libobjgen::UUID> Database::ProcessTransactionQueue()
             return failures;
         }
 
-        queue = mTransactionQueue;
-        mTransactionQueue.clear();
+        queue.swap(mTransactionQueue);
+        mTransactionQueueSize = 0;
     }
 
+    // Let anyone waiting on a full queue continue.
+    mTransactionCondition.notify_all();
+
+    auto start = std::chrono::steady_clock::now();
+
     // Process the general queue transaction first
     auto nullKey = NULLUUID.ToString();
     if(queue.find(nullKey) != queue.end())
@@ -218,9 +322,124 @@ std::list<libobjgen::UUID> Database::ProcessTransactionQueue()
         }
     }
 
+    uint64_t latency = (uint64_t)std::chrono::duration_cast<
+        std::chrono::microseconds>(std::chrono::steady_clock::now() -
+        start).count();
+
+    {
+        std::lock_guard<std::mutex> lock(mTransactionLock);
+
+        mWriteBehindStats.flushes++;
+        mWriteBehindStats.failures += failures.size();
+        mWriteBehindStats.lastFlushLatency = latency;
+        mWriteBehindStats.totalFlushLatency += latency;
+
+        if(latency > mWriteBehindStats.maxFlushLatency)
+        {
+            mWriteBehindStats.maxFlushLatency = latency;
+        }
+    }
+
     return failures;
 }
 
+bool Database::StartWriteBehind()
+{
+    std::lock_guard<std::mutex> lock(mTransactionLock);
+
+    if(mWriteBehindRunning || mWriteBehindThread.joinable())
+    {
+        return false;
+    }
+
+    mWriteBehindRunning = true;
+
+    mWriteBehindThread = std::thread([this]()
+    {
+#if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+        pthread_setname_np(pthread_self(), "database");
+#endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+
+        RunWriteBehind();
+    });
+
+    return true;
+}
+
+void Database::StopWriteBehind()
+{
+    {
+        std::lock_guard<std::mutex> lock(mTransactionLock);
+
+        mWriteBehindRunning = false;
+    }
+
+    mTransactionCondition.notify_all();
+
+    if(mWriteBehindThread.joinable() &&
+        std::this_thread::get_id() != mWriteBehindThread.get_id())
+    {
+        mWriteBehindThread.join();
+    }
+}
+
+Database::WriteBehindStats Database::GetWriteBehindStats()
+{
+    std::lock_guard<std::mutex> lock(mTransactionLock);
+
+    WriteBehindStats stats = mWriteBehindStats;
+    stats.queueDepth = mTransactionQueueSize;
+
+    return stats;
+}
+
+void Database::RunWriteBehind()
+{
+    bool running = true;
+
+    while(running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mTransactionLock);
+
+            size_t flushSize = mConfig->GetWriteBehindFlushSize();
+            auto flushTime = mTransactionQueueTime + std::chrono::milliseconds(
+                mConfig->GetWriteBehindFlushInterval());
+
+            // Wait until the queue is big enough or old enough to flush.
+            while(mWriteBehindRunning && (0 == mTransactionQueueSize ||
+                (mTransactionQueueSize < flushSize &&
+                std::chrono::steady_clock::now() < flushTime)))
+            {
+                if(0 == mTransactionQueueSize)
+                {
+                    mTransactionCondition.wait(lock);
+
+                    flushTime = mTransactionQueueTime +
+                        std::chrono::milliseconds(
+                        mConfig->GetWriteBehindFlushInterval());
+                }
+                else
+                {
+                    mTransactionCondition.wait_until(lock, flushTime);
+                }
+            }
+
+            running = mWriteBehindRunning;
+        }
+
+        // Anything left is processed when stopping.
+        for(auto uuid : ProcessTransactionQueue())
+        {
+            LogDatabaseError([&]()
+            {
+                return String("Failed to process queued transaction: %1\n")
+                    .Arg(uuid.ToString());
+            });
+        }
+    }
+}
+
 bool Database::ProcessChangeSet(const std::shared_ptr<DatabaseChangeSet>& changes)
 {
     auto opChanges = std::dynamic_pointer_cast<DBOperationalChangeSet>(changes);
@@ -295,6 +514,309 @@ std::vector<std::shared_ptr<libobjgen::MetaObject>> Database::GetMappedObjects()
     return metaObjectTables;
 }
 
+DatabaseQuery Database::PrepareCached(void *pConnection, uint64_t sessionID,
+    const std::string& key, const std::function<String()>& getQuery)
+{
+    size_t maxSize = mConfig->GetStatementCacheSize();
+
+    if(nullptr == pConnection || 0 == maxSize)
+    {
+        return Prepare(getQuery());
+    }
+
+    std::shared_ptr<DatabaseStatementCache> cache;
+
+    {
+        std::lock_guard<std::mutex> lock(mStatementCacheLock);
+
+        auto& entry = mStatementCaches[pConnection];
+
+        if(!entry)
+        {
+            entry = std::make_shared<DatabaseStatementCache>(maxSize);
+        }
+
+        cache = entry;
+    }
+
+    cache->SetSession(sessionID);
+
+    return cache->Prepare(key, [&]()
+    {
+        return Prepare(getQuery());
+    });
+}
+
+void Database::RemoveStatementCache(void *pConnection)
+{
+    std::shared_ptr<DatabaseStatementCache> cache;
+
+    {
+        std::lock_guard<std::mutex> lock(mStatementCacheLock);
+
+        auto it = mStatementCaches.find(pConnection);
+
+        if(it == mStatementCaches.end())
+        {
+            return;
+        }
+
+        cache = it->second;
+        mStatementCaches.erase(it);
+
+        auto stats = cache->GetStats();
+
+        mClosedStatementCacheStats.hits += stats.hits;
+        mClosedStatementCacheStats.misses += stats.misses;
+        mClosedStatementCacheStats.evictions += stats.evictions;
+    }
+
+    // Statements still in use are finalized when they are released.
+    cache->Clear();
+}
+
+std::string Database::GetStatementKey(char operation,
+    const libobjgen::MetaObject& metaObject,
+    const std::list<DatabaseBind*>& values)
+{
+    std::string key(1, operation);
+    key += metaObject.GetName();
+
+    for(auto value : values)
+    {
+        key += ',';
+        key += value->GetColumn().C();
+    }
+
+    return key;
+}
+
+bool Database::GetObjectBatches(
+    const std::list<std::shared_ptr<PersistentObject>>& objs,
+    bool insert, std::list<ObjectBatch>& batches)
+{
+    // Most databases limit the number of parameters a statement can have
+    // (SQLite defaults to 999) so keep each batch under that.
+    static const size_t MAX_BINDS = 999;
+
+    size_t batchSize = mConfig->GetChangeSetBatchSize();
+
+    // Batch currently being filled for each statement key.
+    std::unordered_map<std::string, ObjectBatch*> openBatches;
+
+    for(auto obj : objs)
+    {
+        if(!obj->CanSave())
+        {
+            FreeObjectBatches(batches);
+
+            return false;
+        }
+
+        if(insert)
+        {
+            if(obj->GetUUID().IsNull() && !obj->Register(obj))
+            {
+                FreeObjectBatches(batches);
+
+                return false;
+            }
+        }
+        else if(obj->GetUUID().IsNull())
+        {
+            FreeObjectBatches(batches);
+
+            return false;
+        }
+
+        auto values = obj->GetMemberBindValues(insert);
+
+        if(values.empty() && !insert)
+        {
+            // Nothing updated, nothing to do
+            continue;
+        }
+
+        auto metaObject = obj->GetObjectMetadata();
+        auto key = GetStatementKey(insert ? 'I' : 'U', *metaObject, values);
+
+        ObjectBatch *pBatch = openBatches[key];
+
+        if(nullptr == pBatch || pBatch->objects.size() >= pBatch->maxSize)
+        {
+            // Insert binds the UID and each column once per object while
+            // update binds the UID once and twice more per column.
+            size_t bindsPerObject = insert ? (values.size() + 1) :
+                (values.size() * 2 + 1);
+
+            ObjectBatch batch;
+            batch.metaObject = metaObject;
+            batch.key = key;
+            batch.maxSize = std::max<size_t>(1, std::min(batchSize,
+                MAX_BINDS / bindsPerObject));
+
+            batches.push_back(batch);
+
+            pBatch = &batches.back();
+            openBatches[key] = pBatch;
+        }
+
+        pBatch->objects.push_back(obj);
+        pBatch->values.push_back(std::vector<DatabaseBind*>(
+            values.begin(), values.end()));
+    }
+
+    return true;
+}
+
+void Database::FreeObjectBatches(std::list<ObjectBatch>& batches)
+{
+    for(auto& batch : batches)
+    {
+        for(auto& values : batch.values)
+        {
+            for(auto value : values)
+            {
+                delete value;
+            }
+        }
+    }
+
+    batches.clear();
+}
+
+String Database::GetObjectBatchQuery(const ObjectBatch& batch,
+    bool insert, const String& quote)
+{
+    auto& columns = batch.values.front();
+
+    std::stringstream ss;
+
+    if(insert)
+    {
+        ss << "INSERT INTO " << quote << batch.metaObject->GetName() << quote
+            << " (" << quote << "UID" << quote;
+
+        for(auto value : columns)
+        {
+            ss << ", " << quote << value->GetColumn() << quote;
+        }
+
+        ss << ") VALUES ";
+
+        for(size_t i = 0; i < batch.objects.size(); i++)
+        {
+            ss << (i ? ", (?" : "(?");
+
+            for(size_t j = 0; j < columns.size(); j++)
+            {
+                ss << ", ?";
+            }
+
+            ss << ")";
+        }
+    }
+    else
+    {
+        ss << "UPDATE " << quote << batch.metaObject->GetName() << quote
+            << " SET ";
+
+        for(size_t j = 0; j < columns.size(); j++)
+        {
+            ss << (j ? ", " : "") << quote << columns[j]->GetColumn()
+                << quote << " = CASE " << quote << "UID" << quote;
+
+            for(size_t i = 0; i < batch.objects.size(); i++)
+            {
+                ss << " WHEN ? THEN ?";
+            }
+
+            ss << " END";
+        }
+
+        ss << " WHERE " << quote << "UID" << quote << " IN (";
+
+        for(size_t i = 0; i < batch.objects.size(); i++)
+        {
+            ss << (i ? ", ?" : "?");
+        }
+
+        ss << ")";
+    }
+
+    ss << ";";
+
+    return ss.str();
+}
+
+bool Database::BindObjectBatch(DatabaseQuery& query,
+    const ObjectBatch& batch, bool insert, size_t firstIndex,
+    String& failedColumn)
+{
+    size_t idx = firstIndex;
+
+    if(insert)
+    {
+        for(size_t i = 0; i < batch.objects.size(); i++)
+        {
+            if(!query.Bind(idx++, batch.objects[i]->GetUUID()))
+            {
+                failedColumn = "UID";
+
+                return false;
+            }
+
+            for(auto value : batch.values[i])
+            {
+                if(!value->Bind(query, idx++))
+                {
+                    failedColumn = value->GetColumn();
+
+                    return false;
+                }
+            }
+        }
+    }
+    else
+    {
+        size_t columnCount = batch.values.front().size();
+
+        for(size_t j = 0; j < columnCount; j++)
+        {
+            for(size_t i = 0; i < batch.objects.size(); i++)
+            {
+                auto value = batch.values[i][j];
+
+                if(!query.Bind(idx++, batch.objects[i]->GetUUID()))
+                {
+                    failedColumn = "UID";
+
+                    return false;
+                }
+
+                if(!value->Bind(query, idx++))
+                {
+                    failedColumn = value->GetColumn();
+
+                    return false;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < batch.objects.size(); i++)
+        {
+            if(!query.Bind(idx++, batch.objects[i]->GetUUID()))
+            {
+                failedColumn = "UID";
+
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 bool Database::ApplyMigration(const std::shared_ptr<BaseServer>& server,
     DataStore *pDataStore, const libcomp::String& migration,
     const libcomp::String& path)
@@ -320,8 +842,9 @@ bool Database::ApplyMigration(const std::shared_ptr<BaseServer>& server,
     // Zero the string.
     script.push_back(0);
 
-    // Create the script engine.
+    // Create the script engine. Migrations may take as long as they need.
     auto engine = std::make_shared<ScriptEngine>();
+    engine->SetCallBudget(0, 0);
 
     // Parse the script.
     if(!engine->Eval(&script[0], path))
@@ -341,6 +864,9 @@ bool Database::ApplyMigration(const std::shared_ptr<BaseServer>& server,
     auto ref = Sqrat::RootTable(engine->GetVM()).GetFunction(
         "up").Evaluate<bool>(shared_from_this(), server);
 
+    // The migration may have changed the schema.
+    ClearStatementCache();
+
     if(!ref || !(*ref))
     {
         LogDatabaseError([&]()
@@ -34,8 +34,14 @@
 #include "DatabaseConfig.h"
 #include "DatabaseQuery.h"
 #include "DatabaseChangeSet.h"
+#include "DatabaseStatementCache.h"
 #include "PersistentObject.h"
 
+// Standard C++11 Includes
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
 namespace libcomp
 {
 
@@ -54,6 +60,40 @@ class DataStore;
 class Database : public std::enable_shared_from_this<Database>
 {
 public:
+    /**
+     * Counters for the write-behind queue (see @ref StartWriteBehind).
+     */
+    struct WriteBehindStats
+    {
+        /// Number of inserts, updates and deletes waiting in the queue.
+        uint64_t queueDepth;
+
+        /// Number of inserts, updates and deletes queued.
+        uint64_t queued;
+
+        /// Number of queued changes dropped because the same change to the
+        /// same object was already in the queue.
+        uint64_t coalesced;
+
+        /// Number of times the queue was processed.
+        uint64_t flushes;
+
+        /// Number of transactions that failed to process.
+        uint64_t failures;
+
+        /// Number of times a caller had to wait because the queue was full.
+        uint64_t blocked;
+
+        /// Time taken to process the queue the last time (microseconds).
+        uint64_t lastFlushLatency;
+
+        /// Longest time taken to process the queue (microseconds).
+        uint64_t maxFlushLatency;
+
+        /// Total time taken to process the queue (microseconds).
+        uint64_t totalFlushLatency;
+    };
+
     /**
      * Create a new Database connection.
      * @param config Pointer to a database configuration
@@ -169,6 +209,25 @@ public:
      */
     virtual bool UpdateSingleObject(std::shared_ptr<PersistentObject>& obj) = 0;
 
+    /**
+     * Insert multiple @ref PersistentObject instances into the database.
+     * Objects of the same type are inserted together in batches.
+     * @param objs List of pointers to the objects to insert
+     * @return true on success, false on failure
+     */
+    virtual bool InsertObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs) = 0;
+
+    /**
+     * Update the changed fields on multiple @ref PersistentObject
+     * instances in the database. Objects of the same type with the same
+     * fields changed are updated together in batches.
+     * @param objs List of pointers to the objects to update
+     * @return true on success, false on failure
+     */
+    virtual bool UpdateObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs) = 0;
+
     /**
      * Delete one @ref PersistentObject instance from the database.
      * @param obj Pointer to the object to delete
@@ -244,6 +303,44 @@ public:
      */
     std::list<libobjgen::UUID> ProcessTransactionQueue();
 
+    /**
+     * Start a thread that processes the transaction queue in the
+     * background. The queue is processed when it has WriteBehindFlushSize
+     * changes in it or when the oldest change has been waiting for
+     * WriteBehindFlushInterval milliseconds. Callers queueing changes wait
+     * while the queue has WriteBehindMaxQueueSize changes or more (0 for no
+     * limit). Transactions that fail are logged.
+     *
+     * Queued objects are read on the write-behind thread when the queue is
+     * processed, not when they are queued, so the values written are the
+     * ones current at that time. The generated setters and
+     * GetMemberBindValues share the field lock of each object so an object
+     * may keep being changed while it is queued. A change made after its
+     * fields were read stays dirty for the next update.
+     *
+     * This is off unless started. BaseServer::GetDatabase starts it when
+     * WriteBehind is set in the DatabaseConfig. Anything else that opens a
+     * database has to call this itself.
+     * @return true if the thread was started, false if it was already
+     *  running
+     */
+    bool StartWriteBehind();
+
+    /**
+     * Stop the write-behind thread and process anything left in the
+     * transaction queue. This must be called before the database
+     * connection is closed. Derived classes should call this from their
+     * destructor (usually by closing) since the queue can't be written once
+     * only the base class is left.
+     */
+    void StopWriteBehind();
+
+    /**
+     * Get the counters for the transaction queue.
+     * @return Counters for the transaction queue
+     */
+    WriteBehindStats GetWriteBehindStats();
+
     /**
      * Process one or many database changes as a single transaction.
      * @param changes Grouping of changes to apply to the database
@@ -271,7 +368,90 @@ public:
      */
     std::shared_ptr<objects::DatabaseConfig> GetConfig() const;
 
+    /**
+     * Finalize the prepared statements cached for all connections. This
+     * must be done when the schema of the database changes.
+     */
+    void ClearStatementCache();
+
+    /**
+     * Get the counters for the prepared statement caches of all
+     * connections (including connections that have been closed).
+     * @return Counters for the prepared statement caches
+     */
+    DatabaseStatementCache::Stats GetStatementCacheStats();
+
 protected:
+    /**
+     * Objects of the same type with the same columns to write that are
+     * written to the database by a single statement.
+     */
+    struct ObjectBatch
+    {
+        /// Definition of the object type
+        std::shared_ptr<libobjgen::MetaObject> metaObject;
+
+        /// Objects to write
+        std::vector<std::shared_ptr<PersistentObject>> objects;
+
+        /// Values to bind for each object (in the same order as objects)
+        std::vector<std::vector<DatabaseBind*>> values;
+
+        /// Key of the statement for a single object (see
+        /// @ref GetStatementKey)
+        std::string key;
+
+        /// Maximum number of objects in a batch with this key
+        size_t maxSize;
+    };
+
+    /**
+     * Group objects to insert or update into batches. Objects that have no
+     * changes to update are skipped. The bind values in the batches must be
+     * freed with @ref FreeObjectBatches.
+     * @param objs Objects to group
+     * @param insert true if the objects will be inserted, false if they
+     *  will be updated
+     * @param batches Output list of batches (in the order the first object
+     *  of each batch appears)
+     * @return false if any of the objects can't be saved
+     */
+    bool GetObjectBatches(
+        const std::list<std::shared_ptr<PersistentObject>>& objs,
+        bool insert, std::list<ObjectBatch>& batches);
+
+    /**
+     * Free the bind values of batches built by @ref GetObjectBatches.
+     * @param batches Batches to free
+     */
+    static void FreeObjectBatches(std::list<ObjectBatch>& batches);
+
+    /**
+     * Build the query to insert or update a batch of objects. Each value is
+     * bound by index in the order used by @ref BindObjectBatch.
+     * @param batch Batch of objects
+     * @param insert true to insert the objects, false to update them
+     * @param quote Character used to quote table and column names
+     * @return Query text
+     */
+    static String GetObjectBatchQuery(const ObjectBatch& batch,
+        bool insert, const String& quote);
+
+    /**
+     * Bind the values of a batch of objects to a query built by
+     * @ref GetObjectBatchQuery.
+     * @param query Query to bind the values to
+     * @param batch Batch of objects
+     * @param insert true if the query inserts the objects, false if it
+     *  updates them
+     * @param firstIndex Index of the first parameter of the query
+     * @param failedColumn Output name of the column that failed to bind
+     * @return true on success, false on failure
+     */
+    static bool BindObjectBatch(DatabaseQuery& query,
+        const ObjectBatch& batch, bool insert, size_t firstIndex,
+        String& failedColumn);
+
     /**
      * Get a pointer to a new @ref PersistentObject of the specified
      * type populated with the current row being read from a database
@@ -307,6 +487,39 @@ protected:
      */
     std::vector<std::shared_ptr<libobjgen::MetaObject>> GetMappedObjects();
 
+    /**
+     * Get a prepared query from the statement cache of a connection or
+     * prepare a new one if the cache does not have it. The query returns
+     * to the cache when it is destroyed.
+     * @param pConnection Connection the query will run on
+     * @param sessionID ID of the current session of the connection. The
+     *  statements cached for the connection are dropped if this changes.
+     * @param key Key of the statement (see @ref GetStatementKey)
+     * @param getQuery Function to build the query text if the statement
+     *  needs to be prepared
+     * @return Prepared query
+     */
+    DatabaseQuery PrepareCached(void *pConnection, uint64_t sessionID,
+        const std::string& key, const std::function<String()>& getQuery);
+
+    /**
+     * Finalize the prepared statements cached for a connection. This must
+     * be done before the connection is closed.
+     * @param pConnection Connection to remove the statement cache for
+     */
+    void RemoveStatementCache(void *pConnection);
+
+    /**
+     * Build the key of a prepared statement for an object type.
+     * @param operation Character identifying the type of statement
+     * @param metaObject Definition of the object type
+     * @param values Values bound by the statement (in order)
+     * @return Key of the statement
+     */
+    static std::string GetStatementKey(char operation,
+        const libobjgen::MetaObject& metaObject,
+        const std::list<DatabaseBind*>& values);
+
     /// Last error raised by a database related action
     String mError;
 
@@ -314,12 +527,48 @@ protected:
     std::shared_ptr<objects::DatabaseConfig> mConfig;
 
 private:
+    /**
+     * Process the transaction queue from the write-behind thread until it
+     * is stopped.
+     */
+    void RunWriteBehind();
+
     /// Map of transaction pointers by UUID
     std::unordered_map<std::string,
         std::shared_ptr<DBStandardChangeSet>> mTransactionQueue;
 
     /// Mutex to lock accessing the transaction queue
     std::mutex mTransactionLock;
+
+    /// Signaled when changes are queued or the transaction queue is taken
+    /// for processing
+    std::condition_variable mTransactionCondition;
+
+    /// Number of changes in the transaction queue
+    size_t mTransactionQueueSize;
+
+    /// Time the oldest change in the transaction queue was queued
+    std::chrono::steady_clock::time_point mTransactionQueueTime;
+
+    /// Thread processing the transaction queue in the background
+    std::thread mWriteBehindThread;
+
+    /// Indicates if the write-behind thread should keep running
+    bool mWriteBehindRunning;
+
+    /// Counters for the transaction queue (queue depth is filled in by
+    /// @ref GetWriteBehindStats)
+    WriteBehindStats mWriteBehindStats;
+
+    /// Prepared statement cache for each connection
+    std::unordered_map<void*,
+        std::shared_ptr<DatabaseStatementCache>> mStatementCaches;
+
+    /// Counters for the statement caches of connections that were closed
+    DatabaseStatementCache::Stats mClosedStatementCacheStats;
+
+    /// Mutex to lock accessing the statement caches
+    std::mutex mStatementCacheLock;
 };
 
 } // namespace libcomp
@@ -73,28 +73,35 @@ DBStandardChangeSet::~DBStandardChangeSet()
 
 void DBStandardChangeSet::Insert(const std::shared_ptr<PersistentObject>& obj)
 {
-    if(obj)
+    if(obj && mInsertSet.insert(obj).second)
     {
         mInserts.push_back(obj);
-        mInserts.unique();
     }
 }
 
 void DBStandardChangeSet::Update(const std::shared_ptr<PersistentObject>& obj)
 {
-    if(obj)
+    // Each object is only updated once with all of the fields that changed
+    // since it was last saved. Inserts are processed first and save every
+    // field so an update is not needed for them either, nor is one needed
+    // for an object being deleted.
+    if(obj && !mInsertSet.count(obj) && !mDeleteSet.count(obj) &&
+        mUpdateSet.insert(obj).second)
     {
         mUpdates.push_back(obj);
-        mUpdates.unique();
     }
 }
 
 void DBStandardChangeSet::Delete(const std::shared_ptr<PersistentObject>& obj)
 {
-    if(obj)
+    if(obj && mDeleteSet.insert(obj).second)
     {
         mDeletes.push_back(obj);
-        mDeletes.unique();
+
+        if(mUpdateSet.erase(obj))
+        {
+            mUpdates.remove(obj);
+        }
     }
 }
 
@@ -113,6 +120,11 @@ std::list<std::shared_ptr<PersistentObject>> DBStandardChangeSet::GetDeletes() c
     return mDeletes;
 }
 
+size_t DBStandardChangeSet::GetChangeCount() const
+{
+    return mInserts.size() + mUpdates.size() + mDeletes.size();
+}
+
 DBOperationalChange::DBOperationalChange(const std::shared_ptr<PersistentObject>& record,
     DBOperationType type)
     : mType(type), mRecord(record)
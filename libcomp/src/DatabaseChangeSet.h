@@ -37,6 +37,9 @@
 #include "MetaObject.h"
 #include "MetaVariable.h"
 
+// Standard C++11 Includes
+#include <unordered_set>
+
 namespace libcomp
 {
 
@@ -175,6 +178,12 @@ public:
      */
     std::list<std::shared_ptr<PersistentObject>> GetDeletes() const;
 
+    /**
+     * Get the number of inserts, updates and deletes in the change set
+     * @return Number of changes in the change set
+     */
+    size_t GetChangeCount() const;
+
 private:
     /// Inserts associated to the change set
     std::list<std::shared_ptr<PersistentObject>> mInserts;
@@ -184,6 +193,15 @@ private:
 
     /// Deletes associated to the change set
     std::list<std::shared_ptr<PersistentObject>> mDeletes;
+
+    /// Objects in mInserts used to skip repeated changes
+    std::unordered_set<std::shared_ptr<PersistentObject>> mInsertSet;
+
+    /// Objects in mUpdates used to skip repeated changes
+    std::unordered_set<std::shared_ptr<PersistentObject>> mUpdateSet;
+
+    /// Objects in mDeletes used to skip repeated changes
+    std::unordered_set<std::shared_ptr<PersistentObject>> mDeleteSet;
 };
 
 /**
@@ -41,6 +41,10 @@
 // MariaDB Includes
 #include <mysql.h>
 
+// Standard C++11 Includes
+#include <algorithm>
+#include <chrono>
+
 using namespace libcomp;
 
 static libcomp::String ConnectionString(MYSQL *pConnection)
@@ -50,10 +54,24 @@ static libcomp::String ConnectionString(MYSQL *pConnection)
         (uint32_t)((uint64_t)pConnection), 8, 16, '0');
 }
 
+static int64_t PoolTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 DatabaseMariaDB::DatabaseMariaDB(const std::shared_ptr<
     objects::DatabaseConfigMariaDB>& config) :
-    Database(std::dynamic_pointer_cast<objects::DatabaseConfig>(config))
+    Database(std::dynamic_pointer_cast<objects::DatabaseConfig>(config)),
+    mMariaDBConfig(config), mOpen(false), mDatabaseSelected(false),
+    mConnectionWaiters(0), mNextReap(0), mFastCheckouts(0),
+    mAsyncRunning(false), mAsyncClosing(false), mAsyncCompleted(0)
 {
+    static std::atomic<uint64_t> nextPoolID(1);
+
+    mPoolID = nextPoolID++;
+
+    memset(&mPoolStats, 0, sizeof(mPoolStats));
 }
 
 DatabaseMariaDB::~DatabaseMariaDB()
@@ -63,27 +81,80 @@ DatabaseMariaDB::~DatabaseMariaDB()
 
 bool DatabaseMariaDB::Open()
 {
-    return ConnectToDatabase(GetConnection(false), "");
+    // Connections do not select the database until it has been set up.
+    mDatabaseSelected = false;
+    mOpen = true;
+
+    {
+        std::lock_guard<std::mutex> lock(mAsyncLock);
+
+        mAsyncClosing = false;
+    }
+
+    if(nullptr == GetConnection())
+    {
+        mOpen = false;
+
+        return false;
+    }
+
+    return true;
 }
 
 bool DatabaseMariaDB::Close()
 {
+    // Queued changes and work need the connections to be written.
+    StopWriteBehind();
+    StopAsync();
+
+    mOpen = false;
+    mDatabaseSelected = false;
+
+    std::list<MYSQL*> connections;
+
+    {
+        std::lock_guard<std::mutex> lock(mConnectionLock);
+
+        for(auto it = mConnections.begin(); it != mConnections.end();)
+        {
+            int state = POOLED_CONNECTION_IDLE;
+
+            // Connections checked out are closed when they are returned.
+            if((*it)->state.compare_exchange_strong(state,
+                POOLED_CONNECTION_CLOSED))
+            {
+                connections.push_back((*it)->handle);
+                (*it)->handle = nullptr;
+
+                it = mConnections.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+
+        // Anything waiting on a connection should give up.
+        mConnectionCondition.notify_all();
+    }
+
     bool result = true;
 
-    std::lock_guard<std::mutex> lock(mConnectionLock);
-    for(auto kv : mConnections)
+    for(auto connection : connections)
     {
-        result &= Close(kv.second);
+        result &= Close(connection);
     }
-    mConnections.clear();
 
     return result;
 }
 
 bool DatabaseMariaDB::Close(MYSQL*& connection)
 {
-    if(nullptr != connection && nullptr != connection)
+    if(nullptr != connection)
     {
+        // Statements must be closed before the connection they belong to.
+        RemoveStatementCache(connection);
+
         mysql_close(connection);
 
         LogDatabaseDebug([&]()
@@ -108,13 +179,13 @@ bool DatabaseMariaDB::Close(MYSQL*& connection)
 
 bool DatabaseMariaDB::IsOpen() const
 {
-    // Connections are only added when they are valid
-    return mConnections.size() > 0;
+    return mOpen;
 }
 
 DatabaseQuery DatabaseMariaDB::Prepare(const String& query)
 {
-    auto connection = GetConnection(true);
+    // The query keeps the connection checked out until it is done.
+    auto connection = GetConnection();
     return DatabaseQuery(new DatabaseQueryMariaDB(connection), query);
 }
 
@@ -122,8 +193,7 @@ bool DatabaseMariaDB::Exists()
 {
     DatabaseQuery q = Prepare(String(
         "SELECT 1 FROM information_schema.TABLES WHERE TABLE_SCHEMA = '%1';")
-        .Arg(std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(
-            mConfig)->GetDatabaseName()));
+        .Arg(mMariaDBConfig->GetDatabaseName()));
 
     if(!q.Execute())
     {
@@ -153,8 +223,7 @@ bool DatabaseMariaDB::Setup(bool rebuild,
         return false;
     }
 
-    auto databaseName = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(
-        mConfig)->GetDatabaseName();
+    auto databaseName = mMariaDBConfig->GetDatabaseName();
     if(!Exists())
     {
         // Delete the old database if it exists.
@@ -310,10 +379,69 @@ bool DatabaseMariaDB::Setup(bool rebuild,
 
 bool DatabaseMariaDB::Use()
 {
-    // USE not supported so close the connection and re-open
-    auto config = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(mConfig);
+    auto& config = mMariaDBConfig;
+
+    // New connections connect to the database directly and pooled ones
+    // select it the next time they are checked out.
+    mDatabaseSelected = true;
 
-    return ConnectToDatabase(GetConnection(false), config->GetDatabaseName());
+    auto lease = GetConnection();
+    auto connection = GetThreadConnection().last.lock();
+    if(nullptr == lease || nullptr == connection)
+    {
+        return false;
+    }
+
+    // The executing thread may have had its connection checked out
+    // already so make sure it uses the database too.
+    if(!connection->databaseSelected)
+    {
+        if(mysql_select_db(lease.get(), config->GetDatabaseName().C()))
+        {
+            LogDatabaseError([&]()
+            {
+                return String("Failed to select database: %1\n")
+                    .Arg(GetLastError(lease.get()));
+            });
+
+            return false;
+        }
+
+        connection->databaseSelected = true;
+    }
+
+    // Open connections up to the minimum pool size.
+    size_t minConnections = config->GetMinConnections();
+    if(config->GetMaxConnections())
+    {
+        minConnections = std::min(minConnections,
+            (size_t)config->GetMaxConnections());
+    }
+
+    std::list<std::shared_ptr<PooledConnection>> connections;
+
+    while(GetConnectionPoolStats().open < minConnections)
+    {
+        connection = CheckoutConnection();
+        if(nullptr == connection)
+        {
+            break;
+        }
+
+        connections.push_back(connection);
+
+        if(!PrepareConnection(*connection))
+        {
+            break;
+        }
+    }
+
+    for(auto& c : connections)
+    {
+        ReleaseConnection(c);
+    }
+
+    return true;
 }
 
 std::list<std::shared_ptr<PersistentObject>> DatabaseMariaDB::LoadObjects(
@@ -330,19 +458,28 @@ std::list<std::shared_ptr<PersistentObject>> DatabaseMariaDB::LoadObjects(
         return {};
     }
 
-    String sql = String("SELECT * FROM `%1`%2").Arg(
-        metaObject->GetName()).Arg(
-        (nullptr != pValue
-            ? String(" WHERE `%1` = :%1").Arg(pValue->GetColumn())
-            : ""));
+    auto getQuery = [&]()
+    {
+        return String("SELECT * FROM `%1`%2").Arg(
+            metaObject->GetName()).Arg(
+            (nullptr != pValue
+                ? String(" WHERE `%1` = :%1").Arg(pValue->GetColumn())
+                : ""));
+    };
 
-    DatabaseQuery query = Prepare(sql);
+    auto lease = GetConnection();
+    auto connection = lease.get();
+
+    DatabaseQuery query = PrepareCached(connection, GetSessionID(connection),
+        GetStatementKey('S', *metaObject, nullptr != pValue
+        ? std::list<DatabaseBind*>{ pValue } : std::list<DatabaseBind*>()),
+        getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -373,7 +510,7 @@ std::list<std::shared_ptr<PersistentObject>> DatabaseMariaDB::LoadObjects(
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -416,8 +553,7 @@ bool DatabaseMariaDB::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
 {
     auto metaObject = obj->GetObjectMetadata();
 
-    std::stringstream objstream;
-    if(!obj->Save(objstream))
+    if(!obj->CanSave())
     {
         return false;
     }
@@ -427,33 +563,40 @@ bool DatabaseMariaDB::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
         return false;
     }
 
-    std::list<String> columnNames;
-    columnNames.push_back("`UID`");
-
-    std::list<String> columnBinds;
-    columnBinds.push_back(":UID");
-
     auto values = obj->GetMemberBindValues(true);
 
-    for(auto value : values)
+    auto getQuery = [&]()
     {
-        auto columnName = value->GetColumn();
-        columnNames.push_back(String("`%1`").Arg(columnName));
-        columnBinds.push_back(String(":%1").Arg(columnName));
-    }
+        std::list<String> columnNames;
+        columnNames.push_back("`UID`");
+
+        std::list<String> columnBinds;
+        columnBinds.push_back(":UID");
+
+        for(auto value : values)
+        {
+            auto columnName = value->GetColumn();
+            columnNames.push_back(String("`%1`").Arg(columnName));
+            columnBinds.push_back(String(":%1").Arg(columnName));
+        }
+
+        return String("INSERT INTO `%1` (%2) VALUES (%3);").Arg(
+            metaObject->GetName()).Arg(
+            String::Join(columnNames, ", ")).Arg(
+            String::Join(columnBinds, ", "));
+    };
 
-    String sql = String("INSERT INTO `%1` (%2) VALUES (%3);").Arg(
-        metaObject->GetName()).Arg(
-        String::Join(columnNames, ", ")).Arg(
-        String::Join(columnBinds, ", "));
+    auto lease = GetConnection();
+    auto connection = lease.get();
 
-    DatabaseQuery query = Prepare(sql);
+    DatabaseQuery query = PrepareCached(connection, GetSessionID(connection),
+        GetStatementKey('I', *metaObject, values), getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -491,36 +634,43 @@ bool DatabaseMariaDB::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
                 return String("Database said: %1\n").Arg(GetLastError());
             });
 
+            for(auto v : values)
+            {
+                delete v;
+            }
+
             return false;
         }
-
-        delete value;
     }
 
-    if(!query.Execute())
+    bool result = query.Execute();
+
+    if(!result)
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
         {
             return String("Database said: %1\n").Arg(GetLastError());
         });
+    }
 
-        return false;
+    for(auto value : values)
+    {
+        delete value;
     }
 
-    return true;
+    return result;
 }
 
 bool DatabaseMariaDB::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
 {
     auto metaObject = obj->GetObjectMetadata();
 
-    std::stringstream objstream;
-    if(!obj->Save(objstream))
+    if(!obj->CanSave())
     {
         return false;
     }
@@ -537,24 +687,32 @@ bool DatabaseMariaDB::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
         return true;
     }
 
-    std::list<String> columnNames;
-
-    for(auto value : values)
+    auto getQuery = [&]()
     {
-        columnNames.push_back(String("`%1` = :%1").Arg(value->GetColumn()));
-    }
+        std::list<String> columnNames;
 
-    String sql = String("UPDATE `%1` SET %2 WHERE `UID` = :UID;").Arg(
-        metaObject->GetName()).Arg(
-        String::Join(columnNames, ", "));
+        for(auto value : values)
+        {
+            columnNames.push_back(String("`%1` = :%1").Arg(
+                value->GetColumn()));
+        }
 
-    DatabaseQuery query = Prepare(sql);
+        return String("UPDATE `%1` SET %2 WHERE `UID` = :UID;").Arg(
+            metaObject->GetName()).Arg(
+            String::Join(columnNames, ", "));
+    };
+
+    auto lease = GetConnection();
+    auto connection = lease.get();
+
+    DatabaseQuery query = PrepareCached(connection, GetSessionID(connection),
+        GetStatementKey('U', *metaObject, values), getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -592,17 +750,147 @@ bool DatabaseMariaDB::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
                 return String("Database said: %1\n").Arg(GetLastError());
             });
 
+            for(auto v : values)
+            {
+                delete v;
+            }
+
             return false;
         }
+    }
+
+    bool result = query.Execute();
+
+    if(!result)
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to execute query: %1\n").Arg(getQuery());
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+    }
 
+    for(auto value : values)
+    {
         delete value;
     }
 
+    return result;
+}
+
+bool DatabaseMariaDB::InsertObjects(
+    std::list<std::shared_ptr<PersistentObject>>& objs)
+{
+    std::list<ObjectBatch> batches;
+
+    if(!GetObjectBatches(objs, true, batches))
+    {
+        return false;
+    }
+
+    bool result = true;
+
+    for(auto& batch : batches)
+    {
+        if(!ExecuteObjectBatch(batch, true))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    FreeObjectBatches(batches);
+
+    return result;
+}
+
+bool DatabaseMariaDB::UpdateObjects(
+    std::list<std::shared_ptr<PersistentObject>>& objs)
+{
+    std::list<ObjectBatch> batches;
+
+    if(!GetObjectBatches(objs, false, batches))
+    {
+        return false;
+    }
+
+    bool result = true;
+
+    for(auto& batch : batches)
+    {
+        if(!ExecuteObjectBatch(batch, false))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    FreeObjectBatches(batches);
+
+    return result;
+}
+
+bool DatabaseMariaDB::ExecuteObjectBatch(const ObjectBatch& batch, bool insert)
+{
+    auto getQuery = [&]()
+    {
+        return GetObjectBatchQuery(batch, insert, "`");
+    };
+
+    // Only cache the statements for a single object and for full batches
+    // so the odd sized batches left over don't push them out of the cache.
+    size_t count = batch.objects.size();
+    bool cache = 1 == count || batch.maxSize == count;
+
+    std::string key = batch.key + "#" + std::to_string(count);
+
+    auto lease = GetConnection();
+    auto connection = lease.get();
+
+    DatabaseQuery query = cache ? PrepareCached(connection,
+        GetSessionID(connection), key, getQuery) : Prepare(getQuery());
+
+    if(!query.IsValid())
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+
+        return false;
+    }
+
+    String failedColumn;
+
+    if(!BindObjectBatch(query, batch, insert, 0, failedColumn))
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to bind value: %1\n").Arg(failedColumn);
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+
+        return false;
+    }
+
     if(!query.Execute())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -626,11 +914,15 @@ bool DatabaseMariaDB::DeleteObjects(std::list<std::shared_ptr<PersistentObject>>
         metaObjectMap[metaObj].push_back(obj);
     }
 
+    size_t batchSize = std::max<size_t>(1,
+        mConfig->GetChangeSetBatchSize());
+
     for(auto mPair : metaObjectMap)
     {
         auto metaObject = mPair.first;
 
         std::list<String> uidBindings;
+        size_t remaining = mPair.second.size();
         for(auto obj : mPair.second)
         {
             auto uuid = obj->GetUUID();
@@ -643,13 +935,22 @@ bool DatabaseMariaDB::DeleteObjects(std::list<std::shared_ptr<PersistentObject>>
 
             std::string uuidStr = obj->GetUUID().ToString();
             uidBindings.push_back(String("'%1'").Arg(uuidStr));
-        }
 
-        if(!Execute(String("DELETE FROM `%1` WHERE `UID` in (%2);")
-            .Arg(metaObject->GetName())
-            .Arg(String::Join(uidBindings, ", "))))
-        {
-            return false;
+            remaining--;
+
+            if(uidBindings.size() < batchSize && remaining)
+            {
+                continue;
+            }
+
+            if(!Execute(String("DELETE FROM `%1` WHERE `UID` in (%2);")
+                .Arg(metaObject->GetName())
+                .Arg(String::Join(uidBindings, ", "))))
+            {
+                return false;
+            }
+
+            uidBindings.clear();
         }
     }
 
@@ -664,8 +965,7 @@ bool DatabaseMariaDB::VerifyAndSetupSchema(bool recreateTables)
         return true;
     }
 
-    auto databaseName = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(
-        mConfig)->GetDatabaseName();
+    auto databaseName = mMariaDBConfig->GetDatabaseName();
 
     LogDatabaseInfoMsg("Verifying database table structure.\n");
 
@@ -1023,6 +1323,9 @@ bool DatabaseMariaDB::VerifyAndSetupSchema(bool recreateTables)
         }
     }
 
+    // Statements prepared before the tables changed can't be used anymore.
+    ClearStatementCache();
+
     LogDatabaseInfoMsg("Database verification complete.\n");
 
     return true;
@@ -1031,7 +1334,8 @@ bool DatabaseMariaDB::VerifyAndSetupSchema(bool recreateTables)
 bool DatabaseMariaDB::ProcessStandardChangeSet(const std::shared_ptr<
     DBStandardChangeSet>& changes)
 {
-    auto connection = GetConnection(true);
+    auto lease = GetConnection();
+    auto connection = lease.get();
     if(connection == nullptr)
     {
         return false;
@@ -1055,25 +1359,17 @@ bool DatabaseMariaDB::ProcessStandardChangeSet(const std::shared_ptr<
     }
 
     bool result = true;
-    for(auto obj : changes->GetInserts())
+
+    auto inserts = changes->GetInserts();
+    if(inserts.size())
     {
-        if(!InsertSingleObject(obj))
-        {
-            result = false;
-            break;
-        }
+        result = InsertObjects(inserts);
     }
 
-    if(result)
+    auto updates = changes->GetUpdates();
+    if(result && updates.size())
     {
-        for(auto obj : changes->GetUpdates())
-        {
-            if(!UpdateSingleObject(obj))
-            {
-                result = false;
-                break;
-            }
-        }
+        result = UpdateObjects(updates);
     }
 
     auto deletes = changes->GetDeletes();
@@ -1142,7 +1438,8 @@ bool DatabaseMariaDB::ProcessStandardChangeSet(const std::shared_ptr<
 bool DatabaseMariaDB::ProcessOperationalChangeSet(const std::shared_ptr<
     DBOperationalChangeSet>& changes)
 {
-    auto connection = GetConnection(true);
+    auto lease = GetConnection();
+    auto connection = lease.get();
     if(connection == nullptr)
     {
         return false;
@@ -1278,10 +1575,11 @@ bool DatabaseMariaDB::ProcessExplicitUpdate(const std::shared_ptr<
         return false;
     }
 
-    size_t idx = 0;
-    std::list<String> updateClause;
-    std::list<String> whereClause;
-    // Bind the update clause values
+    // The statement binds the columns in the order of the map so the key
+    // must list them in the same order.
+    std::string key("X");
+    key += obj->GetObjectMetadata()->GetName();
+
     for(auto cPair : changedVals)
     {
         auto it = expectedVals.find(cPair.first);
@@ -1290,29 +1588,48 @@ bool DatabaseMariaDB::ProcessExplicitUpdate(const std::shared_ptr<
             return false;
         }
 
-        updateClause.push_back(String("`%1` = :%2").Arg(cPair.first).Arg(idx++));
+        key += ',';
+        key += cPair.first;
     }
 
-    auto uidIdx = idx++;
-
-    // Now bind the where clause values
-    for(auto cPair : changedVals)
+    auto getQuery = [&]()
     {
-        whereClause.push_back(String("`%1` = :%2").Arg(cPair.first).Arg(idx++));
-    }
+        size_t idx = 0;
+        std::list<String> updateClause;
+        std::list<String> whereClause;
+        // Bind the update clause values
+        for(auto cPair : changedVals)
+        {
+            updateClause.push_back(String("`%1` = :%2").Arg(cPair.first).Arg(
+                idx++));
+        }
 
-    String sql = String("UPDATE `%1` SET %2 WHERE `UID` = :%3 AND %4;").Arg(
-        obj->GetObjectMetadata()->GetName()).Arg(
-        String::Join(updateClause, ", ")).Arg(uidIdx).Arg(
-        String::Join(whereClause, " AND "));
+        auto uidIdx = idx++;
 
-    DatabaseQuery query = Prepare(sql);
+        // Now bind the where clause values
+        for(auto cPair : changedVals)
+        {
+            whereClause.push_back(String("`%1` = :%2").Arg(cPair.first).Arg(
+                idx++));
+        }
+
+        return String("UPDATE `%1` SET %2 WHERE `UID` = :%3 AND %4;").Arg(
+            obj->GetObjectMetadata()->GetName()).Arg(
+            String::Join(updateClause, ", ")).Arg(uidIdx).Arg(
+            String::Join(whereClause, " AND "));
+    };
+
+    auto lease = GetConnection();
+    auto connection = lease.get();
+
+    DatabaseQuery query = PrepareCached(connection, GetSessionID(connection),
+        key, getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -1323,7 +1640,7 @@ bool DatabaseMariaDB::ProcessExplicitUpdate(const std::shared_ptr<
         return false;
     }
 
-    idx = 0;
+    size_t idx = 0;
     for(auto cPair : changedVals)
     {
         if(!cPair.second->Bind(query, idx++))
@@ -1377,7 +1694,7 @@ bool DatabaseMariaDB::ProcessExplicitUpdate(const std::shared_ptr<
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -1403,20 +1720,20 @@ bool DatabaseMariaDB::ConnectToDatabase(MYSQL*& connection, const libcomp::Strin
         return false;
     }
 
-    auto config = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(mConfig);
+    auto& config = mMariaDBConfig;
     auto hostIP = config->GetIP();
     auto username = config->GetUsername();
     auto password = config->GetPassword();
 
-    connection = mysql_real_connect(connection,
+    // The handle must still be closed if the connection fails.
+    if(NULL == mysql_real_connect(connection,
         (!hostIP.IsEmpty() ? hostIP.C() : "localhost"),
         (!username.IsEmpty() ? username.C() : NULL),
         (!password.IsEmpty() ? password.C() : NULL),
         (!databaseName.IsEmpty() ? databaseName.C() : NULL),
         config->GetPort(),
         NULL,
-        0);
-    if(connection == NULL)
+        0))
     {
         LogDatabaseErrorMsg("Failed to open database connection\n");
 
@@ -1457,24 +1774,326 @@ bool DatabaseMariaDB::ConnectToDatabase(MYSQL*& connection, const libcomp::Strin
     return true;
 }
 
-MYSQL*& DatabaseMariaDB::GetConnection(bool autoConnect)
+uint64_t DatabaseMariaDB::GetSessionID(MYSQL *connection)
 {
-    auto threadID = std::this_thread::get_id();
-    std::lock_guard<std::mutex> lock(mConnectionLock);
-    if(mConnections.find(threadID) == mConnections.end())
+    // This changes when the connection reconnects which drops the
+    // statements prepared on the server.
+    return nullptr != connection ? (uint64_t)mysql_thread_id(connection) : 0;
+}
+
+std::shared_ptr<MYSQL> DatabaseMariaDB::GetConnection()
+{
+    auto& thread = GetThreadConnection();
+
+    // Stay on the connection the thread has checked out.
+    auto lease = thread.current.lock();
+    if(nullptr != lease)
+    {
+        return lease;
+    }
+
+    if(!mOpen)
+    {
+        return nullptr;
+    }
+
+    // Take back the connection the thread used last if nothing else has.
+    int state = POOLED_CONNECTION_IDLE;
+    auto connection = thread.last.lock();
+    if(nullptr != connection && connection->state.compare_exchange_strong(
+        state, POOLED_CONNECTION_IN_USE))
+    {
+        mFastCheckouts++;
+    }
+    else
+    {
+        connection = CheckoutConnection();
+        if(nullptr == connection)
+        {
+            return nullptr;
+        }
+    }
+
+    thread.last = connection;
+
+    if(!PrepareConnection(*connection))
+    {
+        ReleaseConnection(connection);
+
+        return nullptr;
+    }
+
+    // The connection goes back to the pool when the last copy is gone.
+    lease = std::shared_ptr<MYSQL>(connection->handle,
+        [this, connection](MYSQL*)
+        {
+            ReleaseConnection(connection);
+        });
+
+    thread.current = lease;
+
+    return lease;
+}
+
+std::shared_ptr<DatabaseMariaDB::PooledConnection>
+    DatabaseMariaDB::CheckoutConnection()
+{
+    auto& config = mMariaDBConfig;
+    size_t maxConnections = config->GetMaxConnections();
+    auto timeout = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(config->GetConnectionWaitTimeout());
+
+    std::shared_ptr<PooledConnection> result;
+    bool waited = false;
+
+    std::unique_lock<std::mutex> lock(mConnectionLock);
+
+    // Count the thread as waiting before searching so a connection
+    // returned during the search is not missed.
+    mConnectionWaiters++;
+    mPoolStats.slowCheckouts++;
+
+    while(mOpen && nullptr == result)
+    {
+        for(auto& connection : mConnections)
+        {
+            int state = POOLED_CONNECTION_IDLE;
+
+            if(connection->state.compare_exchange_strong(state,
+                POOLED_CONNECTION_IN_USE))
+            {
+                result = connection;
+                break;
+            }
+        }
+
+        if(nullptr != result)
+        {
+            break;
+        }
+
+        // Connect in PrepareConnection so the lock is not held for it.
+        if(0 == maxConnections || mConnections.size() < maxConnections)
+        {
+            result = std::make_shared<PooledConnection>();
+            result->state = POOLED_CONNECTION_IN_USE;
+            result->lastUsed = PoolTime();
+
+            mConnections.push_back(result);
+            mPoolStats.created++;
+            break;
+        }
+
+        if(!waited)
+        {
+            mPoolStats.waits++;
+            waited = true;
+        }
+
+        if(std::chrono::steady_clock::now() >= timeout)
+        {
+            mPoolStats.timeouts++;
+
+            LogDatabaseError([&]()
+            {
+                return String("Timed out waiting for one of %1 database "
+                    "connections to be returned to the pool.\n")
+                    .Arg(maxConnections);
+            });
+
+            break;
+        }
+
+        mConnectionCondition.wait_until(lock, timeout);
+    }
+
+    mConnectionWaiters--;
+
+    return result;
+}
+
+bool DatabaseMariaDB::PrepareConnection(PooledConnection& connection)
+{
+    auto& config = mMariaDBConfig;
+
+    bool selectDatabase = mDatabaseSelected;
+
+    if(nullptr == connection.handle)
+    {
+        connection.databaseSelected = selectDatabase;
+
+        return ConnectToDatabase(connection.handle, selectDatabase ?
+            config->GetDatabaseName() : String());
+    }
+
+    // The server may have dropped a connection that sat in the pool.
+    int64_t idle = PoolTime() - connection.lastUsed;
+    if(idle >= (int64_t)config->GetConnectionHealthCheckInterval() &&
+        mysql_ping(connection.handle))
+    {
+        LogDatabaseDebug([&]()
+        {
+            return String("Database connection %1 failed health check: %2\n")
+                .Arg(ConnectionString(connection.handle))
+                .Arg(GetLastError(connection.handle));
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(mConnectionLock);
+            mPoolStats.failedHealthChecks++;
+        }
+
+        connection.databaseSelected = selectDatabase;
+
+        return ConnectToDatabase(connection.handle, selectDatabase ?
+            config->GetDatabaseName() : String());
+    }
+
+    if(selectDatabase && !connection.databaseSelected)
+    {
+        if(mysql_select_db(connection.handle, config->GetDatabaseName().C()))
+        {
+            LogDatabaseError([&]()
+            {
+                return String("Failed to select database: %1\n")
+                    .Arg(GetLastError(connection.handle));
+            });
+
+            return false;
+        }
+
+        connection.databaseSelected = true;
+    }
+
+    return true;
+}
+
+void DatabaseMariaDB::ReleaseConnection(
+    const std::shared_ptr<PooledConnection>& connection)
+{
+    // Keep the error for GetLastError after the connection is returned.
+    auto& thread = GetThreadConnection();
+    const char *szError = nullptr != connection->handle
+        ? mysql_error(connection->handle) : nullptr;
+
+    if(nullptr != szError && 0 != szError[0])
+    {
+        thread.lastError = szError;
+    }
+    else if(!thread.lastError.IsEmpty())
+    {
+        thread.lastError = String();
+    }
+
+    if(nullptr == connection->handle || !mOpen)
+    {
+        MYSQL *handle = connection->handle;
+
+        connection->handle = nullptr;
+        connection->state = POOLED_CONNECTION_CLOSED;
+
+        {
+            std::lock_guard<std::mutex> lock(mConnectionLock);
+            mConnections.remove(connection);
+
+            // There is room for another connection now.
+            mConnectionCondition.notify_one();
+        }
+
+        Close(handle);
+
+        return;
+    }
+
+    connection->lastUsed = PoolTime();
+    connection->state = POOLED_CONNECTION_IDLE;
+
+    if(0 < mConnectionWaiters)
+    {
+        std::lock_guard<std::mutex> lock(mConnectionLock);
+        mConnectionCondition.notify_one();
+    }
+
+    ReapIdleConnections();
+}
+
+void DatabaseMariaDB::ReapIdleConnections()
+{
+    auto& config = mMariaDBConfig;
+    int64_t idleTimeout = (int64_t)config->GetConnectionIdleTimeout() * 1000;
+    if(0 == idleTimeout)
+    {
+        return;
+    }
+
+    // Only one thread checks at a time and no more than once a second.
+    int64_t now = PoolTime();
+    int64_t nextReap = mNextReap;
+    if(now < nextReap || !mNextReap.compare_exchange_strong(nextReap,
+        now + 1000))
+    {
+        return;
+    }
+
+    std::list<MYSQL*> connections;
+
     {
-        MYSQL* connection = nullptr;
+        std::lock_guard<std::mutex> lock(mConnectionLock);
 
-        if(autoConnect)
+        size_t minConnections = config->GetMinConnections();
+
+        for(auto it = mConnections.begin(); it != mConnections.end() &&
+            mConnections.size() > minConnections;)
         {
-            auto config = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(mConfig);
-            ConnectToDatabase(connection, config->GetDatabaseName());
+            int state = POOLED_CONNECTION_IDLE;
+
+            if(now - (*it)->lastUsed >= idleTimeout &&
+                (*it)->state.compare_exchange_strong(state,
+                POOLED_CONNECTION_CLOSED))
+            {
+                connections.push_back((*it)->handle);
+                (*it)->handle = nullptr;
+
+                it = mConnections.erase(it);
+                mPoolStats.reaped++;
+            }
+            else
+            {
+                it++;
+            }
         }
+    }
 
-        mConnections[threadID] = connection;
+    for(auto connection : connections)
+    {
+        Close(connection);
     }
+}
 
-    return mConnections[threadID];
+DatabaseMariaDB::ThreadConnection& DatabaseMariaDB::GetThreadConnection() const
+{
+    static thread_local std::list<ThreadConnection> connections;
+
+    for(auto& connection : connections)
+    {
+        if(connection.poolID == mPoolID)
+        {
+            return connection;
+        }
+    }
+
+    // Forget pools the thread has nothing left from.
+    connections.remove_if([](const ThreadConnection& connection)
+        {
+            return connection.last.expired() && connection.current.expired();
+        });
+
+    ThreadConnection connection;
+    connection.poolID = mPoolID;
+
+    connections.push_back(connection);
+
+    return connections.back();
 }
 
 String DatabaseMariaDB::GetVariableType(const std::shared_ptr
@@ -1516,17 +2135,22 @@ String DatabaseMariaDB::GetVariableType(const std::shared_ptr
 
 String DatabaseMariaDB::GetLastError()
 {
-    auto connection = GetConnection(false);
+    auto& thread = GetThreadConnection();
+    auto connection = thread.current.lock();
 
     if(connection)
     {
-        const char *szError = mysql_error(connection);
+        const char *szError = mysql_error(connection.get());
 
         if(nullptr != szError && 0 != szError[0])
         {
             return szError;
         }
     }
+    else if(!thread.lastError.IsEmpty())
+    {
+        return thread.lastError;
+    }
 
     return "Invalid connection.";
 }
@@ -1546,12 +2170,149 @@ String DatabaseMariaDB::GetLastError(MYSQL *connection)
     return "Invalid connection.";
 }
 
+bool DatabaseMariaDB::SubmitAsync(const std::function<void()>& work)
+{
+    auto& config = mMariaDBConfig;
+
+    std::lock_guard<std::mutex> lock(mAsyncLock);
+
+    // Nothing new may start once Close has begun to stop the threads.
+    if(!mOpen || mAsyncClosing || 0 == config->GetAsyncThreadCount())
+    {
+        return false;
+    }
+
+    if(!mAsyncRunning)
+    {
+        mAsyncRunning = true;
+
+        for(uint8_t i = 0; i < config->GetAsyncThreadCount(); i++)
+        {
+            mAsyncThreads.push_back(std::thread([this]()
+            {
+#if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+                pthread_setname_np(pthread_self(), "database_async");
+#endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+
+                RunAsync();
+            }));
+        }
+    }
+
+    mAsyncQueue.push_back(work);
+    mAsyncCondition.notify_one();
+
+    return true;
+}
+
+bool DatabaseMariaDB::ExecuteAsync(const String& query,
+    const std::function<void(bool)>& callback)
+{
+    return SubmitAsync([this, query, callback]()
+    {
+        bool result = Execute(query);
+
+        if(callback)
+        {
+            callback(result);
+        }
+    });
+}
+
+DatabaseMariaDB::ConnectionPoolStats DatabaseMariaDB::GetConnectionPoolStats()
+{
+    ConnectionPoolStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(mConnectionLock);
+
+        stats = mPoolStats;
+        stats.open = (uint64_t)mConnections.size();
+        stats.inUse = 0;
+
+        for(auto& connection : mConnections)
+        {
+            if(POOLED_CONNECTION_IN_USE == connection->state)
+            {
+                stats.inUse++;
+            }
+        }
+    }
+
+    stats.fastCheckouts = mFastCheckouts;
+
+    {
+        std::lock_guard<std::mutex> lock(mAsyncLock);
+
+        stats.asyncQueueDepth = (uint64_t)mAsyncQueue.size();
+        stats.asyncCompleted = mAsyncCompleted;
+    }
+
+    return stats;
+}
+
+void DatabaseMariaDB::StopAsync()
+{
+    // Take the threads so each is only joined by one caller.
+    std::vector<std::thread> threads;
+
+    {
+        std::lock_guard<std::mutex> lock(mAsyncLock);
+
+        mAsyncClosing = true;
+        mAsyncRunning = false;
+        mAsyncThreads.swap(threads);
+        mAsyncCondition.notify_all();
+    }
+
+    for(auto& thread : threads)
+    {
+        // Asynchronous work may close the database itself. That thread
+        // will exit on its own once the work returns.
+        if(std::this_thread::get_id() == thread.get_id())
+        {
+            thread.detach();
+        }
+        else
+        {
+            thread.join();
+        }
+    }
+}
+
+void DatabaseMariaDB::RunAsync()
+{
+    std::unique_lock<std::mutex> lock(mAsyncLock);
+
+    while(true)
+    {
+        mAsyncCondition.wait(lock, [this]()
+        {
+            return !mAsyncQueue.empty() || !mAsyncRunning;
+        });
+
+        // Finish the queue before stopping.
+        if(mAsyncQueue.empty())
+        {
+            break;
+        }
+
+        auto work = mAsyncQueue.front();
+        mAsyncQueue.pop_front();
+
+        lock.unlock();
+        work();
+        lock.lock();
+
+        mAsyncCompleted++;
+    }
+}
+
 bool DatabaseMariaDB::TableExists(const libcomp::String& table)
 {
     int64_t tableExists = 0;
 
-    auto config = std::dynamic_pointer_cast<objects::DatabaseConfigMariaDB>(
-        mConfig);
+    auto& config = mMariaDBConfig;
     auto query = Prepare(libcomp::String("SELECT COUNT(TABLE_NAME) FROM "
         "INFORMATION_SCHEMA.STATISTICS WHERE TABLE_NAME = '%1' AND "
         "TABLE_SCHEMA = '%2';").Arg(table).Arg(config->GetDatabaseName()));
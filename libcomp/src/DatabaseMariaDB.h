@@ -37,6 +37,8 @@
 #include <MetaVariable.h>
 
 // Standard C++ Includes
+#include <atomic>
+#include <functional>
 #include <thread>
 
 typedef struct st_mysql MYSQL;
@@ -50,6 +52,46 @@ namespace libcomp
 class DatabaseMariaDB : public Database
 {
 public:
+    /**
+     * Counters for the connection pool and the asynchronous query threads.
+     */
+    struct ConnectionPoolStats
+    {
+        /// Number of connections in the pool.
+        uint64_t open;
+
+        /// Number of connections checked out of the pool.
+        uint64_t inUse;
+
+        /// Number of times a thread took back the connection it used last
+        /// without locking the pool.
+        uint64_t fastCheckouts;
+
+        /// Number of times a thread had to search the pool for a connection.
+        uint64_t slowCheckouts;
+
+        /// Number of connections opened by the pool.
+        uint64_t created;
+
+        /// Number of connections closed because they were idle too long.
+        uint64_t reaped;
+
+        /// Number of connections that failed a health check.
+        uint64_t failedHealthChecks;
+
+        /// Number of times a thread had to wait because the pool was full.
+        uint64_t waits;
+
+        /// Number of times a thread gave up waiting for a connection.
+        uint64_t timeouts;
+
+        /// Number of asynchronous jobs waiting to run.
+        uint64_t asyncQueueDepth;
+
+        /// Number of asynchronous jobs that have run.
+        uint64_t asyncCompleted;
+    };
+
     /**
      * Create a new MariaDB Database connection.
      * @param config Pointer to a database configuration
@@ -68,7 +110,8 @@ public:
     virtual bool Open();
 
     /**
-     * Close dall database connections.
+     * Close all database connections. Connections checked out by other
+     * threads are closed when they are returned to the pool.
      * @return true on success, false on failure
      */
     virtual bool Close();
@@ -100,6 +143,10 @@ public:
 
     virtual bool InsertSingleObject(std::shared_ptr<PersistentObject>& obj);
     virtual bool UpdateSingleObject(std::shared_ptr<PersistentObject>& obj);
+    virtual bool InsertObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs);
+    virtual bool UpdateObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs);
     virtual bool DeleteObjects(std::list<std::shared_ptr<PersistentObject>>& objs);
 
     virtual bool TableExists(const libcomp::String& table);
@@ -130,6 +177,36 @@ public:
      */
     String GetLastError(MYSQL *pConnection);
 
+    /**
+     * Run work on one of the AsyncThreadCount asynchronous database threads
+     * so the calling thread does not wait on the database. The threads are
+     * started the first time this is called and the work is run in the
+     * order it was submitted. Work still queued when the database is closed
+     * runs before the connections are closed.
+     * @param work Work to run. Any results should be handed back to the
+     *  caller from here.
+     * @return true if the work was queued, false if the database is not
+     *  open, is being closed or there are no asynchronous threads
+     *  configured
+     */
+    bool SubmitAsync(const std::function<void()>& work);
+
+    /**
+     * Execute a query on one of the asynchronous database threads.
+     * @param query Query to execute
+     * @param callback Optional function called from the asynchronous
+     *  thread with the result of the query
+     * @return true if the query was queued, false if it was not
+     */
+    bool ExecuteAsync(const String& query,
+        const std::function<void(bool)>& callback = {});
+
+    /**
+     * Get the counters for the connection pool.
+     * @return Counters for the connection pool
+     */
+    ConnectionPoolStats GetConnectionPoolStats();
+
 protected:
     virtual bool ProcessStandardChangeSet(const std::shared_ptr<
         DBStandardChangeSet>& changes);
@@ -137,6 +214,64 @@ protected:
         DBOperationalChangeSet>& changes);
 
 private:
+    /**
+     * State of a connection in the pool.
+     */
+    enum PooledConnectionState : int
+    {
+        POOLED_CONNECTION_IDLE = 0,
+        POOLED_CONNECTION_IN_USE,
+        POOLED_CONNECTION_CLOSED,
+    };
+
+    /**
+     * Connection owned by the pool. Only the thread that moved the state
+     * from idle to in use may touch the handle.
+     */
+    struct PooledConnection
+    {
+        /// MariaDB connection or null if it has not connected yet
+        MYSQL *handle = nullptr;
+
+        /// Current @ref PooledConnectionState of the connection
+        std::atomic<int> state;
+
+        /// Time the connection was last returned to the pool (milliseconds
+        /// on the steady clock)
+        std::atomic<int64_t> lastUsed;
+
+        /// Indicates if the configured database is selected on the
+        /// connection
+        bool databaseSelected = false;
+    };
+
+    /**
+     * Connection state of a thread for one pool.
+     */
+    struct ThreadConnection
+    {
+        /// ID of the pool the state belongs to
+        uint64_t poolID;
+
+        /// Connection the thread used last which it will try to check out
+        /// again first
+        std::weak_ptr<PooledConnection> last;
+
+        /// Connection the thread has checked out right now
+        std::weak_ptr<MYSQL> current;
+
+        /// Error on the last connection the thread returned to the pool
+        String lastError;
+    };
+
+    /**
+     * Insert or update a batch of objects with a single statement.
+     * @param batch Batch of objects built by @ref GetObjectBatches
+     * @param insert true to insert the objects, false to update them
+     * @return true on success, false on failure
+     */
+    bool ExecuteObjectBatch(const ObjectBatch& batch, bool insert);
+
     /**
      * Process and explicit update to a single record, checking each column's
      * state before and verifying it set to the expected value afterwards.
@@ -155,12 +290,75 @@ private:
     bool ConnectToDatabase(MYSQL*& connection, const libcomp::String& databaseName);
 
     /**
-     * Get a connection for the executing thread.
-     * @param autoConnect true if the connection should be established before
-     *  returning it, false if it should just return the conection reference
-     * @return Reference to the executing thread's connection pointer
+     * Check a connection out of the pool for the executing thread. If the
+     * thread already has one checked out the same connection is returned
+     * so nested calls (and transactions) stay on one connection. Otherwise
+     * the connection the thread used last is taken back without locking the
+     * pool if it is idle. The connection returns to the pool once every
+     * copy of the pointer is gone.
+     * @return Pointer to the connection or null if one could not be
+     *  checked out
      */
-    MYSQL*& GetConnection(bool autoConnect);
+    std::shared_ptr<MYSQL> GetConnection();
+
+    /**
+     * Find an idle connection in the pool, add a new connection if the pool
+     * is not full or wait up to ConnectionWaitTimeout milliseconds for one to
+     * be returned.
+     * @return Connection moved to the in use state or null on failure
+     */
+    std::shared_ptr<PooledConnection> CheckoutConnection();
+
+    /**
+     * Connect a connection just checked out of the pool if needed, check
+     * its health if it has been idle for ConnectionHealthCheckInterval
+     * milliseconds and select the database if it has been opened with
+     * @ref Use.
+     * @param connection Connection checked out by the executing thread
+     * @return true if the connection can be used, false if it can not
+     */
+    bool PrepareConnection(PooledConnection& connection);
+
+    /**
+     * Return a connection to the pool or close it if it is broken or the
+     * database has been closed.
+     * @param connection Connection checked out by the executing thread
+     */
+    void ReleaseConnection(const std::shared_ptr<PooledConnection>& connection);
+
+    /**
+     * Close connections that have been idle for ConnectionIdleTimeout
+     * seconds while the pool has more than MinConnections. This does
+     * nothing if it has run in the last second.
+     */
+    void ReapIdleConnections();
+
+    /**
+     * Get the connection state of the executing thread for this pool.
+     * @return Connection state of the executing thread
+     */
+    ThreadConnection& GetThreadConnection() const;
+
+    /**
+     * Stop the asynchronous database threads after running any work left
+     * in their queue. No more work is accepted until the database is
+     * opened again. This may be called by more than one thread or by the
+     * asynchronous work itself.
+     */
+    void StopAsync();
+
+    /**
+     * Run work submitted with @ref SubmitAsync until the asynchronous
+     * threads are stopped.
+     */
+    void RunAsync();
+
+    /**
+     * Get the ID of the current session of a connection.
+     * @param connection Connection to get the session ID of
+     * @return ID of the session or 0 if there is no connection
+     */
+    uint64_t GetSessionID(MYSQL *connection);
 
     /**
      * Get the MariaDB type represented by a MetaVariable type.
@@ -169,14 +367,66 @@ private:
      */
     String GetVariableType(const std::shared_ptr<libobjgen::MetaVariable> var);
 
-    /// Mutex to lock access to the database connection map
+    /// Config of the database (the same object as @ref mConfig) kept as
+    /// its MariaDB type so it does not have to be cast each time
+    std::shared_ptr<objects::DatabaseConfigMariaDB> mMariaDBConfig;
+
+    /// Unique ID of the pool used to find the connection state of a thread
+    uint64_t mPoolID;
+
+    /// Indicates if the database has been opened and not closed since
+    std::atomic<bool> mOpen;
+
+    /// Indicates if @ref Use has been called so connections should have
+    /// the configured database selected
+    std::atomic<bool> mDatabaseSelected;
+
+    /// Mutex to lock access to the connection pool
     std::mutex mConnectionLock;
 
-    /// Pointers to the MariaDB representation of a database connection per thread.
-    /// References to the pointers in this collection are passed around for use
-    /// throughout the class as they are not removed or modified until the database
-    /// is closed.
-    std::unordered_map<std::thread::id, MYSQL*> mConnections;
+    /// Signaled when a connection is returned to the pool
+    std::condition_variable mConnectionCondition;
+
+    /// Every open connection whether it is idle or checked out. Idle
+    /// connections may be checked out without the lock but connections are
+    /// only added or removed with it.
+    std::list<std::shared_ptr<PooledConnection>> mConnections;
+
+    /// Number of threads waiting for a connection to be returned
+    std::atomic<uint32_t> mConnectionWaiters;
+
+    /// Time idle connections should be reaped next (milliseconds on the
+    /// steady clock)
+    std::atomic<int64_t> mNextReap;
+
+    /// Number of checkouts that did not need to lock the pool
+    std::atomic<uint64_t> mFastCheckouts;
+
+    /// Counters for the connection pool protected by the pool lock
+    /// (current counts are filled in by @ref GetConnectionPoolStats)
+    ConnectionPoolStats mPoolStats;
+
+    /// Mutex to lock access to the asynchronous work queue
+    std::mutex mAsyncLock;
+
+    /// Signaled when asynchronous work is queued or the threads are stopped
+    std::condition_variable mAsyncCondition;
+
+    /// Asynchronous work waiting to run
+    std::list<std::function<void()>> mAsyncQueue;
+
+    /// Threads running asynchronous work
+    std::vector<std::thread> mAsyncThreads;
+
+    /// Indicates if the asynchronous threads should keep running
+    bool mAsyncRunning;
+
+    /// Indicates if the database is being closed so no more asynchronous
+    /// work should be accepted
+    bool mAsyncClosing;
+
+    /// Number of asynchronous jobs that have run
+    uint64_t mAsyncCompleted;
 };
 
 } // namespace libcomp
@@ -28,6 +28,9 @@
 
 #ifndef EXOTIC_PLATFORM
 
+// libcomp Includes
+#include "DatabaseStatementCache.h"
+
 using namespace libcomp;
 
 DatabaseQueryImpl::DatabaseQueryImpl() : mAffectedRowCount(0)
@@ -38,6 +41,11 @@ DatabaseQueryImpl::~DatabaseQueryImpl()
 {
 }
 
+bool DatabaseQueryImpl::Reset()
+{
+    return false;
+}
+
 bool DatabaseQueryImpl::Bind(size_t index, const std::unordered_map<
     std::string, std::vector<char>>& values)
 {
@@ -69,25 +77,27 @@ int64_t DatabaseQueryImpl::AffectedRowCount() const
     return mAffectedRowCount;
 }
 
-DatabaseQuery::DatabaseQuery(DatabaseQueryImpl *pImpl) : mImpl(pImpl)
+DatabaseQuery::DatabaseQuery(DatabaseQueryImpl *pImpl) : mImpl(pImpl),
+    mCacheGeneration(0)
 {
 }
 
 DatabaseQuery::DatabaseQuery(DatabaseQueryImpl *pImpl, const String& query) :
-    mImpl(pImpl)
+    mImpl(pImpl), mCacheGeneration(0)
 {
     Prepare(query);
 }
 
-DatabaseQuery::DatabaseQuery(DatabaseQuery&& other) : mImpl(other.mImpl)
+DatabaseQuery::DatabaseQuery(DatabaseQuery&& other) : mImpl(other.mImpl),
+    mCache(std::move(other.mCache)), mCacheKey(std::move(other.mCacheKey)),
+    mCacheGeneration(other.mCacheGeneration)
 {
     other.mImpl = nullptr;
 }
 
 DatabaseQuery::~DatabaseQuery()
 {
-    delete mImpl;
-    mImpl = nullptr;
+    Release();
 }
 
 bool DatabaseQuery::Prepare(const String& query)
@@ -575,12 +585,32 @@ int64_t DatabaseQuery::AffectedRowCount() const
 
 DatabaseQuery& DatabaseQuery::operator=(DatabaseQuery&& other)
 {
-    delete mImpl;
+    Release();
 
     mImpl = other.mImpl;
+    mCache = std::move(other.mCache);
+    mCacheKey = std::move(other.mCacheKey);
+    mCacheGeneration = other.mCacheGeneration;
     other.mImpl = nullptr;
 
     return *this;
 }
 
+void DatabaseQuery::Release()
+{
+    auto cache = mCache.lock();
+
+    if(cache && nullptr != mImpl)
+    {
+        cache->Release(mCacheKey, mCacheGeneration, mImpl);
+    }
+    else
+    {
+        delete mImpl;
+    }
+
+    mImpl = nullptr;
+    mCache.reset();
+}
+
 #endif // !EXOTIC_PLATFORM
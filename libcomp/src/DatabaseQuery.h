@@ -36,11 +36,14 @@
 #include "CString.h"
 
 // Standard C++11 Includes
+#include <memory>
 #include <unordered_map>
 
 namespace libcomp
 {
 
+class DatabaseStatementCache;
+
 /**
  * Abstract base class to be implemented by specific database types to
  * facilitate column binding and data retrieval.
@@ -80,6 +83,13 @@ public:
      */
     virtual bool Next() = 0;
 
+    /**
+     * Reset an executed query so it can be bound and executed again
+     * without preparing it again. All bound values are cleared.
+     * @return true on success, false if the query can't be reused
+     */
+    virtual bool Reset();
+
     /**
      * Bind a string column value by its index.
      * @param index The column's index
@@ -753,6 +763,24 @@ public:
 protected:
     /// Database specific implementation
     DatabaseQueryImpl *mImpl;
+
+private:
+    friend class DatabaseStatementCache;
+
+    /**
+     * Return the implementation to the statement cache it came from or
+     * delete it if it is not from a cache.
+     */
+    void Release();
+
+    /// Statement cache the implementation is returned to
+    std::weak_ptr<DatabaseStatementCache> mCache;
+
+    /// Key of the implementation in the statement cache
+    std::string mCacheKey;
+
+    /// Generation of the statement cache the implementation came from
+    uint64_t mCacheGeneration;
 };
 
 } // namespace libcomp
@@ -60,8 +60,9 @@ static libcomp::String GetLastError(MYSQL *connection)
     return "Invalid connection.";
 }
 
-DatabaseQueryMariaDB::DatabaseQueryMariaDB(MYSQL *pDatabase) :
-    mDatabase(pDatabase), mStatement(nullptr), mStatus(0)
+DatabaseQueryMariaDB::DatabaseQueryMariaDB(
+    const std::shared_ptr<MYSQL>& connection) : mDatabase(connection.get()),
+    mConnection(connection), mStatement(nullptr), mStatus(0)
 {
 }
 
@@ -97,6 +98,16 @@ bool DatabaseQueryMariaDB::Prepare(const String& query)
             namedParam, "?", std::regex_constants::format_first_only);
     }
 
+    // The pool may not have had a connection to give out.
+    if(nullptr == mDatabase)
+    {
+        LogDatabaseDebugMsg("Failed to prepare statement without a "
+            "database connection\n");
+
+        mStatus = -1;
+        return false;
+    }
+
     mStatement = mysql_stmt_init(mDatabase);
 
     if(nullptr == mStatement)
@@ -370,6 +381,57 @@ bool DatabaseQueryMariaDB::Next()
     return MYSQL_NO_DATA != mStatus && IsValid();
 }
 
+bool DatabaseQueryMariaDB::Reset()
+{
+    // A statement that failed may belong to a lost connection.
+    if(!IsValid())
+    {
+        return false;
+    }
+
+    if(mysql_stmt_free_result(mStatement) || mysql_stmt_reset(mStatement))
+    {
+        LogDatabaseDebug([&]()
+        {
+            return String("Reset of statement %1 failed for "
+                "connection %2\n")
+                .Arg(ConnectionString(mStatement))
+                .Arg(ConnectionString(mDatabase));
+        });
+
+        LogDatabaseDebug([&]()
+        {
+            return String("Last SQL error: %1\n").Arg(GetLastError(mDatabase));
+        });
+
+        mStatus = -1;
+        return false;
+    }
+
+    // The bindings point into the buffers so clear them all together.
+    mBindings.clear();
+    mResultBindings.clear();
+    mResultColumnNames.clear();
+    mResultColumnTypes.clear();
+    mBufferInt.clear();
+    mBufferBigInt.clear();
+    mBufferFloat.clear();
+    mBufferDouble.clear();
+    mBufferBlob.clear();
+    mBufferBool.clear();
+    mBufferNulls.clear();
+    mBufferLengths.clear();
+
+    mStatus = 0;
+    mAffectedRowCount = 0;
+
+    // Cached statements are only used while their connection is checked
+    // out by the caller so give the connection back to the pool.
+    mConnection.reset();
+
+    return true;
+}
+
 bool DatabaseQueryMariaDB::Bind(size_t index, const String& value)
 {
     auto bind = PrepareBinding(index, MYSQL_TYPE_STRING);
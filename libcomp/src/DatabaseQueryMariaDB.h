@@ -52,13 +52,11 @@ class DatabaseQueryMariaDB : public DatabaseQueryImpl
 public:
     /**
      * Create a new MariaDB database query.
-     * @param pDatabase Pointer to the executing MariaDB database
-     * @param maxRetryCount Maximum number of retry attempts allowed
-     *  when access to the DB during query execution returns as busy
-     * @param retryDelay Delay in milliseconds between execution retry
-     *  attempts
+     * @param connection Connection checked out of the pool of the executing
+     *  MariaDB database. It stays checked out until the query is reset or
+     *  destroyed.
      */
-    DatabaseQueryMariaDB(MYSQL *pDatabase);
+    DatabaseQueryMariaDB(const std::shared_ptr<MYSQL>& connection);
 
     /**
      * Clean up the query.
@@ -68,6 +66,7 @@ public:
     virtual bool Prepare(const String& query);
     virtual bool Execute();
     virtual bool Next();
+    virtual bool Reset();
 
     virtual bool Bind(size_t index, const String& value);
     virtual bool Bind(const String& name, const String& value);
@@ -140,6 +139,10 @@ private:
     /// Pointer to the MariaDB database the query executes on
     MYSQL *mDatabase;
 
+    /// Hold on the pooled connection the query executes on. This is
+    /// released when the query is reset for the statement cache.
+    std::shared_ptr<MYSQL> mConnection;
+
     /// Pointer to the MariaDB representation of the query as a statement
     MYSQL_STMT *mStatement;
 
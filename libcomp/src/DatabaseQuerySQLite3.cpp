@@ -115,6 +115,26 @@ bool DatabaseQuerySQLite3::Next()
     return IsValid() && SQLITE_DONE != mStatus;
 }
 
+bool DatabaseQuerySQLite3::Reset()
+{
+    if(nullptr == mStatement)
+    {
+        return false;
+    }
+
+    // This returns the error of the last step (if any) which does not stop
+    // the statement from being used again.
+    (void)sqlite3_reset(mStatement);
+
+    mStatus = sqlite3_clear_bindings(mStatement);
+    mDidJustExecute = false;
+    mAffectedRowCount = 0;
+    mResultColumnNames.clear();
+    mResultColumnTypes.clear();
+
+    return IsValid();
+}
+
 bool DatabaseQuerySQLite3::Bind(size_t index, const String& value)
 {
     int idx = (int)index;
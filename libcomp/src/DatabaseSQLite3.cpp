@@ -38,6 +38,9 @@
 // SQLite3 Includes
 #include <sqlite3.h>
 
+// Standard C++11 Includes
+#include <algorithm>
+
 using namespace libcomp;
 
 DatabaseSQLite3::DatabaseSQLite3(const std::shared_ptr<
@@ -76,10 +79,16 @@ bool DatabaseSQLite3::Open()
 
 bool DatabaseSQLite3::Close()
 {
+    // Queued changes need the connection to be written.
+    StopWriteBehind();
+
     bool result = true;
 
     if(nullptr != mDatabase)
     {
+        // All statements must be finalized before the connection can close.
+        RemoveStatementCache(mDatabase);
+
         if(SQLITE_OK != sqlite3_close(mDatabase))
         {
             result = false;
@@ -305,19 +314,24 @@ std::list<std::shared_ptr<PersistentObject>> DatabaseSQLite3::LoadObjects(
         return {};
     }
 
-    String sql = String("SELECT * FROM %1%2").Arg(
-        metaObject->GetName()).Arg(
-        (nullptr != pValue
-            ? String(" WHERE %1 = :%1").Arg(pValue->GetColumn())
-            : ""));
+    auto getQuery = [&]()
+    {
+        return String("SELECT * FROM %1%2").Arg(
+            metaObject->GetName()).Arg(
+            (nullptr != pValue
+                ? String(" WHERE %1 = :%1").Arg(pValue->GetColumn())
+                : ""));
+    };
 
-    DatabaseQuery query = Prepare(sql);
+    DatabaseQuery query = PrepareCached(mDatabase, 0, GetStatementKey('S',
+        *metaObject, nullptr != pValue ? std::list<DatabaseBind*>{ pValue }
+        : std::list<DatabaseBind*>()), getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -348,7 +362,7 @@ std::list<std::shared_ptr<PersistentObject>> DatabaseSQLite3::LoadObjects(
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -391,8 +405,7 @@ bool DatabaseSQLite3::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
 {
     auto metaObject = obj->GetObjectMetadata();
 
-    std::stringstream objstream;
-    if(!obj->Save(objstream))
+    if(!obj->CanSave())
     {
         return false;
     }
@@ -402,33 +415,37 @@ bool DatabaseSQLite3::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
         return false;
     }
 
-    std::list<String> columnNames;
-    columnNames.push_back("UID");
-
-    std::list<String> columnBinds;
-    columnBinds.push_back(":UID");
-
     auto values = obj->GetMemberBindValues(true);
 
-    for(auto value : values)
+    auto getQuery = [&]()
     {
-        auto columnName = value->GetColumn();
-        columnNames.push_back(columnName);
-        columnBinds.push_back(String(":%1").Arg(columnName));
-    }
+        std::list<String> columnNames;
+        columnNames.push_back("UID");
+
+        std::list<String> columnBinds;
+        columnBinds.push_back(":UID");
 
-    String sql = String("INSERT INTO %1 (%2) VALUES (%3);").Arg(
-        metaObject->GetName()).Arg(
-        String::Join(columnNames, ", ")).Arg(
-        String::Join(columnBinds, ", "));
+        for(auto value : values)
+        {
+            auto columnName = value->GetColumn();
+            columnNames.push_back(columnName);
+            columnBinds.push_back(String(":%1").Arg(columnName));
+        }
 
-    DatabaseQuery query = Prepare(sql);
+        return String("INSERT INTO %1 (%2) VALUES (%3);").Arg(
+            metaObject->GetName()).Arg(
+            String::Join(columnNames, ", ")).Arg(
+            String::Join(columnBinds, ", "));
+    };
+
+    DatabaseQuery query = PrepareCached(mDatabase, 0,
+        GetStatementKey('I', *metaObject, values), getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -466,36 +483,43 @@ bool DatabaseSQLite3::InsertSingleObject(std::shared_ptr<PersistentObject>& obj)
                 return String("Database said: %1\n").Arg(GetLastError());
             });
 
+            for(auto v : values)
+            {
+                delete v;
+            }
+
             return false;
         }
-
-        delete value;
     }
 
-    if(!query.Execute())
+    bool result = query.Execute();
+
+    if(!result)
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
         {
             return String("Database said: %1\n").Arg(GetLastError());
         });
+    }
 
-        return false;
+    for(auto value : values)
+    {
+        delete value;
     }
 
-    return true;
+    return result;
 }
 
 bool DatabaseSQLite3::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
 {
     auto metaObject = obj->GetObjectMetadata();
 
-    std::stringstream objstream;
-    if(!obj->Save(objstream))
+    if(!obj->CanSave())
     {
         return false;
     }
@@ -512,24 +536,28 @@ bool DatabaseSQLite3::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
         return true;
     }
 
-    std::list<String> columnNames;
-
-    for(auto value : values)
+    auto getQuery = [&]()
     {
-        columnNames.push_back(String("%1 = :%1").Arg(value->GetColumn()));
-    }
+        std::list<String> columnNames;
+
+        for(auto value : values)
+        {
+            columnNames.push_back(String("%1 = :%1").Arg(value->GetColumn()));
+        }
 
-    String sql = String("UPDATE %1 SET %2 WHERE UID = :UID;").Arg(
-        metaObject->GetName()).Arg(
-        String::Join(columnNames, ", "));
+        return String("UPDATE %1 SET %2 WHERE UID = :UID;").Arg(
+            metaObject->GetName()).Arg(
+            String::Join(columnNames, ", "));
+    };
 
-    DatabaseQuery query = Prepare(sql);
+    DatabaseQuery query = PrepareCached(mDatabase, 0,
+        GetStatementKey('U', *metaObject, values), getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -567,17 +595,144 @@ bool DatabaseSQLite3::UpdateSingleObject(std::shared_ptr<PersistentObject>& obj)
                 return String("Database said: %1\n").Arg(GetLastError());
             });
 
+            for(auto v : values)
+            {
+                delete v;
+            }
+
             return false;
         }
+    }
 
+    bool result = query.Execute();
+
+    if(!result)
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to execute query: %1\n").Arg(getQuery());
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+    }
+
+    for(auto value : values)
+    {
         delete value;
     }
 
+    return result;
+}
+
+bool DatabaseSQLite3::InsertObjects(
+    std::list<std::shared_ptr<PersistentObject>>& objs)
+{
+    std::list<ObjectBatch> batches;
+
+    if(!GetObjectBatches(objs, true, batches))
+    {
+        return false;
+    }
+
+    bool result = true;
+
+    for(auto& batch : batches)
+    {
+        if(!ExecuteObjectBatch(batch, true))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    FreeObjectBatches(batches);
+
+    return result;
+}
+
+bool DatabaseSQLite3::UpdateObjects(
+    std::list<std::shared_ptr<PersistentObject>>& objs)
+{
+    std::list<ObjectBatch> batches;
+
+    if(!GetObjectBatches(objs, false, batches))
+    {
+        return false;
+    }
+
+    bool result = true;
+
+    for(auto& batch : batches)
+    {
+        if(!ExecuteObjectBatch(batch, false))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    FreeObjectBatches(batches);
+
+    return result;
+}
+
+bool DatabaseSQLite3::ExecuteObjectBatch(const ObjectBatch& batch, bool insert)
+{
+    auto getQuery = [&]()
+    {
+        return GetObjectBatchQuery(batch, insert, "");
+    };
+
+    // Only cache the statements for a single object and for full batches
+    // so the odd sized batches left over don't push them out of the cache.
+    size_t count = batch.objects.size();
+    bool cache = 1 == count || batch.maxSize == count;
+
+    std::string key = batch.key + "#" + std::to_string(count);
+
+    DatabaseQuery query = cache ? PrepareCached(mDatabase, 0, key,
+        getQuery) : Prepare(getQuery());
+
+    if(!query.IsValid())
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+
+        return false;
+    }
+
+    String failedColumn;
+
+    if(!BindObjectBatch(query, batch, insert, 1, failedColumn))
+    {
+        LogDatabaseError([&]()
+        {
+            return String("Failed to bind value: %1\n").Arg(failedColumn);
+        });
+
+        LogDatabaseError([&]()
+        {
+            return String("Database said: %1\n").Arg(GetLastError());
+        });
+
+        return false;
+    }
+
     if(!query.Execute())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -601,11 +756,15 @@ bool DatabaseSQLite3::DeleteObjects(std::list<std::shared_ptr<PersistentObject>>
         metaObjectMap[metaObj].push_back(obj);
     }
 
+    size_t batchSize = std::max<size_t>(1,
+        mConfig->GetChangeSetBatchSize());
+
     for(auto mPair : metaObjectMap)
     {
         auto metaObject = mPair.first;
 
         std::list<String> uidBindings;
+        size_t remaining = mPair.second.size();
         for(auto obj : mPair.second)
         {
             auto uuid = obj->GetUUID();
@@ -618,13 +777,22 @@ bool DatabaseSQLite3::DeleteObjects(std::list<std::shared_ptr<PersistentObject>>
 
             std::string uuidStr = obj->GetUUID().ToString();
             uidBindings.push_back(String("'%1'").Arg(uuidStr));
-        }
 
-        if(!Execute(String("DELETE FROM %1 WHERE UID in (%2);")
-            .Arg(metaObject->GetName())
-            .Arg(String::Join(uidBindings, ", "))))
-        {
-            return false;
+            remaining--;
+
+            if(uidBindings.size() < batchSize && remaining)
+            {
+                continue;
+            }
+
+            if(!Execute(String("DELETE FROM %1 WHERE UID in (%2);")
+                .Arg(metaObject->GetName())
+                .Arg(String::Join(uidBindings, ", "))))
+            {
+                return false;
+            }
+
+            uidBindings.clear();
         }
     }
 
@@ -977,6 +1145,9 @@ bool DatabaseSQLite3::VerifyAndSetupSchema(bool recreateTables)
         }
     }
 
+    // Statements prepared before the tables changed can't be used anymore.
+    ClearStatementCache();
+
     LogDatabaseInfoMsg("Database verification complete.\n");
 
     return true;
@@ -994,25 +1165,17 @@ bool DatabaseSQLite3::ProcessStandardChangeSet(const std::shared_ptr<
     }
 
     bool result = true;
-    for(auto obj : changes->GetInserts())
+
+    auto inserts = changes->GetInserts();
+    if(inserts.size())
     {
-        if(!InsertSingleObject(obj))
-        {
-            result = false;
-            break;
-        }
+        result = InsertObjects(inserts);
     }
 
-    if(result)
+    auto updates = changes->GetUpdates();
+    if(result && updates.size())
     {
-        for(auto obj : changes->GetUpdates())
-        {
-            if(!UpdateSingleObject(obj))
-            {
-                result = false;
-                break;
-            }
-        }
+        result = UpdateObjects(updates);
     }
 
     auto deletes = changes->GetDeletes();
@@ -1135,10 +1298,11 @@ bool DatabaseSQLite3::ProcessExplicitUpdate(const std::shared_ptr<
         return false;
     }
 
-    size_t idx = 1;
-    std::list<String> updateClause;
-    std::list<String> whereClause;
-    // Bind the update clause values
+    // The statement binds the columns in the order of the map so the key
+    // must list them in the same order.
+    std::string key("X");
+    key += obj->GetObjectMetadata()->GetName();
+
     for(auto cPair : changedVals)
     {
         auto it = expectedVals.find(cPair.first);
@@ -1147,29 +1311,44 @@ bool DatabaseSQLite3::ProcessExplicitUpdate(const std::shared_ptr<
             return false;
         }
 
-        updateClause.push_back(String("%1 = ?%2").Arg(cPair.first).Arg(idx++));
+        key += ',';
+        key += cPair.first;
     }
 
-    auto uidIdx = idx++;
-
-    // Now bind the where clause values
-    for(auto cPair : changedVals)
+    auto getQuery = [&]()
     {
-        whereClause.push_back(String("%1 = ?%2").Arg(cPair.first).Arg(idx++));
-    }
+        size_t idx = 1;
+        std::list<String> updateClause;
+        std::list<String> whereClause;
+        // Bind the update clause values
+        for(auto cPair : changedVals)
+        {
+            updateClause.push_back(String("%1 = ?%2").Arg(cPair.first).Arg(
+                idx++));
+        }
 
-    String sql = String("UPDATE `%1` SET %2 WHERE `UID` = :%3 AND %4;").Arg(
-        obj->GetObjectMetadata()->GetName()).Arg(
-        String::Join(updateClause, ", ")).Arg(uidIdx).Arg(
-        String::Join(whereClause, " AND "));
+        auto uidIdx = idx++;
 
-    DatabaseQuery query = Prepare(sql);
+        // Now bind the where clause values
+        for(auto cPair : changedVals)
+        {
+            whereClause.push_back(String("%1 = ?%2").Arg(cPair.first).Arg(
+                idx++));
+        }
+
+        return String("UPDATE `%1` SET %2 WHERE `UID` = :%3 AND %4;").Arg(
+            obj->GetObjectMetadata()->GetName()).Arg(
+            String::Join(updateClause, ", ")).Arg(uidIdx).Arg(
+            String::Join(whereClause, " AND "));
+    };
+
+    DatabaseQuery query = PrepareCached(mDatabase, 0, key, getQuery);
 
     if(!query.IsValid())
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to prepare SQL query: %1\n").Arg(sql);
+            return String("Failed to prepare SQL query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
@@ -1180,7 +1359,7 @@ bool DatabaseSQLite3::ProcessExplicitUpdate(const std::shared_ptr<
         return false;
     }
 
-    idx = 1;
+    size_t idx = 1;
     for(auto cPair : changedVals)
     {
         if(!cPair.second->Bind(query, idx++))
@@ -1234,7 +1413,7 @@ bool DatabaseSQLite3::ProcessExplicitUpdate(const std::shared_ptr<
     {
         LogDatabaseError([&]()
         {
-            return String("Failed to execute query: %1\n").Arg(sql);
+            return String("Failed to execute query: %1\n").Arg(getQuery());
         });
 
         LogDatabaseError([&]()
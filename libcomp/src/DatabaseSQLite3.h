@@ -97,6 +97,10 @@ public:
 
     virtual bool InsertSingleObject(std::shared_ptr<PersistentObject>& obj);
     virtual bool UpdateSingleObject(std::shared_ptr<PersistentObject>& obj);
+    virtual bool InsertObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs);
+    virtual bool UpdateObjects(
+        std::list<std::shared_ptr<PersistentObject>>& objs);
     virtual bool DeleteObjects(std::list<std::shared_ptr<PersistentObject>>& objs);
 
     virtual bool TableExists(const libcomp::String& table);
@@ -121,6 +125,14 @@ protected:
         DBOperationalChangeSet>& changes);
 
 private:
+    /**
+     * Insert or update a batch of objects with a single statement.
+     * @param batch Batch of objects built by @ref GetObjectBatches
+     * @param insert true to insert the objects, false to update them
+     * @return true on success, false on failure
+     */
+    bool ExecuteObjectBatch(const ObjectBatch& batch, bool insert);
+
     /**
      * Process and explicit update to a single record, checking each column's
      * state before and verifying it set to the expected value afterwards.
@@ -0,0 +1,188 @@
+/**
+ * @file libcomp/src/DatabaseStatementCache.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Cache of prepared statements for a database connection.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DatabaseStatementCache.h"
+
+#ifndef EXOTIC_PLATFORM
+
+// Standard C++11 Includes
+#include <cstring>
+
+using namespace libcomp;
+
+DatabaseStatementCache::DatabaseStatementCache(size_t maxSize) :
+    mMaxSize(maxSize), mGeneration(0), mSessionID(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+DatabaseStatementCache::~DatabaseStatementCache()
+{
+    for(auto& entry : mEntries)
+    {
+        delete entry.second;
+    }
+
+    mEntries.clear();
+    mIndex.clear();
+}
+
+DatabaseQuery DatabaseStatementCache::Prepare(const std::string& key,
+    const std::function<DatabaseQuery()>& prepare)
+{
+    DatabaseQueryImpl *pImpl = nullptr;
+    uint64_t generation;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        generation = mGeneration;
+
+        auto it = mIndex.find(key);
+
+        if(it != mIndex.end())
+        {
+            pImpl = it->second->second;
+
+            mEntries.erase(it->second);
+            mIndex.erase(it);
+
+            mStats.hits++;
+        }
+        else
+        {
+            mStats.misses++;
+        }
+    }
+
+    if(nullptr != pImpl)
+    {
+        DatabaseQuery query(pImpl);
+        query.mCache = shared_from_this();
+        query.mCacheKey = key;
+        query.mCacheGeneration = generation;
+
+        return query;
+    }
+
+    DatabaseQuery query = prepare();
+
+    // Only keep statements that prepared without error.
+    if(query.IsValid())
+    {
+        query.mCache = shared_from_this();
+        query.mCacheKey = key;
+        query.mCacheGeneration = generation;
+    }
+
+    return query;
+}
+
+void DatabaseStatementCache::Clear()
+{
+    std::list<Entry_t> entries;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        entries.swap(mEntries);
+        mIndex.clear();
+        mGeneration++;
+    }
+
+    for(auto& entry : entries)
+    {
+        delete entry.second;
+    }
+}
+
+void DatabaseStatementCache::SetSession(uint64_t sessionID)
+{
+    bool changed;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        changed = sessionID != mSessionID;
+        mSessionID = sessionID;
+    }
+
+    if(changed)
+    {
+        Clear();
+    }
+}
+
+DatabaseStatementCache::Stats DatabaseStatementCache::GetStats()
+{
+    std::lock_guard<std::mutex> guard(mLock);
+
+    Stats stats = mStats;
+    stats.size = mEntries.size();
+
+    return stats;
+}
+
+void DatabaseStatementCache::Release(const std::string& key,
+    uint64_t generation, DatabaseQueryImpl *pImpl)
+{
+    // Reset without holding the lock as this may talk to the database.
+    if(pImpl->Reset())
+    {
+        DatabaseQueryImpl *pEvicted = nullptr;
+
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+
+            // If the same statement was in use twice at the same time only
+            // the first one returned is kept.
+            if(generation == mGeneration && 0 < mMaxSize &&
+                mIndex.find(key) == mIndex.end())
+            {
+                mEntries.emplace_front(key, pImpl);
+                mIndex[key] = mEntries.begin();
+
+                pImpl = nullptr;
+
+                if(mEntries.size() > mMaxSize)
+                {
+                    pEvicted = mEntries.back().second;
+
+                    mIndex.erase(mEntries.back().first);
+                    mEntries.pop_back();
+
+                    mStats.evictions++;
+                }
+            }
+        }
+
+        delete pEvicted;
+    }
+
+    delete pImpl;
+}
+
+#endif // !EXOTIC_PLATFORM
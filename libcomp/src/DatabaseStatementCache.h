@@ -0,0 +1,164 @@
+/**
+ * @file libcomp/src/DatabaseStatementCache.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Cache of prepared statements for a database connection.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_DATABASESTATEMENTCACHE_H
+#define LIBCOMP_SRC_DATABASESTATEMENTCACHE_H
+
+#ifndef EXOTIC_PLATFORM
+
+// libcomp Includes
+#include "DatabaseQuery.h"
+
+// Standard C++11 Includes
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace libcomp
+{
+
+/**
+ * Keeps the prepared statements of a single database connection so the
+ * query text does not need to be built and compiled by the database for
+ * each row that is loaded or saved. Statements are identified by a key
+ * (normally the object type, operation and columns bound) and handed out
+ * by @ref Prepare. A statement is removed from the cache while it is in use
+ * and is reset and returned to the cache when the @ref DatabaseQuery that
+ * holds it is destroyed. The least recently used statements are dropped
+ * when the cache is full.
+ *
+ * The cache must be owned by a std::shared_ptr.
+ */
+class DatabaseStatementCache : public std::enable_shared_from_this<
+    DatabaseStatementCache>
+{
+public:
+    /**
+     * Counters for the cache.
+     */
+    struct Stats
+    {
+        /// Number of statements that were taken from the cache.
+        uint64_t hits;
+
+        /// Number of statements that had to be prepared.
+        uint64_t misses;
+
+        /// Number of statements dropped because the cache was full.
+        uint64_t evictions;
+
+        /// Number of statements waiting in the cache.
+        uint64_t size;
+    };
+
+    /**
+     * Create a statement cache.
+     * @param maxSize Maximum number of statements kept in the cache.
+     */
+    DatabaseStatementCache(size_t maxSize);
+
+    /**
+     * Finalize all statements in the cache. This must be done before the
+     * connection the statements belong to is closed.
+     */
+    ~DatabaseStatementCache();
+
+    /**
+     * Get a statement from the cache or prepare a new one if the cache does
+     * not have one for the key. Valid statements are returned to the cache
+     * when the query is destroyed.
+     * @param key Key of the statement.
+     * @param prepare Function to prepare a new statement.
+     * @return Prepared query.
+     */
+    DatabaseQuery Prepare(const std::string& key,
+        const std::function<DatabaseQuery()>& prepare);
+
+    /**
+     * Finalize all statements in the cache. Statements in use are finalized
+     * when they are released.
+     */
+    void Clear();
+
+    /**
+     * Clear the cache if the session of the connection changed (like when
+     * the connection was re-established).
+     * @param sessionID ID of the current session of the connection.
+     */
+    void SetSession(uint64_t sessionID);
+
+    /**
+     * Get the counters for the cache.
+     * @return Counters for the cache.
+     */
+    Stats GetStats();
+
+private:
+    friend class DatabaseQuery;
+
+    /**
+     * Reset a statement and return it to the cache (or finalize it if it
+     * can't be reused or the cache was cleared since it was taken).
+     * @param key Key of the statement.
+     * @param generation Value of @ref mGeneration when the statement was
+     *  handed out.
+     * @param pImpl Statement to return.
+     */
+    void Release(const std::string& key, uint64_t generation,
+        DatabaseQueryImpl *pImpl);
+
+    /// Statement waiting in the cache with its key.
+    typedef std::pair<std::string, DatabaseQueryImpl*> Entry_t;
+
+    /// Maximum number of statements kept in the cache.
+    size_t mMaxSize;
+
+    /// Lock for the members below.
+    std::mutex mLock;
+
+    /// Statements in the cache with the most recently used first.
+    std::list<Entry_t> mEntries;
+
+    /// Statements in the cache by key.
+    std::unordered_map<std::string, std::list<Entry_t>::iterator> mIndex;
+
+    /// Incremented each time the cache is cleared.
+    uint64_t mGeneration;
+
+    /// ID of the session of the connection the statements belong to.
+    uint64_t mSessionID;
+
+    /// Counters for the cache (size is filled in by @ref GetStats).
+    Stats mStats;
+};
+
+} // namespace libcomp
+
+#endif // !EXOTIC_PLATFORM
+
+#endif // LIBCOMP_SRC_DATABASESTATEMENTCACHE_H
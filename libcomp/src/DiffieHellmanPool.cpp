@@ -0,0 +1,248 @@
+/**
+ * @file libcomp/src/DiffieHellmanPool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of pre-generated Diffie-Hellman key pairs.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DiffieHellmanPool.h"
+
+// libcomp Includes
+#include "Log.h"
+
+// Standard C++11 Includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+using namespace libcomp;
+
+/**
+ * Pools created by @ref DiffieHellmanPool::Create.
+ */
+struct DiffieHellmanPoolRegistry
+{
+    /// Lock for the pools.
+    std::mutex lock;
+
+    /// Pool for each prime. The owner of the pool keeps it alive.
+    std::unordered_map<std::string, std::weak_ptr<DiffieHellmanPool>> pools;
+};
+
+/**
+ * Get the registry of pools.
+ * @returns Registry of pools.
+ */
+static DiffieHellmanPoolRegistry& GetRegistry()
+{
+    static DiffieHellmanPoolRegistry registry;
+
+    return registry;
+}
+
+DiffieHellmanPool::DiffieHellmanPool(const String& prime, size_t size,
+    size_t threadCount) : mPrime(prime), mSize(size), mStopped(false)
+{
+    memset(&mStats, 0, sizeof(mStats));
+
+    mReady.reserve(size);
+
+    for(size_t i = 0; i < std::max(threadCount, (size_t)1); ++i)
+    {
+        mThreads.emplace_back([this]()
+        {
+#if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+            pthread_setname_np(pthread_self(), "crypto");
+#endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+
+            Run();
+        });
+    }
+}
+
+DiffieHellmanPool::~DiffieHellmanPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        mStopped = true;
+    }
+
+    mWorkCondition.notify_all();
+
+    for(auto& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+std::shared_ptr<DiffieHellmanPool> DiffieHellmanPool::Create(
+    const String& prime, size_t size, size_t threadCount)
+{
+    auto pool = std::make_shared<DiffieHellmanPool>(prime, size,
+        threadCount);
+
+    auto& registry = GetRegistry();
+
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    registry.pools[prime.ToUtf8()] = pool;
+
+    return pool;
+}
+
+std::shared_ptr<DiffieHellmanPool> DiffieHellmanPool::GetPool(
+    const String& prime)
+{
+    auto& registry = GetRegistry();
+
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    auto it = registry.pools.find(prime.ToUtf8());
+
+    if(registry.pools.end() == it)
+    {
+        return nullptr;
+    }
+
+    return it->second.lock();
+}
+
+std::shared_ptr<Crypto::DiffieHellman> DiffieHellmanPool::Take()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        if(!mReady.empty())
+        {
+            auto diffieHellman = mReady.back();
+            mReady.pop_back();
+
+            mStats.hits++;
+
+            // Have a crypto thread replace the key pair.
+            mWorkCondition.notify_one();
+
+            return diffieHellman;
+        }
+
+        mStats.misses++;
+    }
+
+    return Generate();
+}
+
+void DiffieHellmanPool::QueueSecret(const std::shared_ptr<
+    Crypto::DiffieHellman>& diffieHellman, const String& otherPublic,
+    const SecretCallback_t& callback)
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        mSecretJobs.push_back({ diffieHellman, otherPublic, callback });
+    }
+
+    mWorkCondition.notify_one();
+}
+
+void DiffieHellmanPool::RecordHandshake(uint64_t microseconds)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+
+    mStats.handshakes++;
+    mStats.handshakeMicroseconds += microseconds;
+    mStats.maxHandshakeMicroseconds = std::max(
+        mStats.maxHandshakeMicroseconds, microseconds);
+}
+
+DiffieHellmanPool::Stats DiffieHellmanPool::GetStats()
+{
+    std::lock_guard<std::mutex> guard(mLock);
+
+    Stats stats = mStats;
+    stats.depth = mReady.size();
+
+    return stats;
+}
+
+std::shared_ptr<Crypto::DiffieHellman> DiffieHellmanPool::Generate() const
+{
+    auto diffieHellman = std::make_shared<Crypto::DiffieHellman>(mPrime);
+
+    if(!diffieHellman->IsValid() || diffieHellman->GeneratePublic().IsEmpty())
+    {
+        LogCryptoErrorMsg("Failed to generate a Diffie-Hellman key pair.\n");
+
+        return nullptr;
+    }
+
+    return diffieHellman;
+}
+
+void DiffieHellmanPool::Run()
+{
+    std::unique_lock<std::mutex> uniqueLock(mLock);
+
+    while(!mStopped)
+    {
+        // Secrets come first since a connection is waiting on each one.
+        if(!mSecretJobs.empty())
+        {
+            SecretJob job = std::move(mSecretJobs.front());
+            mSecretJobs.pop_front();
+
+            mStats.secrets++;
+
+            uniqueLock.unlock();
+
+            auto secret = job.diffieHellman->GenerateSecret(job.otherPublic);
+
+            job.callback(secret);
+
+            uniqueLock.lock();
+        }
+        else if(mReady.size() < mSize)
+        {
+            uniqueLock.unlock();
+
+            auto diffieHellman = Generate();
+
+            uniqueLock.lock();
+
+            if(!diffieHellman)
+            {
+                // Don't spin if the prime is bad.
+                mWorkCondition.wait_for(uniqueLock, std::chrono::seconds(1));
+            }
+            else if(mReady.size() < mSize)
+            {
+                mReady.push_back(diffieHellman);
+                mStats.generated++;
+            }
+        }
+        else
+        {
+            mWorkCondition.wait(uniqueLock);
+        }
+    }
+}
@@ -0,0 +1,213 @@
+/**
+ * @file libcomp/src/DiffieHellmanPool.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of pre-generated Diffie-Hellman key pairs.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_DIFFIEHELLMANPOOL_H
+#define LIBCOMP_SRC_DIFFIEHELLMANPOOL_H
+
+// libcomp Includes
+#include "CString.h"
+#include "Crypto.h"
+
+// Standard C++11 Includes
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libcomp
+{
+
+/**
+ * Keeps a supply of Diffie-Hellman key pairs with their public key already
+ * generated so a new connection does not have to wait for the modular
+ * exponentiation on the network thread. The crypto threads of the pool
+ * also derive the shared secrets of the key exchanges. A pool is created
+ * for a prime and @ref TcpServer::LoadDiffieHellman takes key pairs from
+ * it when one exists.
+ */
+class DiffieHellmanPool
+{
+public:
+    /**
+     * Counters for the pool.
+     */
+    struct Stats
+    {
+        /// Number of key pairs ready to be handed out.
+        uint64_t depth;
+
+        /// Number of key pairs generated by the crypto threads.
+        uint64_t generated;
+
+        /// Number of key pairs handed out from the pool.
+        uint64_t hits;
+
+        /// Number of key pairs generated on the spot because the pool was
+        /// empty.
+        uint64_t misses;
+
+        /// Number of shared secrets derived by the crypto threads.
+        uint64_t secrets;
+
+        /// Number of key exchanges completed.
+        uint64_t handshakes;
+
+        /// Total time of the completed key exchanges (microseconds).
+        uint64_t handshakeMicroseconds;
+
+        /// Longest key exchange (microseconds).
+        uint64_t maxHandshakeMicroseconds;
+    };
+
+    /**
+     * Function called with the shared secret of a key exchange (or an
+     * empty vector on error). It is called on a crypto thread.
+     */
+    typedef std::function<void(const std::vector<char>&)> SecretCallback_t;
+
+    /**
+     * Create the pool and start the crypto threads.
+     * @param prime Prime of the key pairs in big endian hex.
+     * @param size Number of key pairs to keep ready.
+     * @param threadCount Number of crypto threads.
+     */
+    DiffieHellmanPool(const String& prime, size_t size,
+        size_t threadCount = 1);
+
+    /**
+     * Stop the crypto threads. Secrets still queued are dropped.
+     */
+    ~DiffieHellmanPool();
+
+    /**
+     * Create a pool and make it the pool for its prime.
+     * @param prime Prime of the key pairs in big endian hex.
+     * @param size Number of key pairs to keep ready.
+     * @param threadCount Number of crypto threads.
+     * @returns New pool.
+     */
+    static std::shared_ptr<DiffieHellmanPool> Create(const String& prime,
+        size_t size, size_t threadCount = 1);
+
+    /**
+     * Get the pool for a prime.
+     * @param prime Prime of the key pairs in big endian hex.
+     * @returns Pool for the prime or null if there is none.
+     */
+    static std::shared_ptr<DiffieHellmanPool> GetPool(const String& prime);
+
+    /**
+     * Take a key pair with its public key generated. If the pool is empty
+     * the key pair is generated on the calling thread.
+     * @returns Key pair or null on error.
+     */
+    std::shared_ptr<Crypto::DiffieHellman> Take();
+
+    /**
+     * Derive the shared secret of a key exchange on a crypto thread.
+     * @param diffieHellman Key pair of this side of the exchange. It must
+     *   not be used until the callback is called.
+     * @param otherPublic Public key of the other side.
+     * @param callback Function given the shared secret.
+     */
+    void QueueSecret(const std::shared_ptr<Crypto::DiffieHellman>&
+        diffieHellman, const String& otherPublic,
+        const SecretCallback_t& callback);
+
+    /**
+     * Record the time a key exchange took.
+     * @param microseconds Time from the start of the exchange until the
+     *   connection was encrypted.
+     */
+    void RecordHandshake(uint64_t microseconds);
+
+    /**
+     * Get the counters for the pool.
+     * @returns Counters for the pool.
+     */
+    Stats GetStats();
+
+private:
+    /**
+     * Shared secret waiting for a crypto thread.
+     */
+    struct SecretJob
+    {
+        /// Key pair of this side of the exchange.
+        std::shared_ptr<Crypto::DiffieHellman> diffieHellman;
+
+        /// Public key of the other side.
+        String otherPublic;
+
+        /// Function given the shared secret.
+        SecretCallback_t callback;
+    };
+
+    /**
+     * Generate a key pair and its public key.
+     * @returns Key pair or null on error.
+     */
+    std::shared_ptr<Crypto::DiffieHellman> Generate() const;
+
+    /**
+     * Main loop of a crypto thread.
+     */
+    void Run();
+
+    /// Prime of the key pairs.
+    String mPrime;
+
+    /// Number of key pairs to keep ready.
+    size_t mSize;
+
+    /// Lock for the members below.
+    std::mutex mLock;
+
+    /// Signaled when there is work for the crypto threads.
+    std::condition_variable mWorkCondition;
+
+    /// Key pairs ready to be handed out.
+    std::vector<std::shared_ptr<Crypto::DiffieHellman>> mReady;
+
+    /// Shared secrets waiting for a crypto thread.
+    std::list<SecretJob> mSecretJobs;
+
+    /// Set when the crypto threads should stop.
+    bool mStopped;
+
+    /// Counters for the pool (depth is filled in by @ref GetStats).
+    Stats mStats;
+
+    /// Crypto threads.
+    std::vector<std::thread> mThreads;
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_DIFFIEHELLMANPOOL_H
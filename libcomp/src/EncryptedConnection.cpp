@@ -27,8 +27,11 @@
 #include "EncryptedConnection.h"
 
 // libcomp Includes
+#include "CaptureWriter.h"
 #include "Constants.h"
 #include "Crypto.h"
+#include "DiffieHellmanPool.h"
+#include "Endian.h"
 #include "Exception.h"
 #include "Log.h"
 #include "MessageConnectionClosed.h"
@@ -40,29 +43,29 @@
 #include <ServerConfig.h>
 
 // Standard C++11 Includes
+#include <cstring>
 #include <ctime>
 
 using namespace libcomp;
 
 EncryptedConnection::EncryptedConnection(asio::io_service& io_service) :
     libcomp::TcpConnection(io_service), mPacketParser(nullptr),
-    mCaptureFile(nullptr)
+    mCaptureID(0)
 {
 }
 
 EncryptedConnection::EncryptedConnection(asio::ip::tcp::socket& socket,
     const std::shared_ptr<Crypto::DiffieHellman>& diffieHellman) :
     libcomp::TcpConnection(socket, diffieHellman), mPacketParser(nullptr),
-    mCaptureFile(nullptr)
+    mCaptureID(0)
 {
 }
 
 EncryptedConnection::~EncryptedConnection()
 {
-    if(nullptr != mCaptureFile)
+    if(mCaptureWriter)
     {
-        delete mCaptureFile;
-        mCaptureFile = nullptr;
+        mCaptureWriter->CloseCapture(mCaptureID);
     }
 }
 
@@ -155,72 +158,24 @@ void EncryptedConnection::ConnectionEncrypted()
 
         if(!capturePath.IsEmpty())
         {
-            std::time_t now = std::time(nullptr);
-            std::tm *pTM = std::localtime(&now);
-
-            char szTimeStamp[32];
-            std::memset(szTimeStamp, 0, sizeof(szTimeStamp));
-
-            std::strftime(szTimeStamp, sizeof(szTimeStamp),
-                "%Y%m%d%H%M%S", pTM);
+#ifdef EXOTIC_PLATFORM
+            uint64_t maxFileSize = 0;
+            uint32_t sampleRate = 1;
+#else // !EXOTIC_PLATFORM
+            uint64_t maxFileSize = static_cast<uint64_t>(
+                mServerConfig->GetCaptureMaxFileSize()) * 1024 * 1024;
+            uint32_t sampleRate = mServerConfig->GetCaptureSampleRate();
+#endif // !EXOTIC_PLATFORM
 
-            auto captureFilePath = libcomp::String("%1/%2-%3-%4.hack").Arg(
-                capturePath).Arg(szTimeStamp).Arg(
-                GetRemoteAddress()).Arg(rand());
+            // The writer thread opens and writes the file.
+            auto writer = CaptureWriter::GetWriter(capturePath, maxFileSize,
+                sampleRate);
 
-            mCaptureFile = new std::ofstream();
-            mCaptureFile->open(captureFilePath.C(), std::ofstream::binary);
+            mCaptureID = writer->OpenCapture(GetRemoteAddress());
 
-            if(!mCaptureFile->good())
+            if(0 != mCaptureID)
             {
-                delete mCaptureFile;
-                mCaptureFile = nullptr;
-
-                LogConnectionCritical([&]()
-                {
-                    return String("Failed to open capture file: %1\n")
-                        .Arg(captureFilePath);
-                });
-            }
-            else
-            {
-                auto remoteAddress = GetRemoteAddress();
-
-                uint32_t magic = HACK_FORMAT_MAGIC;
-                uint32_t version = HACK_FORMAT_VER2;
-                uint64_t stamp = static_cast<uint64_t>(now);
-                uint32_t addrlen = static_cast<uint32_t>(remoteAddress.Size());
-
-                // Write the header.
-                mCaptureFile->write(reinterpret_cast<char*>(&magic),
-                    sizeof(magic));
-                mCaptureFile->write(reinterpret_cast<char*>(&version),
-                    sizeof(version));
-                mCaptureFile->write(reinterpret_cast<char*>(&stamp),
-                    sizeof(stamp));
-                mCaptureFile->write(reinterpret_cast<char*>(&addrlen),
-                    sizeof(addrlen));
-                mCaptureFile->write(remoteAddress.C(),
-                    addrlen);
-                mCaptureFile->flush();
-
-                if(!mCaptureFile->good())
-                {
-                    LogConnectionCritical([&]()
-                    {
-                        return String("Failed to write capture file: %1\n")
-                            .Arg(captureFilePath);
-                    });
-
-                    delete mCaptureFile;
-                    mCaptureFile = nullptr;
-                }
-
-                LogConnectionDebug([&]()
-                {
-                    return String("Started capture: %1\n")
-                        .Arg(captureFilePath);
-                });
+                mCaptureWriter = writer;
             }
         }
     }
@@ -262,8 +217,26 @@ void EncryptedConnection::SendMessage(const std::function<
         messageQueue->Enqueue(messageAllocFunction(self));
     }
 
+    // Read whole batches of packets unless the configuration says to read
+    // the sizes and data of each packet separately.
+    bool batchedReceive = true;
+
+#ifndef EXOTIC_PLATFORM
+    if(nullptr != mServerConfig.get())
+    {
+        batchedReceive = mServerConfig->GetBatchedReceive();
+    }
+#endif // !EXOTIC_PLATFORM
+
+    if(batchedReceive)
+    {
+        if(!RequestStream())
+        {
+            SocketError("Failed to request more data.");
+        }
+    }
     // Start reading until we have the packet sizes.
-    if(!RequestPacket(2 * sizeof(uint32_t)))
+    else if(!RequestPacket(2 * sizeof(uint32_t)))
     {
         SocketError("Failed to request more data.");
     }
@@ -425,6 +398,7 @@ void EncryptedConnection::ParseServerEncryptionStart(libcomp::Packet& packet)
         if(0 == packet.Left() && 1 == first && 8 == second)
         {
             mStatus = STATUS_WAITING_ENCRYPTION;
+            mHandshakeStart = std::chrono::steady_clock::now();
 
             libcomp::Packet reply;
 
@@ -510,32 +484,30 @@ void EncryptedConnection::ParseServerEncryptionFinish(libcomp::Packet& packet)
         // Make sure we read the entire packet.
         if(status && 0 == packet.Left())
         {
-            std::vector<char> sharedData = GenerateDiffieHellmanSharedData(
-                mDiffieHellman, clientPublic);
+            // Get ready for the next packet.
+            packet.Clear();
 
-            if(BF_NET_KEY_BYTE_SIZE != sharedData.size())
-            {
-                // Get ready for the next packet.
-                packet.Clear();
+            auto pool = DiffieHellmanPool::GetPool(GetDiffieHellmanPrime(
+                mDiffieHellman));
+            auto self = shared_from_this();
 
-                SocketError("Failed to generate shared data.");
+            if(pool && self)
+            {
+                // Generate the shared data on a crypto thread and finish on
+                // the network thread. Nothing is read until then.
+                pool->QueueSecret(mDiffieHellman, clientPublic,
+                    [this, self](const std::vector<char>& sharedData)
+                    {
+                        Post([this, self, sharedData]()
+                        {
+                            FinishServerEncryption(sharedData);
+                        });
+                    });
             }
             else
             {
-                // Set the encryption key.
-                SetEncryptionKey(sharedData);
-
-                // We are now encrypted.
-                mStatus = STATUS_ENCRYPTED;
-
-                // Use this packet parser now.
-                mPacketParser = &EncryptedConnection::ParsePacket;
-
-                // Get ready for the next packet.
-                packet.Clear();
-
-                // Callback.
-                ConnectionEncrypted();
+                FinishServerEncryption(GenerateDiffieHellmanSharedData(
+                    mDiffieHellman, clientPublic));
             }
         }
         else if(status)
@@ -548,6 +520,45 @@ void EncryptedConnection::ParseServerEncryptionFinish(libcomp::Packet& packet)
     }
 }
 
+void EncryptedConnection::FinishServerEncryption(
+    const std::vector<char>& sharedData)
+{
+    // The connection may have been closed in the meantime.
+    if(STATUS_WAITING_ENCRYPTION != GetStatus())
+    {
+        return;
+    }
+
+    if(BF_NET_KEY_BYTE_SIZE != sharedData.size())
+    {
+        SocketError("Failed to generate shared data.");
+
+        return;
+    }
+
+    // Set the encryption key.
+    SetEncryptionKey(sharedData);
+
+    // We are now encrypted.
+    mStatus = STATUS_ENCRYPTED;
+
+    // Use this packet parser now.
+    mPacketParser = &EncryptedConnection::ParsePacket;
+
+    auto pool = DiffieHellmanPool::GetPool(GetDiffieHellmanPrime(
+        mDiffieHellman));
+
+    if(pool)
+    {
+        pool->RecordHandshake(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mHandshakeStart).count()));
+    }
+
+    // Callback.
+    ConnectionEncrypted();
+}
+
 void EncryptedConnection::ParsePacket(libcomp::Packet& packet)
 {
     (void)packet;
@@ -611,36 +622,16 @@ void EncryptedConnection::ParsePacket(libcomp::Packet& packet,
     mEncryptionKey.DecryptPacket(packet);
 
     // Save the packet to the capture.
-    if(nullptr != mCaptureFile)
+    if(mCaptureWriter)
     {
-        std::time_t now = std::time(nullptr);
+        CaptureRecord *pRecord = mCaptureWriter->CreateRecord(mCaptureID,
+            HACK_SOURCE_CLIENT, packet.Size());
 
-        uint8_t source = HACK_SOURCE_CLIENT;
-        uint64_t stamp = static_cast<uint64_t>(now);
-        uint64_t microtime = static_cast<uint64_t>(
-            std::chrono::time_point_cast<std::chrono::microseconds>(
-                std::chrono::steady_clock::now()
-            ).time_since_epoch().count());
-        uint32_t size = packet.Size();
-
-        mCaptureFile->write(reinterpret_cast<char*>(&source),
-            sizeof(source));
-        mCaptureFile->write(reinterpret_cast<char*>(&stamp),
-            sizeof(stamp));
-        mCaptureFile->write(reinterpret_cast<char*>(&microtime),
-            sizeof(microtime));
-        mCaptureFile->write(reinterpret_cast<char*>(&size),
-            sizeof(size));
-        mCaptureFile->write(packet.ConstData(),
-            size);
-        mCaptureFile->flush();
-
-        if(!mCaptureFile->good())
+        if(nullptr != pRecord)
         {
-            LogConnectionCriticalMsg("Failed to write capture file.\n");
+            memcpy(pRecord->Data(), packet.ConstData(), pRecord->Size());
 
-            delete mCaptureFile;
-            mCaptureFile = nullptr;
+            mCaptureWriter->QueueRecord(pRecord);
         }
     }
 
@@ -788,6 +779,71 @@ void EncryptedConnection::PacketReceived(libcomp::Packet& packet)
     }
 }
 
+size_t EncryptedConnection::StreamReceived(const char *pData, size_t size)
+{
+    if(STATUS_ENCRYPTED != GetStatus())
+    {
+        SocketError("Connection should be encrypted but isn't.");
+
+        return size;
+    }
+
+    size_t consumed = 0;
+
+    try
+    {
+        // Parse every complete packet in the stream.
+        while(STATUS_ENCRYPTED == GetStatus() &&
+            (2 * sizeof(uint32_t)) <= (size - consumed))
+        {
+            const char *pPacket = pData + consumed;
+
+            // Read the sizes.
+            uint32_t paddedSize, realSize;
+
+            std::memcpy(&paddedSize, pPacket, sizeof(paddedSize));
+            std::memcpy(&realSize, pPacket + sizeof(paddedSize),
+                sizeof(realSize));
+
+            paddedSize = be32toh(paddedSize);
+            realSize = be32toh(realSize);
+
+            if((MAX_PACKET_SIZE - 2 * sizeof(uint32_t)) < paddedSize)
+            {
+                SocketError("Corrupt packet (too much data).");
+
+                break;
+            }
+
+            // The sizes are not included in the padded size.
+            uint32_t packetSize = paddedSize +
+                2 * static_cast<uint32_t>(sizeof(uint32_t));
+
+            // Wait for the rest of the packet.
+            if(packetSize > (size - consumed))
+            {
+                break;
+            }
+
+            libcomp::Packet packet(pPacket, packetSize);
+
+            consumed += packetSize;
+
+            // We have a full packet, handle it now.
+            ParsePacket(packet, paddedSize, realSize);
+        }
+    }
+    catch(libcomp::Exception& e)
+    {
+        e.Log();
+
+        // This connection is now bad; kill it.
+        SocketError();
+    }
+
+    return consumed;
+}
+
 void EncryptedConnection::SetMessageQueue(const std::weak_ptr<
     MessageQueue<libcomp::Message::Message*>>& messageQueue)
 {
@@ -806,21 +862,15 @@ void EncryptedConnection::PreparePackets(std::list<ReadOnlyPacket>& packets)
     {
         Packet finalPacket;
 
-        // Reserve space for the sizes.
-        finalPacket.WriteBlank(GetHeaderSize());
-
-        // Now add the packet data.
-        for(auto& packet : packets)
+        if(BuildFrame(packets, finalPacket))
         {
-            finalPacket.WriteU16Big((uint16_t)(packet.Size() + 2));
-            finalPacket.WriteU16Little((uint16_t)(packet.Size() + 2));
-            finalPacket.WriteArray(packet.ConstData(), packet.Size());
+            FinishFrame(finalPacket);
+        }
+        else
+        {
+            // We should never get here.
+            SocketError();
         }
-
-        // Encrypt the packet
-        mEncryptionKey.EncryptPacket(finalPacket);
-
-        mOutgoing = finalPacket;
     }
     else if(STATUS_NOT_CONNECTED != mStatus)
     {
@@ -836,37 +886,84 @@ void EncryptedConnection::PreparePackets(std::list<ReadOnlyPacket>& packets)
     }
 }
 
+bool EncryptedConnection::BuildFrame(std::list<ReadOnlyPacket>& packets,
+    Packet& frame)
+{
+    if(STATUS_ENCRYPTED != mStatus)
+    {
+        return false;
+    }
+
+    uint32_t headerSize = GetHeaderSize();
+
+    // Allocate a buffer big enough for the packet and padding so it is
+    // never grown while writing.
+    frame.Allocate(GetFrameCapacity(headerSize, packets));
+
+    // Reserve space for the sizes.
+    frame.WriteBlank(headerSize);
+
+    // Now add the packet data.
+    for(auto& packet : packets)
+    {
+        frame.WriteU16Big((uint16_t)(packet.Size() + 2));
+        frame.WriteU16Little((uint16_t)(packet.Size() + 2));
+        frame.WriteArray(packet.ConstData(), packet.Size());
+    }
+
+    return true;
+}
+
+void EncryptedConnection::FinishFrame(Packet& frame)
+{
+    // Encrypt the packet
+    mEncryptionKey.EncryptPacket(frame);
+
+    mOutgoing = frame;
+}
+
+bool EncryptedConnection::QueueSharedFrame(ReadOnlyPacket& frame)
+{
+    if(STATUS_ENCRYPTED != mStatus)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mOutgoingMutex);
+
+    mOutgoingPackets.emplace_back(frame, true);
+
+    return true;
+}
+
 std::list<ReadOnlyPacket> EncryptedConnection::GetCombinedPackets()
 {
     std::list<ReadOnlyPacket> packets;
 
     std::lock_guard<std::mutex> guard(mOutgoingMutex);
 
-    if(!mSendingPacket)
-    {
-        uint32_t totalSize = GetHeaderSize();
+    uint32_t totalSize = GetHeaderSize();
 
-        while(!mOutgoingPackets.empty() && totalSize < MAX_PACKET_SIZE)
-        {
-            ReadOnlyPacket& nextPacket = mOutgoingPackets.front();
+    // Stop at a shared frame as it is sent on its own.
+    while(!mOutgoingPackets.empty() && !mOutgoingPackets.front().sharedFrame &&
+        totalSize < MAX_PACKET_SIZE)
+    {
+        ReadOnlyPacket& nextPacket = mOutgoingPackets.front().packet;
 
-            uint32_t packetSize = nextPacket.Size() + 2 *
-                static_cast<uint32_t>(sizeof(uint16_t));
+        uint32_t packetSize = nextPacket.Size() + 2 *
+            static_cast<uint32_t>(sizeof(uint16_t));
 
-            if((totalSize + packetSize) < MAX_PACKET_SIZE)
-            {
-                totalSize += packetSize;
-                packets.push_back(mOutgoingPackets.front());
-                mOutgoingPackets.pop_front();
-            }
-            else
-            {
-                // Stop parsing new packets.
-                break;
-            }
+        if((totalSize + packetSize) < MAX_PACKET_SIZE)
+        {
+            totalSize += packetSize;
+            packets.push_back(nextPacket);
+            mOutgoingPackets.pop_front();
+        }
+        else
+        {
+            // Stop parsing new packets.
+            break;
         }
-
-        mSendingPacket = !packets.empty();
     }
 
     return packets;
@@ -876,3 +973,18 @@ uint32_t EncryptedConnection::GetHeaderSize()
 {
     return 2 * sizeof(uint32_t);
 }
+
+uint32_t EncryptedConnection::GetFrameCapacity(uint32_t headerSize,
+    const std::list<ReadOnlyPacket>& packets)
+{
+    uint32_t capacity = headerSize + static_cast<uint32_t>(
+        BLOWFISH_BLOCK_SIZE);
+
+    for(auto& packet : packets)
+    {
+        capacity += packet.Size() + 2 * static_cast<uint32_t>(
+            sizeof(uint16_t));
+    }
+
+    return capacity < MAX_PACKET_SIZE ? capacity : MAX_PACKET_SIZE;
+}
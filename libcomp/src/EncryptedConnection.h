@@ -32,7 +32,7 @@
 #include "TcpConnection.h"
 
 // Standard C++11 Includes
-#include <fstream>
+#include <chrono>
 #include <functional>
 
 namespace objects
@@ -45,6 +45,8 @@ class ServerConfig;
 namespace libcomp
 {
 
+class CaptureWriter;
+
 namespace Message
 {
 
@@ -244,6 +246,15 @@ protected:
      */
     void ParseServerEncryptionFinish(libcomp::Packet& packet);
 
+    /**
+     * Finish the key exchange started by @ref ParseServerEncryptionFinish
+     * once the shared private has been generated. When a
+     * @ref DiffieHellmanPool is used this is called on the network thread
+     * after a crypto thread generated the shared private.
+     * @param sharedData Shared private of the key exchange.
+     */
+    void FinishServerEncryption(const std::vector<char>& sharedData);
+
     /**
      * Parse incoming encrypted packet data. This will buffer all incoming
      * data. It will then peek at the first 8 bytes to determine the size of
@@ -294,6 +305,15 @@ protected:
      */
     virtual void PacketReceived(libcomp::Packet& packet);
 
+    /**
+     * Called after stream data has been received from the remote host. This
+     * will parse every complete packet in the stream.
+     * @param pData Pointer to the data in the stream buffer.
+     * @param size Number of bytes in the stream buffer.
+     * @return Number of bytes consumed from the start of the buffer.
+     */
+    virtual size_t StreamReceived(const char *pData, size_t size);
+
     /**
      * Called to prepare packets before they are sent to the remote host. This
      * will combine commands into a single over the wire packet. It will then
@@ -303,6 +323,29 @@ protected:
      */
     virtual void PreparePackets(std::list<ReadOnlyPacket>& packets);
 
+    /**
+     * Combine the packets into a single unencrypted frame with room for the
+     * header at the start.
+     * @param packets List of packets to combine into the frame.
+     * @param frame Packet to write the frame into.
+     * @return true if the frame was built; false otherwise.
+     */
+    virtual bool BuildFrame(std::list<ReadOnlyPacket>& packets,
+        Packet& frame);
+
+    /**
+     * Encrypt a frame built by @ref BuildFrame.
+     * @param frame Frame to encrypt.
+     */
+    virtual void FinishFrame(Packet& frame);
+
+    /**
+     * Queue a shared frame if the connection is encrypted.
+     * @param frame Frame to queue.
+     * @return true if the frame was queued; false otherwise.
+     */
+    virtual bool QueueSharedFrame(ReadOnlyPacket& frame);
+
     /**
      * Decompress a packet. This base implementation does nothing as only some
      * connections support this part of the protocol.
@@ -319,7 +362,8 @@ protected:
         uint32_t& paddedSize, uint32_t& realSize, uint32_t& dataStart);
 
     /**
-     * Returns a list of packets that have been combined.
+     * Returns a list of packets that have been combined. This will return
+     * as many queued packets as fit into a single frame.
      * @return List of packet that have been combined.
      */
     virtual std::list<ReadOnlyPacket> GetCombinedPackets();
@@ -330,6 +374,16 @@ protected:
      */
     virtual uint32_t GetHeaderSize();
 
+    /**
+     * Calculate the buffer size needed to combine packets into a single
+     * frame including the header and padding.
+     * @param headerSize Size of the frame header.
+     * @param packets Packets that will be combined.
+     * @return Buffer size needed for the frame.
+     */
+    static uint32_t GetFrameCapacity(uint32_t headerSize,
+        const std::list<ReadOnlyPacket>& packets);
+
     /// Active parse being used for received packets.
     PacketParser_t mPacketParser;
 
@@ -339,8 +393,14 @@ protected:
     /// Server configuration.
     std::shared_ptr<objects::ServerConfig> mServerConfig;
 
-    /// File to save a capture to.
-    std::ofstream *mCaptureFile;
+    /// Writer for the capture of this connection.
+    std::shared_ptr<CaptureWriter> mCaptureWriter;
+
+    /// ID of the capture of this connection.
+    uint32_t mCaptureID;
+
+    /// Time the client started the key exchange.
+    std::chrono::steady_clock::time_point mHandshakeStart;
 };
 
 } // namespace libcomp
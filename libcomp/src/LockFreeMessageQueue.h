@@ -0,0 +1,521 @@
+/**
+ * @file libcomp/src/LockFreeMessageQueue.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Lock-free multi-producer, single-consumer message queue.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_LOCKFREEMESSAGEQUEUE_H
+#define LIBCOMP_SRC_LOCKFREEMESSAGEQUEUE_H
+
+// Standard C++11 Includes
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libcomp
+{
+
+/**
+ * Unbounded multi-producer, single-consumer version of the message queue.
+ * Producers link a node onto the queue with a single atomic exchange so
+ * they never wait on each other or on the consumer. The consumer only
+ * takes a lock when the queue is empty and it has to go to sleep. A
+ * producer only touches that lock if it sees the consumer is asleep.
+ *
+ * Only one thread may call @ref Dequeue, @ref DequeueAll and
+ * @ref DequeueAny at a time. Any number of threads may call
+ * @ref Enqueue.
+ *
+ * Nodes are reused instead of being allocated for each message. Each
+ * thread keeps a small cache of free nodes and moves them to and from a
+ * shared depot in batches. The consumer frees the nodes and the producers
+ * allocate them, so most nodes pass through the depot.
+ */
+template<class T>
+class LockFreeMessageQueue
+{
+public:
+    /**
+     * Create an empty queue.
+     */
+    LockFreeMessageQueue() : mHead(new Node), mSleeping(false)
+    {
+        mTail = mHead.load();
+    }
+
+    /**
+     * Free any nodes left in the queue.
+     */
+    ~LockFreeMessageQueue()
+    {
+        while(nullptr != mTail)
+        {
+            Node *pNext = mTail->next.load(std::memory_order_relaxed);
+            FreeNode(mTail);
+            mTail = pNext;
+        }
+    }
+
+    /**
+     * Enqueue a message.
+     * @param Message to add
+     */
+    void Enqueue(T item)
+    {
+        Node *pNode = AllocateNode(std::move(item));
+
+        Link(pNode, pNode, 1);
+    }
+
+    /**
+     * Enqueue multiple messages.
+     * @param Messages to add
+     */
+    void Enqueue(std::list<T>& items)
+    {
+        if(items.empty())
+        {
+            return;
+        }
+
+        // Build the chain first so it is added with a single exchange.
+        Node *pFirst = nullptr;
+        Node *pLast = nullptr;
+        size_t count = items.size();
+
+        for(auto& item : items)
+        {
+            Node *pNode = AllocateNode(std::move(item));
+
+            if(nullptr == pLast)
+            {
+                pFirst = pNode;
+            }
+            else
+            {
+                pLast->next.store(pNode, std::memory_order_relaxed);
+            }
+
+            pLast = pNode;
+        }
+
+        items.clear();
+
+        Link(pFirst, pLast, count);
+    }
+
+    /**
+     * Dequeue the first message added and wait if empty.
+     * @return The first message added
+     */
+    T Dequeue()
+    {
+        T item;
+
+        while(!Pop(item, true))
+        {
+            Wait();
+        }
+
+        return item;
+    }
+
+    /**
+     * Dequeue all the messages and wait if its empty.
+     * @param List to add the messages to
+     */
+    void DequeueAll(std::list<T>& destinationQueue)
+    {
+        Wait();
+
+        T item;
+
+        // Wait for the first message to finish linking but do not hold up
+        // the consumer for any message still being added after that.
+        if(Pop(item, true))
+        {
+            destinationQueue.push_back(std::move(item));
+
+            while(Pop(item, false))
+            {
+                destinationQueue.push_back(std::move(item));
+            }
+        }
+    }
+
+    /**
+     * Dequeue all the current messages.
+     * @param List to add the messages to
+     */
+    void DequeueAny(std::list<T>& destinationQueue)
+    {
+        T item;
+
+        while(Pop(item, false))
+        {
+            destinationQueue.push_back(std::move(item));
+        }
+    }
+
+    /**
+     * Set the functions to call when messages are added to the queue. This
+     * must be set before the queue is shared with other threads.
+     * @param reserveHandler Function given the number of messages about to
+     *  be added. It is called before a consumer can see the messages and
+     *  returns true if the enqueue handler should be called once they are
+     *  in the queue.
+     * @param handler Function to call after the messages are added
+     */
+    void SetEnqueueHandler(const std::function<bool(size_t)>& reserveHandler,
+        const std::function<void()>& handler)
+    {
+        mReserveHandler = reserveHandler;
+        mEnqueueHandler = handler;
+    }
+
+private:
+    /**
+     * Node holding a single message. The node at the tail of the queue is
+     * a placeholder that has already been dequeued.
+     */
+    struct Node
+    {
+        Node() : next(nullptr)
+        {
+        }
+
+        explicit Node(T&& value) : item(std::move(value)), next(nullptr)
+        {
+        }
+
+        /// Message stored in the node.
+        T item;
+
+        /// Next node in the queue.
+        std::atomic<Node*> next;
+    };
+
+    /**
+     * Free nodes shared by every thread. It is never destroyed so nodes
+     * freed while the program exits can still be returned to it.
+     */
+    struct NodeDepot
+    {
+        /// Lock for the depot
+        std::mutex lock;
+
+        /// Chains of free nodes (most are @ref NODE_BATCH_SIZE long)
+        std::vector<Node*> batches;
+    };
+
+    /**
+     * Free nodes cached by a single thread.
+     */
+    struct NodeCache
+    {
+        NodeCache() : pHead(nullptr), count(0)
+        {
+        }
+
+        /**
+         * Delete the cached nodes as the thread exits.
+         */
+        ~NodeCache()
+        {
+            NodeCacheDestroyed() = true;
+
+            while(nullptr != pHead)
+            {
+                Node *pNext = pHead->next.load(std::memory_order_relaxed);
+                delete pHead;
+                pHead = pNext;
+            }
+        }
+
+        /// First free node
+        Node *pHead;
+
+        /// Number of free nodes
+        size_t count;
+    };
+
+    /// Number of nodes moved between a thread cache and the depot at once.
+    static const size_t NODE_BATCH_SIZE = 64;
+
+    /// Number of times the consumer checks the queue again before it
+    /// sleeps on the condition.
+    static const int SPIN_COUNT = 64;
+
+    /**
+     * Link a chain of nodes onto the queue and wake the consumer.
+     * @param pFirst First node of the chain.
+     * @param pLast Last node of the chain.
+     * @param count Number of nodes in the chain.
+     */
+    void Link(Node *pFirst, Node *pLast, size_t count)
+    {
+        bool notify = mReserveHandler && mReserveHandler(count);
+
+        // The exchange orders the queue. The consumer can't see the chain
+        // until the previous node is pointed at it.
+        Node *pPrev = mHead.exchange(pLast);
+        pPrev->next.store(pFirst, std::memory_order_release);
+
+        // This load is ordered after the exchange above. The consumer sets
+        // the flag before it checks if the queue is empty so one of the
+        // two threads is guaranteed to see the other.
+        if(mSleeping.load())
+        {
+            std::lock_guard<std::mutex> guard(mWakeLock);
+            mWakeCondition.notify_one();
+        }
+
+        if(notify)
+        {
+            mEnqueueHandler();
+        }
+    }
+
+    /**
+     * Check if the queue is empty. Only the consumer may call this.
+     * @returns true if no message has been added; false otherwise.
+     */
+    bool IsEmpty() const
+    {
+        return mHead.load() == mTail;
+    }
+
+    /**
+     * Remove the first message from the queue. Only the consumer may call
+     * this.
+     * @param item Variable to move the message into.
+     * @param waitForLink If a producer has added a message but not linked
+     *   it yet, wait for it instead of returning.
+     * @returns true if a message was removed; false otherwise.
+     */
+    bool Pop(T& item, bool waitForLink)
+    {
+        Node *pTail = mTail;
+        Node *pNext = pTail->next.load(std::memory_order_acquire);
+
+        while(nullptr == pNext)
+        {
+            if(!waitForLink || IsEmpty())
+            {
+                return false;
+            }
+
+            // A producer is between the exchange and the link.
+            std::this_thread::yield();
+
+            pNext = pTail->next.load(std::memory_order_acquire);
+        }
+
+        // The next node becomes the new placeholder.
+        item = std::move(pNext->item);
+        pNext->item = T();
+        mTail = pNext;
+
+        FreeNode(pTail);
+
+        return true;
+    }
+
+    /**
+     * Get the shared node depot.
+     * @returns Shared node depot.
+     */
+    static NodeDepot& GetNodeDepot()
+    {
+        static NodeDepot *pDepot = new NodeDepot;
+
+        return *pDepot;
+    }
+
+    /**
+     * Get the flag set once the node cache of this thread is destroyed.
+     * This is trivially destructible so it can still be read while the
+     * thread is exiting.
+     * @returns Flag for this thread.
+     */
+    static bool& NodeCacheDestroyed()
+    {
+        static thread_local bool destroyed = false;
+
+        return destroyed;
+    }
+
+    /**
+     * Get the node cache of this thread. This must not be called once
+     * @ref NodeCacheDestroyed is set.
+     * @returns Node cache of this thread.
+     */
+    static NodeCache& GetNodeCache()
+    {
+        static thread_local NodeCache cache;
+
+        return cache;
+    }
+
+    /**
+     * Get a free node (or a new one if there are none) holding a message.
+     * @param item Message to store in the node.
+     * @returns Node holding the message.
+     */
+    static Node* AllocateNode(T&& item)
+    {
+        if(NodeCacheDestroyed())
+        {
+            return new Node(std::move(item));
+        }
+
+        NodeCache& cache = GetNodeCache();
+
+        if(nullptr == cache.pHead)
+        {
+            NodeDepot& depot = GetNodeDepot();
+
+            std::lock_guard<std::mutex> guard(depot.lock);
+
+            if(depot.batches.empty())
+            {
+                return new Node(std::move(item));
+            }
+
+            cache.pHead = depot.batches.back();
+            cache.count = NODE_BATCH_SIZE;
+            depot.batches.pop_back();
+        }
+
+        Node *pNode = cache.pHead;
+        cache.pHead = pNode->next.load(std::memory_order_relaxed);
+        cache.count--;
+
+        pNode->item = std::move(item);
+        pNode->next.store(nullptr, std::memory_order_relaxed);
+
+        return pNode;
+    }
+
+    /**
+     * Return a node that is no longer in any queue.
+     * @param pNode Node to free.
+     */
+    static void FreeNode(Node *pNode)
+    {
+        if(NodeCacheDestroyed())
+        {
+            delete pNode;
+
+            return;
+        }
+
+        // Let go of whatever the message held now instead of when the
+        // node is next used.
+        pNode->item = T();
+
+        NodeCache& cache = GetNodeCache();
+
+        pNode->next.store(cache.pHead, std::memory_order_relaxed);
+        cache.pHead = pNode;
+        cache.count++;
+
+        // Give a full batch to the depot so a thread that only frees nodes
+        // (like a consumer) does not hold on to all of them.
+        if((2 * NODE_BATCH_SIZE) <= cache.count)
+        {
+            Node *pBatch = cache.pHead;
+            Node *pLast = pBatch;
+
+            for(size_t i = 1; i < NODE_BATCH_SIZE; ++i)
+            {
+                pLast = pLast->next.load(std::memory_order_relaxed);
+            }
+
+            cache.pHead = pLast->next.load(std::memory_order_relaxed);
+            cache.count -= NODE_BATCH_SIZE;
+            pLast->next.store(nullptr, std::memory_order_relaxed);
+
+            NodeDepot& depot = GetNodeDepot();
+
+            std::lock_guard<std::mutex> guard(depot.lock);
+            depot.batches.push_back(pBatch);
+        }
+    }
+
+    /**
+     * Wait until the queue is not empty. Only the consumer may call this.
+     */
+    void Wait()
+    {
+        for(int i = 0; i < SPIN_COUNT && IsEmpty(); ++i)
+        {
+            std::this_thread::yield();
+        }
+
+        if(!IsEmpty())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> uniqueLock(mWakeLock);
+        mSleeping.store(true);
+
+        mWakeCondition.wait(uniqueLock, [this]()
+        {
+            return !IsEmpty();
+        });
+
+        mSleeping.store(false);
+    }
+
+    /// Last node added to the queue (written by the producers)
+    std::atomic<Node*> mHead;
+
+    /// Set while the consumer is waiting on the condition
+    std::atomic<bool> mSleeping;
+
+    /// Mutex lock to use when waiting for a message to be queued
+    std::mutex mWakeLock;
+
+    /// Blocking condition to wait for when no messages are queued. This
+    /// also keeps the producer and consumer sides on separate cache lines.
+    std::condition_variable mWakeCondition;
+
+    /// Placeholder node before the first message (owned by the consumer)
+    Node *mTail;
+
+    /// Function to call before messages are added
+    std::function<bool(size_t)> mReserveHandler;
+
+    /// Function to call after messages are added
+    std::function<void()> mEnqueueHandler;
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_LOCKFREEMESSAGEQUEUE_H
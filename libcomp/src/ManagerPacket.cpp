@@ -56,11 +56,13 @@ std::list<libcomp::Message::MessageType>
 
 bool ManagerPacket::ProcessMessage(const libcomp::Message::Message *pMessage)
 {
-    const libcomp::Message::Packet *pPacketMessage = dynamic_cast<
-        const libcomp::Message::Packet*>(pMessage);
-
-    if(nullptr != pPacketMessage)
+    // Only packet messages use the packet message type.
+    if(libcomp::Message::MessageType::MESSAGE_TYPE_PACKET ==
+        pMessage->GetType())
     {
+        const libcomp::Message::Packet *pPacketMessage = static_cast<
+            const libcomp::Message::Packet*>(pMessage);
+
         libcomp::ReadOnlyPacket p(pPacketMessage->GetPacket());
         p.Rewind();
         //p.HexDump();
@@ -47,6 +47,22 @@ enum class MessageType : int32_t
     MESSAGE_TYPE_CLIENT,        //!< Message is of type @ref MessageClient.
 };
 
+/// Number of message types. This must be updated when a type is added.
+static const size_t MESSAGE_TYPE_COUNT =
+    (size_t)MessageType::MESSAGE_TYPE_CLIENT + 1;
+
+/**
+ * Specific type of a @ref MessageType::MESSAGE_TYPE_SYSTEM message. This
+ * lets the worker handle system messages without a dynamic_cast.
+ */
+enum class SystemMessageType : int32_t
+{
+    SYSTEM_MESSAGE_OTHER,       //!< Message is handled by a @ref Manager.
+    SYSTEM_MESSAGE_SHUTDOWN,    //!< Message is of type @ref Shutdown.
+    SYSTEM_MESSAGE_EXECUTE,     //!< Message is of type @ref Execute.
+    SYSTEM_MESSAGE_INIT,        //!< Message is of type @ref Init.
+};
+
 /**
  * Abstract base class representing a message to be handled when received by
  * a @ref MessageQueue.
@@ -65,6 +81,27 @@ public:
      */
     virtual MessageType GetType() const = 0;
 
+    /**
+     * Get the specific type of a system message.
+     * @return The message's system message type.
+     */
+    virtual SystemMessageType GetSystemMessageType() const
+    {
+        return SystemMessageType::SYSTEM_MESSAGE_OTHER;
+    }
+
+    /**
+     * Check if the message reports that its connection was closed. This
+     * lets the worker release a connection's mailbox without a
+     * dynamic_cast (not every message of the connection type is a
+     * @ref ConnectionMessage).
+     * @return true if the message is a @ref ConnectionClosed message.
+     */
+    virtual bool IsConnectionClosed() const
+    {
+        return false;
+    }
+
     /**
      * Dump the message for logging.
      * @return String representation of the message.
@@ -50,6 +50,11 @@ Message::ConnectionMessageType Message::ConnectionClosed::GetConnectionMessageTy
     return ConnectionMessageType::CONNECTION_MESSAGE_CONNECTION_CLOSED;
 }
 
+bool Message::ConnectionClosed::IsConnectionClosed() const
+{
+    return true;
+}
+
 libcomp::String Message::ConnectionClosed::Dump() const
 {
     if(mConnection)
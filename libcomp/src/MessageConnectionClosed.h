@@ -48,6 +48,8 @@ public:
 
     virtual ConnectionMessageType GetConnectionMessageType() const;
 
+    virtual bool IsConnectionClosed() const override;
+
     virtual libcomp::String Dump() const override;
 
 private:
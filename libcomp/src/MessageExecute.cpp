@@ -0,0 +1,295 @@
+/**
+ * @file libcomp/src/MessageExecute.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Message that provides code to execute inside the worker.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MessageExecute.h"
+
+// Standard C++11 Includes
+#include <mutex>
+#include <vector>
+
+using namespace libcomp;
+
+namespace
+{
+
+/// Size of each block handed out by the pool
+const size_t BLOCK_SIZE = (sizeof(Message::ExecuteClosure) +
+    alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+/// Number of blocks moved between a thread and the shared depot at once
+const size_t BATCH_SIZE = 64;
+
+/**
+ * Free block in the pool.
+ */
+struct FreeBlock
+{
+    /// Next free block
+    FreeBlock *pNext;
+};
+
+/**
+ * Blocks shared by every thread. Threads take and return whole batches
+ * so the lock is only taken once every @ref BATCH_SIZE messages.
+ */
+struct BlockDepot
+{
+    /// Lock for the depot
+    std::mutex lock;
+
+    /// Lists of free blocks (most are @ref BATCH_SIZE long)
+    std::vector<FreeBlock*> batches;
+
+    /// Every slab allocated (they are never freed)
+    std::vector<void*> slabs;
+};
+
+/**
+ * Get the shared depot. It is never destroyed so messages deleted while
+ * the program exits can still be returned to it.
+ * @returns Shared depot.
+ */
+BlockDepot& GetDepot()
+{
+    static BlockDepot *pDepot = new BlockDepot;
+
+    return *pDepot;
+}
+
+/**
+ * Free blocks cached by a single thread.
+ */
+struct BlockCache
+{
+    BlockCache() : pHead(nullptr), count(0)
+    {
+    }
+
+    /**
+     * Give every cached block back to the depot.
+     */
+    ~BlockCache();
+
+    /// First free block
+    FreeBlock *pHead;
+
+    /// Number of free blocks
+    size_t count;
+};
+
+/// Set once the cache of this thread is destroyed. This is trivially
+/// destructible so it can still be read while the thread is exiting.
+thread_local bool tBlockCacheDestroyed = false;
+
+thread_local BlockCache tBlockCache;
+
+BlockCache::~BlockCache()
+{
+    tBlockCacheDestroyed = true;
+
+    BlockDepot& depot = GetDepot();
+
+    std::lock_guard<std::mutex> guard(depot.lock);
+
+    while(nullptr != pHead)
+    {
+        FreeBlock *pBatch = pHead;
+        FreeBlock *pLast = pHead;
+
+        for(size_t i = 1; i < BATCH_SIZE && nullptr != pLast->pNext; ++i)
+        {
+            pLast = pLast->pNext;
+        }
+
+        pHead = pLast->pNext;
+        pLast->pNext = nullptr;
+
+        depot.batches.push_back(pBatch);
+    }
+
+    count = 0;
+}
+
+/**
+ * Fill the cache of the calling thread with a batch of blocks.
+ * @param cache Cache to fill.
+ */
+void RefillCache(BlockCache& cache)
+{
+    BlockDepot& depot = GetDepot();
+
+    FreeBlock *pBatch = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(depot.lock);
+
+        if(!depot.batches.empty())
+        {
+            pBatch = depot.batches.back();
+            depot.batches.pop_back();
+        }
+        else
+        {
+            uint8_t *pSlab = static_cast<uint8_t*>(::operator new(
+                BLOCK_SIZE * BATCH_SIZE));
+            depot.slabs.push_back(pSlab);
+
+            for(size_t i = BATCH_SIZE; 0 < i; --i)
+            {
+                FreeBlock *pBlock = reinterpret_cast<FreeBlock*>(
+                    pSlab + (i - 1) * BLOCK_SIZE);
+                pBlock->pNext = pBatch;
+                pBatch = pBlock;
+            }
+        }
+    }
+
+    while(nullptr != pBatch)
+    {
+        FreeBlock *pNext = pBatch->pNext;
+        pBatch->pNext = cache.pHead;
+        cache.pHead = pBatch;
+        cache.count++;
+        pBatch = pNext;
+    }
+}
+
+/**
+ * Give a batch of blocks from the cache of the calling thread back to the
+ * depot. This keeps a thread that only deletes messages (like a worker)
+ * from holding on to every block.
+ * @param cache Cache to take the blocks from.
+ */
+void DrainCache(BlockCache& cache)
+{
+    FreeBlock *pBatch = cache.pHead;
+    FreeBlock *pLast = pBatch;
+
+    for(size_t i = 1; i < BATCH_SIZE; ++i)
+    {
+        pLast = pLast->pNext;
+    }
+
+    cache.pHead = pLast->pNext;
+    cache.count -= BATCH_SIZE;
+    pLast->pNext = nullptr;
+
+    BlockDepot& depot = GetDepot();
+
+    std::lock_guard<std::mutex> guard(depot.lock);
+    depot.batches.push_back(pBatch);
+}
+
+} // namespace
+
+Message::ExecuteClosure::~ExecuteClosure()
+{
+    if(static_cast<void*>(mCallable) == static_cast<void*>(mStorage))
+    {
+        mCallable->~CallableBase();
+    }
+    else
+    {
+        delete mCallable;
+    }
+}
+
+Message::MessageType Message::ExecuteClosure::GetType() const
+{
+    return MessageType::MESSAGE_TYPE_SYSTEM;
+}
+
+libcomp::String Message::ExecuteClosure::Dump() const
+{
+    return "Message: Execute";
+}
+
+void Message::ExecuteClosure::Run()
+{
+    mCallable->Run();
+}
+
+void* Message::ExecuteClosure::operator new(size_t size)
+{
+    if(BLOCK_SIZE < size || tBlockCacheDestroyed)
+    {
+        return ::operator new(size);
+    }
+
+    BlockCache& cache = tBlockCache;
+
+    if(nullptr == cache.pHead)
+    {
+        RefillCache(cache);
+    }
+
+    FreeBlock *pBlock = cache.pHead;
+    cache.pHead = pBlock->pNext;
+    cache.count--;
+
+    return pBlock;
+}
+
+void Message::ExecuteClosure::operator delete(void *pMemory, size_t size)
+{
+    if(nullptr == pMemory)
+    {
+        return;
+    }
+
+    if(BLOCK_SIZE < size)
+    {
+        ::operator delete(pMemory);
+
+        return;
+    }
+
+    FreeBlock *pBlock = static_cast<FreeBlock*>(pMemory);
+
+    if(tBlockCacheDestroyed)
+    {
+        // The thread is exiting so hand the block straight to the depot.
+        pBlock->pNext = nullptr;
+
+        BlockDepot& depot = GetDepot();
+
+        std::lock_guard<std::mutex> guard(depot.lock);
+        depot.batches.push_back(pBlock);
+
+        return;
+    }
+
+    BlockCache& cache = tBlockCache;
+
+    pBlock->pNext = cache.pHead;
+    cache.pHead = pBlock;
+    cache.count++;
+
+    if((2 * BATCH_SIZE) <= cache.count)
+    {
+        DrainCache(cache);
+    }
+}
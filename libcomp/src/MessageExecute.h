@@ -33,8 +33,11 @@
 #include "Message.h"
 
 // Standard C++11 Includes
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace libcomp
@@ -53,6 +56,11 @@ public:
      * Execute the code contained in the message.
      */
     virtual void Run() = 0;
+
+    virtual SystemMessageType GetSystemMessageType() const override
+    {
+        return SystemMessageType::SYSTEM_MESSAGE_EXECUTE;
+    }
 };
 
 /**
@@ -105,6 +113,126 @@ private:
     libcomp::String mBacktrace;
 };
 
+/**
+ * Message that provides code to execute inside the worker. The function
+ * and its arguments are stored inside the message when they are small
+ * enough so the only allocation is the message itself. Messages are
+ * allocated from fixed size blocks that are cached by each thread so the
+ * common case does not call the heap allocator at all.
+ * @note Unlike @ref ExecuteImpl this does not record a backtrace when the
+ * message is created.
+ */
+class ExecuteClosure final : public Execute
+{
+public:
+    /// Number of bytes available to store the function and arguments
+    /// inside the message.
+    static const size_t INLINE_SIZE = 112;
+
+    /**
+     * Create the message.
+     * @param f Function to execute.
+     * @param args Arguments to pass to the function when it is executed.
+     */
+    template<typename Function, typename... Args>
+    explicit ExecuteClosure(Function&& f, Args&&... args) : Execute()
+    {
+        typedef decltype(std::bind(std::forward<Function>(f),
+            std::forward<Args>(args)...)) Bind_t;
+        typedef Callable<Bind_t> Callable_t;
+
+        mCallable = Create<Callable_t>(std::integral_constant<bool,
+            sizeof(Callable_t) <= INLINE_SIZE &&
+            alignof(Callable_t) <= alignof(std::max_align_t)>(),
+            std::bind(std::forward<Function>(f),
+            std::forward<Args>(args)...));
+    }
+
+    /**
+     * Cleanup the message.
+     */
+    virtual ~ExecuteClosure();
+
+    virtual MessageType GetType() const override;
+
+    virtual libcomp::String Dump() const override;
+
+    virtual void Run() override;
+
+    /**
+     * Allocate a message from the block pool.
+     * @param size Size of the message.
+     * @returns Pointer to the memory for the message.
+     */
+    static void* operator new(size_t size);
+
+    /**
+     * Return a message to the block pool.
+     * @param pMemory Pointer to the memory for the message.
+     * @param size Size of the message.
+     */
+    static void operator delete(void *pMemory, size_t size);
+
+private:
+    /**
+     * Type erased function and arguments.
+     */
+    class CallableBase
+    {
+    public:
+        virtual ~CallableBase() { }
+        virtual void Run() = 0;
+    };
+
+    /**
+     * Function bound to its arguments.
+     */
+    template<typename Bind_t>
+    class Callable : public CallableBase
+    {
+    public:
+        explicit Callable(Bind_t&& bind) : mBind(std::move(bind))
+        {
+        }
+
+        virtual void Run() override
+        {
+            mBind();
+        }
+
+    private:
+        Bind_t mBind;
+    };
+
+    /**
+     * Store the function inside the message.
+     * @param bind Function bound to its arguments.
+     * @returns Pointer to the stored function.
+     */
+    template<typename Callable_t, typename Bind_t>
+    CallableBase* Create(std::true_type, Bind_t&& bind)
+    {
+        return new(mStorage) Callable_t(std::move(bind));
+    }
+
+    /**
+     * Store the function on the heap as it does not fit in the message.
+     * @param bind Function bound to its arguments.
+     * @returns Pointer to the stored function.
+     */
+    template<typename Callable_t, typename Bind_t>
+    CallableBase* Create(std::false_type, Bind_t&& bind)
+    {
+        return new Callable_t(std::move(bind));
+    }
+
+    /// Function to execute (points into mStorage if stored inline)
+    CallableBase *mCallable;
+
+    /// Storage for a small function and its arguments
+    alignas(std::max_align_t) unsigned char mStorage[INLINE_SIZE];
+};
+
 } // namespace Message
 
 } // namespace libcomp
@@ -41,6 +41,11 @@ Message::MessageType Message::Init::GetType() const
     return MessageType::MESSAGE_TYPE_SYSTEM;
 }
 
+Message::SystemMessageType Message::Init::GetSystemMessageType() const
+{
+    return SystemMessageType::SYSTEM_MESSAGE_INIT;
+}
+
 libcomp::String Message::Init::Dump() const
 {
     return "Message: Init";
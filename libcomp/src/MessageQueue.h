@@ -27,9 +27,14 @@
 #ifndef LIBCOMP_SRC_MESSAGEQUEUE_H
 #define LIBCOMP_SRC_MESSAGEQUEUE_H
 
+// libcomp Includes
+#include "LockFreeMessageQueue.h"
+
+// Standard C++11 Includes
 #include <list>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 
 namespace libcomp
 {
@@ -38,10 +43,11 @@ namespace libcomp
  * A thread safe collection of @ref Message instances to be created and
  * handled by a server. Messages queues are shared by both server
  * @ref Worker instances as well as each @ref EncryptedConnection that
- * connects to the server but is not limited to this usage.
+ * connects to the server but is not limited to this usage. This version
+ * protects a std::list with a mutex and allows more than one consumer.
  */
 template<class T>
-class MessageQueue
+class LockingMessageQueue
 {
 public:
     /**
@@ -50,6 +56,8 @@ public:
      */
     void Enqueue(T item)
     {
+        bool notify = mReserveHandler && mReserveHandler(1);
+
         mQueueLock.lock();
         bool wasEmpty = mQueue.empty();
         mQueue.push_back(item);
@@ -60,6 +68,11 @@ public:
             std::unique_lock<std::mutex> uniqueLock(mEmptyConditionLock);
             mEmptyCondition.notify_one();
         }
+
+        if(notify)
+        {
+            mEnqueueHandler();
+        }
     }
 
     /**
@@ -68,6 +81,10 @@ public:
      */
     void Enqueue(std::list<T>& items)
     {
+        size_t count = items.size();
+        bool notify = mReserveHandler && 0 < count &&
+            mReserveHandler(count);
+
         mQueueLock.lock();
         bool wasEmpty = mQueue.empty();
         mQueue.splice(mQueue.end(), items);
@@ -78,6 +95,11 @@ public:
             std::unique_lock<std::mutex> uniqueLock(mEmptyConditionLock);
             mEmptyCondition.notify_one();
         }
+
+        if(notify)
+        {
+            mEnqueueHandler();
+        }
     }
 
     /**
@@ -142,6 +164,22 @@ public:
         destinationQueue.splice(destinationQueue.end(), tempQueue);
     }
 
+    /**
+     * Set the functions to call when messages are added to the queue. This
+     * must be set before the queue is shared with other threads.
+     * @param reserveHandler Function given the number of messages about to
+     *  be added. It is called before a consumer can see the messages and
+     *  returns true if the enqueue handler should be called once they are
+     *  in the queue.
+     * @param handler Function to call after the messages are added
+     */
+    void SetEnqueueHandler(const std::function<bool(size_t)>& reserveHandler,
+        const std::function<void()>& handler)
+    {
+        mReserveHandler = reserveHandler;
+        mEnqueueHandler = handler;
+    }
+
 private:
     /// The list of messages
     std::list<T> mQueue;
@@ -154,8 +192,31 @@ private:
 
     /// Blocking condition to wait for when no messages are queued
     std::condition_variable mEmptyCondition;
+
+    /// Function to call before messages are added
+    std::function<bool(size_t)> mReserveHandler;
+
+    /// Function to call after messages are added
+    std::function<void()> mEnqueueHandler;
 };
 
+#ifdef LIBCOMP_LOCKFREE_MESSAGE_QUEUE
+/**
+ * Message queue used by @ref Worker, @ref Log and the other threads that
+ * consume messages. Each of these queues has a single consumer so the build
+ * may select the lock-free queue with USE_LOCKFREE_MESSAGE_QUEUE.
+ */
+template<class T>
+using MessageQueue = LockFreeMessageQueue<T>;
+#else // LIBCOMP_LOCKFREE_MESSAGE_QUEUE
+/**
+ * Message queue used by @ref Worker, @ref Log and the other threads that
+ * consume messages. This build uses the mutex protected queue.
+ */
+template<class T>
+using MessageQueue = LockingMessageQueue<T>;
+#endif // LIBCOMP_LOCKFREE_MESSAGE_QUEUE
+
 } // namespace libcomp
 
 #endif // LIBCOMP_SRC_MESSAGEQUEUE_H
@@ -41,6 +41,11 @@ Message::MessageType Message::Shutdown::GetType() const
     return MessageType::MESSAGE_TYPE_SYSTEM;
 }
 
+Message::SystemMessageType Message::Shutdown::GetSystemMessageType() const
+{
+    return SystemMessageType::SYSTEM_MESSAGE_SHUTDOWN;
+}
+
 libcomp::String Message::Shutdown::Dump() const
 {
     return "Message: Shutdown";
@@ -58,6 +58,8 @@ public:
 
     virtual MessageType GetType() const;
 
+    virtual SystemMessageType GetSystemMessageType() const override;
+
     virtual libcomp::String Dump() const override;
 };
 
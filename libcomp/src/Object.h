@@ -123,6 +123,16 @@ public:
      */
     virtual bool IsValid(bool recursive = true) const = 0;
 
+    /**
+     * Check if the object can be saved to a standard output stream without
+     * writing it anywhere. This is the same check done by @ref Save when
+     * flat = false (references to non-persistent objects must be set and
+     * fixed size strings must fit in their buffer) but does not write any
+     * of the data members.
+     * @return true if the object can be saved, false if it can not
+     */
+    virtual bool CanSave() const = 0;
+
     /**
      * Load the object's data members from an ObjectInStream.
      * @param stream Byte stream containing data member values
@@ -43,6 +43,7 @@
 #include <sys/socket.h>
 #endif // _WIN32
 
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 
@@ -57,7 +58,7 @@ Packet::Packet() : ReadOnlyPacket()
 Packet::Packet(const Packet& other) : ReadOnlyPacket(other.mPosition,
     other.mSize, nullptr, nullptr)
 {
-    Allocate();
+    Allocate(other.mSize);
 
     // Make sure the data pointer is valid first.
     if(nullptr != mData)
@@ -87,7 +88,7 @@ Packet::Packet(const std::vector<char>& data) : ReadOnlyPacket()
     if(!data.empty())
     {
         // Allocate the packet data.
-        Allocate();
+        Allocate((uint32_t)data.size());
 
         // Write the data.
         WriteArray(data);
@@ -106,7 +107,7 @@ Packet::Packet(const void *pData, uint32_t sz) : ReadOnlyPacket()
     if(0 < sz)
     {
         // Allocate the packet data.
-        Allocate();
+        Allocate(sz);
 
         // Write the data.
         WriteArray(pData, sz);
@@ -151,6 +152,9 @@ void Packet::GrowPacket(uint32_t sz)
     }
     else
     {
+        // Make sure the buffer is big enough for the new data.
+        Allocate(newSize);
+
         // The new packet size is valid, set it.
         mSize = newSize;
     }
@@ -451,7 +455,9 @@ void Packet::Clear()
     uint32_t deadbeef = 0xEFBEADDE;
 
     // Fill the buffer with "dead beef" so you can see what is and isn't data.
-    for(uint32_t i = 0; i < MAX_PACKET_SIZE; i += 4)
+    uint32_t capacity = Capacity() & ~3u;
+
+    for(uint32_t i = 0; i < capacity; i += 4)
     {
         memcpy(mData + i, &deadbeef, 4);
     }
@@ -490,8 +496,8 @@ char* Packet::Direct(uint32_t sz)
             "size of the packet").Arg(sz), this);
     }
 
-    // Make sure the buffer is allocated before we fill it.
-    Allocate();
+    // Make sure the buffer is allocated and big enough before we fill it.
+    Allocate(sz);
 
     // Set the new size of the packet.
     mSize = sz;
@@ -542,34 +548,34 @@ int32_t Packet::Decompress(int32_t sz)
             "packet").Arg(sz), this);
     }
 
-    // Allocate the compressed copy.
-    uint8_t *pData = new uint8_t[sz];
+    // The decompressed size is not known so decompress into a second
+    // buffer big enough for a full packet. This avoids copying the
+    // compressed data out of the way first.
+    auto dataRef = PacketBufferPool::Allocate(MAX_PACKET_SIZE);
 
-    if(nullptr == pData)
+    // Decompress the data
+    int32_t written = Compress::Decompress(mData + mPosition,
+        dataRef->Data() + mPosition, sz,
+        (int32_t)(dataRef->Capacity() - mPosition));
+
+    if(0 > written)
     {
-        return 0;
+        return written;
     }
 
-    // Copy the data to decompress.
-    memcpy(pData, mData + mPosition, (size_t)sz);
-
-    // Update the size of the packet.
-    mSize = mPosition;
+    // Keep the data before the cursor and switch to the new buffer.
+    memcpy(dataRef->Data(), mData, mPosition);
 
-    // Decompress the data
-    int32_t written = Compress::Decompress(pData, mData + mPosition,
-        sz, (int32_t)(MAX_PACKET_SIZE - mSize));
+    mDataRef = dataRef;
+    mData = mDataRef->Data();
 
     // Update the size.
-    mSize += (uint32_t)written;
-
-    // Free the compressed copy.
-    delete[] pData;
+    mSize = mPosition + (uint32_t)written;
 
     return written;
 }
 
-int32_t Packet::Compress(int32_t sz)
+int32_t Packet::Compress(int32_t sz, int32_t compressionLevel)
 {
     // If there is no data to compress, do nothing.
     if(0 == sz)
@@ -586,29 +592,31 @@ int32_t Packet::Compress(int32_t sz)
             "packet").Arg(sz), this);
     }
 
-    // Allocate the compressed copy.
-    uint8_t *pData = new uint8_t[sz];
+    // Compress into a second buffer with room for the worst case
+    // compressed size. This avoids copying the data out of the way first.
+    auto dataRef = PacketBufferPool::Allocate(std::min<uint32_t>(
+        MAX_PACKET_SIZE, mPosition + (uint32_t)compressBound((uLong)sz)));
 
-    if(nullptr == pData)
+    // Compress the data
+    int32_t written = Compress::Compress(mData + mPosition,
+        dataRef->Data() + mPosition, sz,
+        (int32_t)(dataRef->Capacity() - mPosition), compressionLevel);
+
+    // Leave the packet alone if the data did not get any smaller so it can
+    // still be sent uncompressed.
+    if(0 >= written || sz <= written)
     {
-        return 0;
+        return 0 > written ? 0 : written;
     }
 
-    // Copy the data to compress.
-    memcpy(pData, mData + mPosition, (size_t)sz);
+    // Keep the data before the cursor and switch to the new buffer.
+    memcpy(dataRef->Data(), mData, mPosition);
 
-    // Update the size.
-    mSize = mPosition;
-
-    // Compress the data
-    int32_t written = Compress::Compress(pData, mData + mPosition,
-        sz, (int32_t)(MAX_PACKET_SIZE - mSize));
+    mDataRef = dataRef;
+    mData = mDataRef->Data();
 
     // Update the size.
-    mSize += (uint32_t)written;
-
-    // Free the uncompressed copy.
-    delete[] pData;
+    mSize = mPosition + (uint32_t)written;
 
     return written;
 }
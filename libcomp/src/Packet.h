@@ -529,17 +529,21 @@ public:
      * %Decompress from the cursor position @em sz bytes. After the
      * decompression the current position will remain the same.
      * @param sz Number of bytes to decompress.
-     * @returns The uncompressed size or 0 if the decompression failed.
+     * @returns The uncompressed size or a negative number if the
+     *   decompression failed.
      */
     int32_t Decompress(int32_t sz);
 
     /**
      * %Compress from the cursor position @em sz bytes. After the compression
-     * the current position will remain the same.
+     * the current position will remain the same. If the compressed data is
+     * not smaller than @em sz bytes the packet is left unchanged.
      * @param sz Number of bytes to compress.
+     * @param compressionLevel zlib compression level from 0 to 9 or -1 to
+     *   use the default level.
      * @returns The compressed size or 0 if the compression failed.
      */
-    int32_t Compress(int32_t sz);
+    int32_t Compress(int32_t sz, int32_t compressionLevel = -1);
 
     /**
      * @brief Move the packet data from another Packet object into this one.
@@ -0,0 +1,453 @@
+/**
+ * @file libcomp/src/PacketBufferPool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of size-classed buffers used to store packet data.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PacketBufferPool.h"
+
+// Standard C++11 Includes
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using namespace libcomp;
+
+namespace
+{
+
+/// Extra bytes in each block for the shared pointer control block.
+const size_t BLOCK_OVERHEAD = 128;
+
+/// Number of blocks moved between a thread cache and the shared free list.
+const size_t BATCH_SIZE = 16;
+
+/// Maximum number of free blocks of each size class kept by a thread.
+const size_t THREAD_CACHE_SIZE = 2 * BATCH_SIZE;
+
+/// Buffer capacity of each size class.
+const uint32_t CLASS_CAPACITY[PacketBufferPool::SIZE_CLASS_COUNT] = {
+    PACKET_BUFFER_SMALL_SIZE,
+    PACKET_BUFFER_MEDIUM_SIZE,
+    MAX_PACKET_SIZE,
+};
+
+/// Default number of free blocks of each size class kept in the pool.
+const size_t CLASS_RETAIN_LIMIT[PacketBufferPool::SIZE_CLASS_COUNT] = {
+    4096,
+    512,
+    128,
+};
+
+/**
+ * Packet buffer with inline storage of @em N bytes.
+ */
+template<uint32_t N>
+class PacketBufferStorage : public PacketBuffer
+{
+public:
+    /**
+     * Create the buffer. The storage is intentionally left uninitialized.
+     */
+    PacketBufferStorage() : PacketBuffer(mStorage, N)
+    {
+    }
+
+private:
+    /// Storage for the buffer.
+    uint8_t mStorage[N];
+};
+
+/**
+ * Allocator given to std::allocate_shared so the buffer and the control
+ * block are recycled by the pool.
+ */
+template<typename T>
+class PacketBufferAllocator
+{
+public:
+    typedef T value_type;
+
+    PacketBufferAllocator()
+    {
+    }
+
+    template<typename U>
+    PacketBufferAllocator(const PacketBufferAllocator<U>& other)
+    {
+        (void)other;
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(PacketBufferPool::AllocateBlock(
+            n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n)
+    {
+        PacketBufferPool::FreeBlock(p, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const PacketBufferAllocator<T>&,
+    const PacketBufferAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const PacketBufferAllocator<T>&,
+    const PacketBufferAllocator<U>&)
+{
+    return false;
+}
+
+/**
+ * Shared free list and counters for a size class.
+ */
+class SharedFreeList
+{
+public:
+    SharedFreeList() : retainLimit(0), allocations(0), heapAllocations(0),
+        inUse(0)
+    {
+    }
+
+    /// Lock for the free list.
+    std::mutex lock;
+
+    /// Free blocks.
+    std::vector<void*> blocks;
+
+    /// Maximum number of free blocks to keep.
+    size_t retainLimit;
+
+    /// Number of buffers handed out.
+    std::atomic<uint64_t> allocations;
+
+    /// Number of blocks allocated from the heap.
+    std::atomic<uint64_t> heapAllocations;
+
+    /// Number of blocks in use.
+    std::atomic<uint64_t> inUse;
+};
+
+/**
+ * Get the shared free lists. These are never freed so blocks released by
+ * thread caches during shutdown always have somewhere to go.
+ * @returns Array of free lists (one per size class).
+ */
+SharedFreeList* GetSharedFreeLists()
+{
+    static SharedFreeList *pLists = []()
+    {
+        auto lists = new SharedFreeList[PacketBufferPool::SIZE_CLASS_COUNT];
+
+        for(int i = 0; i < PacketBufferPool::SIZE_CLASS_COUNT; ++i)
+        {
+            lists[i].retainLimit = CLASS_RETAIN_LIMIT[i];
+        }
+
+        return lists;
+    }();
+
+    return pLists;
+}
+
+/**
+ * Return free blocks to the shared free list. Blocks beyond the retain
+ * limit are given back to the heap.
+ * @param sizeClass Size class the blocks belong to.
+ * @param blocks Blocks to release. Up to @em count blocks are removed from
+ *   the end of the list.
+ * @param count Number of blocks to release.
+ */
+void ReleaseBlocks(int sizeClass, std::vector<void*>& blocks, size_t count)
+{
+    SharedFreeList& shared = GetSharedFreeLists()[sizeClass];
+
+    std::lock_guard<std::mutex> guard(shared.lock);
+
+    while(0 < count-- && !blocks.empty())
+    {
+        void *pBlock = blocks.back();
+        blocks.pop_back();
+
+        if(shared.blocks.size() < shared.retainLimit)
+        {
+            shared.blocks.push_back(pBlock);
+        }
+        else
+        {
+            ::operator delete(pBlock);
+        }
+    }
+}
+
+/**
+ * Per thread cache of free blocks.
+ */
+class ThreadCache
+{
+public:
+    ThreadCache();
+    ~ThreadCache();
+
+    /// Free blocks for each size class.
+    std::vector<void*> blocks[PacketBufferPool::SIZE_CLASS_COUNT];
+};
+
+/// State of the cache for this thread (0 = not created, 1 = alive,
+/// 2 = destroyed). This is trivially destructible so it is always safe
+/// to read, even while the thread is exiting.
+thread_local int tThreadCacheState = 0;
+
+ThreadCache::ThreadCache()
+{
+    for(auto& classBlocks : blocks)
+    {
+        classBlocks.reserve(THREAD_CACHE_SIZE + 1);
+    }
+
+    tThreadCacheState = 1;
+}
+
+ThreadCache::~ThreadCache()
+{
+    tThreadCacheState = 2;
+
+    for(int i = 0; i < PacketBufferPool::SIZE_CLASS_COUNT; ++i)
+    {
+        ReleaseBlocks(i, blocks[i], blocks[i].size());
+    }
+}
+
+/**
+ * Get the cache for this thread.
+ * @returns Cache for this thread or nullptr if the thread is exiting and
+ *   the cache has already been destroyed.
+ */
+ThreadCache* GetThreadCache()
+{
+    if(2 == tThreadCacheState)
+    {
+        return nullptr;
+    }
+
+    static thread_local ThreadCache cache;
+
+    return &cache;
+}
+
+/**
+ * Determine the size class of a raw block request.
+ * @param size Size of the block in bytes.
+ * @returns Size class or -1 if the block is too big for the pool.
+ */
+int GetBlockClass(size_t size)
+{
+    for(int i = 0; i < PacketBufferPool::SIZE_CLASS_COUNT; ++i)
+    {
+        if(size <= (CLASS_CAPACITY[i] + BLOCK_OVERHEAD))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+} // namespace
+
+std::shared_ptr<PacketBuffer> PacketBufferPool::Allocate(uint32_t size)
+{
+    switch(GetSizeClass(size))
+    {
+        case SIZE_CLASS_SMALL:
+            return std::allocate_shared<PacketBufferStorage<
+                PACKET_BUFFER_SMALL_SIZE>>(PacketBufferAllocator<
+                PacketBufferStorage<PACKET_BUFFER_SMALL_SIZE>>());
+        case SIZE_CLASS_MEDIUM:
+            return std::allocate_shared<PacketBufferStorage<
+                PACKET_BUFFER_MEDIUM_SIZE>>(PacketBufferAllocator<
+                PacketBufferStorage<PACKET_BUFFER_MEDIUM_SIZE>>());
+        default:
+            return std::allocate_shared<PacketBufferStorage<
+                MAX_PACKET_SIZE>>(PacketBufferAllocator<
+                PacketBufferStorage<MAX_PACKET_SIZE>>());
+    }
+}
+
+PacketBufferPool::SizeClass_t PacketBufferPool::GetSizeClass(uint32_t size)
+{
+    if(PACKET_BUFFER_SMALL_SIZE >= size)
+    {
+        return SIZE_CLASS_SMALL;
+    }
+    else if(PACKET_BUFFER_MEDIUM_SIZE >= size)
+    {
+        return SIZE_CLASS_MEDIUM;
+    }
+
+    return SIZE_CLASS_FULL;
+}
+
+PacketBufferPool::Stats PacketBufferPool::GetStats(SizeClass_t sizeClass)
+{
+    Stats stats = { 0, 0, 0, 0 };
+
+    if(0 <= sizeClass && SIZE_CLASS_COUNT > sizeClass)
+    {
+        SharedFreeList& shared = GetSharedFreeLists()[sizeClass];
+
+        stats.allocations = shared.allocations;
+        stats.heapAllocations = shared.heapAllocations;
+        stats.inUse = shared.inUse;
+
+        std::lock_guard<std::mutex> guard(shared.lock);
+        stats.retained = shared.blocks.size();
+    }
+
+    return stats;
+}
+
+void PacketBufferPool::SetRetainLimit(SizeClass_t sizeClass, size_t count)
+{
+    if(0 <= sizeClass && SIZE_CLASS_COUNT > sizeClass)
+    {
+        SharedFreeList& shared = GetSharedFreeLists()[sizeClass];
+
+        std::lock_guard<std::mutex> guard(shared.lock);
+        shared.retainLimit = count;
+
+        // Free anything over the new limit.
+        while(shared.blocks.size() > count)
+        {
+            ::operator delete(shared.blocks.back());
+            shared.blocks.pop_back();
+        }
+    }
+}
+
+void* PacketBufferPool::AllocateBlock(size_t size)
+{
+    int sizeClass = GetBlockClass(size);
+
+    // This should not happen but don't fail if it does.
+    if(0 > sizeClass)
+    {
+        return ::operator new(size);
+    }
+
+    SharedFreeList& shared = GetSharedFreeLists()[sizeClass];
+
+    shared.allocations.fetch_add(1, std::memory_order_relaxed);
+    shared.inUse.fetch_add(1, std::memory_order_relaxed);
+
+    ThreadCache *pCache = GetThreadCache();
+
+    if(nullptr != pCache)
+    {
+        auto& blocks = pCache->blocks[sizeClass];
+
+        // Refill the thread cache from the shared free list.
+        if(blocks.empty())
+        {
+            std::lock_guard<std::mutex> guard(shared.lock);
+
+            for(size_t i = 0; i < BATCH_SIZE && !shared.blocks.empty(); ++i)
+            {
+                blocks.push_back(shared.blocks.back());
+                shared.blocks.pop_back();
+            }
+        }
+
+        if(!blocks.empty())
+        {
+            void *pBlock = blocks.back();
+            blocks.pop_back();
+
+            return pBlock;
+        }
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(shared.lock);
+
+        if(!shared.blocks.empty())
+        {
+            void *pBlock = shared.blocks.back();
+            shared.blocks.pop_back();
+
+            return pBlock;
+        }
+    }
+
+    shared.heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    return ::operator new(CLASS_CAPACITY[sizeClass] + BLOCK_OVERHEAD);
+}
+
+void PacketBufferPool::FreeBlock(void *pBlock, size_t size)
+{
+    if(nullptr == pBlock)
+    {
+        return;
+    }
+
+    int sizeClass = GetBlockClass(size);
+
+    if(0 > sizeClass)
+    {
+        ::operator delete(pBlock);
+
+        return;
+    }
+
+    GetSharedFreeLists()[sizeClass].inUse.fetch_sub(1,
+        std::memory_order_relaxed);
+
+    ThreadCache *pCache = GetThreadCache();
+
+    if(nullptr != pCache)
+    {
+        auto& blocks = pCache->blocks[sizeClass];
+        blocks.push_back(pBlock);
+
+        // Give a batch back if the cache is full. This is common on the
+        // thread that sends packets built by another thread.
+        if(THREAD_CACHE_SIZE < blocks.size())
+        {
+            ReleaseBlocks(sizeClass, blocks, BATCH_SIZE);
+        }
+    }
+    else
+    {
+        std::vector<void*> blocks = { pBlock };
+
+        ReleaseBlocks(sizeClass, blocks, 1);
+    }
+}
@@ -0,0 +1,179 @@
+/**
+ * @file libcomp/src/PacketBufferPool.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of size-classed buffers used to store packet data.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_PACKETBUFFERPOOL_H
+#define LIBCOMP_SRC_PACKETBUFFERPOOL_H
+
+// libcomp Includes
+#include "Constants.h"
+
+// Standard C++11 Includes
+#include <cstddef>
+#include <memory>
+
+#include <stdint.h>
+
+namespace libcomp
+{
+
+/**
+ * Block of memory that stores the data for a @ref ReadOnlyPacket. A buffer
+ * is always allocated from the @ref PacketBufferPool and is returned to the
+ * pool when the last reference to it is released.
+ */
+class PacketBuffer
+{
+public:
+    /**
+     * Get a pointer to the buffer data.
+     * @returns Pointer to the buffer data.
+     */
+    uint8_t* Data() const
+    {
+        return mData;
+    }
+
+    /**
+     * Get the number of bytes the buffer can hold.
+     * @returns Number of bytes the buffer can hold.
+     */
+    uint32_t Capacity() const
+    {
+        return mCapacity;
+    }
+
+protected:
+    /**
+     * Create the buffer.
+     * @param pData Storage for the buffer.
+     * @param capacity Number of bytes in the storage.
+     */
+    PacketBuffer(uint8_t *pData, uint32_t capacity) : mData(pData),
+        mCapacity(capacity)
+    {
+    }
+
+private:
+    /// Storage for the buffer.
+    uint8_t *mData;
+
+    /// Number of bytes in the storage.
+    uint32_t mCapacity;
+};
+
+/**
+ * Thread safe pool of packet buffers. Each request is rounded up to one of
+ * three size classes (@ref PACKET_BUFFER_SMALL_SIZE,
+ * @ref PACKET_BUFFER_MEDIUM_SIZE and @ref MAX_PACKET_SIZE). The buffer and
+ * the shared pointer control block are allocated as a single block that is
+ * recycled when the last reference is dropped. Each thread keeps a small
+ * cache of free blocks for each size class so most allocations never touch
+ * the shared free lists. Blocks are moved between the thread caches and the
+ * shared free lists in batches.
+ */
+class PacketBufferPool
+{
+public:
+    /**
+     * Size classes of the pool.
+     */
+    typedef enum
+    {
+        SIZE_CLASS_SMALL = 0, //!< Up to @ref PACKET_BUFFER_SMALL_SIZE bytes.
+        SIZE_CLASS_MEDIUM,    //!< Up to @ref PACKET_BUFFER_MEDIUM_SIZE bytes.
+        SIZE_CLASS_FULL,      //!< Up to @ref MAX_PACKET_SIZE bytes.
+        SIZE_CLASS_COUNT,
+    } SizeClass_t;
+
+    /**
+     * Usage counters of the pool (one set per size class).
+     */
+    struct Stats
+    {
+        /// Number of buffers handed out by the pool.
+        uint64_t allocations;
+
+        /// Number of buffers that had to be allocated from the heap.
+        uint64_t heapAllocations;
+
+        /// Number of buffers currently in use.
+        uint64_t inUse;
+
+        /// Number of free buffers retained in the shared free list.
+        uint64_t retained;
+    };
+
+    /**
+     * Allocate a buffer that can hold at least @em size bytes.
+     * @param size Minimum number of bytes the buffer must hold. This must
+     *   not be larger than @ref MAX_PACKET_SIZE.
+     * @returns Shared pointer to the new buffer.
+     */
+    static std::shared_ptr<PacketBuffer> Allocate(uint32_t size);
+
+    /**
+     * Get the size class a buffer of @em size bytes is allocated from.
+     * @param size Number of bytes requested.
+     * @returns Size class the buffer is allocated from.
+     */
+    static SizeClass_t GetSizeClass(uint32_t size);
+
+    /**
+     * Get the usage counters for a size class.
+     * @param sizeClass Size class to get the counters for.
+     * @returns Usage counters for the size class.
+     */
+    static Stats GetStats(SizeClass_t sizeClass);
+
+    /**
+     * Set the maximum number of free buffers of a size class that are kept
+     * in the shared free list. Free buffers beyond this limit are returned
+     * to the heap so memory usage drops again after a burst.
+     * @param sizeClass Size class to set the limit for.
+     * @param count Maximum number of free buffers to retain.
+     */
+    static void SetRetainLimit(SizeClass_t sizeClass, size_t count);
+
+    /**
+     * Allocate a raw block of memory for a buffer. This is used by the
+     * allocator given to std::allocate_shared.
+     * @param size Size of the block in bytes.
+     * @returns Pointer to the block.
+     */
+    static void* AllocateBlock(size_t size);
+
+    /**
+     * Return a raw block of memory to the pool. This is used by the
+     * allocator given to std::allocate_shared.
+     * @param pBlock Block to return to the pool.
+     * @param size Size of the block in bytes.
+     */
+    static void FreeBlock(void *pBlock, size_t size);
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_PACKETBUFFERPOOL_H
@@ -55,7 +55,7 @@ ReadOnlyPacket::ReadOnlyPacket() : mPosition(0), mSize(0), mData(nullptr)
 }
 
 ReadOnlyPacket::ReadOnlyPacket(uint32_t position, uint32_t size,
-    uint8_t *pData, std::shared_ptr<PacketArray> dataRef) :
+    uint8_t *pData, std::shared_ptr<PacketBuffer> dataRef) :
     mPosition(position), mSize(size), mData(pData), mDataRef(dataRef)
 {
 }
@@ -94,13 +94,42 @@ ReadOnlyPacket::~ReadOnlyPacket()
 {
 }
 
-void ReadOnlyPacket::Allocate()
+uint32_t ReadOnlyPacket::Capacity() const
+{
+    if(nullptr == mData || !mDataRef)
+    {
+        return 0;
+    }
+
+    // Shallow copies may start part way into the buffer.
+    return mDataRef->Capacity() - static_cast<uint32_t>(
+        mData - mDataRef->Data());
+}
+
+void ReadOnlyPacket::Allocate(uint32_t capacity)
 {
     // Ensure the packet data buffer is allocated.
     if(nullptr == mData)
     {
-        mDataRef = std::shared_ptr<PacketArray>(new PacketArray);
-        mData = mDataRef.get()->data();
+        mDataRef = PacketBufferPool::Allocate(capacity);
+        mData = mDataRef->Data();
+    }
+    else if(capacity > Capacity())
+    {
+        if(MAX_PACKET_SIZE < capacity)
+        {
+            PACKET_EXCEPTION(String("Attempted to grow the packet buffer to "
+                "%1 bytes; however, this size exceeds the "
+                "MAX_PACKET_SIZE").Arg(capacity), this);
+        }
+
+        // Move the data into a bigger buffer. Any other packet sharing the
+        // old buffer keeps it alive until it is done with it.
+        auto dataRef = PacketBufferPool::Allocate(capacity);
+        memcpy(dataRef->Data(), mData, mSize);
+
+        mDataRef = dataRef;
+        mData = mDataRef->Data();
     }
 }
 
@@ -30,6 +30,7 @@
 #include "Constants.h"
 #include "Convert.h"
 #include "CString.h"
+#include "PacketBufferPool.h"
 
 #include <memory>
 #include <vector>
@@ -84,9 +85,6 @@ class PacketException;
  */
 class ReadOnlyPacket
 {
-private:
-    typedef std::array<uint8_t, MAX_PACKET_SIZE> PacketArray;
-
 public:
     /// This class needs to directly access data in the Packet class.
     friend class PacketException;
@@ -730,10 +728,21 @@ public:
      */
     const char* ConstData() const;
 
+    /**
+     * Get the number of bytes the packet buffer can currently hold. The
+     * buffer grows as data is written so this is not the maximum size of
+     * the packet (see @ref MAX_PACKET_SIZE).
+     * @returns Number of bytes the packet buffer can currently hold.
+     */
+    uint32_t Capacity() const;
+
     /**
      * @brief Ensure the packet data buffer is allocated.
+     * @param capacity Minimum number of bytes the buffer should hold. If
+     *   the current buffer is too small the data is copied into a larger
+     *   buffer from the @ref PacketBufferPool.
      */
-    void Allocate();
+    void Allocate(uint32_t capacity = 0);
 
     /**
      * @brief Copy the packet data from another ReadOnlyPacket object.
@@ -750,7 +759,7 @@ public:
 protected:
     /// Protected constructor for use by subclasses.
     explicit ReadOnlyPacket(uint32_t position, uint32_t size,
-        uint8_t *pData, std::shared_ptr<PacketArray> dataRef);
+        uint8_t *pData, std::shared_ptr<PacketBuffer> dataRef);
 
     /// Current position in the packet.
     uint32_t mPosition;
@@ -763,7 +772,7 @@ protected:
 
     /// Reference to the underlying buffer (which could be shared between
     /// read only packets).
-    std::shared_ptr<PacketArray> mDataRef;
+    std::shared_ptr<PacketBuffer> mDataRef;
 };
 
 } // namespace libcomp
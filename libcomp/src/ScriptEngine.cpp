@@ -33,7 +33,9 @@
 #include "Constants.h"
 #include "Database.h"
 #include "Crypto.h"
+#include "DataStore.h"
 #include "DefinitionManager.h"
+#include "Exception.h"
 #include "Log.h"
 #include "ServerDataManager.h"
 
@@ -47,8 +49,11 @@
 #include <RegisteredChannel.h>
 #include <RegisteredWorld.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <mutex>
 
 #include <sqstdmath.h>
 #include <sqstdstring.h>
@@ -64,6 +69,116 @@ const SQBool    RAISE_ERROR = SQTrue;
 std::unordered_map<std::string, std::function<bool(ScriptEngine&,
     const std::string& module)>> ScriptEngine::mModules;
 
+/**
+ * Compiled scripts shared by every VM.
+ */
+struct BytecodeCache
+{
+    /// Lock for the cache.
+    std::mutex lock;
+
+    /// Bytecode of each script by the hash of the name and source.
+    std::unordered_map<std::string, std::shared_ptr<
+        const std::vector<char>>> bytecode;
+
+    /// Data store the bytecode is saved to (or null).
+    DataStore *pDataStore = nullptr;
+
+    /// Directory in the data store for the bytecode.
+    String path;
+};
+
+/**
+ * Get the cache of compiled scripts.
+ * @returns Cache of compiled scripts.
+ */
+static BytecodeCache& GetBytecodeCache()
+{
+    static BytecodeCache cache;
+
+    return cache;
+}
+
+/**
+ * Profiler settings and counters shared by every VM.
+ */
+struct ScriptProfiler
+{
+    /// Lock for the members below.
+    std::mutex lock;
+
+    /// If new engines should time the calls to each function.
+    bool profiling = false;
+
+    /// Maximum number of lines a call may run in new engines.
+    uint64_t maxLines = 0;
+
+    /// Maximum time a call may run in new engines (microseconds).
+    uint64_t maxMicroseconds = 0;
+
+    /// Counters for each function by name and location.
+    std::unordered_map<std::string, ScriptEngine::ProfileEntry> profile;
+};
+
+/**
+ * Get the profiler settings and counters.
+ * @returns Profiler settings and counters.
+ */
+static ScriptProfiler& GetProfiler()
+{
+    static ScriptProfiler profiler;
+
+    return profiler;
+}
+
+/**
+ * Number of lines to run between checks of the time budget.
+ */
+static const uint64_t LINES_PER_TIME_CHECK = 64;
+
+/**
+ * Position in the bytecode being read by sq_readclosure.
+ */
+struct BytecodeReader
+{
+    /// Bytecode being read.
+    const std::vector<char> *pBytecode;
+
+    /// Offset of the next byte to read.
+    size_t offset;
+};
+
+static SQInteger ReadBytecode(SQUserPointer pUserData, SQUserPointer pBuffer,
+    SQInteger size)
+{
+    BytecodeReader *pReader = reinterpret_cast<BytecodeReader*>(pUserData);
+
+    if(0 > size || (pReader->pBytecode->size() - pReader->offset) <
+        static_cast<size_t>(size))
+    {
+        return -1;
+    }
+
+    memcpy(pBuffer, pReader->pBytecode->data() + pReader->offset,
+        static_cast<size_t>(size));
+    pReader->offset += static_cast<size_t>(size);
+
+    return size;
+}
+
+static SQInteger WriteBytecode(SQUserPointer pUserData, SQUserPointer pBuffer,
+    SQInteger size)
+{
+    std::vector<char> *pBytecode = reinterpret_cast<std::vector<char>*>(
+        pUserData);
+
+    const char *pData = reinterpret_cast<const char*>(pBuffer);
+
+    pBytecode->insert(pBytecode->end(), pData, pData + size);
+
+    return size;
+}
+
 static std::shared_ptr<objects::Account> ToAccount(
     const std::shared_ptr<libcomp::PersistentObject>& obj)
 {
@@ -211,8 +326,13 @@ static void SquirrelErrorFunctionRaw(HSQUIRRELVM vm,
     delete[] szBuffer;
 }
 
-ScriptEngine::ScriptEngine(bool useRawPrint) : mUseRawPrint(useRawPrint)
+ScriptEngine::ScriptEngine(bool useRawPrint) : mHostEngine(this),
+    mSavedTop(0), mHasSavedState(false), mUseRawPrint(useRawPrint),
+    mProfiling(false), mMaxLines(0), mMaxMicroseconds(0), mAborted(false),
+    mCallDepth(0), mCallLines(0), mGuardDepth(0), mBudgetExceeded(false)
 {
+    sq_resetobject(&mThread);
+
     if(mModules.empty())
     {
         InitializeBuiltins();
@@ -263,36 +383,697 @@ ScriptEngine::ScriptEngine(bool useRawPrint) : mUseRawPrint(useRawPrint)
     // These are required by most things so just bind them now.
     Using<Sqrat::s64>();
     Using<Sqrat::u64>();
+
+    auto& profiler = GetProfiler();
+
+    {
+        std::lock_guard<std::mutex> guard(profiler.lock);
+
+        mProfiling = profiler.profiling;
+        mMaxLines = profiler.maxLines;
+        mMaxMicroseconds = profiler.maxMicroseconds;
+    }
+
+    UpdateDebugHook();
+}
+
+ScriptEngine::ScriptEngine(const std::shared_ptr<ScriptEngine>& host) :
+    mHostEngine(host.get()), mHost(host), mSavedTop(0),
+    mHasSavedState(false), mUseRawPrint(host->mUseRawPrint),
+    mProfiling(host->mProfiling), mMaxLines(host->mMaxLines),
+    mMaxMicroseconds(host->mMaxMicroseconds), mAborted(false),
+    mCallDepth(0), mCallLines(0), mGuardDepth(0), mBudgetExceeded(false)
+{
+    HSQUIRRELVM hostVM = host->mVM;
+
+    mVM = sq_newthread(hostVM, SQUIRREL_STACK_SIZE);
+
+    // Keep the thread alive until this engine is destroyed.
+    sq_resetobject(&mThread);
+    sq_getstackobj(hostVM, -1, &mThread);
+    sq_addref(hostVM, &mThread);
+    sq_pop(hostVM, 1);
+
+    sq_setforeignptr(mVM, this);
+
+    // The thread starts with an empty stack.
+    sq_pushroottable(mVM);
+
+    UpdateDebugHook();
 }
 
 ScriptEngine::~ScriptEngine()
 {
-    sq_close(mVM);
+    MergeProfile();
+
+    if(mHost)
+    {
+        sq_release(mHost->mVM, &mThread);
+    }
+    else
+    {
+        ClearState();
+
+        sq_close(mVM);
+    }
 }
 
 bool ScriptEngine::Eval(const String& source, const String& sourceName)
 {
+    if(mAborted)
+    {
+        return false;
+    }
+
     bool result = false;
 
     SQInteger top = sq_gettop(mVM);
 
-    if(SQ_SUCCEEDED(sq_compilebuffer(mVM, source.C(),
-        (SQInteger)source.Size(), sourceName.C(), 1)))
-    {
-        sq_pushroottable(mVM);
+    // Calls over budget may only be unwound while something catches them.
+    mGuardDepth++;
 
-        if(SQ_SUCCEEDED(sq_call(mVM, ONE_PARAM,
-            NO_RETURN_VALUE, RAISE_ERROR)))
+    try
+    {
+        if(LoadClosure(source, sourceName))
         {
-            result = true;
+            sq_pushroottable(mVM);
+
+            if(SQ_SUCCEEDED(sq_call(mVM, ONE_PARAM,
+                NO_RETURN_VALUE, RAISE_ERROR)))
+            {
+                result = true;
+            }
         }
     }
+    catch(const Exception& e)
+    {
+        mGuardDepth--;
+
+        HandleException(e);
+
+        // Don't touch the stack of the VM again.
+        return false;
+    }
+
+    mGuardDepth--;
 
     sq_settop(mVM, top);
 
     return result;
 }
 
+bool ScriptEngine::Call(const std::function<void()>& func)
+{
+    if(mAborted)
+    {
+        return false;
+    }
+
+    mGuardDepth++;
+
+    try
+    {
+        func();
+    }
+    catch(const Exception& e)
+    {
+        mGuardDepth--;
+
+        HandleException(e);
+
+        return false;
+    }
+
+    mGuardDepth--;
+
+    return true;
+}
+
+bool ScriptEngine::IsAborted() const
+{
+    return mAborted;
+}
+
+void ScriptEngine::SetProfiling(bool enabled)
+{
+    mProfiling = enabled;
+
+    UpdateDebugHook();
+}
+
+void ScriptEngine::SetCallBudget(uint64_t maxLines, uint64_t maxMicroseconds)
+{
+    mMaxLines = maxLines;
+    mMaxMicroseconds = maxMicroseconds;
+
+    UpdateDebugHook();
+}
+
+void ScriptEngine::SetDefaults(bool profiling, uint64_t maxLines,
+    uint64_t maxMicroseconds)
+{
+    auto& profiler = GetProfiler();
+
+    std::lock_guard<std::mutex> guard(profiler.lock);
+
+    profiler.profiling = profiling;
+    profiler.maxLines = maxLines;
+    profiler.maxMicroseconds = maxMicroseconds;
+}
+
+std::unordered_map<std::string, ScriptEngine::ProfileEntry>
+    ScriptEngine::GetProfile()
+{
+    auto& profiler = GetProfiler();
+
+    std::lock_guard<std::mutex> guard(profiler.lock);
+
+    return profiler.profile;
+}
+
+void ScriptEngine::LogProfile(size_t count)
+{
+    auto profile = GetProfile();
+
+    std::vector<std::pair<std::string, ProfileEntry>> entries(
+        profile.begin(), profile.end());
+
+    std::sort(entries.begin(), entries.end(), [](
+        const std::pair<std::string, ProfileEntry>& a,
+        const std::pair<std::string, ProfileEntry>& b)
+    {
+        return a.second.microseconds > b.second.microseconds;
+    });
+
+    if(entries.size() > count)
+    {
+        entries.resize(count);
+    }
+
+    LogScriptEngineInfo([&]()
+    {
+        return String("Script profile (%1 of %2 functions by total time):\n")
+            .Arg(entries.size()).Arg(profile.size());
+    });
+
+    for(auto& entry : entries)
+    {
+        LogScriptEngineInfo([&]()
+        {
+            return String("  %1: %2 calls, %3 us total, %4 us avg, "
+                "%5 us max\n").Arg(entry.first).Arg(entry.second.calls)
+                .Arg(entry.second.microseconds)
+                .Arg(entry.second.microseconds / std::max(
+                    entry.second.calls, (uint64_t)1))
+                .Arg(entry.second.maxMicroseconds);
+        });
+    }
+}
+
+void ScriptEngine::ClearProfile()
+{
+    auto& profiler = GetProfiler();
+
+    std::lock_guard<std::mutex> guard(profiler.lock);
+
+    profiler.profile.clear();
+}
+
+void ScriptEngine::UpdateDebugHook()
+{
+    if(mProfiling || 0 != mMaxLines || 0 != mMaxMicroseconds)
+    {
+        sq_setnativedebughook(mVM, &ScriptEngine::DebugHook);
+    }
+    else
+    {
+        sq_setnativedebughook(mVM, nullptr);
+    }
+}
+
+void ScriptEngine::HandleException(const Exception& e)
+{
+    // The budget was already logged when the call was aborted.
+    if(!mAborted)
+    {
+        e.Log();
+    }
+
+    // Frames unwound by the exception were never reported as returns.
+    mAborted = true;
+    mCallDepth = 0;
+    mProfileStack.clear();
+
+    MergeProfile();
+}
+
+void ScriptEngine::MergeProfile()
+{
+    if(mProfile.empty())
+    {
+        return;
+    }
+
+    auto& profiler = GetProfiler();
+
+    {
+        std::lock_guard<std::mutex> guard(profiler.lock);
+
+        for(auto& entry : mProfile)
+        {
+            auto& total = profiler.profile[entry.first];
+            total.calls += entry.second.calls;
+            total.microseconds += entry.second.microseconds;
+            total.maxMicroseconds = std::max(total.maxMicroseconds,
+                entry.second.maxMicroseconds);
+        }
+    }
+
+    mProfile.clear();
+}
+
+void ScriptEngine::DebugHook(HSQUIRRELVM vm, SQInteger type,
+    const SQChar *szSource, SQInteger line, const SQChar *szFunction)
+{
+    ScriptEngine *pEngine = (ScriptEngine*)sq_getforeignptr(vm);
+
+    if(nullptr == pEngine || pEngine->mAborted)
+    {
+        return;
+    }
+
+    switch(type)
+    {
+        case 'c':
+        {
+            auto now = std::chrono::steady_clock::now();
+
+            if(0 == pEngine->mCallDepth++)
+            {
+                pEngine->mCallStart = now;
+                pEngine->mCallLines = 0;
+                pEngine->mBudgetExceeded = false;
+            }
+
+            if(pEngine->mProfiling)
+            {
+                pEngine->mProfileStack.push_back({ String("%1 (%2:%3)").Arg(
+                    szFunction ? szFunction : "?").Arg(
+                    szSource ? szSource : "?").Arg((int64_t)line).ToUtf8(),
+                    now });
+            }
+
+            if(0 != pEngine->mMaxMicroseconds &&
+                pEngine->mMaxMicroseconds < (uint64_t)std::chrono::
+                duration_cast<std::chrono::microseconds>(
+                now - pEngine->mCallStart).count())
+            {
+                pEngine->AbortCall("time budget exceeded",
+                    szSource, line, szFunction);
+            }
+            break;
+        }
+        case 'r':
+        {
+            if(0 == pEngine->mCallDepth)
+            {
+                // The hook was installed during the call.
+                break;
+            }
+
+            pEngine->mCallDepth--;
+
+            // Only frames pushed while profiling are timed.
+            if(pEngine->mProfileStack.size() > pEngine->mCallDepth)
+            {
+                auto& frame = pEngine->mProfileStack.back();
+
+                uint64_t elapsed = (uint64_t)std::chrono::duration_cast<
+                    std::chrono::microseconds>(std::chrono::steady_clock::now()
+                    - frame.start).count();
+
+                auto& entry = pEngine->mProfile[frame.name];
+                entry.calls++;
+                entry.microseconds += elapsed;
+                entry.maxMicroseconds = std::max(entry.maxMicroseconds,
+                    elapsed);
+
+                pEngine->mProfileStack.pop_back();
+            }
+
+            if(0 == pEngine->mCallDepth)
+            {
+                pEngine->MergeProfile();
+            }
+            break;
+        }
+        case 'l':
+        {
+            pEngine->mCallLines++;
+
+            if(0 != pEngine->mMaxLines &&
+                pEngine->mCallLines > pEngine->mMaxLines)
+            {
+                pEngine->AbortCall("line budget exceeded",
+                    szSource, line, szFunction);
+            }
+
+            // Reading the clock on every line is too slow.
+            if(0 != pEngine->mMaxMicroseconds && 0 == (pEngine->mCallLines %
+                LINES_PER_TIME_CHECK) && pEngine->mMaxMicroseconds <
+                (uint64_t)std::chrono::duration_cast<
+                std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                pEngine->mCallStart).count())
+            {
+                pEngine->AbortCall("time budget exceeded",
+                    szSource, line, szFunction);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void ScriptEngine::AbortCall(const String& reason, const SQChar *szSource,
+    SQInteger line, const SQChar *szFunction)
+{
+    // An exception thrown here without Eval or Call to catch it would
+    // unwind through the VM and terminate the process so let it finish.
+    if(0 == mGuardDepth)
+    {
+        if(!mBudgetExceeded)
+        {
+            mBudgetExceeded = true;
+
+            LogScriptEngineWarning([&]()
+            {
+                return String("Script call in %1 (%2:%3) was not made "
+                    "through Eval or Call so it can't be aborted and will "
+                    "finish: %4\n").Arg(szFunction ? szFunction :
+                    "?").Arg(szSource ? szSource : "?").Arg((int64_t)line)
+                    .Arg(reason);
+            });
+        }
+
+        return;
+    }
+
+    LogScriptEngineError([&]()
+    {
+        return String("Aborting script call in %1 (%2:%3) after %4 lines "
+            "and %5 us: %6\n").Arg(szFunction ? szFunction : "?")
+            .Arg(szSource ? szSource : "?").Arg((int64_t)line)
+            .Arg(mCallLines).Arg((uint64_t)std::chrono::duration_cast<
+            std::chrono::microseconds>(std::chrono::steady_clock::now() -
+            mCallStart).count()).Arg(reason);
+    });
+
+    sqstd_printcallstack(mVM);
+
+    mAborted = true;
+
+    // Squirrel has no way to stop a call from the debug hook so unwind it.
+    EXCEPTION(String("Script call aborted: %1").Arg(reason));
+}
+
+void ScriptEngine::SaveState()
+{
+    if(mHost)
+    {
+        return;
+    }
+
+    ClearState();
+
+    mSavedTop = sq_gettop(mVM);
+    mSavedBindings = mBindings;
+    mSavedImports = mImports;
+
+    sq_pushroottable(mVM);
+    sq_pushnull(mVM);
+
+    while(SQ_SUCCEEDED(sq_next(mVM, -2)))
+    {
+        HSQOBJECT key, value;
+
+        sq_getstackobj(mVM, -2, &key);
+        sq_getstackobj(mVM, -1, &value);
+        sq_addref(mVM, &key);
+        sq_addref(mVM, &value);
+
+        mSavedRoot.push_back(std::make_pair(key, value));
+
+        sq_pop(mVM, 2);
+    }
+
+    // Pop the iterator and the root table.
+    sq_pop(mVM, 2);
+
+    mHasSavedState = true;
+}
+
+bool ScriptEngine::ResetState()
+{
+    if(mHost || !mHasSavedState)
+    {
+        return false;
+    }
+
+    sq_settop(mVM, mSavedTop);
+
+    // Find the slots that were added.
+    std::vector<HSQOBJECT> added;
+
+    sq_pushroottable(mVM);
+    sq_pushnull(mVM);
+
+    while(SQ_SUCCEEDED(sq_next(mVM, -2)))
+    {
+        HSQOBJECT key;
+
+        sq_getstackobj(mVM, -2, &key);
+
+        bool found = false;
+
+        for(auto& slot : mSavedRoot)
+        {
+            // Keys are strings (which are shared) or simple values.
+            if(slot.first._type == key._type &&
+                slot.first._unVal.raw == key._unVal.raw)
+            {
+                found = true;
+                break;
+            }
+        }
+
+        if(!found)
+        {
+            sq_addref(mVM, &key);
+            added.push_back(key);
+        }
+
+        sq_pop(mVM, 2);
+    }
+
+    // Pop the iterator (the root table stays for the changes below).
+    sq_pop(mVM, 1);
+
+    for(auto& key : added)
+    {
+        sq_pushobject(mVM, key);
+        sq_deleteslot(mVM, -2, SQFalse);
+        sq_release(mVM, &key);
+    }
+
+    // Put back any values that were replaced.
+    for(auto& slot : mSavedRoot)
+    {
+        sq_pushobject(mVM, slot.first);
+        sq_pushobject(mVM, slot.second);
+        sq_newslot(mVM, -3, SQFalse);
+    }
+
+    sq_pop(mVM, 1);
+
+    mBindings = mSavedBindings;
+    mImports = mSavedImports;
+
+    sq_collectgarbage(mVM);
+
+    return true;
+}
+
+bool ScriptEngine::IsThread() const
+{
+    return nullptr != mHost;
+}
+
+void ScriptEngine::ClearState()
+{
+    for(auto& slot : mSavedRoot)
+    {
+        sq_release(mVM, &slot.first);
+        sq_release(mVM, &slot.second);
+    }
+
+    mSavedRoot.clear();
+    mSavedBindings.clear();
+    mSavedImports.clear();
+    mHasSavedState = false;
+}
+
+void ScriptEngine::SetBytecodeStore(DataStore *pDataStore,
+    const String& path)
+{
+    auto& cache = GetBytecodeCache();
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    cache.pDataStore = pDataStore;
+    cache.path = path;
+
+    if(nullptr != pDataStore && !pDataStore->Exists(path) &&
+        !pDataStore->CreateDirectory(path))
+    {
+        LogScriptEngineWarning([&]()
+        {
+            return String("Failed to create the script cache directory %1: "
+                "%2\n").Arg(path).Arg(pDataStore->GetError());
+        });
+
+        cache.pDataStore = nullptr;
+    }
+}
+
+void ScriptEngine::ClearBytecodeCache()
+{
+    auto& cache = GetBytecodeCache();
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    cache.bytecode.clear();
+}
+
+size_t ScriptEngine::GetBytecodeCacheSize()
+{
+    auto& cache = GetBytecodeCache();
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    return cache.bytecode.size();
+}
+
+bool ScriptEngine::LoadClosure(const String& source,
+    const String& sourceName)
+{
+    auto& cache = GetBytecodeCache();
+
+    // Line events for the call budget need the debug info.
+    bool debugInfo = 0 != mMaxLines || 0 != mMaxMicroseconds;
+
+    // The name is part of the key as it is stored in the bytecode.
+    std::vector<char> key(sourceName.C(), sourceName.C() +
+        sourceName.Size() + 1);
+    key.insert(key.end(), source.C(), source.C() + source.Size());
+
+    if(debugInfo)
+    {
+        key.push_back(0);
+        key.push_back('d');
+    }
+
+    std::string hash = Crypto::SHA1(key).ToUtf8();
+
+    std::shared_ptr<const std::vector<char>> bytecode;
+    DataStore *pDataStore = nullptr;
+    String bytecodePath;
+
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+
+        auto it = cache.bytecode.find(hash);
+
+        if(cache.bytecode.end() != it)
+        {
+            bytecode = it->second;
+        }
+
+        pDataStore = cache.pDataStore;
+
+        if(nullptr != pDataStore)
+        {
+            bytecodePath = String("%1/%2.cnut").Arg(cache.path).Arg(hash);
+        }
+    }
+
+    // Check for bytecode saved by a previous run.
+    if(!bytecode && nullptr != pDataStore && pDataStore->Exists(
+        bytecodePath))
+    {
+        auto data = std::make_shared<std::vector<char>>(
+            pDataStore->ReadFile(bytecodePath));
+
+        if(!data->empty())
+        {
+            bytecode = data;
+
+            std::lock_guard<std::mutex> guard(cache.lock);
+
+            cache.bytecode[hash] = bytecode;
+        }
+    }
+
+    if(bytecode)
+    {
+        BytecodeReader reader = { bytecode.get(), 0 };
+
+        if(SQ_SUCCEEDED(sq_readclosure(mVM, &ReadBytecode, &reader)))
+        {
+            return true;
+        }
+
+        // The bytecode may be from another version of Squirrel so just
+        // compile the script again.
+        LogScriptEngineDebug([&]()
+        {
+            return String("Discarding invalid bytecode for script %1\n")
+                .Arg(sourceName);
+        });
+    }
+
+    sq_enabledebuginfo(mVM, debugInfo ? SQTrue : SQFalse);
+
+    if(SQ_FAILED(sq_compilebuffer(mVM, source.C(),
+        (SQInteger)source.Size(), sourceName.C(), 1)))
+    {
+        return false;
+    }
+
+    auto data = std::make_shared<std::vector<char>>();
+
+    if(SQ_SUCCEEDED(sq_writeclosure(mVM, &WriteBytecode, data.get())))
+    {
+        {
+            std::lock_guard<std::mutex> guard(cache.lock);
+
+            cache.bytecode[hash] = data;
+        }
+
+        if(nullptr != pDataStore && !pDataStore->WriteFile(bytecodePath,
+            *data))
+        {
+            LogScriptEngineWarning([&]()
+            {
+                return String("Failed to save the bytecode for script %1 "
+                    "to %2\n").Arg(sourceName).Arg(bytecodePath);
+            });
+        }
+    }
+
+    return true;
+}
+
 HSQUIRRELVM ScriptEngine::GetVM()
 {
     return mVM;
@@ -322,10 +1103,12 @@ std::shared_ptr<ScriptEngine> ScriptEngine::Self(HSQUIRRELVM vm)
 
 bool ScriptEngine::BindingExists(const std::string& name, bool lockBinding)
 {
-    bool result = mBindings.find(name) != mBindings.end();
+    auto& bindings = mHostEngine->mBindings;
+
+    bool result = bindings.find(name) != bindings.end();
     if(!result && lockBinding)
     {
-        mBindings.insert(name);
+        bindings.insert(name);
     }
 
     return result;
@@ -381,7 +1164,9 @@ bool ScriptEngine::Include(const std::string& path)
 
 bool ScriptEngine::Import(const std::string& module)
 {
-    bool result = mImports.find(module) != mImports.end();
+    auto& imports = mHostEngine->mImports;
+
+    bool result = imports.find(module) != imports.end();
 
     if(result)
     {
@@ -409,7 +1194,7 @@ bool ScriptEngine::Import(const std::string& module)
 
     if(result)
     {
-        mImports.insert(module);
+        imports.insert(module);
     }
 
     return result;
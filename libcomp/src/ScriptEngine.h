@@ -42,13 +42,18 @@
 #include "PopIgnore.h"
 
 // Standard C++11 Includes
+#include <chrono>
 #include <functional>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace libcomp
 {
 
+class DataStore;
+class Exception;
+
 /**
  * Represents a Sqrat based Squirrel virtual machine handler to facilitate
  * script execution and bind @ref Object instances to the VM.
@@ -56,12 +61,36 @@ namespace libcomp
 class ScriptEngine : public std::enable_shared_from_this<ScriptEngine>
 {
 public:
+    /**
+     * Counters collected by the profiler for a script function.
+     */
+    struct ProfileEntry
+    {
+        /// Number of calls to the function.
+        uint64_t calls;
+
+        /// Time spent in the function including the functions it called
+        /// (microseconds).
+        uint64_t microseconds;
+
+        /// Longest single call to the function (microseconds).
+        uint64_t maxMicroseconds;
+    };
+
     /**
      * Create the VM.
      * @param useRawPrint Set this to not prefix messages with "SQUIRREL: ".
      */
     ScriptEngine(bool useRawPrint = false);
 
+    /**
+     * Create a Squirrel thread of another engine. The thread has its own
+     * stack but shares the root table, bindings and imports of the other
+     * engine so it must only be used on the same thread as it.
+     * @param host Engine that owns the VM.
+     */
+    explicit ScriptEngine(const std::shared_ptr<ScriptEngine>& host);
+
     /**
      * Clean up the VM.
      */
@@ -102,12 +131,108 @@ public:
     static std::shared_ptr<ScriptEngine> Self(HSQUIRRELVM vm);
 
     /**
-     * Evaluate a Squirrel script block as a string.
+     * Evaluate a Squirrel script block as a string. The script is compiled
+     * once and the bytecode is cached (by the name and contents of the
+     * script) so evaluating it again in any VM only has to load it.
      * @param source Squirrel script block as a string
+     * @param sourceName Name of the script used in error messages.
      * @return true on success, false on failure
      */
     bool Eval(const String& source, const String& sourceName = String());
 
+    /**
+     * Make a call into the VM (like a Sqrat::Function) and catch the
+     * exception thrown when the call goes over its budget. Once a call has
+     * been aborted the engine can't be used again.
+     * @param func Function that calls into the VM.
+     * @return true if the call finished, false if it was aborted.
+     */
+    bool Call(const std::function<void()>& func);
+
+    /**
+     * Check if a call into the VM was aborted. Squirrel can't stop a call
+     * from the debug hook so it is unwound with an exception which leaves
+     * the VM in an unknown state. The engine should be destroyed.
+     * @return true if a call was aborted, false otherwise.
+     */
+    bool IsAborted() const;
+
+    /**
+     * Enable or disable the profiler for this engine.
+     * @param enabled If the calls to each function should be timed.
+     */
+    void SetProfiling(bool enabled);
+
+    /**
+     * Set the limits for each call into the VM. A call made through
+     * @ref Eval or @ref Call that goes over either limit is aborted (see
+     * @ref IsAborted). Squirrel only reports when a new line starts
+     * so the line count is used in place of an instruction count. Lines
+     * are only reported for scripts compiled after the limits were set.
+     *
+     * @note The limits are not enforced for a script function called
+     * directly through Sqrat (Sqrat::Function::Execute or Evaluate), which
+     * is how most server code calls into scripts. The abort is an exception
+     * that would unwind through the VM with nothing to catch it, so such a
+     * call only logs a warning and runs to the end. Wrap the call in
+     * @ref Call to have the limits apply to it.
+     * @param maxLines Maximum number of lines a call may run or 0 for no
+     *  limit.
+     * @param maxMicroseconds Maximum time a call may run (microseconds) or
+     *  0 for no limit.
+     */
+    void SetCallBudget(uint64_t maxLines, uint64_t maxMicroseconds);
+
+    /**
+     * Set the profiler and call budget settings used by new engines.
+     * @param profiling If the calls to each function should be timed.
+     * @param maxLines Maximum number of lines a call may run or 0 for no
+     *  limit.
+     * @param maxMicroseconds Maximum time a call may run (microseconds) or
+     *  0 for no limit.
+     */
+    static void SetDefaults(bool profiling, uint64_t maxLines,
+        uint64_t maxMicroseconds);
+
+    /**
+     * Get the counters collected by the profiler of every engine. The
+     * counters of an engine are added once its outermost call returns.
+     * @return Counters for each function by name and location.
+     */
+    static std::unordered_map<std::string, ProfileEntry> GetProfile();
+
+    /**
+     * Log the functions that took the most time.
+     * @param count Maximum number of functions to log.
+     */
+    static void LogProfile(size_t count = 20);
+
+    /**
+     * Remove the counters collected by the profiler.
+     */
+    static void ClearProfile();
+
+    /**
+     * Set where compiled scripts are saved so they can be loaded by the
+     * next run of the server instead of compiled again.
+     * @param pDataStore Data store to save the scripts to or null to only
+     *  cache the compiled scripts in memory.
+     * @param path Directory in the data store for the compiled scripts.
+     */
+    static void SetBytecodeStore(DataStore *pDataStore,
+        const String& path = String());
+
+    /**
+     * Remove all compiled scripts from the memory cache.
+     */
+    static void ClearBytecodeCache();
+
+    /**
+     * Get the number of compiled scripts in the memory cache.
+     * @return Number of compiled scripts.
+     */
+    static size_t GetBytecodeCacheSize();
+
     /**
      * Import a Squirrel binding module into the virtual machine.
      * @param module Name of the module to import.
@@ -130,6 +255,27 @@ public:
     void RegisterModule(const std::string& module, const std::function<
         bool(ScriptEngine&, const std::string& module)>& func);
 
+    /**
+     * Remember the root table, bindings and imports so @ref ResetState can
+     * return the VM to this state.
+     */
+    void SaveState();
+
+    /**
+     * Remove everything added to the root table since @ref SaveState was
+     * called and restore the values that were replaced. The bindings and
+     * imports are restored as well.
+     * @return true if the state was reset, false if there is no saved state
+     *  or the engine is a thread of another engine.
+     */
+    bool ResetState();
+
+    /**
+     * Check if the engine is a Squirrel thread of another engine.
+     * @return true if the engine is a thread, false otherwise.
+     */
+    bool IsThread() const;
+
 private:
     /**
      * Utility function to complete the binding of an object via @ref ScriptEngine::Using.
@@ -138,7 +284,7 @@ private:
      */
     template <class T, class A> void Bind(const std::string& name,  Sqrat::Class<T, A>& binding)
     {
-        mBindings.insert(name);
+        mHostEngine->mBindings.insert(name);
         Sqrat::RootTable(mVM).Bind(name.c_str(), binding);
     }
 
@@ -157,9 +303,102 @@ private:
      */
     void InitializeBuiltins();
 
+    /**
+     * Release the references to the saved root table.
+     */
+    void ClearState();
+
+    /**
+     * Push the compiled closure for a script onto the stack. The bytecode
+     * is taken from the cache (or the bytecode store) when possible.
+     * Otherwise the script is compiled and the bytecode is cached.
+     * @param source Squirrel script block as a string
+     * @param sourceName Name of the script used in error messages.
+     * @return true if the closure was pushed, false if the script failed
+     *  to compile.
+     */
+    bool LoadClosure(const String& source, const String& sourceName);
+
+    /**
+     * Install or remove the debug hook depending on if the profiler or a
+     * call budget is enabled.
+     */
+    void UpdateDebugHook();
+
+    /**
+     * Handle an exception thrown out of the VM.
+     * @param e Exception that was caught.
+     */
+    void HandleException(const Exception& e);
+
+    /**
+     * Add the counters of this engine to the counters of every engine.
+     */
+    void MergeProfile();
+
+    /**
+     * Called by Squirrel when a function is called or returns or a new
+     * line starts.
+     * @param vm Squirrel handle to the virtual machine.
+     * @param type 'c' for a call, 'r' for a return or 'l' for a line.
+     * @param szSource Name of the script.
+     * @param line Current line of the script.
+     * @param szFunction Name of the function.
+     */
+    static void DebugHook(HSQUIRRELVM vm, SQInteger type,
+        const SQChar *szSource, SQInteger line, const SQChar *szFunction);
+
+    /**
+     * Log why a call was aborted and unwind it. The call is only logged if
+     * it was not made through @ref Eval or @ref Call.
+     * @param reason Description of the limit that was reached.
+     * @param szSource Name of the script.
+     * @param line Current line of the script.
+     * @param szFunction Name of the function.
+     */
+    void AbortCall(const String& reason, const SQChar *szSource,
+        SQInteger line, const SQChar *szFunction);
+
+    /**
+     * A call into a script function being timed by the profiler.
+     */
+    struct ProfileFrame
+    {
+        /// Name and location of the function.
+        std::string name;
+
+        /// When the function was called.
+        std::chrono::steady_clock::time_point start;
+    };
+
     /// The Sqrat VM
     HSQUIRRELVM mVM;
 
+    /// Engine that owns the VM. This is the engine itself unless it is a
+    /// thread of another engine.
+    ScriptEngine *mHostEngine;
+
+    /// Keeps the engine that owns the VM alive for a thread.
+    std::shared_ptr<ScriptEngine> mHost;
+
+    /// Reference to the Squirrel thread (if the engine is a thread).
+    HSQOBJECT mThread;
+
+    /// Slots of the root table saved by @ref SaveState.
+    std::vector<std::pair<HSQOBJECT, HSQOBJECT>> mSavedRoot;
+
+    /// Stack size saved by @ref SaveState.
+    SQInteger mSavedTop;
+
+    /// Bindings saved by @ref SaveState.
+    std::set<std::string> mSavedBindings;
+
+    /// Imports saved by @ref SaveState.
+    std::set<std::string> mSavedImports;
+
+    /// Indicates @ref SaveState has been called.
+    bool mHasSavedState;
+
     /// Bindings that have already been made to objects via @ref ScriptEngine::Using
     std::set<std::string> mBindings;
 
@@ -169,6 +408,41 @@ private:
     /// If the logging system should be used or not.
     bool mUseRawPrint;
 
+    /// If the calls to each function should be timed.
+    bool mProfiling;
+
+    /// Maximum number of lines a call may run (0 for no limit).
+    uint64_t mMaxLines;
+
+    /// Maximum time a call may run in microseconds (0 for no limit).
+    uint64_t mMaxMicroseconds;
+
+    /// Indicates a call was aborted and the VM can't be used again.
+    bool mAborted;
+
+    /// Number of script functions currently being called.
+    uint64_t mCallDepth;
+
+    /// Number of lines run by the current outermost call.
+    uint64_t mCallLines;
+
+    /// Number of @ref Eval and @ref Call scopes that will catch an
+    /// aborted call.
+    uint64_t mGuardDepth;
+
+    /// Indicates the current outermost call went over its budget but
+    /// could not be aborted.
+    bool mBudgetExceeded;
+
+    /// When the current outermost call started.
+    std::chrono::steady_clock::time_point mCallStart;
+
+    /// Functions being timed by the profiler.
+    std::vector<ProfileFrame> mProfileStack;
+
+    /// Counters not yet added to the counters of every engine.
+    std::unordered_map<std::string, ProfileEntry> mProfile;
+
     /// Map of functions to import a script module.
     static std::unordered_map<std::string, std::function<bool(ScriptEngine&,
         const std::string& module)>> mModules;
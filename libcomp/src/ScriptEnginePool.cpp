@@ -0,0 +1,268 @@
+/**
+ * @file libcomp/src/ScriptEnginePool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of script engines with common bindings already applied.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScriptEnginePool.h"
+
+#ifndef EXOTIC_PLATFORM
+
+// Standard C++11 Includes
+#include <cstring>
+
+#if defined(__GLIBC__) && (2 < __GLIBC__ || \
+    (2 == __GLIBC__ && 33 <= __GLIBC_MINOR__))
+#include <malloc.h>
+
+#define HAVE_MALLINFO2
+#endif // glibc 2.33+
+
+using namespace libcomp;
+
+/**
+ * Get the heap memory in use by the process.
+ * @returns Heap memory in use (bytes) or 0 if it is not known.
+ */
+static uint64_t GetHeapUsage()
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2();
+
+    return static_cast<uint64_t>(info.uordblks + info.hblkhd);
+#else // !HAVE_MALLINFO2
+    return 0;
+#endif // HAVE_MALLINFO2
+}
+
+ScriptEnginePool::ScriptEnginePool(const Setup_t& setup, size_t maxIdle,
+    bool useRawPrint) : mSetup(setup), mMaxIdle(maxIdle),
+    mUseRawPrint(useRawPrint), mMeasuredMemory(0), mMeasuredCount(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+ScriptEnginePool::~ScriptEnginePool()
+{
+    for(auto pEngine : mIdle)
+    {
+        delete pEngine;
+    }
+
+    mIdle.clear();
+}
+
+void ScriptEnginePool::Warm(size_t count)
+{
+    std::list<ScriptEngine*> engines;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        if(count <= mIdle.size())
+        {
+            return;
+        }
+
+        count -= mIdle.size();
+    }
+
+    // Create the engines without holding the lock.
+    for(size_t i = 0; i < count; ++i)
+    {
+        engines.push_back(CreateEngine());
+    }
+
+    std::lock_guard<std::mutex> guard(mLock);
+
+    mIdle.splice(mIdle.end(), engines);
+}
+
+std::shared_ptr<ScriptEngine> ScriptEnginePool::Acquire()
+{
+    ScriptEngine *pEngine = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        mStats.acquired++;
+
+        if(!mIdle.empty())
+        {
+            pEngine = mIdle.front();
+            mIdle.pop_front();
+        }
+        else
+        {
+            mStats.created++;
+        }
+    }
+
+    if(nullptr == pEngine)
+    {
+        pEngine = CreateEngine();
+    }
+
+    return Wrap(pEngine);
+}
+
+std::shared_ptr<ScriptEngine> ScriptEnginePool::AcquireThread()
+{
+    std::shared_ptr<ScriptEngine> host;
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        host = mSharedEngine;
+    }
+
+    if(!host)
+    {
+        host = Wrap(CreateEngine());
+
+        std::lock_guard<std::mutex> guard(mLock);
+
+        // Another thread may have created it first.
+        if(mSharedEngine)
+        {
+            host = mSharedEngine;
+        }
+        else
+        {
+            mSharedEngine = host;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        mStats.threadCount++;
+    }
+
+    std::weak_ptr<ScriptEnginePool> weakPool = shared_from_this();
+
+    return std::shared_ptr<ScriptEngine>(new ScriptEngine(host),
+        [weakPool](ScriptEngine *pEngine)
+        {
+            delete pEngine;
+
+            auto pool = weakPool.lock();
+
+            if(pool)
+            {
+                std::lock_guard<std::mutex> guard(pool->mLock);
+
+                pool->mStats.threadCount--;
+            }
+        });
+}
+
+ScriptEnginePool::Stats ScriptEnginePool::GetStats()
+{
+    std::lock_guard<std::mutex> guard(mLock);
+
+    Stats stats = mStats;
+    stats.idleCount = mIdle.size();
+    stats.memoryPerVM = 0 == mMeasuredCount ? 0 :
+        (mMeasuredMemory / mMeasuredCount);
+
+    return stats;
+}
+
+ScriptEngine* ScriptEnginePool::CreateEngine()
+{
+    // This is only an estimate as other threads may allocate memory at the
+    // same time.
+    uint64_t heapBefore = GetHeapUsage();
+
+    ScriptEngine *pEngine = new ScriptEngine(mUseRawPrint);
+
+    if(mSetup)
+    {
+        mSetup(*pEngine);
+    }
+
+    pEngine->SaveState();
+
+    uint64_t heapAfter = GetHeapUsage();
+
+    std::lock_guard<std::mutex> guard(mLock);
+
+    mStats.vmCount++;
+
+    if(heapAfter > heapBefore)
+    {
+        mMeasuredMemory += heapAfter - heapBefore;
+        mMeasuredCount++;
+    }
+
+    return pEngine;
+}
+
+void ScriptEnginePool::Release(ScriptEngine *pEngine)
+{
+    // The VM of an aborted engine can't be trusted so never reuse it.
+    bool aborted = pEngine->IsAborted();
+
+    if(!aborted)
+    {
+        pEngine->ResetState();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+
+        if(!aborted && mIdle.size() < mMaxIdle)
+        {
+            mIdle.push_back(pEngine);
+
+            return;
+        }
+
+        mStats.vmCount--;
+    }
+
+    delete pEngine;
+}
+
+std::shared_ptr<ScriptEngine> ScriptEnginePool::Wrap(ScriptEngine *pEngine)
+{
+    std::weak_ptr<ScriptEnginePool> weakPool = shared_from_this();
+
+    return std::shared_ptr<ScriptEngine>(pEngine,
+        [weakPool](ScriptEngine *pReleased)
+        {
+            auto pool = weakPool.lock();
+
+            if(pool)
+            {
+                pool->Release(pReleased);
+            }
+            else
+            {
+                delete pReleased;
+            }
+        });
+}
+
+#endif // !EXOTIC_PLATFORM
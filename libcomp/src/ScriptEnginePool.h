@@ -0,0 +1,189 @@
+/**
+ * @file libcomp/src/ScriptEnginePool.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of script engines with common bindings already applied.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_SCRIPTENGINEPOOL_H
+#define LIBCOMP_SRC_SCRIPTENGINEPOOL_H
+
+#ifndef EXOTIC_PLATFORM
+
+// libcomp Includes
+#include "ScriptEngine.h"
+
+// Standard C++11 Includes
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace libcomp
+{
+
+/**
+ * Keeps warm script engines that have already been set up with the
+ * bindings common to a type of script. Creating an engine and binding the
+ * objects it needs is expensive so engines are handed out by
+ * @ref Acquire and returned to the pool when the last pointer to them is
+ * released. The root table of a returned engine is reset to the state it
+ * had after the setup so nothing leaks between users of the engine.
+ *
+ * For many small scripts that do not need their own root table (like the
+ * AI of each entity in a zone) @ref AcquireThread hands out Squirrel
+ * threads of one shared engine instead. These all share the root table
+ * of the shared engine and must only be used by a single thread at a time.
+ *
+ * The pool must be owned by a std::shared_ptr.
+ */
+class ScriptEnginePool : public std::enable_shared_from_this<
+    ScriptEnginePool>
+{
+public:
+    /**
+     * Function called to set up the bindings of a new engine.
+     */
+    typedef std::function<void(ScriptEngine&)> Setup_t;
+
+    /**
+     * Counters for the pool.
+     */
+    struct Stats
+    {
+        /// Number of engines (each with its own VM) that exist.
+        uint64_t vmCount;
+
+        /// Number of engines waiting in the pool.
+        uint64_t idleCount;
+
+        /// Number of Squirrel threads of the shared engine that exist.
+        uint64_t threadCount;
+
+        /// Number of engines handed out by the pool.
+        uint64_t acquired;
+
+        /// Number of engines that had to be created because the pool was
+        /// empty.
+        uint64_t created;
+
+        /// Heap memory used by each engine after it was set up (bytes).
+        /// This is 0 if it could not be measured.
+        uint64_t memoryPerVM;
+    };
+
+    /**
+     * Create a pool of engines.
+     * @param setup Function to set up the bindings of each new engine.
+     * @param maxIdle Maximum number of engines kept in the pool. Engines
+     *  returned to a full pool are destroyed.
+     * @param useRawPrint Set this to not prefix messages with "SQUIRREL: ".
+     */
+    ScriptEnginePool(const Setup_t& setup, size_t maxIdle = 16,
+        bool useRawPrint = false);
+
+    /**
+     * Destroy the engines in the pool. Engines still handed out are
+     * destroyed when they are released.
+     */
+    ~ScriptEnginePool();
+
+    /**
+     * Create the engines so the pool has the given number of them waiting.
+     * @param count Number of engines to have waiting in the pool.
+     */
+    void Warm(size_t count);
+
+    /**
+     * Get an engine with its own VM. The engine goes back to the pool when
+     * the last pointer to it is released.
+     * @return Engine ready to evaluate scripts.
+     */
+    std::shared_ptr<ScriptEngine> Acquire();
+
+    /**
+     * Get a Squirrel thread of the shared engine of the pool. The thread
+     * has its own stack but shares the root table with the other threads.
+     * @return Engine for the thread.
+     */
+    std::shared_ptr<ScriptEngine> AcquireThread();
+
+    /**
+     * Get the counters for the pool.
+     * @return Counters for the pool.
+     */
+    Stats GetStats();
+
+private:
+    /**
+     * Create an engine and set it up.
+     * @return New engine.
+     */
+    ScriptEngine* CreateEngine();
+
+    /**
+     * Return an engine to the pool (or destroy it if the pool is full or
+     * a call into the engine was aborted).
+     * @param pEngine Engine to return.
+     */
+    void Release(ScriptEngine *pEngine);
+
+    /**
+     * Wrap an engine so it goes back to the pool when it is released.
+     * @param pEngine Engine to wrap.
+     * @return Pointer to the engine.
+     */
+    std::shared_ptr<ScriptEngine> Wrap(ScriptEngine *pEngine);
+
+    /// Function to set up the bindings of each new engine.
+    Setup_t mSetup;
+
+    /// Maximum number of engines kept in the pool.
+    size_t mMaxIdle;
+
+    /// If new engines should not prefix messages with "SQUIRREL: ".
+    bool mUseRawPrint;
+
+    /// Lock for the members below.
+    std::mutex mLock;
+
+    /// Engines waiting in the pool.
+    std::list<ScriptEngine*> mIdle;
+
+    /// Engine the threads handed out by @ref AcquireThread belong to.
+    std::shared_ptr<ScriptEngine> mSharedEngine;
+
+    /// Counters for the pool (idle count is filled in by @ref GetStats).
+    Stats mStats;
+
+    /// Total heap memory measured for the engines that were created.
+    uint64_t mMeasuredMemory;
+
+    /// Number of engines the heap memory was measured for.
+    uint64_t mMeasuredCount;
+};
+
+} // namespace libcomp
+
+#endif // !EXOTIC_PLATFORM
+
+#endif // LIBCOMP_SRC_SCRIPTENGINEPOOL_H
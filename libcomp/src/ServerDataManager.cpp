@@ -32,6 +32,7 @@
 #include "DefinitionManager.h"
 #include "Log.h"
 #include "ScriptEngine.h"
+#include "ScriptEnginePool.h"
 
 // object Includes
 #include <Action.h>
@@ -2586,9 +2587,20 @@ namespace libcomp
 bool ServerDataManager::LoadScript(const libcomp::String& path,
     const libcomp::String& source)
 {
-    ScriptEngine engine;
-    engine.Using<ServerScript>();
-    if(!engine.Eval(source))
+    // Every script is loaded by the same engine (reset after each one).
+    if(!mScriptEnginePool)
+    {
+        mScriptEnginePool = std::make_shared<ScriptEnginePool>(
+            [](ScriptEngine& scriptEngine)
+            {
+                // Loading is not held to the script call budget.
+                scriptEngine.SetCallBudget(0, 0);
+                scriptEngine.Using<ServerScript>();
+            }, 1);
+    }
+
+    auto engine = mScriptEnginePool->Acquire();
+    if(!engine->Eval(source, path))
     {
         LogServerDataManagerError([&]()
         {
@@ -2599,7 +2611,7 @@ bool ServerDataManager::LoadScript(const libcomp::String& path,
         return false;
     }
 
-    auto root = Sqrat::RootTable(engine.GetVM());
+    auto root = Sqrat::RootTable(engine->GetVM());
     auto fDef = root.GetFunction("define");
     if(fDef.IsNull())
     {
@@ -71,6 +71,7 @@ namespace libcomp
 {
 
 class DefinitionManager;
+class ScriptEnginePool;
 
 /**
  * Container for script information.
@@ -674,6 +675,9 @@ private:
 
     /// Map of AI scripts by name
     std::unordered_map<std::string, std::shared_ptr<ServerScript>> mAIScripts;
+
+    /// Engines used to load the scripts
+    std::shared_ptr<ScriptEnginePool> mScriptEnginePool;
 };
 
 } // namspace libcomp
@@ -34,12 +34,18 @@
 #include "CryptSupport.h"
 #endif
 
+// Standard C++11 Includes
+#include <cstring>
+#include <typeindex>
+#include <unordered_map>
+
 using namespace libcomp;
 
 TcpConnection::TcpConnection(asio::io_service& io_service) :
     mSocket(io_service), mDiffieHellman(nullptr), mStatus(
     TcpConnection::STATUS_NOT_CONNECTED), mRole(TcpConnection::ROLE_CLIENT),
-    mRemoteAddress("0.0.0.0"), mSendingPacket(false)
+    mStreamSize(0), mRemoteAddress("0.0.0.0"), mSendingPacket(false),
+    mCloseAfterSend(false)
 {
 }
 
@@ -47,7 +53,8 @@ TcpConnection::TcpConnection(asio::ip::tcp::socket& socket,
     const std::shared_ptr<Crypto::DiffieHellman>& diffieHellman) :
     mSocket(std::move(socket)), mDiffieHellman(diffieHellman),
     mStatus(TcpConnection::STATUS_CONNECTED), mRole(TcpConnection::ROLE_SERVER),
-    mRemoteAddress("0.0.0.0"), mSendingPacket(false)
+    mStreamSize(0), mRemoteAddress("0.0.0.0"), mSendingPacket(false),
+    mCloseAfterSend(false)
 {
     // Cache the remote address.
     try
@@ -199,6 +206,11 @@ bool TcpConnection::RequestPacket(size_t size)
     if(0 != size && MAX_PACKET_SIZE >= (mReceivedPacket.Size() + size) &&
         nullptr != pDestination)
     {
+        // Make sure the buffer can hold the requested data.
+        mReceivedPacket.Allocate(static_cast<uint32_t>(
+            mReceivedPacket.Size() + size));
+        pDestination = mReceivedPacket.Data();
+
         // Calculate where to write the data.
         pDestination += mReceivedPacket.Size();
 
@@ -250,6 +262,84 @@ bool TcpConnection::RequestPacket(size_t size)
     return result;
 }
 
+bool TcpConnection::RequestStream()
+{
+    if(!mStreamBuffer.empty())
+    {
+        LogConnectionErrorMsg("TcpConnection::RequestStream() called when "
+            "the stream is already being received.\n");
+
+        return false;
+    }
+
+    mStreamBuffer.resize(RECEIVE_STREAM_SIZE);
+    mStreamSize = 0;
+
+    ReceiveStream();
+
+    return true;
+}
+
+void TcpConnection::ReceiveStream()
+{
+    // Get a shared pointer to the connection so it outlives the callback.
+    auto self = shared_from_this();
+
+    // Read as much as the socket has (up to the free space in the buffer).
+    mSocket.async_receive(asio::buffer(&mStreamBuffer[mStreamSize],
+        mStreamBuffer.size() - mStreamSize), 0,
+        [self](asio::error_code errorCode, std::size_t length)
+        {
+            if(errorCode)
+            {
+                LogConnectionDebug([&]()
+                {
+                    return String("ASIO Error: %1\n")
+                        .Arg(errorCode.message());
+                });
+
+                self->SocketError();
+
+                return;
+            }
+
+            self->mStreamSize += length;
+
+            // Let the connection parse everything that has arrived.
+            size_t consumed = self->StreamReceived(
+                self->mStreamBuffer.data(), self->mStreamSize);
+
+            if(consumed > self->mStreamSize)
+            {
+                consumed = self->mStreamSize;
+            }
+
+            // Keep the partial data for the next receive.
+            self->mStreamSize -= consumed;
+
+            if(0 < self->mStreamSize && 0 < consumed)
+            {
+                std::memmove(self->mStreamBuffer.data(),
+                    self->mStreamBuffer.data() + consumed,
+                    self->mStreamSize);
+            }
+
+            if(STATUS_NOT_CONNECTED == self->mStatus)
+            {
+                return;
+            }
+
+            if(self->mStreamBuffer.size() <= self->mStreamSize)
+            {
+                self->SocketError("Stream buffer is full.");
+            }
+            else
+            {
+                self->ReceiveStream();
+            }
+        });
+}
+
 TcpConnection::Role_t TcpConnection::GetRole() const
 {
     return mRole;
@@ -318,100 +408,150 @@ void TcpConnection::HandleConnection(asio::error_code errorCode)
 
 void TcpConnection::FlushOutgoing(bool closeConnection)
 {
-    std::list<ReadOnlyPacket> packets = GetCombinedPackets();
+    {
+        std::lock_guard<std::mutex> guard(mOutgoingMutex);
+
+        if(closeConnection)
+        {
+            mCloseAfterSend = true;
+        }
+
+        // Only one thread prepares and sends packets at a time. If a send is
+        // in progress the queued packets will be sent when it is done.
+        if(mSendingPacket || mOutgoingPackets.empty())
+        {
+            return;
+        }
 
-    if(!packets.empty())
+        mSendingPacket = true;
+    }
+
+    std::list<ReadOnlyPacket> frames;
+    ReadOnlyPacket emptyPacket;
+
+    // Prepare everything in the queue (up to a limit) so it can all be sent
+    // with a single call.
+    while(MAX_SEND_FRAMES > frames.size())
     {
-        PreparePackets(packets);
+        std::list<ReadOnlyPacket> packets;
+        bool sharedFrame = false;
+
+        {
+            std::lock_guard<std::mutex> guard(mOutgoingMutex);
+
+            // Shared frames are never combined with other packets.
+            if(!mOutgoingPackets.empty() &&
+                mOutgoingPackets.front().sharedFrame)
+            {
+                packets.push_back(mOutgoingPackets.front().packet);
+                mOutgoingPackets.pop_front();
+
+                sharedFrame = true;
+            }
+        }
+
+        if(!sharedFrame)
+        {
+            packets = GetCombinedPackets();
+        }
 
-        mOutgoing.Rewind();
+        if(packets.empty())
+        {
+            break;
+        }
 
-        FlushOutgoingInside(closeConnection);
+        // Clear the last frame so it is not sent again if this one fails.
+        mOutgoing = emptyPacket;
+
+        if(sharedFrame)
+        {
+            // Finish a private copy of the shared frame.
+            Packet frame(packets.front().ConstData(), packets.front().Size());
+
+            FinishFrame(frame);
+        }
+        else
+        {
+            PreparePackets(packets);
+        }
+
+        if(0 < mOutgoing.Size())
+        {
+            mOutgoing.Rewind();
+            frames.push_back(mOutgoing);
+        }
     }
+
+    mOutgoing = emptyPacket;
+
+    {
+        std::lock_guard<std::mutex> guard(mOutgoingMutex);
+
+        // Don't send anything if we are not connected.
+        if(frames.empty() || STATUS_NOT_CONNECTED == mStatus)
+        {
+            mSendingPacket = false;
+
+            return;
+        }
+
+        mSendingFrames = std::move(frames);
+    }
+
+    FlushOutgoingInside();
 }
 
-void TcpConnection::FlushOutgoingInside(bool closeConnection)
+void TcpConnection::FlushOutgoingInside()
 {
-    // Don't send anything if we are not connected.
-    if(STATUS_NOT_CONNECTED == mStatus)
+    std::vector<asio::const_buffer> buffers;
+    buffers.reserve(mSendingFrames.size());
+
+    for(auto& frame : mSendingFrames)
     {
-        return;
+        buffers.push_back(asio::buffer(frame.ConstData(), frame.Size()));
     }
 
     // Get a shared pointer to the connection so it outlives the callback.
     auto self = shared_from_this();
 
-    mSocket.async_send(asio::buffer(mOutgoing.ConstData() +
-        mOutgoing.Tell(), mOutgoing.Left()), 0, [closeConnection,
-        self](asio::error_code errorCode, std::size_t length)
+    // Write every frame with one gather write.
+    asio::async_write(mSocket, buffers, [self](asio::error_code errorCode,
+        std::size_t length)
     {
-        bool sendSame = false;
-        bool sendAnother = false;
-        bool packetOk = false;
+        (void)length;
 
-        ReadOnlyPacket readOnlyPacket;
+        std::list<ReadOnlyPacket> frames;
+        bool sendAnother = false;
+        bool closeConnection = false;
 
-        // Ignore errors and everything else, just close the connection.
-        if(closeConnection && self->mOutgoing.Left() == length)
         {
-            LogConnectionDebugMsg("Closing connection after sending packet.\n");
-
-            std::lock_guard<std::mutex> outgoingGuard(
-                self->mOutgoingMutex);
+            std::lock_guard<std::mutex> outgoingGuard(self->mOutgoingMutex);
 
+            frames = std::move(self->mSendingFrames);
+            self->mSendingFrames.clear();
             self->mSendingPacket = false;
 
-            self->SocketError();
-            return;
+            sendAnother = !self->mOutgoingPackets.empty();
+            closeConnection = !sendAnother && self->mCloseAfterSend;
         }
 
         if(errorCode)
         {
-            std::lock_guard<std::mutex> outgoingGuard(
-                self->mOutgoingMutex);
-
-            self->mSendingPacket = false;
+            self->SocketError();
+        }
+        else if(closeConnection)
+        {
+            // Ignore everything else, just close the connection.
+            LogConnectionDebugMsg("Closing connection after sending packet.\n");
 
             self->SocketError();
         }
         else
         {
-            std::lock_guard<std::mutex> outgoingGuard(self->mOutgoingMutex);
-
-            uint32_t outgoingSize = self->mOutgoing.Size();
-
-            if(0 == outgoingSize || length > self->mOutgoing.Left())
+            for(auto& frame : frames)
             {
-                self->SocketError();
+                self->PacketSent(frame);
             }
-            else
-            {
-                self->mOutgoing.Skip((uint32_t)length);
-
-                if(0 != self->mOutgoing.Left())
-                {
-                    sendSame = true;
-                }
-                else
-                {
-                    self->mOutgoing.Rewind();
-
-                    readOnlyPacket = self->mOutgoing;
-                    sendAnother = !self->mOutgoingPackets.empty();
-                    packetOk = true;
-                }
-            }
-
-            self->mSendingPacket = sendSame;
-        }
-
-        if(sendSame)
-        {
-            self->FlushOutgoingInside(closeConnection);
-        }
-        else if(packetOk)
-        {
-            self->PacketSent(readOnlyPacket);
 
             if(sendAnother)
             {
@@ -453,6 +593,19 @@ void TcpConnection::PacketSent(ReadOnlyPacket& packet)
     (void)packet;
 }
 
+size_t TcpConnection::StreamReceived(const char *pData, size_t size)
+{
+    (void)pData;
+
+    LogConnectionDebug([&]()
+    {
+        return String("Connection '%1' discarded %2 bytes of stream data.\n")
+            .Arg(GetName()).Arg(size);
+    });
+
+    return size;
+}
+
 void TcpConnection::PacketReceived(Packet& packet)
 {
     packet.Clear();
@@ -471,6 +624,11 @@ void TcpConnection::SetEncryptionKey(const void *pData, size_t dataSize)
     }
 }
 
+void TcpConnection::Post(const std::function<void()>& task)
+{
+    asio::post(mSocket.get_executor(), task);
+}
+
 String TcpConnection::GetDiffieHellmanPrime(const std::shared_ptr<
     Crypto::DiffieHellman>& diffieHellman)
 {
@@ -480,6 +638,13 @@ String TcpConnection::GetDiffieHellmanPrime(const std::shared_ptr<
 String TcpConnection::GenerateDiffieHellmanPublic(const std::shared_ptr<
     Crypto::DiffieHellman>& diffieHellman)
 {
+    auto publicKey = diffieHellman->GetPublic();
+
+    if(!publicKey.IsEmpty())
+    {
+        return publicKey;
+    }
+
     return diffieHellman->GeneratePublic();
 }
 
@@ -501,15 +666,67 @@ void TcpConnection::BroadcastPacket(const std::list<std::shared_ptr<
 void TcpConnection::BroadcastPacket(const std::list<std::shared_ptr<
     TcpConnection>>& connections, ReadOnlyPacket& packet)
 {
+    // Frame built for each type of connection. A null frame means the
+    // frame has not been built yet.
+    std::unordered_map<std::type_index, std::shared_ptr<ReadOnlyPacket>> frames;
+
     for(auto connection : connections)
     {
-        if(connection)
+        if(!connection)
+        {
+            continue;
+        }
+
+        auto& frame = frames[std::type_index(typeid(*connection))];
+
+        if(!frame)
+        {
+            std::list<ReadOnlyPacket> packets;
+            packets.push_back(packet);
+
+            Packet builtFrame;
+
+            // If this connection can't build the frame, try again with the
+            // next connection of the same type.
+            if(connection->BuildFrame(packets, builtFrame))
+            {
+                frame = std::make_shared<ReadOnlyPacket>(std::move(
+                    builtFrame));
+            }
+        }
+
+        if(frame && connection->QueueSharedFrame(*frame))
+        {
+            connection->FlushOutgoing();
+        }
+        else
         {
             connection->SendPacket(packet);
         }
     }
 }
 
+bool TcpConnection::BuildFrame(std::list<ReadOnlyPacket>& packets,
+    Packet& frame)
+{
+    (void)packets;
+    (void)frame;
+
+    return false;
+}
+
+void TcpConnection::FinishFrame(Packet& frame)
+{
+    mOutgoing = frame;
+}
+
+bool TcpConnection::QueueSharedFrame(ReadOnlyPacket& frame)
+{
+    (void)frame;
+
+    return false;
+}
+
 void TcpConnection::PreparePackets(std::list<ReadOnlyPacket>& packets)
 {
     // There should only be one!
@@ -529,12 +746,10 @@ std::list<ReadOnlyPacket> TcpConnection::GetCombinedPackets()
 
     std::lock_guard<std::mutex> guard(mOutgoingMutex);
 
-    if(!mSendingPacket && !mOutgoingPackets.empty())
+    if(!mOutgoingPackets.empty() && !mOutgoingPackets.front().sharedFrame)
     {
-        packets.push_back(mOutgoingPackets.front());
+        packets.push_back(mOutgoingPackets.front().packet);
         mOutgoingPackets.pop_front();
-
-        mSendingPacket = true;
     }
 
     return packets;
@@ -38,7 +38,9 @@
 #include "PopIgnore.h"
 
 // Standard C++11 Includes
+#include <functional>
 #include <mutex>
+#include <vector>
 
 namespace libcomp
 {
@@ -102,7 +104,9 @@ public:
         Crypto::DiffieHellman>& diffieHellman);
 
     /**
-     * Generate the public key for the Diffie-Hellman key exchange.
+     * Generate the public key for the Diffie-Hellman key exchange. If the
+     * public key was already generated (see @ref DiffieHellmanPool) it is
+     * returned as is.
      * @param diffieHellman Object that stores the DH key.
      * @return Public key to be used in the DH key exchange.
      */
@@ -220,6 +224,17 @@ public:
      */
     bool RequestPacket(size_t size);
 
+    /**
+     * Start receiving everything the remote host sends. Each receive reads
+     * as much data as the socket has available into a stream buffer and
+     * calls @ref StreamReceived with the contents of the buffer. Any data
+     * not consumed by the callback is kept for the next call. Receiving
+     * continues until the connection is closed so this should only be
+     * called once and never mixed with @ref RequestPacket.
+     * @return true on success; false otherwise.
+     */
+    bool RequestStream();
+
     /**
      * Get the role the connection is operating in.
      * @return Role the connection is operating in.
@@ -263,7 +278,10 @@ public:
         TcpConnection>>& connections, Packet& packet);
 
     /**
-     * Send a packet to a list of connections.
+     * Send a packet to a list of connections. The frame for the packet is
+     * built once for each type of connection and shared by every connection
+     * of that type. Each connection then only has to finish (encrypt) its
+     * own copy of the frame.
      * @param connections List of connections to send the packet to.
      * @param packet Packet to send to the list of connections.
      */
@@ -302,6 +320,15 @@ protected:
      */
     virtual void PacketReceived(Packet& packet);
 
+    /**
+     * Called after stream data has been received from the remote host.
+     * @sa RequestStream
+     * @param pData Pointer to the data in the stream buffer.
+     * @param size Number of bytes in the stream buffer.
+     * @return Number of bytes consumed from the start of the buffer.
+     */
+    virtual size_t StreamReceived(const char *pData, size_t size);
+
     /**
      * Called to prepare packets before they are sent to the remote host.
      * @param packets List of packets to be sent to the remote host.
@@ -309,7 +336,38 @@ protected:
     virtual void PreparePackets(std::list<ReadOnlyPacket>& packets);
 
     /**
-     * Returns a list of packets that have been combined.
+     * Build the frame for a list of packets before it is finished by
+     * @ref FinishFrame. The frame must only depend on the type of the
+     * connection as @ref BroadcastPacket shares it with every connection of
+     * the same type. This base implementation does not build frames.
+     * @param packets List of packets to combine into the frame.
+     * @param frame Packet to write the frame into.
+     * @return true if the frame was built; false otherwise.
+     */
+    virtual bool BuildFrame(std::list<ReadOnlyPacket>& packets,
+        Packet& frame);
+
+    /**
+     * Finish a frame built by @ref BuildFrame so it can be sent by this
+     * connection. The result is stored in @ref mOutgoing.
+     * @param frame Frame to finish. This is a copy owned by this connection.
+     */
+    virtual void FinishFrame(Packet& frame);
+
+    /**
+     * Queue a frame built by @ref BuildFrame that is shared with other
+     * connections. This base implementation does not accept shared frames.
+     * @param frame Frame to queue.
+     * @return true if the frame was queued; false if the packet should be
+     *   queued normally instead.
+     */
+    virtual bool QueueSharedFrame(ReadOnlyPacket& frame);
+
+    /**
+     * Returns a list of packets that have been combined. The packets are
+     * removed from the outgoing queue and will be passed to
+     * @ref PreparePackets to form a single frame. This is only called by the
+     * thread that is currently sending packets.
      * @return List of packet that have been combined.
      */
     virtual std::list<ReadOnlyPacket> GetCombinedPackets();
@@ -327,13 +385,19 @@ protected:
      */
     void SetEncryptionKey(const void *pData, size_t dataSize);
 
+    /**
+     * Run a task on the network thread of the connection. The task must
+     * keep the connection alive itself.
+     * @param task Task to run.
+     */
+    void Post(const std::function<void()>& task);
+
 private:
     /**
-     * Send all queued packets to the remote host.
-     * @param closeConnection If the connection should be closed after the
-     *   send queue has been emptied.
+     * Send all prepared frames to the remote host with a single gather
+     * write.
      */
-    void FlushOutgoingInside(bool closeConnection = false);
+    void FlushOutgoingInside();
 
     /**
      * Used to handle a connection error code.
@@ -346,6 +410,12 @@ private:
      */
     void SendNextPacket();
 
+    /**
+     * Start an asynchronous receive into the free space of the stream
+     * buffer.
+     */
+    void ReceiveStream();
+
     /// ASIO network socket for the connection.
     asio::ip::tcp::socket mSocket;
 
@@ -366,6 +436,12 @@ private:
     /// Last received packet.
     Packet mReceivedPacket;
 
+    /// Buffer of data received by @ref RequestStream.
+    std::vector<char> mStreamBuffer;
+
+    /// Number of bytes in the stream buffer that have not been consumed.
+    size_t mStreamSize;
+
     /// Cached address of the remote host.
     String mRemoteAddress;
 
@@ -373,17 +449,47 @@ private:
     String mName;
 
 protected:
+    /**
+     * Entry in the outgoing packet queue.
+     */
+    struct OutgoingPacket
+    {
+        /**
+         * Create a queue entry.
+         * @param p Packet to queue.
+         * @param shared Indicates the packet is a shared frame.
+         */
+        OutgoingPacket(const ReadOnlyPacket& p, bool shared = false) :
+            packet(p), sharedFrame(shared)
+        {
+        }
+
+        /// Packet to send.
+        ReadOnlyPacket packet;
+
+        /// Indicates the packet is a frame built by @ref BuildFrame that is
+        /// shared with other connections and only needs @ref FinishFrame.
+        bool sharedFrame;
+    };
+
     /// Mutex to ensure the outgoing packet code is executed from one thread.
     std::mutex mOutgoingMutex;
 
     /// List of packets to be sent to the remote host.
-    std::list<ReadOnlyPacket> mOutgoingPackets;
+    std::list<OutgoingPacket> mOutgoingPackets;
 
     /// Indicates if an outgoing packet is being sent.
     bool mSendingPacket;
 
-    /// Packet being sent to the remote host.
+    /// Indicates the connection should be closed once the outgoing queue
+    /// has been sent.
+    bool mCloseAfterSend;
+
+    /// Packet prepared by @ref PreparePackets to be sent to the remote host.
     ReadOnlyPacket mOutgoing;
+
+    /// Prepared packets being sent to the remote host.
+    std::list<ReadOnlyPacket> mSendingFrames;
 };
 
 } // namespace libcomp
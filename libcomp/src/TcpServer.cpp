@@ -27,6 +27,7 @@
 #include "TcpServer.h"
 
 #include "Constants.h"
+#include "DiffieHellmanPool.h"
 #include "Log.h"
 #include "TcpConnection.h"
 #include "WindowsService.h"
@@ -42,7 +43,8 @@
 using namespace libcomp;
 
 TcpServer::TcpServer(const String& listenAddress, uint16_t port) :
-    mAcceptor(mService), mDiffieHellman(nullptr),
+    mAcceptor(mService), mNetworkThreadCount(1), mNextService(0),
+    mDiffieHellmanPoolSize(0), mDiffieHellman(nullptr),
     mListenAddress(listenAddress), mPort(port)
 {
 #if !defined(_WIN32)
@@ -82,6 +84,14 @@ int TcpServer::Start(bool delayReady)
         }
     }
 
+    // Start generating key pairs for the new connections.
+    if(nullptr != mDiffieHellman && 0 < mDiffieHellmanPoolSize)
+    {
+        mDiffieHellmanPool = DiffieHellmanPool::Create(
+            mDiffieHellman->GetPrime(), mDiffieHellmanPoolSize,
+            GetNetworkThreadCount());
+    }
+
     asio::ip::tcp::endpoint endpoint;
 
     if(mListenAddress.IsEmpty() || "any" == mListenAddress.ToLower())
@@ -99,13 +109,27 @@ int TcpServer::Start(bool delayReady)
     mAcceptor.bind(endpoint);
     mAcceptor.listen();
 
-    asio::ip::tcp::socket socket(mService);
+    // The first network thread runs the main service (which also accepts
+    // new connections). Start a service for each extra thread.
+    size_t threadCount = GetNetworkThreadCount();
 
-    mAcceptor.async_accept(socket,
-        [this, &socket](asio::error_code errorCode)
+    for(size_t i = 1; i < threadCount; ++i)
+    {
+        mShardServices.emplace_back(new asio::io_service);
+        mShardWork.emplace_back(new asio::io_service::work(
+            *mShardServices.back()));
+    }
+
+    if(1 < threadCount)
+    {
+        LogConnectionDebug([&]()
         {
-            AcceptHandler(errorCode, socket);
+            return String("Network operations will be distributed between "
+                "%1 threads\n").Arg(threadCount);
         });
+    }
+
+    AsyncAccept();
 
     mServiceThread = std::thread([this]()
     {
@@ -116,6 +140,23 @@ int TcpServer::Start(bool delayReady)
         mService.run();
     });
 
+    for(size_t i = 0; i < mShardServices.size(); ++i)
+    {
+        asio::io_service *pService = mShardServices[i].get();
+
+        mShardThreads.emplace_back([pService, i]()
+        {
+#if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+            pthread_setname_np(pthread_self(), String("asio_%1").Arg(
+                i + 1).C());
+#else // defined(EXOTIC_PLATFORM) || defined(_WIN32) || defined(__APPLE__)
+            (void)i;
+#endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
+
+            pService->run();
+        });
+    }
+
     if(!delayReady)
     {
         ServerReady();
@@ -125,6 +166,41 @@ int TcpServer::Start(bool delayReady)
 
     mServiceThread.join();
 
+    // The main service has been stopped so stop the other network threads.
+    mShardWork.clear();
+
+    for(auto& service : mShardServices)
+    {
+        service->stop();
+    }
+
+    for(auto& thread : mShardThreads)
+    {
+        thread.join();
+    }
+
+    mShardThreads.clear();
+
+    if(mDiffieHellmanPool)
+    {
+        auto stats = mDiffieHellmanPool->GetStats();
+
+        LogCryptoInfo([&]()
+        {
+            return String("Key exchanges: %1 (avg %2 us, max %3 us); key "
+                "pairs: %4 pooled, %5 generated on demand, %6 ready\n")
+                .Arg(stats.handshakes)
+                .Arg(0 == stats.handshakes ? 0 :
+                    stats.handshakeMicroseconds / stats.handshakes)
+                .Arg(stats.maxHandshakeMicroseconds)
+                .Arg(stats.hits)
+                .Arg(stats.misses)
+                .Arg(stats.depth);
+        });
+
+        mDiffieHellmanPool.reset();
+    }
+
     return returnCode;
 }
 
@@ -140,6 +216,34 @@ void TcpServer::RemoveConnection(std::shared_ptr<TcpConnection>& connection)
     }
 }
 
+void TcpServer::SetNetworkThreadCount(size_t count)
+{
+    mNetworkThreadCount = count;
+}
+
+size_t TcpServer::GetNetworkThreadCount() const
+{
+    size_t count = mNetworkThreadCount;
+
+    // Use one thread for each core if no count was given.
+    if(0 == count)
+    {
+        count = std::thread::hardware_concurrency();
+    }
+
+    return 0 == count ? 1 : count;
+}
+
+void TcpServer::SetDiffieHellmanPoolSize(size_t size)
+{
+    mDiffieHellmanPoolSize = size;
+}
+
+size_t TcpServer::GetDiffieHellmanPoolSize() const
+{
+    return mDiffieHellmanPoolSize;
+}
+
 int TcpServer::Run()
 {
     return 0;
@@ -205,15 +309,9 @@ void TcpServer::AcceptHandler(asio::error_code errorCode,
                 mConnections.push_back(connection);
             }
 
-            // This is actually using a different socket because the
-            // CreateConnection() call will use std::move on the socket which
-            // will reset this socket (which is a reference to the local
-            // variable in the Start() function).
-            mAcceptor.async_accept(socket,
-                [this, &socket](asio::error_code acceptErrorCode)
-                {
-                    AcceptHandler(acceptErrorCode, socket);
-                });
+            // The socket was moved into the connection so accept the next
+            // connection into a new socket (which may be on another thread).
+            AsyncAccept();
         }
         else
         {
@@ -223,6 +321,32 @@ void TcpServer::AcceptHandler(asio::error_code errorCode,
     }
 }
 
+asio::io_service& TcpServer::GetNextService()
+{
+    // Index 0 is the main service, the rest are the extra services.
+    size_t index = mNextService++ % (mShardServices.size() + 1);
+
+    if(0 == index)
+    {
+        return mService;
+    }
+
+    return *mShardServices[index - 1];
+}
+
+void TcpServer::AsyncAccept()
+{
+    mAcceptSocket.reset(new asio::ip::tcp::socket(GetNextService()));
+
+    asio::ip::tcp::socket *pSocket = mAcceptSocket.get();
+
+    mAcceptor.async_accept(*pSocket,
+        [this, pSocket](asio::error_code errorCode)
+        {
+            AcceptHandler(errorCode, *pSocket);
+        });
+}
+
 std::shared_ptr<Crypto::DiffieHellman> TcpServer::GetDiffieHellman() const
 {
     return mDiffieHellman;
@@ -242,5 +366,17 @@ std::shared_ptr<Crypto::DiffieHellman> TcpServer::GenerateDiffieHellman()
 std::shared_ptr<Crypto::DiffieHellman> TcpServer::LoadDiffieHellman(
     const String& prime)
 {
+    auto pool = DiffieHellmanPool::GetPool(prime);
+
+    if(pool)
+    {
+        auto diffieHellman = pool->Take();
+
+        if(diffieHellman)
+        {
+            return diffieHellman;
+        }
+    }
+
     return std::make_shared<Crypto::DiffieHellman>(prime);
 }
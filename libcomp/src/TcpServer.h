@@ -38,12 +38,15 @@
 
 // Standard C++ Includes
 #include <memory>
+#include <list>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace libcomp
 {
 
+class DiffieHellmanPool;
 class TcpConnection;
 
 /**
@@ -95,7 +98,9 @@ public:
     static std::shared_ptr<Crypto::DiffieHellman> GenerateDiffieHellman();
 
     /**
-     * Create a Diffie-Helman key pair given the hex encoded prime.
+     * Create a Diffie-Helman key pair given the hex encoded prime. If a
+     * @ref DiffieHellmanPool exists for the prime the key pair is taken from
+     * it (with the public key already generated).
      * @param prime Hex encoded string representing the prime.
      * @return Generated key pair or nullptr on failure.
      */
@@ -107,6 +112,40 @@ public:
      */
     virtual void ServerReady();
 
+    /**
+     * Set the number of threads used to handle network operations. Each
+     * thread runs its own ASIO service and new connections are assigned to
+     * them in turn. All operations for a connection are handled by the same
+     * thread so they never run at the same time. This must be called before
+     * @ref Start to have any effect.
+     * @param count Number of network threads. If this is 0 one thread will
+     *  be used for each core.
+     */
+    void SetNetworkThreadCount(size_t count);
+
+    /**
+     * Get the number of threads used to handle network operations.
+     * @return Number of network threads.
+     */
+    size_t GetNetworkThreadCount() const;
+
+    /**
+     * Set the number of Diffie-Hellman key pairs to generate ahead of new
+     * connections. The pool is created by @ref Start and uses one crypto
+     * thread for each network thread. This must be called before
+     * @ref Start to have any effect.
+     * @param size Number of key pairs to keep ready. If this is 0 no pool is
+     *  used and the key exchange is done on the network threads.
+     */
+    void SetDiffieHellmanPoolSize(size_t size);
+
+    /**
+     * Get the number of Diffie-Hellman key pairs to generate ahead of new
+     * connections.
+     * @return Number of key pairs to keep ready.
+     */
+    size_t GetDiffieHellmanPoolSize() const;
+
 protected:
     /**
      * Main loop for the server.
@@ -144,25 +183,66 @@ protected:
     void AcceptHandler(asio::error_code errorCode,
         asio::ip::tcp::socket& socket);
 
+    /**
+     * Get the ASIO service the next connection should be assigned to. The
+     * services are used in turn so connections are spread evenly between
+     * the network threads.
+     * @return ASIO service to assign the next connection to.
+     */
+    asio::io_service& GetNextService();
+
     /// Lock for the connection list.
     std::mutex mConnectionsLock;
 
     /// List of connections managed by this server.
     std::list<std::shared_ptr<TcpConnection>> mConnections;
 
-    /// ASIO service used to handle network operations.
+    /// ASIO service used to handle network operations. This service also
+    /// accepts new connections and is the first of the network threads.
     asio::io_service mService;
 
 private:
+    /**
+     * Start an asynchronous accept into a new socket owned by the service
+     * returned by @ref GetNextService.
+     */
+    void AsyncAccept();
+
     /// Asynchronous acceptor for new connections.
     asio::ip::tcp::acceptor mAcceptor;
 
     /// Thread that runs the ASIO service.
     std::thread mServiceThread;
 
+    /// Additional ASIO services (one for each network thread after the
+    /// first).
+    std::vector<std::unique_ptr<asio::io_service>> mShardServices;
+
+    /// Work objects that keep the additional ASIO services running while
+    /// they have no connections.
+    std::vector<std::unique_ptr<asio::io_service::work>> mShardWork;
+
+    /// Threads that run the additional ASIO services.
+    std::vector<std::thread> mShardThreads;
+
+    /// Socket the next connection is accepted into.
+    std::unique_ptr<asio::ip::tcp::socket> mAcceptSocket;
+
+    /// Number of network threads requested.
+    size_t mNetworkThreadCount;
+
+    /// Index of the service the next connection is assigned to.
+    size_t mNextService;
+
+    /// Number of Diffie-Hellman key pairs to keep ready.
+    size_t mDiffieHellmanPoolSize;
+
     /// Diffie-Hellman key pair used to encrypt connections.
     std::shared_ptr<Crypto::DiffieHellman> mDiffieHellman;
 
+    /// Pool of key pairs for new connections.
+    std::shared_ptr<DiffieHellmanPool> mDiffieHellmanPool;
+
     /// Address the server is listening on.
     String mListenAddress;
 
@@ -26,55 +26,143 @@
 
 #include "TimerManager.h"
 
+// Standard C++11 Includes
+#include <limits>
+
 namespace libcomp
 {
 
-class TimerEvent
+class TimerEvent : public TimerLink
 {
-    friend class TimerEventComp;
     friend class TimerManager;
 
-protected:
+public:
     TimerEvent();
     ~TimerEvent();
 
+protected:
+    uint64_t tick;
     std::chrono::steady_clock::time_point time;
     std::chrono::milliseconds period;
     libcomp::Message::Execute *msg;
+    std::shared_ptr<libcomp::Message::Execute> sharedMsg;
     bool mIsPeriodic;
 };
 
+/**
+ * Message sent to the message queue each time a periodic event runs. The
+ * event keeps its own message so it is shared with the queue.
+ */
+class TimerPeriodicExecute : public libcomp::Message::Execute
+{
+public:
+    explicit TimerPeriodicExecute(
+        const std::shared_ptr<libcomp::Message::Execute>& msg) : mMessage(msg)
+    {
+    }
+
+    virtual libcomp::Message::MessageType GetType() const
+    {
+        return libcomp::Message::MessageType::MESSAGE_TYPE_SYSTEM;
+    }
+
+    virtual libcomp::String Dump() const override
+    {
+        return libcomp::String("Message: Periodic Timer Event\n%1").Arg(
+            mMessage->Dump());
+    }
+
+    virtual void Run()
+    {
+        mMessage->Run();
+    }
+
+private:
+    std::shared_ptr<libcomp::Message::Execute> mMessage;
+};
+
 } // namespace libcomp
 
 using namespace libcomp;
 
-TimerEvent::TimerEvent() : msg(nullptr), mIsPeriodic(false)
+static inline void ListInit(TimerLink *pList)
 {
+    pList->prev = pList;
+    pList->next = pList;
 }
 
-TimerEvent::~TimerEvent()
+static inline bool ListEmpty(const TimerLink *pList)
+{
+    return pList->next == pList;
+}
+
+static inline void ListAppend(TimerLink *pList, TimerLink *pLink)
 {
-    delete msg;
+    pLink->prev = pList->prev;
+    pLink->next = pList;
+    pList->prev->next = pLink;
+    pList->prev = pLink;
 }
 
-bool TimerEventComp::operator()(const TimerEvent *lhs,
-    const TimerEvent *rhs) const
+static inline void ListRemove(TimerLink *pLink)
 {
-    return lhs->time < rhs->time;
+    pLink->prev->next = pLink->next;
+    pLink->next->prev = pLink->prev;
+    pLink->prev = nullptr;
+    pLink->next = nullptr;
 }
 
-TimerManager::TimerManager() : mRunning(true), mProcessingEvents(false)
+static inline void ListSplice(TimerLink *pFrom, TimerLink *pTo)
 {
+    if(ListEmpty(pFrom))
+    {
+        return;
+    }
+
+    pFrom->next->prev = pTo->prev;
+    pFrom->prev->next = pTo;
+    pTo->prev->next = pFrom->next;
+    pTo->prev = pFrom->prev;
+
+    ListInit(pFrom);
+}
+
+TimerEvent::TimerEvent() : tick(0), period(0), msg(nullptr),
+    mIsPeriodic(false)
+{
+    prev = nullptr;
+    next = nullptr;
+}
+
+TimerEvent::~TimerEvent()
+{
+    if(!sharedMsg)
+    {
+        delete msg;
+    }
+}
+
+TimerManager::TimerManager() : mRunning(true),
+    mStartTime(std::chrono::steady_clock::now()), mNextTick(0), mWaitTick(0),
+    mEventCount(0), mRunningEvent(nullptr)
+{
+    for(auto& slot : mSlots)
+    {
+        ListInit(&slot);
+    }
+
+    ListInit(&mExpired);
+
     mRunThread = std::thread([&]()
     {
 #if !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
         pthread_setname_np(pthread_self(), "timer");
 #endif // !defined(EXOTIC_PLATFORM) && !defined(_WIN32) && !defined(__APPLE__)
 
+        std::unique_lock<std::mutex> lock(mEventLock);
+
         while(mRunning)
         {
-            std::unique_lock<std::mutex> lock(mEventLock);
-
             ProcessEvents(lock);
             WaitForEvent(lock);
         }
@@ -83,112 +171,199 @@ TimerManager::TimerManager() : mRunning(true), mProcessingEvents(false)
 
 TimerManager::~TimerManager()
 {
-    mRunning = false;
+    {
+        std::unique_lock<std::mutex> lock(mEventLock);
+        mRunning = false;
+    }
 
     mEventCondition.notify_all();
 
     mRunThread.join();
 
-    for(TimerEvent *pEvent : mEvents)
+    for(auto& slot : mSlots)
     {
-        delete pEvent;
+        while(!ListEmpty(&slot))
+        {
+            FreeEvent(static_cast<TimerEvent*>(slot.next));
+        }
     }
 }
 
 void TimerManager::ProcessEvents(std::unique_lock<std::mutex>& lock)
 {
     auto now = std::chrono::steady_clock::now();
+    uint64_t nowTick = (uint64_t)std::chrono::duration_cast<
+        std::chrono::milliseconds>(now - mStartTime).count();
 
-    std::list<TimerEvent*> periodicals;
+    // With nothing in the wheel there is nothing to cascade either.
+    if(0 == mEventCount)
+    {
+        mNextTick = std::max(mNextTick, nowTick + 1);
 
-    mProcessingEvents = true;
+        return;
+    }
 
-    while(!mEvents.empty())
+    while(mNextTick <= nowTick)
     {
-        auto it = mEvents.begin();
-
-        TimerEvent *pEvent = *it;
+        uint64_t tick = NextEventTick();
 
-        if(pEvent->time > now)
+        if(tick > nowTick)
         {
+            mNextTick = nowTick + 1;
             break;
         }
-        else
+
+        mNextTick = tick;
+
+        // Move the events of the next window down at the start of it.
+        uint32_t index = (uint32_t)(tick & WHEEL_ROOT_MASK);
+
+        if(0 == index)
         {
-            mEvents.erase(it++);
+            int shift = WHEEL_ROOT_BITS;
 
-            if(pEvent->msg)
+            for(int level = 1; level < WHEEL_LEVELS; ++level)
             {
-                // Unlock the mutex in the case the callback waits on another
-                // mutex that waits on the timer or the callback tries to
-                // register a new timer event. We don't like deadlocks.
-                lock.unlock();
-                pEvent->msg->Run();
-                lock.lock();
+                if(0 != Cascade(level, (uint32_t)((tick >> shift) &
+                    WHEEL_MASK)))
+                {
+                    break;
+                }
+
+                shift += WHEEL_BITS;
             }
+        }
 
-            if(pEvent->mIsPeriodic)
-            {
-                pEvent->time += pEvent->period;
+        ListSplice(&mSlots[index], &mExpired);
 
-                periodicals.push_back(pEvent);
-            }
-            else
-            {
-                delete pEvent;
-            }
+        mNextTick++;
+    }
+
+    auto messageQueue = mMessageQueue.lock();
+
+    while(!ListEmpty(&mExpired))
+    {
+        TimerEvent *pEvent = static_cast<TimerEvent*>(mExpired.next);
+        ListRemove(pEvent);
+
+        bool periodic = pEvent->mIsPeriodic;
+
+        // Unlock the mutex in the case the callback waits on another
+        // mutex that waits on the timer or the callback tries to
+        // register a new timer event. We don't like deadlocks.
+        mRunningEvent = pEvent;
+        lock.unlock();
+        RunEvent(pEvent, periodic, messageQueue);
+        lock.lock();
+        mRunningEvent = nullptr;
+
+        // The event may have been cancelled while it was running.
+        if(pEvent->mIsPeriodic)
+        {
+            pEvent->time += pEvent->period;
+            pEvent->tick = TimeToTick(pEvent->time);
+
+            AddEvent(pEvent);
+        }
+        else
+        {
+            FreeEvent(pEvent);
         }
     }
+}
+
+void TimerManager::RunEvent(TimerEvent *pEvent, bool periodic,
+    const std::shared_ptr<MessageQueue<
+    libcomp::Message::Message*>>& messageQueue)
+{
+    if(!pEvent->msg)
+    {
+        return;
+    }
 
-    for(TimerEvent *pEvent : periodicals)
+    if(!messageQueue)
+    {
+        pEvent->msg->Run();
+    }
+    else if(periodic)
     {
-        mEvents.insert(pEvent);
+        if(!pEvent->sharedMsg)
+        {
+            pEvent->sharedMsg.reset(pEvent->msg);
+        }
+
+        messageQueue->Enqueue(new TimerPeriodicExecute(pEvent->sharedMsg));
     }
+    else
+    {
+        // The queue owns the message now.
+        messageQueue->Enqueue(pEvent->msg);
 
-    mProcessingEvents = false;
+        pEvent->msg = nullptr;
+    }
 }
 
 void TimerManager::WaitForEvent(std::unique_lock<std::mutex>& lock)
 {
-    if(mEvents.empty())
+    if(!mRunning)
+    {
+        return;
+    }
+
+    if(0 == mEventCount)
     {
         // Wait for at least one event.
+        mWaitTick = std::numeric_limits<uint64_t>::max();
         mEventCondition.wait(lock);
     }
     else
     {
         // We don't care why we wake we'll check everything anyway.
-        (void)mEventCondition.wait_until(lock, (*mEvents.begin())->time);
+        mWaitTick = NextEventTick();
+        (void)mEventCondition.wait_until(lock, mStartTime +
+            std::chrono::milliseconds(mWaitTick));
     }
 
+    // Events registered while processing don't need to wake the thread.
+    mWaitTick = 0;
 }
 
 TimerEvent* TimerManager::RegisterEvent(const std::chrono::steady_clock::time_point& time, libcomp::Message::Execute *pMessage)
 {
-    TimerEvent *pEvent = new TimerEvent;
+    std::unique_lock<std::mutex> lock(mEventLock);
+
+    TimerEvent *pEvent = AllocateEvent();
     pEvent->time = time;
+    pEvent->tick = TimeToTick(time);
     pEvent->msg = pMessage;
 
-    std::unique_lock<std::mutex> lock(mEventLock);
+    AddEvent(pEvent);
 
-    mEvents.insert(pEvent);
-    mEventCondition.notify_all();
+    if(pEvent->tick < mWaitTick)
+    {
+        mEventCondition.notify_one();
+    }
 
     return pEvent;
 }
 
 TimerEvent* TimerManager::RegisterPeriodicEvent(const std::chrono::milliseconds& period, libcomp::Message::Execute *pMessage)
 {
-    TimerEvent *pEvent = new TimerEvent;
+    std::unique_lock<std::mutex> lock(mEventLock);
+
+    TimerEvent *pEvent = AllocateEvent();
     pEvent->time = std::chrono::steady_clock::now() + period;
+    pEvent->tick = TimeToTick(pEvent->time);
     pEvent->period = period;
     pEvent->mIsPeriodic = true;
     pEvent->msg = pMessage;
 
-    std::unique_lock<std::mutex> lock(mEventLock);
+    AddEvent(pEvent);
 
-    mEvents.insert(pEvent);
-    mEventCondition.notify_all();
+    if(pEvent->tick < mWaitTick)
+    {
+        mEventCondition.notify_one();
+    }
 
     return pEvent;
 }
@@ -199,20 +374,184 @@ void TimerManager::CancelEvent(TimerEvent *pEvent)
 
     // If the event is being processed we can't cancel but if the event
     // is periodic we can keep it from happening next time.
-    if(mProcessingEvents)
+    if(mRunningEvent == pEvent)
     {
         pEvent->mIsPeriodic = false;
         return;
     }
 
-    auto it = mEvents.find(pEvent);
+    // Events that are not linked into the wheel have already been freed.
+    if(nullptr != pEvent && nullptr != pEvent->next)
+    {
+        ListRemove(pEvent);
+        FreeEvent(pEvent);
+    }
+}
+
+void TimerManager::SetMessageQueue(const std::weak_ptr<
+    MessageQueue<libcomp::Message::Message*>>& messageQueue)
+{
+    std::unique_lock<std::mutex> lock(mEventLock);
 
-    if(mEvents.end() != it)
+    mMessageQueue = messageQueue;
+}
+
+size_t TimerManager::GetEventCount()
+{
+    std::unique_lock<std::mutex> lock(mEventLock);
+
+    return mEventCount;
+}
+
+TimerEvent* TimerManager::AllocateEvent()
+{
+    if(mFreeEvents.empty())
     {
-        mEvents.erase(it);
+        std::unique_ptr<TimerEvent[]> block(new TimerEvent[EVENT_BLOCK_SIZE]);
+
+        for(size_t i = EVENT_BLOCK_SIZE; 0 < i; --i)
+        {
+            mFreeEvents.push_back(&block[i - 1]);
+        }
 
-        delete pEvent;
+        mEventBlocks.push_back(std::move(block));
     }
 
-    mEventCondition.notify_all();
+    TimerEvent *pEvent = mFreeEvents.back();
+    mFreeEvents.pop_back();
+
+    mEventCount++;
+
+    return pEvent;
+}
+
+void TimerManager::FreeEvent(TimerEvent *pEvent)
+{
+    if(nullptr != pEvent->next)
+    {
+        ListRemove(pEvent);
+    }
+
+    if(pEvent->sharedMsg)
+    {
+        pEvent->sharedMsg.reset();
+    }
+    else
+    {
+        delete pEvent->msg;
+    }
+
+    pEvent->msg = nullptr;
+    pEvent->period = std::chrono::milliseconds(0);
+    pEvent->mIsPeriodic = false;
+
+    mFreeEvents.push_back(pEvent);
+
+    mEventCount--;
+}
+
+void TimerManager::AddEvent(TimerEvent *pEvent)
+{
+    // Events that are already due run on the next tick.
+    uint64_t expires = std::max(pEvent->tick, mNextTick);
+    uint64_t delta = expires - mNextTick;
+
+    size_t slot;
+
+    if(delta <= WHEEL_ROOT_MASK)
+    {
+        slot = (size_t)(expires & WHEEL_ROOT_MASK);
+    }
+    else
+    {
+        // Events past the last level wait in it and are cascaded again.
+        if(delta > WHEEL_MAX_DELTA)
+        {
+            expires = mNextTick + WHEEL_MAX_DELTA;
+            delta = WHEEL_MAX_DELTA;
+        }
+
+        int level = 1;
+        int shift = WHEEL_ROOT_BITS;
+
+        while(level < (WHEEL_LEVELS - 1) && (delta >> (shift + WHEEL_BITS)))
+        {
+            shift += WHEEL_BITS;
+            level++;
+        }
+
+        slot = SlotIndex(level, expires >> shift);
+    }
+
+    ListAppend(&mSlots[slot], pEvent);
+}
+
+uint32_t TimerManager::Cascade(int level, uint32_t index)
+{
+    TimerLink events;
+    ListInit(&events);
+    ListSplice(&mSlots[SlotIndex(level, index)], &events);
+
+    while(!ListEmpty(&events))
+    {
+        TimerEvent *pEvent = static_cast<TimerEvent*>(events.next);
+        ListRemove(pEvent);
+
+        AddEvent(pEvent);
+    }
+
+    return index;
+}
+
+size_t TimerManager::SlotIndex(int level, uint64_t index)
+{
+    if(0 == level)
+    {
+        return (size_t)(index & WHEEL_ROOT_MASK);
+    }
+
+    return (size_t)((WHEEL_ROOT_MASK + 1) + (uint64_t)(level - 1) *
+        (WHEEL_MASK + 1) + (index & WHEEL_MASK));
+}
+
+uint64_t TimerManager::NextEventTick() const
+{
+    uint64_t tick = mNextTick;
+
+    // Stop at the end of the first level so the next window is cascaded.
+    if(0 == (tick & WHEEL_ROOT_MASK))
+    {
+        return tick;
+    }
+
+    while(ListEmpty(&mSlots[tick & WHEEL_ROOT_MASK]))
+    {
+        if(0 == (++tick & WHEEL_ROOT_MASK))
+        {
+            break;
+        }
+    }
+
+    return tick;
+}
+
+uint64_t TimerManager::TimeToTick(
+    const std::chrono::steady_clock::time_point& time) const
+{
+    if(time <= mStartTime)
+    {
+        return 0;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        time - mStartTime);
+    uint64_t tick = (uint64_t)elapsed.count();
+
+    // Never run an event before its time.
+    if(mStartTime + elapsed < time)
+    {
+        tick++;
+    }
+
+    return tick;
 }
@@ -29,10 +29,12 @@
 
 // libcomp Includes
 #include "MessageExecute.h"
+#include "MessageQueue.h"
 
 #include <chrono>
 #include <list>
-#include <set>
+#include <memory>
+#include <vector>
 
 #include <condition_variable>
 #include <thread>
@@ -42,12 +44,28 @@ namespace libcomp
 
 class TimerEvent;
 
-class TimerEventComp
+/**
+ * Link in one of the intrusive lists of the timing wheel.
+ */
+struct TimerLink
 {
-public:
-    bool operator()(const TimerEvent *lhs, const TimerEvent *rhs) const;
+    /// Previous link in the list
+    TimerLink *prev;
+
+    /// Next link in the list (null if not in a list)
+    TimerLink *next;
 };
 
+/**
+ * Runs messages at a given time or every given period. Events are kept in
+ * a hierarchical timing wheel with a resolution of one millisecond so
+ * scheduling and cancelling an event does not depend on how many events
+ * there are. Event nodes are pooled and reused.
+ *
+ * By default the events run on the timer thread. If a message queue is set
+ * with @ref SetMessageQueue the events are sent to that queue instead so
+ * they run on the worker that owns it.
+ */
 class TimerManager
 {
 public:
@@ -60,8 +78,30 @@ public:
     TimerEvent* RegisterPeriodicEvent(
         const std::chrono::milliseconds& period,
         libcomp::Message::Execute *pMessage);
+
+    /**
+     * Cancel an event. A periodic event that is running when this is
+     * called will not run again. A one shot event must not be cancelled
+     * after it has run as the event may have been reused.
+     * @param pEvent Event to cancel.
+     */
     void CancelEvent(TimerEvent *pEvent);
 
+    /**
+     * Send events to a message queue instead of running them on the timer
+     * thread. If the queue is gone the events run on the timer thread.
+     * @param messageQueue Queue to send the events to or null to run them
+     *   on the timer thread.
+     */
+    void SetMessageQueue(const std::weak_ptr<
+        MessageQueue<libcomp::Message::Message*>>& messageQueue);
+
+    /**
+     * Get the number of events waiting to run.
+     * @returns Number of events waiting to run.
+     */
+    size_t GetEventCount();
+
     /**
      * Executes code in the worker thread.
      * @param f Function (lambda) to execute in the worker thread.
@@ -73,7 +113,7 @@ public:
         const std::chrono::steady_clock::time_point& time,
         Function&& f, Args&&... args)
     {
-        auto msg = new libcomp::Message::ExecuteImpl<Args...>(
+        auto msg = new libcomp::Message::ExecuteClosure(
             std::forward<Function>(f), std::forward<Args>(args)...);
 
         return RegisterEvent(time, msg);
@@ -89,7 +129,7 @@ public:
     TimerEvent* ScheduleEventIn(int seconds,
         Function&& f, Args&&... args)
     {
-        auto msg = new libcomp::Message::ExecuteImpl<Args...>(
+        auto msg = new libcomp::Message::ExecuteClosure(
             std::forward<Function>(f), std::forward<Args>(args)...);
 
         return RegisterEvent(std::chrono::steady_clock::now() +
@@ -107,19 +147,134 @@ public:
         const std::chrono::milliseconds& period,
         Function&& f, Args&&... args)
     {
-        auto msg = new libcomp::Message::ExecuteImpl<Args...>(
+        auto msg = new libcomp::Message::ExecuteClosure(
             std::forward<Function>(f), std::forward<Args>(args)...);
 
         return RegisterPeriodicEvent(period, msg);
     }
 
 private:
+    /// Number of bits used to index the first level of the wheel
+    static const int WHEEL_ROOT_BITS = 8;
+
+    /// Number of bits used to index the other levels of the wheel
+    static const int WHEEL_BITS = 6;
+
+    /// Number of levels in the wheel (covers 2^32 milliseconds)
+    static const int WHEEL_LEVELS = 5;
+
+    /// Total number of slots in all levels of the wheel
+    static const int WHEEL_SLOTS = (1 << WHEEL_ROOT_BITS) +
+        (WHEEL_LEVELS - 1) * (1 << WHEEL_BITS);
+
+    /// Mask of the index into the first level of the wheel
+    static const uint64_t WHEEL_ROOT_MASK = (1 << WHEEL_ROOT_BITS) - 1;
+
+    /// Mask of the index into the other levels of the wheel
+    static const uint64_t WHEEL_MASK = (1 << WHEEL_BITS) - 1;
+
+    /// Furthest an event can be placed from the current tick
+    static const uint64_t WHEEL_MAX_DELTA = 0xFFFFFFFFull;
+
+    /// Number of event nodes allocated at once
+    static const size_t EVENT_BLOCK_SIZE = 256;
+
     void ProcessEvents(std::unique_lock<std::mutex>& lock);
     void WaitForEvent(std::unique_lock<std::mutex>& lock);
 
+    /**
+     * Run an event or send it to the message queue. This is called with
+     * the lock released.
+     * @param pEvent Event to run.
+     * @param periodic true if the event will run again.
+     * @param messageQueue Queue to send the event to or null to run it on
+     *   the timer thread.
+     */
+    void RunEvent(TimerEvent *pEvent, bool periodic,
+        const std::shared_ptr<MessageQueue<
+        libcomp::Message::Message*>>& messageQueue);
+
+    /**
+     * Take an event node from the pool.
+     * @returns Event node with no message.
+     */
+    TimerEvent* AllocateEvent();
+
+    /**
+     * Delete the message of an event and return the node to the pool.
+     * @param pEvent Event node to free.
+     */
+    void FreeEvent(TimerEvent *pEvent);
+
+    /**
+     * Add an event to the slot for the tick it is due at.
+     * @param pEvent Event to add.
+     */
+    void AddEvent(TimerEvent *pEvent);
+
+    /**
+     * Move the events in a slot of an upper level down the wheel.
+     * @param level Level of the slot.
+     * @param index Index of the slot in the level.
+     * @returns Index of the slot that was cascaded.
+     */
+    uint32_t Cascade(int level, uint32_t index);
+
+    /**
+     * Get the index into @ref mSlots of a slot in the wheel.
+     * @param level Level of the slot.
+     * @param index Index of the slot in the level (masked to fit).
+     * @returns Index of the slot.
+     */
+    static size_t SlotIndex(int level, uint64_t index);
+
+    /**
+     * Get the next tick that has events to run or has to cascade the
+     * upper levels of the wheel.
+     * @returns Next tick to process.
+     */
+    uint64_t NextEventTick() const;
+
+    /**
+     * Convert a time to the first tick at or after it.
+     * @param time Time to convert.
+     * @returns Tick for the time.
+     */
+    uint64_t TimeToTick(const std::chrono::steady_clock::time_point& time)
+        const;
+
     volatile bool mRunning;
-    volatile bool mProcessingEvents;
-    std::multiset<TimerEvent*, TimerEventComp> mEvents;
+
+    /// Time of tick zero
+    std::chrono::steady_clock::time_point mStartTime;
+
+    /// Next tick to process
+    uint64_t mNextTick;
+
+    /// Tick the timer thread is sleeping until
+    uint64_t mWaitTick;
+
+    /// Number of events waiting to run
+    size_t mEventCount;
+
+    /// Slots of every level of the wheel
+    TimerLink mSlots[WHEEL_SLOTS];
+
+    /// Events that are due and are being run
+    TimerLink mExpired;
+
+    /// Event being run with the lock released
+    TimerEvent *mRunningEvent;
+
+    /// Blocks of allocated event nodes
+    std::vector<std::unique_ptr<TimerEvent[]>> mEventBlocks;
+
+    /// Event nodes ready to be reused
+    std::vector<TimerEvent*> mFreeEvents;
+
+    /// Queue to send the events to
+    std::weak_ptr<MessageQueue<libcomp::Message::Message*>> mMessageQueue;
+
     std::condition_variable mEventCondition;
     std::mutex mEventLock;
     std::thread mRunThread;
@@ -30,15 +30,17 @@
 #include "Exception.h"
 #include "Log.h"
 #include "MessageShutdown.h"
+#include "WorkerPool.h"
 
 // Standard C++11 Includes
 #include <thread>
 
 using namespace libcomp;
 
-Worker::Worker() : mRunning(false), mMessageQueue(new MessageQueue<
-    Message::Message*>()), mThread(nullptr)
+Worker::Worker() : mRunning(false), mWorkerPoolIndex(0),
+    mMessageQueue(new MessageQueue<Message::Message*>()), mThread(nullptr)
 {
+    mDispatchOffsets.fill(0);
 }
 
 Worker::~Worker()
@@ -48,15 +50,23 @@ Worker::~Worker()
 
 void Worker::AddManager(const std::shared_ptr<Manager>& manager)
 {
-    for(auto messageType : manager->GetSupportedTypes())
+    if(!manager)
     {
-        mManagers.insert(std::make_pair(messageType, manager));
+        LogGeneralErrorMsg("Manager is null!\n");
+
+        return;
     }
+
+    mManagers.push_back(manager);
+
+    BuildDispatchTable();
 }
 
 void Worker::RemoveAllManagers()
 {
     mManagers.clear();
+
+    BuildDispatchTable();
 }
 
 void Worker::Start(const libcomp::String& name, bool blocking)
@@ -94,66 +104,114 @@ void Worker::Run(MessageQueue<Message::Message*> *pMessageQueue)
     while(mRunning)
     {
         std::list<libcomp::Message::Message*> msgs;
-        pMessageQueue->DequeueAll(msgs);
+
+        auto pool = mWorkerPool.lock();
+
+        if(pool && RunMailbox(pool))
+        {
+            // Check for messages sent to this worker between mailboxes.
+            pMessageQueue->DequeueAny(msgs);
+        }
+        else if(pool)
+        {
+            // Mark the worker idle before the last check so a mailbox
+            // scheduled after the check wakes the worker up.
+            pool->SetIdle(mWorkerPoolIndex, true);
+
+            if(pool->HasReadyMailbox())
+            {
+                pMessageQueue->DequeueAny(msgs);
+            }
+            else
+            {
+                pMessageQueue->DequeueAll(msgs);
+            }
+
+            pool->SetIdle(mWorkerPoolIndex, false);
+        }
+        else
+        {
+            pMessageQueue->DequeueAll(msgs);
+        }
 
         for(auto pMessage : msgs)
         {
-            HandleMessage(pMessage);
+            // A null message is only sent to wake the worker up.
+            if(nullptr != pMessage)
+            {
+                HandleMessage(pMessage);
+            }
+        }
+    }
+}
+
+bool Worker::RunMailbox(const std::shared_ptr<WorkerPool>& pool)
+{
+    auto mailbox = pool->NextMailbox(mWorkerPoolIndex);
+
+    if(!mailbox)
+    {
+        return false;
+    }
+
+    std::list<libcomp::Message::Message*> msgs;
+    mailbox->DequeueAny(msgs);
+
+    bool closed = false;
+
+    for(auto pMessage : msgs)
+    {
+        // The connection sends nothing after it has been closed.
+        if(pMessage->IsConnectionClosed())
+        {
+            closed = true;
         }
+
+        HandleMessage(pMessage);
     }
+
+    pool->FinishMailbox(mWorkerPoolIndex, mailbox, msgs.size(), closed);
+
+    return true;
 }
 
 void Worker::HandleMessage(libcomp::Message::Message *pMessage)
 {
-    // Check for a shutdown message.
-    libcomp::Message::Shutdown *pShutdown = dynamic_cast<
-        libcomp::Message::Shutdown*>(pMessage);
+    auto messageType = pMessage->GetType();
 
-    // Check for an execute message.
-    libcomp::Message::Execute *pExecute = dynamic_cast<
-        libcomp::Message::Execute*>(pMessage);
+    // Check for a shutdown or execute message.
+    auto systemType = libcomp::Message::MessageType::MESSAGE_TYPE_SYSTEM ==
+        messageType ? pMessage->GetSystemMessageType() :
+        libcomp::Message::SystemMessageType::SYSTEM_MESSAGE_OTHER;
 
     // Do not handle any more messages if a shutdown was sent.
-    if(nullptr != pShutdown || !mRunning)
+    if(libcomp::Message::SystemMessageType::SYSTEM_MESSAGE_SHUTDOWN ==
+        systemType || !mRunning)
     {
         mRunning = false;
     }
-    else if(nullptr != pExecute)
+    else if(libcomp::Message::SystemMessageType::SYSTEM_MESSAGE_EXECUTE ==
+        systemType)
     {
         // Run the code now.
-        pExecute->Run();
+        static_cast<libcomp::Message::Execute*>(pMessage)->Run();
     }
     else
     {
         bool didProcess = false;
 
-        // Attempt to find a manager to process this message.
-        auto range = mManagers.equal_range(pMessage->GetType());
-
-        // List of managers to process for.
-        std::list<std::shared_ptr<Manager>> managers;
-
-        // Get the list of managers to process.
-        for(auto it = range.first; it != range.second; ++it)
-        {
-            auto manager = it->second;
-
-            if(!manager)
-            {
-                LogGeneralErrorMsg("Manager is null!\n");
-            }
-            else
-            {
-                managers.push_back(manager);
-            }
-        }
+        // Process the message with the managers for the message type.
+        auto typeIndex = (size_t)messageType;
 
-        // Process the message with the list of managers.
-        for(auto manager : managers)
+        if(Message::MESSAGE_TYPE_COUNT > typeIndex)
         {
-            if(manager->ProcessMessage(pMessage))
+            for(size_t i = mDispatchOffsets[typeIndex];
+                i < mDispatchOffsets[typeIndex + 1]; ++i)
             {
-                didProcess = true;
+                if(mDispatchTable[i]->ProcessMessage(pMessage))
+                {
+                    didProcess = true;
+                }
             }
         }
 
@@ -181,6 +239,31 @@ void Worker::HandleMessage(libcomp::Message::Message *pMessage)
     }
 }
 
+void Worker::BuildDispatchTable()
+{
+    mDispatchTable.clear();
+
+    for(size_t typeIndex = 0; typeIndex < Message::MESSAGE_TYPE_COUNT;
+        ++typeIndex)
+    {
+        mDispatchOffsets[typeIndex] = mDispatchTable.size();
+
+        for(auto& manager : mManagers)
+        {
+            for(auto messageType : manager->GetSupportedTypes())
+            {
+                if(typeIndex == (size_t)messageType)
+                {
+                    mDispatchTable.push_back(manager.get());
+                    break;
+                }
+            }
+        }
+    }
+
+    mDispatchOffsets[Message::MESSAGE_TYPE_COUNT] = mDispatchTable.size();
+}
+
 void Worker::Shutdown()
 {
     mMessageQueue->Enqueue(new libcomp::Message::Shutdown());
@@ -233,6 +316,13 @@ void Worker::SetNextWorker(const std::weak_ptr<Worker>& nextWorker)
     mNextWorker = nextWorker;
 }
 
+void Worker::SetWorkerPool(const std::weak_ptr<WorkerPool>& pool,
+    size_t index)
+{
+    mWorkerPool = pool;
+    mWorkerPoolIndex = index;
+}
+
 std::shared_ptr<MessageQueue<Message::Message*>> Worker::GetMessageQueue() const
 {
     return mMessageQueue;
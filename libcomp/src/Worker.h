@@ -35,14 +35,18 @@
 #include "MessageQueue.h"
 
 // Standard C++11 Includes
+#include <array>
 #include <list>
 #include <memory>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace libcomp
 {
 
+class WorkerPool;
+
 /**
  * Generic worker assigned to a message queue used to handle messages as
  * they are received.  Workers can run syncronously or in their own thread
@@ -117,6 +121,14 @@ public:
      */
     void SetNextWorker(const std::weak_ptr<Worker>& nextWorker);
 
+    /**
+     * Set the pool the worker runs connection mailboxes for. This is called
+     * by @ref WorkerPool::AddWorker before the worker is started.
+     * @param pool Pool the worker belongs to.
+     * @param index Index of the worker in the pool.
+     */
+    void SetWorkerPool(const std::weak_ptr<WorkerPool>& pool, size_t index);
+
     /**
      * Get the message queue assinged to the worker.
      * @return Assigned message queue
@@ -145,7 +157,7 @@ public:
 
         if(nullptr != queue)
         {
-            auto msg = new libcomp::Message::ExecuteImpl<Args...>(
+            auto msg = new libcomp::Message::ExecuteClosure(
                 std::forward<Function>(f), std::forward<Args>(args)...);
             queue->Enqueue(msg);
 
@@ -169,6 +181,18 @@ protected:
     virtual void HandleMessage(libcomp::Message::Message *pMessage);
 
 private:
+    /**
+     * Run the next connection mailbox from the worker pool.
+     * @param pool Pool the worker belongs to.
+     * @returns true if a mailbox was run; false if there was none.
+     */
+    bool RunMailbox(const std::shared_ptr<WorkerPool>& pool);
+
+    /**
+     * Rebuild the dispatch table from the list of managers.
+     */
+    void BuildDispatchTable();
+
     /// Signifier that the worker should continue running
     bool mRunning;
 
@@ -178,13 +202,26 @@ private:
     /// Next worker to forward messages to.
     std::weak_ptr<Worker> mNextWorker;
 
+    /// Pool the worker runs connection mailboxes for.
+    std::weak_ptr<WorkerPool> mWorkerPool;
+
+    /// Index of the worker in the pool.
+    size_t mWorkerPoolIndex;
+
     /// Message queue to retrieve messages from
     std::shared_ptr<libcomp::MessageQueue<
         libcomp::Message::Message*>> mMessageQueue;
 
-    /// Map of pointers to message handlers mapped by message type
-    EnumMultiMap<Message::MessageType,
-        std::shared_ptr<Manager>> mManagers;
+    /// Message handlers in the order they were added
+    std::list<std::shared_ptr<Manager>> mManagers;
+
+    /// Message handlers for each message type one after the other. The
+    /// managers are kept alive by @ref mManagers.
+    std::vector<Manager*> mDispatchTable;
+
+    /// Index into @ref mDispatchTable of the first message handler for each
+    /// message type. The handlers for a type end where the next type starts.
+    std::array<size_t, Message::MESSAGE_TYPE_COUNT + 1> mDispatchOffsets;
 
     /// Thread used to handle asynchronous execution
     std::thread *mThread;
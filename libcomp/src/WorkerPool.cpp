@@ -0,0 +1,361 @@
+/**
+ * @file libcomp/src/WorkerPool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of workers that share connection mailboxes.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+
+// libcomp Includes
+#include "Worker.h"
+
+using namespace libcomp;
+
+WorkerMailbox::WorkerMailbox(const std::weak_ptr<WorkerPool>& pool,
+    size_t homeWorker) : mPool(pool), mHomeWorker(homeWorker), mPending(0)
+{
+    SetEnqueueHandler([this](size_t count)
+    {
+        return ReserveMessages(count);
+    }, [this]()
+    {
+        MessagesQueued();
+    });
+}
+
+WorkerMailbox::~WorkerMailbox()
+{
+    std::list<Message::Message*> msgs;
+    DequeueAny(msgs);
+
+    for(auto pMessage : msgs)
+    {
+        delete pMessage;
+    }
+}
+
+size_t WorkerMailbox::GetHomeWorker() const
+{
+    return mHomeWorker;
+}
+
+int64_t WorkerMailbox::GetPendingCount() const
+{
+    return mPending;
+}
+
+bool WorkerMailbox::ReserveMessages(size_t count)
+{
+    // Count the messages before a worker can see them so a worker never
+    // handles a message that is not counted yet. Only the messages that
+    // take the count up from zero schedule the mailbox. The worker running
+    // it picks up anything added after that.
+    return 0 == mPending.fetch_add((int64_t)count);
+}
+
+void WorkerMailbox::MessagesQueued()
+{
+    auto pool = mPool.lock();
+
+    if(pool)
+    {
+        pool->Schedule(shared_from_this());
+    }
+}
+
+WorkerPool::WorkerPool() : mReadyCount(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+}
+
+void WorkerPool::AddWorker(const std::shared_ptr<Worker>& worker)
+{
+    std::unique_ptr<WorkerState> state(new WorkerState);
+    state->worker = worker;
+
+    worker->SetWorkerPool(shared_from_this(), mWorkers.size());
+
+    mWorkers.push_back(std::move(state));
+}
+
+std::shared_ptr<WorkerMailbox> WorkerPool::CreateMailbox(
+    const std::shared_ptr<Worker>& homeWorker)
+{
+    if(mWorkers.empty())
+    {
+        return nullptr;
+    }
+
+    size_t homeIndex = mWorkers.size();
+
+    for(size_t i = 0; i < mWorkers.size(); ++i)
+    {
+        if(mWorkers[i]->worker.lock() == homeWorker)
+        {
+            homeIndex = i;
+            break;
+        }
+    }
+
+    // Fall back on the least busy worker.
+    if(mWorkers.size() <= homeIndex)
+    {
+        homeIndex = 0;
+
+        for(size_t i = 1; i < mWorkers.size(); ++i)
+        {
+            if(mWorkers[i]->mailboxes < mWorkers[homeIndex]->mailboxes)
+            {
+                homeIndex = i;
+            }
+        }
+    }
+
+    auto mailbox = std::make_shared<WorkerMailbox>(shared_from_this(),
+        homeIndex);
+
+    mWorkers[homeIndex]->mailboxes++;
+
+    std::lock_guard<std::mutex> lock(mMailboxLock);
+    mMailboxes[mailbox.get()] = mailbox;
+
+    return mailbox;
+}
+
+std::shared_ptr<Worker> WorkerPool::GetLeastBusyWorker() const
+{
+    std::shared_ptr<Worker> leastBusy;
+    size_t leastMailboxes = 0;
+
+    for(auto& state : mWorkers)
+    {
+        auto worker = state->worker.lock();
+
+        if(worker && (!leastBusy || state->mailboxes < leastMailboxes))
+        {
+            leastBusy = worker;
+            leastMailboxes = state->mailboxes;
+        }
+    }
+
+    return leastBusy;
+}
+
+std::vector<WorkerPool::WorkerStats> WorkerPool::GetStats() const
+{
+    std::vector<WorkerStats> stats;
+
+    for(auto& state : mWorkers)
+    {
+        WorkerStats workerStats;
+        workerStats.mailboxes = state->mailboxes;
+        workerStats.mailboxRuns = state->mailboxRuns;
+        workerStats.steals = state->steals;
+        workerStats.queuedMessages = 0;
+
+        std::lock_guard<std::mutex> lock(state->lock);
+        workerStats.queueDepth = state->ready.size();
+
+        for(auto& mailbox : state->ready)
+        {
+            workerStats.queuedMessages += mailbox->GetPendingCount();
+        }
+
+        stats.push_back(workerStats);
+    }
+
+    return stats;
+}
+
+size_t WorkerPool::GetQueueDepth() const
+{
+    return mReadyCount;
+}
+
+uint64_t WorkerPool::GetStealCount() const
+{
+    uint64_t steals = 0;
+
+    for(auto& state : mWorkers)
+    {
+        steals += state->steals;
+    }
+
+    return steals;
+}
+
+std::shared_ptr<WorkerMailbox> WorkerPool::NextMailbox(size_t workerIndex)
+{
+    if(mWorkers.size() <= workerIndex)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<WorkerMailbox> mailbox;
+
+    // Run the worker's own mailboxes in the order they were scheduled.
+    {
+        auto& state = *mWorkers[workerIndex];
+
+        std::lock_guard<std::mutex> lock(state.lock);
+
+        if(!state.ready.empty())
+        {
+            mailbox = state.ready.front();
+            state.ready.pop_front();
+        }
+    }
+
+    if(mailbox)
+    {
+        mReadyCount--;
+
+        return mailbox;
+    }
+
+    // Steal from the back of another worker's queue. That mailbox would
+    // have waited the longest for its own worker.
+    for(size_t i = 1; i < mWorkers.size() && !mailbox; ++i)
+    {
+        size_t victimIndex = (workerIndex + i) % mWorkers.size();
+        auto& victim = *mWorkers[victimIndex];
+
+        std::lock_guard<std::mutex> lock(victim.lock);
+
+        if(!victim.ready.empty())
+        {
+            mailbox = victim.ready.back();
+            victim.ready.pop_back();
+
+            // The connection now belongs to this worker.
+            mailbox->mHomeWorker = workerIndex;
+            victim.mailboxes--;
+        }
+    }
+
+    if(mailbox)
+    {
+        mReadyCount--;
+
+        auto& state = *mWorkers[workerIndex];
+        state.mailboxes++;
+        state.steals++;
+    }
+
+    return mailbox;
+}
+
+void WorkerPool::FinishMailbox(size_t workerIndex,
+    const std::shared_ptr<WorkerMailbox>& mailbox, size_t count, bool closed)
+{
+    if(mWorkers.size() <= workerIndex)
+    {
+        return;
+    }
+
+    mWorkers[workerIndex]->mailboxRuns++;
+
+    if(closed)
+    {
+        // The mailbox is never scheduled again so drop it now.
+        mWorkers[mailbox->mHomeWorker]->mailboxes--;
+
+        std::lock_guard<std::mutex> lock(mMailboxLock);
+        mMailboxes.erase(mailbox.get());
+
+        return;
+    }
+
+    // Keep the mailbox scheduled if more messages were added while it ran.
+    // This includes messages counted but not in the mailbox yet so the
+    // mailbox may run again with nothing in it until they are added.
+    if((int64_t)count != mailbox->mPending.fetch_sub((int64_t)count))
+    {
+        Schedule(mailbox);
+    }
+}
+
+bool WorkerPool::HasReadyMailbox() const
+{
+    return 0 < mReadyCount;
+}
+
+void WorkerPool::SetIdle(size_t workerIndex, bool idle)
+{
+    if(workerIndex < mWorkers.size())
+    {
+        mWorkers[workerIndex]->idle = idle;
+    }
+}
+
+void WorkerPool::Schedule(const std::shared_ptr<WorkerMailbox>& mailbox)
+{
+    size_t homeIndex = mailbox->mHomeWorker;
+
+    {
+        auto& state = *mWorkers[homeIndex];
+
+        std::lock_guard<std::mutex> lock(state.lock);
+        state.ready.push_back(mailbox);
+    }
+
+    // This is ordered before the idle checks below. An idle worker sets
+    // the flag before it checks the count so one side sees the other.
+    mReadyCount++;
+
+    // Wake the home worker or, if it is busy, any idle worker to steal it.
+    if(!Wake(homeIndex))
+    {
+        for(size_t i = 1; i < mWorkers.size(); ++i)
+        {
+            if(Wake((homeIndex + i) % mWorkers.size()))
+            {
+                break;
+            }
+        }
+    }
+}
+
+bool WorkerPool::Wake(size_t workerIndex)
+{
+    auto& state = *mWorkers[workerIndex];
+
+    if(!state.idle.load() || !state.idle.exchange(false))
+    {
+        return false;
+    }
+
+    auto worker = state.worker.lock();
+    auto queue = worker ? worker->GetMessageQueue() : nullptr;
+
+    if(queue)
+    {
+        // A null message only wakes the worker up.
+        queue->Enqueue(nullptr);
+    }
+
+    return true;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file libcomp/src/WorkerPool.h
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Pool of workers that share connection mailboxes.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCOMP_SRC_WORKERPOOL_H
+#define LIBCOMP_SRC_WORKERPOOL_H
+
+// libcomp Includes
+#include "Message.h"
+#include "MessageQueue.h"
+
+// Standard C++11 Includes
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace libcomp
+{
+
+class Worker;
+class WorkerPool;
+
+/**
+ * Message queue for a single connection that is run by a @ref WorkerPool.
+ * The mailbox is scheduled on its home worker when a message is added to
+ * it while it is empty. Only one worker runs the mailbox at a time so the
+ * messages of a connection are always handled in order.
+ */
+class WorkerMailbox : public MessageQueue<Message::Message*>,
+    public std::enable_shared_from_this<WorkerMailbox>
+{
+public:
+    /**
+     * Create the mailbox.
+     * @param pool Pool that runs the mailbox.
+     * @param homeWorker Index of the worker the mailbox is scheduled on.
+     */
+    WorkerMailbox(const std::weak_ptr<WorkerPool>& pool, size_t homeWorker);
+
+    /**
+     * Delete any messages left in the mailbox.
+     */
+    ~WorkerMailbox();
+
+    /**
+     * Get the index of the worker the mailbox is scheduled on. This changes
+     * when another worker steals the mailbox.
+     * @returns Index of the home worker.
+     */
+    size_t GetHomeWorker() const;
+
+    /**
+     * Get the number of messages added to the mailbox that have not been
+     * handled yet.
+     * @returns Number of pending messages.
+     */
+    int64_t GetPendingCount() const;
+
+private:
+    friend class WorkerPool;
+
+    /**
+     * Called before messages are added to the mailbox.
+     * @param count Number of messages about to be added.
+     * @returns true if the mailbox should be scheduled once they are added.
+     */
+    bool ReserveMessages(size_t count);
+
+    /**
+     * Called after messages are added to the mailbox if it needs to be
+     * scheduled.
+     */
+    void MessagesQueued();
+
+    /// Pool that runs the mailbox.
+    std::weak_ptr<WorkerPool> mPool;
+
+    /// Index of the worker the mailbox is scheduled on.
+    std::atomic<size_t> mHomeWorker;
+
+    /// Number of messages not handled yet, counted before they are added.
+    /// The mailbox is scheduled when this goes up from zero and stays with
+    /// one worker until it is zero.
+    std::atomic<int64_t> mPending;
+};
+
+/**
+ * Pool of @ref Worker instances that run connection mailboxes. Each worker
+ * has a queue of mailboxes that are ready to run. A worker takes mailboxes
+ * from the front of its own queue and, when it has none, steals from the
+ * back of the queue of another worker. A stolen mailbox moves to the worker
+ * that stole it so a connection stays on one worker until that worker gets
+ * too busy to keep up.
+ */
+class WorkerPool : public std::enable_shared_from_this<WorkerPool>
+{
+public:
+    /**
+     * Counters for a single worker in the pool.
+     */
+    struct WorkerStats
+    {
+        /// Number of mailboxes scheduled on the worker.
+        size_t mailboxes;
+
+        /// Number of mailboxes waiting to run on the worker.
+        size_t queueDepth;
+
+        /// Number of messages waiting in those mailboxes.
+        int64_t queuedMessages;
+
+        /// Number of times the worker ran a mailbox.
+        uint64_t mailboxRuns;
+
+        /// Number of mailboxes the worker stole from other workers.
+        uint64_t steals;
+    };
+
+    /**
+     * Create an empty pool.
+     */
+    WorkerPool();
+
+    /**
+     * Cleanup the pool.
+     */
+    ~WorkerPool();
+
+    /**
+     * Add a worker to the pool. This must be called before the worker is
+     * started.
+     * @param worker Worker to add.
+     */
+    void AddWorker(const std::shared_ptr<Worker>& worker);
+
+    /**
+     * Create a mailbox for a connection.
+     * @param homeWorker Worker to schedule the mailbox on first. If this is
+     *   null or not in the pool the least busy worker is used.
+     * @returns Mailbox to give to the connection as its message queue.
+     */
+    std::shared_ptr<WorkerMailbox> CreateMailbox(
+        const std::shared_ptr<Worker>& homeWorker);
+
+    /**
+     * Get the worker with the fewest mailboxes scheduled on it.
+     * @returns Least busy worker or null if the pool is empty.
+     */
+    std::shared_ptr<Worker> GetLeastBusyWorker() const;
+
+    /**
+     * Get the counters for every worker in the pool.
+     * @returns Counters in the order the workers were added.
+     */
+    std::vector<WorkerStats> GetStats() const;
+
+    /**
+     * Get the number of mailboxes waiting to run on any worker.
+     * @returns Number of mailboxes waiting to run.
+     */
+    size_t GetQueueDepth() const;
+
+    /**
+     * Get the number of mailboxes stolen by any worker.
+     * @returns Number of mailboxes stolen.
+     */
+    uint64_t GetStealCount() const;
+
+    /**
+     * Take the next mailbox for a worker to run, stealing one from another
+     * worker if the worker has none of its own.
+     * @param workerIndex Index of the worker.
+     * @returns Mailbox to run or null if there is none.
+     */
+    std::shared_ptr<WorkerMailbox> NextMailbox(size_t workerIndex);
+
+    /**
+     * Called by a worker after it has handled messages from a mailbox.
+     * @param workerIndex Index of the worker.
+     * @param mailbox Mailbox that was run.
+     * @param count Number of messages handled.
+     * @param closed true if the connection was closed and the mailbox
+     *   will not be used again.
+     */
+    void FinishMailbox(size_t workerIndex,
+        const std::shared_ptr<WorkerMailbox>& mailbox, size_t count,
+        bool closed);
+
+    /**
+     * Check if any worker has a mailbox waiting to run.
+     * @returns true if there is a mailbox to run; false otherwise.
+     */
+    bool HasReadyMailbox() const;
+
+    /**
+     * Mark a worker as idle (about to wait for messages) or busy. An idle
+     * worker is woken up when a mailbox is scheduled.
+     * @param workerIndex Index of the worker.
+     * @param idle true if the worker is about to wait.
+     */
+    void SetIdle(size_t workerIndex, bool idle);
+
+private:
+    friend class WorkerMailbox;
+
+    /**
+     * State of a worker in the pool.
+     */
+    struct WorkerState
+    {
+        WorkerState() : mailboxes(0), idle(false), mailboxRuns(0),
+            steals(0)
+        {
+        }
+
+        /// Worker the state belongs to.
+        std::weak_ptr<Worker> worker;
+
+        /// Lock for the ready queue.
+        std::mutex lock;
+
+        /// Mailboxes waiting to run.
+        std::deque<std::shared_ptr<WorkerMailbox>> ready;
+
+        /// Number of mailboxes scheduled on the worker.
+        std::atomic<size_t> mailboxes;
+
+        /// Set while the worker is waiting for messages.
+        std::atomic<bool> idle;
+
+        /// Number of times the worker ran a mailbox.
+        std::atomic<uint64_t> mailboxRuns;
+
+        /// Number of mailboxes the worker stole.
+        std::atomic<uint64_t> steals;
+    };
+
+    /**
+     * Add a mailbox to the ready queue of its home worker and wake a
+     * worker to run it.
+     * @param mailbox Mailbox to schedule.
+     */
+    void Schedule(const std::shared_ptr<WorkerMailbox>& mailbox);
+
+    /**
+     * Wake a worker if it is idle.
+     * @param workerIndex Index of the worker.
+     * @returns true if the worker was idle; false otherwise.
+     */
+    bool Wake(size_t workerIndex);
+
+    /// State of each worker.
+    std::vector<std::unique_ptr<WorkerState>> mWorkers;
+
+    /// Number of mailboxes waiting to run on any worker.
+    std::atomic<size_t> mReadyCount;
+
+    /// Lock for the list of mailboxes.
+    std::mutex mMailboxLock;
+
+    /// Every open mailbox. Connections only keep a weak pointer to their
+    /// mailbox so the pool owns them until the connection is closed.
+    std::unordered_map<WorkerMailbox*,
+        std::shared_ptr<WorkerMailbox>> mMailboxes;
+};
+
+} // namespace libcomp
+
+#endif // LIBCOMP_SRC_WORKERPOOL_H
@@ -0,0 +1,302 @@
+/**
+ * @file libcomp/tests/CaptureReader.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the CaptureReader class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <CaptureReader.h>
+#include <CaptureWriter.h>
+#include <Compress.h>
+#include <Constants.h>
+#include <Packet.h>
+
+// Standard C++11 Includes
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <glob.h>
+#include <unistd.h>
+#endif // !_WIN32
+
+using namespace libcomp;
+
+/**
+ * Build the commands of a packet.
+ */
+static std::vector<char> BuildCommands(const std::vector<std::pair<uint16_t,
+    std::string>>& commands)
+{
+    Packet p;
+
+    for(auto& command : commands)
+    {
+        uint16_t commandSize = static_cast<uint16_t>(2 * sizeof(uint16_t) +
+            command.second.size());
+
+        p.WriteU16Big(commandSize);
+        p.WriteU16Little(commandSize);
+        p.WriteU16Little(command.first);
+        p.WriteArray(command.second.c_str(),
+            static_cast<uint32_t>(command.second.size()));
+    }
+
+    return std::vector<char>(p.ConstData(), p.ConstData() + p.Size());
+}
+
+/**
+ * Build a decrypted packet the way it is captured (sizes and padding).
+ */
+static std::vector<char> BuildPacket(const std::vector<char>& data)
+{
+    uint32_t realSize = static_cast<uint32_t>(data.size());
+    uint32_t paddedSize = (realSize + 7) & ~7u;
+
+    Packet p;
+    p.WriteU32Big(paddedSize);
+    p.WriteU32Big(realSize);
+    p.WriteArray(data);
+    p.WriteBlank(paddedSize - realSize);
+
+    return std::vector<char>(p.ConstData(), p.ConstData() + p.Size());
+}
+
+/**
+ * Add the channel compression header to the commands of a packet.
+ */
+static std::vector<char> BuildChannelData(std::vector<char> commands,
+    bool compress)
+{
+    int32_t uncompressedSize = static_cast<int32_t>(commands.size());
+    std::vector<char> data = commands;
+
+    if(compress)
+    {
+        data.resize(commands.size() + 64);
+        data.resize(static_cast<size_t>(Compress::Compress(&commands[0],
+            &data[0], uncompressedSize, static_cast<int32_t>(data.size()))));
+    }
+
+    Packet p;
+    p.WriteArray("gzip", 4);
+    p.WriteS32Little(uncompressedSize);
+    p.WriteS32Little(static_cast<int32_t>(data.size()));
+    p.WriteArray("lv6", 4);
+    p.WriteArray(data);
+
+    return std::vector<char>(p.ConstData(), p.ConstData() + p.Size());
+}
+
+TEST(CaptureReader, Commands)
+{
+    std::string big(1000, 'x');
+
+    auto commands = BuildCommands({ { 0x1234, "abc" }, { 0x0001, "" },
+        { 0x4321, big } });
+
+    std::vector<std::vector<char>> packets = {
+        BuildPacket(commands),
+        BuildPacket(BuildChannelData(commands, false)),
+        BuildPacket(BuildChannelData(commands, true)),
+    };
+
+    // The compressed packet must actually be compressed.
+    EXPECT_LT(packets[2].size(), packets[1].size());
+
+    std::vector<CaptureReader::Command> result;
+    std::vector<char> scratch;
+
+    for(size_t i = 0; i < packets.size(); ++i)
+    {
+        CaptureReader::Record record;
+        record.source = HACK_SOURCE_CLIENT;
+        record.stamp = 0;
+        record.microTime = 0;
+        record.pData = &packets[i][0];
+        record.size = static_cast<uint32_t>(packets[i].size());
+
+        ASSERT_TRUE(CaptureReader::GetCommands(record, 0 != i, result,
+            scratch));
+        ASSERT_EQ(result.size(), 3u);
+
+        EXPECT_EQ(result[0].code, 0x1234);
+        EXPECT_EQ(std::string(result[0].pData, result[0].size), "abc");
+        EXPECT_EQ(result[1].code, 0x0001);
+        EXPECT_EQ(result[1].size, 0u);
+        EXPECT_EQ(result[2].code, 0x4321);
+        EXPECT_EQ(std::string(result[2].pData, result[2].size), big);
+
+        // Only the compressed packet is copied.
+        EXPECT_EQ(2 != i, result[0].pData > record.pData &&
+            result[0].pData < (record.pData + record.size));
+
+        // A lobby packet has no compression header and a channel packet
+        // must have one.
+        EXPECT_FALSE(CaptureReader::GetCommands(record, 0 == i, result,
+            scratch));
+
+        // A truncated packet is rejected.
+        record.size -= 8;
+
+        EXPECT_FALSE(CaptureReader::GetCommands(record, 0 != i, result,
+            scratch));
+    }
+}
+
+TEST(CaptureReader, ReadCapture)
+{
+#ifndef _WIN32
+    String address = String("capread%1").Arg(getpid());
+
+    auto commands = BuildCommands({ { 0x0002, "hello" } });
+    auto clientPacket = BuildPacket(commands);
+    auto serverPacket = BuildPacket(BuildChannelData(commands, true));
+
+    {
+        CaptureWriter writer("/tmp");
+
+        uint32_t captureID = writer.OpenCapture(address);
+
+        for(int i = 0; i < 10; ++i)
+        {
+            auto& packet = 0 == (i % 2) ? clientPacket : serverPacket;
+
+            CaptureRecord *pRecord = writer.CreateRecord(captureID,
+                0 == (i % 2) ? HACK_SOURCE_CLIENT : HACK_SOURCE_SERVER,
+                static_cast<uint32_t>(packet.size()));
+
+            ASSERT_NE(pRecord, nullptr);
+
+            memcpy(pRecord->Data(), &packet[0], packet.size());
+
+            writer.QueueRecord(pRecord);
+        }
+
+        writer.CloseCapture(captureID);
+    }
+
+    auto pattern = String("/tmp/*-%1-*.hack").Arg(address);
+
+    glob_t results;
+
+    ASSERT_EQ(glob(pattern.C(), 0, nullptr, &results), 0);
+    ASSERT_EQ(results.gl_pathc, 1u);
+
+    String path(results.gl_pathv[0]);
+
+    globfree(&results);
+
+    CaptureReader reader;
+
+    ASSERT_TRUE(reader.Open(path));
+    EXPECT_EQ(reader.GetRemoteAddress(), address);
+    EXPECT_NE(reader.GetStamp(), 0u);
+
+    std::vector<CaptureReader::Command> result;
+    std::vector<char> scratch;
+
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        CaptureReader::Record record;
+        uint64_t lastMicroTime = 0;
+        int count = 0;
+
+        while(reader.Next(record))
+        {
+            bool client = HACK_SOURCE_CLIENT == record.source;
+
+            EXPECT_EQ(client, 0 == (count % 2));
+            EXPECT_GE(record.microTime, lastMicroTime);
+            EXPECT_TRUE(CaptureReader::GetCommands(record, !client, result,
+                scratch));
+            ASSERT_EQ(result.size(), 1u);
+            EXPECT_EQ(std::string(result[0].pData, result[0].size),
+                "hello");
+
+            lastMicroTime = record.microTime;
+            count++;
+        }
+
+        EXPECT_EQ(count, 10);
+        EXPECT_TRUE(reader.AtEnd());
+
+        reader.Rewind();
+    }
+
+    reader.Close();
+
+    EXPECT_FALSE(reader.IsOpen());
+
+    // A truncated record stops the reader before the end of the file.
+    {
+        std::FILE *pFile = std::fopen(path.C(), "rb");
+        std::vector<char> data(4096);
+        data.resize(std::fread(&data[0], 1, data.size(), pFile));
+        std::fclose(pFile);
+
+        pFile = std::fopen(path.C(), "wb");
+        std::fwrite(&data[0], 1, data.size() - 1, pFile);
+        std::fclose(pFile);
+    }
+
+    ASSERT_TRUE(reader.Open(path));
+
+    CaptureReader::Record record;
+    int count = 0;
+
+    while(reader.Next(record))
+    {
+        count++;
+    }
+
+    EXPECT_EQ(count, 9);
+    EXPECT_FALSE(reader.AtEnd());
+
+    reader.Close();
+
+    remove(path.C());
+
+    // Anything that is not a capture file is rejected.
+    EXPECT_FALSE(reader.Open(path));
+    EXPECT_FALSE(reader.Open("/dev/null"));
+#endif // !_WIN32
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,302 @@
+/**
+ * @file libcomp/tests/CaptureWriter.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the CaptureWriter class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <CaptureWriter.h>
+#include <Constants.h>
+
+// Standard C++11 Includes
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <vector>
+
+#ifndef _WIN32
+#include <glob.h>
+#include <unistd.h>
+#endif // !_WIN32
+
+using namespace libcomp;
+
+static const int PACKET_COUNT = 100;
+static const uint32_t PACKET_SIZE = 100;
+static const uint64_t MAX_FILE_SIZE = 4096;
+
+#ifndef _WIN32
+/**
+ * Find the capture files written for a remote address.
+ */
+static std::vector<std::string> FindCaptureFiles(const String& address)
+{
+    std::vector<std::string> files;
+
+    auto pattern = String("/tmp/*-%1-*.hack").Arg(address);
+
+    glob_t results;
+
+    if(0 == glob(pattern.C(), 0, nullptr, &results))
+    {
+        for(size_t i = 0; i < results.gl_pathc; ++i)
+        {
+            files.push_back(results.gl_pathv[i]);
+        }
+    }
+
+    globfree(&results);
+
+    return files;
+}
+
+/**
+ * Read the packets in a capture file and check the header.
+ */
+static bool ReadCaptureFile(const std::string& path, const String& address,
+    std::set<uint32_t>& packets, uint64_t& fileSize)
+{
+    std::ifstream file(path, std::ifstream::binary);
+
+    file.seekg(0, std::ifstream::end);
+    fileSize = (uint64_t)file.tellg();
+    file.seekg(0, std::ifstream::beg);
+
+    uint32_t magic = 0, version = 0, addrlen = 0;
+    uint64_t stamp = 0;
+
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&stamp), sizeof(stamp));
+    file.read(reinterpret_cast<char*>(&addrlen), sizeof(addrlen));
+
+    std::vector<char> addr(addrlen);
+    file.read(&addr[0], addrlen);
+
+    if(!file.good() || HACK_FORMAT_MAGIC != magic ||
+        HACK_FORMAT_VER2 != version || 0 == stamp ||
+        String(&addr[0], addr.size()) != address)
+    {
+        return false;
+    }
+
+    for(;;)
+    {
+        uint8_t source = 0;
+        uint64_t microtime = 0;
+        uint32_t size = 0;
+
+        file.read(reinterpret_cast<char*>(&source), sizeof(source));
+
+        if(file.eof())
+        {
+            break;
+        }
+
+        file.read(reinterpret_cast<char*>(&stamp), sizeof(stamp));
+        file.read(reinterpret_cast<char*>(&microtime), sizeof(microtime));
+        file.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+        std::vector<char> data(size);
+        file.read(&data[0], size);
+
+        uint32_t index;
+        memcpy(&index, &data[0], sizeof(index));
+
+        if(!file.good() || HACK_SOURCE_SERVER != source ||
+            PACKET_SIZE != size || (char)index != data[size - 1])
+        {
+            return false;
+        }
+
+        packets.insert(index);
+    }
+
+    return true;
+}
+#endif // !_WIN32
+
+TEST(CaptureWriter, SampleAndRotate)
+{
+#ifndef _WIN32
+    String address = String("captest%1").Arg(getpid());
+    String skippedAddress = String("capskip%1").Arg(getpid());
+
+    CaptureWriter writer("/tmp", MAX_FILE_SIZE, 2);
+
+    // Only every second connection is captured.
+    uint32_t captureID = writer.OpenCapture(address);
+    uint32_t skippedID = writer.OpenCapture(skippedAddress);
+
+    EXPECT_NE(captureID, 0u);
+    EXPECT_EQ(skippedID, 0u);
+    EXPECT_EQ(writer.CreateRecord(skippedID, HACK_SOURCE_SERVER,
+        PACKET_SIZE), nullptr);
+
+    for(uint32_t i = 0; i < (uint32_t)PACKET_COUNT; ++i)
+    {
+        CaptureRecord *pRecord = writer.CreateRecord(captureID,
+            HACK_SOURCE_SERVER, PACKET_SIZE);
+
+        ASSERT_NE(pRecord, nullptr);
+        ASSERT_EQ(pRecord->Size(), PACKET_SIZE);
+
+        memset(pRecord->Data(), (char)i, PACKET_SIZE);
+        memcpy(pRecord->Data(), &i, sizeof(i));
+
+        writer.QueueRecord(pRecord);
+    }
+
+    writer.CloseCapture(captureID);
+    writer.Stop();
+
+    // Nothing is written once the writer is stopped.
+    EXPECT_EQ(writer.OpenCapture(address), 0u);
+
+    auto stats = writer.GetStats();
+
+    EXPECT_EQ(stats.captures, 1u);
+    EXPECT_EQ(stats.skippedCaptures, 1u);
+    EXPECT_EQ(stats.packets, (uint64_t)PACKET_COUNT);
+    EXPECT_EQ(stats.droppedPackets, 0u);
+    EXPECT_GE(stats.rotations, 2u);
+
+    // Every packet must be in one of the files and no file may be over
+    // the size limit.
+    auto files = FindCaptureFiles(address);
+
+    EXPECT_EQ(files.size(), stats.rotations + 1);
+
+    std::set<uint32_t> packets;
+    uint64_t totalSize = 0;
+
+    for(auto& path : files)
+    {
+        uint64_t fileSize = 0;
+
+        EXPECT_TRUE(ReadCaptureFile(path, address, packets, fileSize));
+        EXPECT_LE(fileSize, MAX_FILE_SIZE);
+
+        totalSize += fileSize;
+
+        remove(path.c_str());
+    }
+
+    EXPECT_EQ(packets.size(), (size_t)PACKET_COUNT);
+    EXPECT_EQ(totalSize, stats.bytes);
+    EXPECT_TRUE(FindCaptureFiles(skippedAddress).empty());
+#endif // !_WIN32
+}
+
+TEST(CaptureWriter, TimeUnits)
+{
+#ifndef _WIN32
+    String address = String("captime%1").Arg(getpid());
+
+    CaptureWriter writer("/tmp", 0, 1);
+
+    uint32_t captureID = writer.OpenCapture(address);
+
+    ASSERT_NE(captureID, 0u);
+
+    auto before = static_cast<uint64_t>(
+        std::chrono::time_point_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now()).time_since_epoch().count());
+
+    // Records from both sides of the connection share the same unit.
+    for(uint32_t i = 0; i < (uint32_t)PACKET_COUNT; ++i)
+    {
+        CaptureRecord *pRecord = writer.CreateRecord(captureID,
+            0 == (i % 2) ? HACK_SOURCE_CLIENT : HACK_SOURCE_SERVER,
+            PACKET_SIZE);
+
+        ASSERT_NE(pRecord, nullptr);
+
+        memset(pRecord->Data(), 0, PACKET_SIZE);
+
+        writer.QueueRecord(pRecord);
+    }
+
+    auto after = static_cast<uint64_t>(
+        std::chrono::time_point_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now()).time_since_epoch().count());
+
+    writer.CloseCapture(captureID);
+    writer.Stop();
+
+    auto files = FindCaptureFiles(address);
+
+    ASSERT_EQ(files.size(), 1u);
+
+    std::ifstream file(files.front(), std::ifstream::binary);
+
+    // Skip the magic, version and stamp to the remote address.
+    uint32_t addrlen = 0;
+
+    file.seekg(2 * sizeof(uint32_t) + sizeof(uint64_t));
+    file.read(reinterpret_cast<char*>(&addrlen), sizeof(addrlen));
+    file.seekg(addrlen, std::ifstream::cur);
+
+    uint64_t lastMicroTime = before;
+
+    for(int i = 0; i < PACKET_COUNT; ++i)
+    {
+        uint64_t microtime = 0;
+
+        // Skip the source and stamp then read the time and skip the data.
+        file.seekg(sizeof(uint8_t) + sizeof(uint64_t),
+            std::ifstream::cur);
+        file.read(reinterpret_cast<char*>(&microtime), sizeof(microtime));
+        file.seekg(sizeof(uint32_t) + PACKET_SIZE, std::ifstream::cur);
+
+        EXPECT_GE(microtime, lastMicroTime);
+        EXPECT_LE(microtime, after);
+
+        lastMicroTime = microtime;
+    }
+
+    EXPECT_TRUE(file.good());
+
+    file.close();
+    remove(files.front().c_str());
+#endif // !_WIN32
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
@@ -111,6 +111,28 @@ TEST(String, CP932)
         ((sizeof(encodedString) - 1 + 4 - 1) / 4) * 4);
 }
 
+TEST(String, ConvertRoundTrip)
+{
+    String message;
+
+    for(int i = 0; i < 10; ++i)
+    {
+        message += "Hello! 日本語が大好き！ ";
+    }
+
+    for(auto encoding : { Convert::ENCODING_CP932,
+        Convert::ENCODING_CP1252 })
+    {
+        String text = Convert::ENCODING_CP932 == encoding ? message :
+            String("Hello! ¿Qué tal? ");
+
+        auto encoded = Convert::ToEncoding(encoding, text, false);
+
+        EXPECT_EQ(encoded.size(), Convert::SizeEncoded(encoding, text));
+        EXPECT_EQ(Convert::FromEncoding(encoding, encoded), text);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     try
@@ -32,6 +32,7 @@
 #include <Crypto.h>
 #include <Exception.h>
 
+#include <random>
 #include <regex>
 
 using namespace libcomp;
@@ -284,6 +285,58 @@ TEST(Hash, MD5)
     EXPECT_EQ(hash, Crypto::MD5(data));
 }
 
+TEST(Blowfish, InterleavedMatchesLibrary)
+{
+    std::mt19937 rng(1234);
+
+    bool interleaved = Crypto::Blowfish::IsInterleaved();
+
+    for(size_t blockCount = 0; blockCount <= 19; ++blockCount)
+    {
+        std::vector<char> key(16);
+        std::vector<char> data(blockCount * BLOWFISH_BLOCK_SIZE);
+
+        for(auto& c : key)
+        {
+            c = (char)rng();
+        }
+
+        for(auto& c : data)
+        {
+            c = (char)rng();
+        }
+
+        Crypto::Blowfish bf;
+        bf.SetKey(key);
+
+        // Encrypt with the crypto library.
+        Crypto::Blowfish::SetInterleaved(false);
+
+        std::vector<char> library = data;
+        bf.Encrypt(library);
+
+        // Encrypt with the interleaved kernel.
+        Crypto::Blowfish::SetInterleaved(true);
+
+        std::vector<char> kernel = data;
+        bf.Encrypt(kernel);
+
+        EXPECT_EQ(kernel, library);
+
+        // Decrypt with the other implementation each way.
+        bf.Decrypt(library);
+
+        Crypto::Blowfish::SetInterleaved(false);
+
+        bf.Decrypt(kernel);
+
+        EXPECT_EQ(library, data);
+        EXPECT_EQ(kernel, data);
+    }
+
+    Crypto::Blowfish::SetInterleaved(interleaved);
+}
+
 int main(int argc, char *argv[])
 {
     try
@@ -28,17 +28,315 @@
 #include <gtest/gtest.h>
 #include <PopIgnore.h>
 
+// libcomp Includes
+#include <Account.h>
+#include <DatabaseBind.h>
 #include <DatabaseSQLite3.h>
 
+// Standard C++11 Includes
+#include <cstdio>
+#include <vector>
+
 using namespace libcomp;
 
+class SQLiteAccount : public objects::Account
+{
+public:
+    SQLiteAccount()
+    {
+    }
+
+    static void RegisterPersistentType()
+    {
+        RegisterType(typeid(SQLiteAccount),
+            SQLiteAccount::GetMetadata(), []()
+        {
+            return (PersistentObject*)new SQLiteAccount();
+        });
+    }
+};
+
+std::shared_ptr<objects::DatabaseConfigSQLite3> GetConfig()
+{
+    auto config = std::shared_ptr<objects::DatabaseConfigSQLite3>(
+        new objects::DatabaseConfigSQLite3);
+    config->SetDatabaseName("comp_hack_test");
+    config->SetFileDirectory(".");
+
+    // Start each test with an empty database.
+    std::remove("./comp_hack_test.sqlite3");
+
+    return config;
+}
+
 TEST(SQLite3, OpenCloseDatabase)
 {
-    DatabaseSQLite3 db;
+    DatabaseSQLite3 db(GetConfig());
 
-    ASSERT_TRUE(db.Open(":memory:"));
+    ASSERT_TRUE(db.Open());
     ASSERT_TRUE(db.IsOpen());
     ASSERT_TRUE(db.Close());
+    ASSERT_FALSE(db.IsOpen());
+}
+
+TEST(SQLite3, StatementCache)
+{
+    auto config = GetConfig();
+    SQLiteAccount::RegisterPersistentType();
+
+    auto db = std::make_shared<DatabaseSQLite3>(config);
+
+    EXPECT_TRUE(db->Open());
+    EXPECT_TRUE(db->Setup());
+
+    auto before = db->GetStatementCacheStats();
+
+    std::list<std::shared_ptr<PersistentObject>> accounts;
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        auto account = std::make_shared<SQLiteAccount>();
+        account->Register(account);
+        account->SetCP(i);
+
+        std::shared_ptr<PersistentObject> obj = account;
+        EXPECT_TRUE(db->InsertSingleObject(obj));
+
+        accounts.push_back(obj);
+    }
+
+    for(auto obj : accounts)
+    {
+        auto account = std::dynamic_pointer_cast<SQLiteAccount>(obj);
+        account->SetCP(account->GetCP() + 100);
+
+        EXPECT_TRUE(db->UpdateSingleObject(obj));
+    }
+
+    // Each insert and update after the first reuses the statement.
+    auto after = db->GetStatementCacheStats();
+
+    EXPECT_EQ(after.misses - before.misses, 2u);
+    EXPECT_EQ(after.hits - before.hits, 4u);
+    EXPECT_EQ(after.evictions - before.evictions, 0u);
+    EXPECT_EQ(after.size, 2u);
+
+    for(auto obj : accounts)
+    {
+        DatabaseBindUUID bind("UID", obj->GetUUID());
+
+        auto loaded = std::dynamic_pointer_cast<SQLiteAccount>(
+            db->LoadSingleObject(typeid(SQLiteAccount).hash_code(), &bind));
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetCP(), std::dynamic_pointer_cast<
+            SQLiteAccount>(obj)->GetCP());
+    }
+
+    // Changing the schema drops the cached statements.
+    db->ClearStatementCache();
+
+    EXPECT_EQ(db->GetStatementCacheStats().size, 0u);
+
+    // Closing keeps the counters but not the statements.
+    before = db->GetStatementCacheStats();
+
+    EXPECT_TRUE(db->Close());
+    EXPECT_FALSE(db->IsOpen());
+
+    after = db->GetStatementCacheStats();
+
+    EXPECT_EQ(after.hits, before.hits);
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(after.size, 0u);
+
+    std::remove("./comp_hack_test.sqlite3");
+}
+
+TEST(SQLite3, StatementCacheEviction)
+{
+    auto config = GetConfig();
+    config->SetStatementCacheSize(1);
+    SQLiteAccount::RegisterPersistentType();
+
+    DatabaseSQLite3 db(config);
+
+    EXPECT_TRUE(db.Open());
+    EXPECT_TRUE(db.Setup());
+
+    auto before = db.GetStatementCacheStats();
+
+    // With room for one statement the insert and update push each other
+    // out of the cache.
+    for(uint32_t i = 0; i < 2; i++)
+    {
+        auto account = std::make_shared<SQLiteAccount>();
+        account->Register(account);
+        account->SetCP(i);
+
+        std::shared_ptr<PersistentObject> obj = account;
+        EXPECT_TRUE(db.InsertSingleObject(obj));
+
+        account->SetCP(i + 100);
+        EXPECT_TRUE(db.UpdateSingleObject(obj));
+    }
+
+    auto after = db.GetStatementCacheStats();
+
+    EXPECT_EQ(after.misses - before.misses, 4u);
+    EXPECT_EQ(after.hits - before.hits, 0u);
+    EXPECT_EQ(after.evictions - before.evictions, 3u);
+    EXPECT_EQ(after.size, 1u);
+
+    EXPECT_TRUE(db.Close());
+
+    std::remove("./comp_hack_test.sqlite3");
+}
+
+TEST(SQLite3, StatementCacheSession)
+{
+    DatabaseSQLite3 db(GetConfig());
+
+    ASSERT_TRUE(db.Open());
+
+    auto cache = std::make_shared<DatabaseStatementCache>(4);
+
+    auto prepare = [&]()
+    {
+        return db.Prepare("SELECT 1;");
+    };
+
+    {
+        auto query = cache->Prepare("one", prepare);
+
+        EXPECT_TRUE(query.IsValid());
+        EXPECT_TRUE(query.Execute());
+    }
+
+    EXPECT_EQ(cache->GetStats().misses, 1u);
+    EXPECT_EQ(cache->GetStats().size, 1u);
+
+    // The same session keeps the statements.
+    cache->SetSession(0);
+
+    {
+        auto query = cache->Prepare("one", prepare);
+
+        EXPECT_TRUE(query.IsValid());
+        EXPECT_TRUE(query.Execute());
+    }
+
+    EXPECT_EQ(cache->GetStats().hits, 1u);
+    EXPECT_EQ(cache->GetStats().size, 1u);
+
+    // A new session drops them.
+    cache->SetSession(1);
+
+    EXPECT_EQ(cache->GetStats().size, 0u);
+
+    {
+        auto query = cache->Prepare("one", prepare);
+
+        EXPECT_TRUE(query.IsValid());
+
+        // A statement in use when the session changes is not kept.
+        cache->SetSession(2);
+    }
+
+    EXPECT_EQ(cache->GetStats().misses, 2u);
+    EXPECT_EQ(cache->GetStats().size, 0u);
+
+    // The statements have to be finalized before the connection closes.
+    cache.reset();
+
+    EXPECT_TRUE(db.Close());
+
+    std::remove("./comp_hack_test.sqlite3");
+}
+
+TEST(SQLite3, BatchedChangeSet)
+{
+    auto config = GetConfig();
+    config->SetChangeSetBatchSize(2);
+    SQLiteAccount::RegisterPersistentType();
+
+    DatabaseSQLite3 db(config);
+
+    EXPECT_TRUE(db.Open());
+    EXPECT_TRUE(db.Setup());
+
+    std::vector<std::shared_ptr<SQLiteAccount>> accounts;
+
+    auto changeset = libcomp::DatabaseChangeSet::Create();
+
+    // Five inserts with a batch size of 2 makes three statements.
+    for(uint32_t i = 0; i < 5; i++)
+    {
+        auto account = std::make_shared<SQLiteAccount>();
+        account->Register(account);
+        account->SetUsername(libcomp::String("batch%1").Arg(i));
+        account->SetEmail(libcomp::String("batch%1@test").Arg(i));
+        account->SetCP(i);
+
+        changeset->Insert(account);
+        accounts.push_back(account);
+    }
+
+    EXPECT_TRUE(db.ProcessChangeSet(changeset));
+
+    for(size_t i = 0; i < accounts.size(); i++)
+    {
+        DatabaseBindUUID bind("UID", accounts[i]->GetUUID());
+
+        auto loaded = std::dynamic_pointer_cast<SQLiteAccount>(
+            db.LoadSingleObject(typeid(SQLiteAccount).hash_code(), &bind));
+
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetCP(), i);
+        EXPECT_EQ(loaded->GetEmail(), accounts[i]->GetEmail());
+    }
+
+    changeset = libcomp::DatabaseChangeSet::Create();
+
+    // Each account in a batch gets its own value and accounts with
+    // different fields changed are updated separately.
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        accounts[i]->SetCP(accounts[i]->GetCP() + 100);
+
+        if(i == 2)
+        {
+            accounts[i]->SetTicketCount(7);
+        }
+
+        changeset->Update(accounts[i]);
+    }
+
+    changeset->Delete(accounts[3]);
+
+    EXPECT_TRUE(db.ProcessChangeSet(changeset));
+
+    for(size_t i = 0; i < accounts.size(); i++)
+    {
+        DatabaseBindUUID bind("UID", accounts[i]->GetUUID());
+
+        auto loaded = std::dynamic_pointer_cast<SQLiteAccount>(
+            db.LoadSingleObject(typeid(SQLiteAccount).hash_code(), &bind));
+
+        if(i == 3)
+        {
+            EXPECT_EQ(loaded, nullptr);
+            continue;
+        }
+
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetCP(), i < 3 ? (i + 100) : i);
+        EXPECT_EQ(loaded->GetTicketCount(), i == 2 ? 7 : 0);
+        EXPECT_EQ(loaded->GetUsername(), accounts[i]->GetUsername());
+    }
+
+    EXPECT_TRUE(db.Close());
+
+    std::remove("./comp_hack_test.sqlite3");
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,154 @@
+/**
+ * @file libcomp/tests/DiffieHellmanPool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Test the pool of Diffie-Hellman key pairs.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2014-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <Constants.h>
+#include <Crypto.h>
+#include <DiffieHellmanPool.h>
+#include <TcpServer.h>
+
+// Standard C++11 Includes
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+
+using namespace libcomp;
+
+static const String PRIME = "9C4169BBE8F535F7A7404D4EB3AE22CF63C0450FC2C7B2A5"
+    "A03794D4CFA9F290FF5774267885E60B848280E3A07468366E62F040DAC3CB67E95E8F"
+    "3DC4D97F94AD1D3D98F0B066F72B65CB391643A95BB96CF048ED5D60FB7AF7A969F38A"
+    "BD2301F6A7EC4DB7DAFC2CFD1F417E0B634033FEE8B102D62A28EC03D95266E2B0B3";
+
+TEST(DiffieHellmanPool, Take)
+{
+    ASSERT_EQ(PRIME.Length(), DH_KEY_HEX_SIZE);
+
+    auto pool = DiffieHellmanPool::Create(PRIME, 4, 2);
+
+    // Wait for the pool to fill.
+    for(int i = 0; i < 500 && 4 > pool->GetStats().depth; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_EQ(pool->GetStats().depth, 4u);
+
+    // Each key pair is handed out once with the public key generated.
+    std::list<String> publics;
+
+    for(int i = 0; i < 6; ++i)
+    {
+        auto dh = TcpServer::LoadDiffieHellman(PRIME);
+        ASSERT_NE(dh, nullptr);
+        ASSERT_EQ(dh->GetPublic().Length(), DH_KEY_HEX_SIZE);
+        ASSERT_EQ(dh->GetPrime(), PRIME);
+
+        for(auto& other : publics)
+        {
+            ASSERT_NE(other, dh->GetPublic());
+        }
+
+        publics.push_back(dh->GetPublic());
+    }
+
+    auto stats = pool->GetStats();
+    EXPECT_EQ(stats.hits + stats.misses, 6u);
+    EXPECT_GE(stats.hits, 4u);
+
+    // Other primes do not use the pool.
+    EXPECT_EQ(DiffieHellmanPool::GetPool("1234"), nullptr);
+
+    pool.reset();
+
+    EXPECT_EQ(DiffieHellmanPool::GetPool(PRIME), nullptr);
+    EXPECT_TRUE(TcpServer::LoadDiffieHellman(PRIME)->GetPublic().IsEmpty());
+}
+
+TEST(DiffieHellmanPool, QueueSecret)
+{
+    auto pool = DiffieHellmanPool::Create(PRIME, 1);
+
+    auto dhServer = pool->Take();
+    ASSERT_NE(dhServer, nullptr);
+
+    Crypto::DiffieHellman dhClient(PRIME);
+    String clientPublic = dhClient.GeneratePublic();
+    std::vector<char> clientData = dhClient.GenerateSecret(
+        dhServer->GetPublic());
+    ASSERT_EQ(clientData.size(), BF_NET_KEY_BYTE_SIZE);
+
+    std::mutex lock;
+    std::condition_variable condition;
+    std::vector<char> serverData;
+    bool done = false;
+
+    pool->QueueSecret(dhServer, clientPublic,
+        [&](const std::vector<char>& sharedData)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            serverData = sharedData;
+            done = true;
+
+            condition.notify_one();
+        });
+
+    {
+        std::unique_lock<std::mutex> uniqueLock(lock);
+
+        ASSERT_TRUE(condition.wait_for(uniqueLock, std::chrono::seconds(10),
+            [&]() { return done; }));
+    }
+
+    ASSERT_EQ(serverData, clientData);
+
+    pool->RecordHandshake(100);
+    pool->RecordHandshake(300);
+
+    auto stats = pool->GetStats();
+    EXPECT_EQ(stats.secrets, 1u);
+    EXPECT_EQ(stats.handshakes, 2u);
+    EXPECT_EQ(stats.handshakeMicroseconds, 400u);
+    EXPECT_EQ(stats.maxHandshakeMicroseconds, 300u);
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
@@ -29,6 +29,8 @@
 #include <PopIgnore.h>
 
 #include <TestObject.h>
+#include <TestObjectA.h>
+#include <TestObjectB.h>
 
 using namespace libcomp;
 using namespace objects;
@@ -370,6 +372,59 @@ TEST(Object, TestObject)
     EXPECT_EQ(TestObject::EnumYN_t::YES, data.GetEnumYN());
 }
 
+TEST(Object, CanSave)
+{
+    TestObjectA data;
+
+    std::stringstream stream(std::stringstream::out |
+        std::stringstream::binary);
+
+    EXPECT_TRUE(data.CanSave());
+    EXPECT_TRUE(data.Save(stream));
+
+    // A missing reference can't be saved.
+    EXPECT_TRUE(data.SetObjectB(nullptr));
+    EXPECT_FALSE(data.CanSave());
+    EXPECT_FALSE(data.Save(stream));
+
+    // Including one in a list.
+    EXPECT_TRUE(data.SetObjectB(std::make_shared<TestObjectB>()));
+    EXPECT_TRUE(data.AppendObjectBList(std::make_shared<TestObjectB>()));
+    EXPECT_TRUE(data.CanSave());
+    EXPECT_TRUE(data.AppendObjectBList(nullptr));
+    EXPECT_FALSE(data.CanSave());
+    EXPECT_FALSE(data.Save(stream));
+
+    // Flat saves skip the references.
+    EXPECT_TRUE(data.Save(stream, true));
+
+    // A fixed size string has to fit in its buffer. Loading one that fills
+    // the whole buffer leaves no room for the null terminator.
+    TestObject fixed;
+
+    std::stringstream fixedStream(std::stringstream::out |
+        std::stringstream::binary);
+
+    EXPECT_TRUE(fixed.CanSave());
+    ASSERT_TRUE(fixed.Save(fixedStream));
+
+    auto encoded = Convert::ToEncoding(Convert::ENCODING_CP932,
+        fixed.GetStringCP932(), false);
+    std::string bytes = fixedStream.str();
+    size_t offset = bytes.find(std::string(encoded.begin(), encoded.end()));
+
+    ASSERT_NE(offset, std::string::npos);
+    bytes.replace(offset, 16, 16, 'A');
+
+    std::stringstream fullStream(bytes, std::stringstream::in |
+        std::stringstream::binary);
+
+    EXPECT_TRUE(fixed.Load(fullStream));
+    EXPECT_EQ(fixed.GetStringCP932(), String(16, 'A'));
+    EXPECT_FALSE(fixed.CanSave());
+    EXPECT_FALSE(fixed.Save(stream));
+}
+
 int main(int argc, char *argv[])
 {
     try
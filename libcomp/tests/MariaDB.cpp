@@ -30,8 +30,13 @@
 
 // libcomp Includes
 #include <Account.h>
+#include <DatabaseBind.h>
 #include <DatabaseMariaDB.h>
 
+// Standard C++11 Includes
+#include <atomic>
+#include <thread>
+
 using namespace libcomp;
 
 class MariaDBAccount : public objects::Account
@@ -359,6 +364,290 @@ TEST(MariaDB, ChangeSet)
     EXPECT_FALSE(db.IsOpen());
 }
 
+TEST(MariaDB, BatchedChangeSet)
+{
+    auto config = GetConfig();
+    config->SetChangeSetBatchSize(2);
+    MariaDBAccount::RegisterPersistentType();
+
+    DatabaseMariaDB db(config);
+
+    EXPECT_TRUE(db.Open());
+    EXPECT_TRUE(db.Setup());
+
+    std::vector<std::shared_ptr<MariaDBAccount>> accounts;
+
+    auto changeset = libcomp::DatabaseChangeSet::Create();
+
+    // Five inserts with a batch size of 2 makes three statements.
+    for(uint32_t i = 0; i < 5; i++)
+    {
+        auto account = std::make_shared<MariaDBAccount>();
+        account->Register(account);
+        account->SetUsername(libcomp::String("batch%1").Arg(i));
+        account->SetEmail(libcomp::String("batch%1@test").Arg(i));
+        account->SetCP(i);
+
+        changeset->Insert(account);
+        accounts.push_back(account);
+    }
+
+    EXPECT_TRUE(db.ProcessChangeSet(changeset));
+
+    changeset = libcomp::DatabaseChangeSet::Create();
+
+    // Accounts with different fields changed are updated separately.
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        accounts[i]->SetCP(accounts[i]->GetCP() + 100);
+
+        if(i == 2)
+        {
+            accounts[i]->SetTicketCount(7);
+        }
+
+        changeset->Update(accounts[i]);
+    }
+
+    changeset->Delete(accounts[3]);
+
+    EXPECT_TRUE(db.ProcessChangeSet(changeset));
+
+    for(size_t i = 0; i < accounts.size(); i++)
+    {
+        DatabaseBindUUID bind("UID", accounts[i]->GetUUID());
+
+        auto loaded = std::dynamic_pointer_cast<MariaDBAccount>(
+            db.LoadSingleObject(typeid(MariaDBAccount).hash_code(), &bind));
+
+        if(i == 3)
+        {
+            EXPECT_EQ(loaded, nullptr);
+            continue;
+        }
+
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetCP(), i < 3 ? (i + 100) : i);
+        EXPECT_EQ(loaded->GetTicketCount(), i == 2 ? 7 : 0);
+        EXPECT_EQ(loaded->GetUsername(), accounts[i]->GetUsername());
+    }
+
+    EXPECT_TRUE(db.Execute("DROP DATABASE IF EXISTS comp_hack_test;"));
+
+    EXPECT_TRUE(db.Close());
+    EXPECT_FALSE(db.IsOpen());
+}
+
+TEST(MariaDB, StatementCache)
+{
+    auto config = GetConfig();
+    MariaDBAccount::RegisterPersistentType();
+
+    auto db = std::make_shared<DatabaseMariaDB>(config);
+
+    EXPECT_TRUE(db->Open());
+    EXPECT_TRUE(db->Setup());
+
+    auto before = db->GetStatementCacheStats();
+
+    std::list<std::shared_ptr<PersistentObject>> accounts;
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        auto account = std::make_shared<MariaDBAccount>();
+        account->Register(account);
+        account->SetCP(i);
+
+        std::shared_ptr<PersistentObject> obj = account;
+        EXPECT_TRUE(db->InsertSingleObject(obj));
+
+        accounts.push_back(obj);
+    }
+
+    for(auto obj : accounts)
+    {
+        auto account = std::dynamic_pointer_cast<MariaDBAccount>(obj);
+        account->SetCP(account->GetCP() + 100);
+
+        EXPECT_TRUE(db->UpdateSingleObject(obj));
+    }
+
+    // Each insert and update after the first reuses the statement.
+    auto after = db->GetStatementCacheStats();
+
+    EXPECT_EQ(after.misses - before.misses, 2u);
+    EXPECT_EQ(after.hits - before.hits, 4u);
+    EXPECT_EQ(after.size, 2u);
+
+    for(auto obj : accounts)
+    {
+        DatabaseBindUUID bind("UID", obj->GetUUID());
+
+        auto loaded = std::dynamic_pointer_cast<MariaDBAccount>(
+            db->LoadSingleObject(typeid(MariaDBAccount).hash_code(), &bind));
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetCP(), std::dynamic_pointer_cast<
+            MariaDBAccount>(obj)->GetCP());
+    }
+
+    // Changing the schema drops the cached statements.
+    db->ClearStatementCache();
+
+    EXPECT_EQ(db->GetStatementCacheStats().size, 0u);
+
+    EXPECT_TRUE(db->Execute("DROP DATABASE IF EXISTS comp_hack_test;"));
+
+    EXPECT_TRUE(db->Close());
+    EXPECT_FALSE(db->IsOpen());
+}
+
+TEST(MariaDB, WriteBehind)
+{
+    auto config = GetConfig();
+    config->SetWriteBehindFlushInterval(10);
+    MariaDBAccount::RegisterPersistentType();
+
+    DatabaseMariaDB db(config);
+
+    EXPECT_TRUE(db.Open());
+    EXPECT_TRUE(db.Setup());
+
+    auto account = std::make_shared<MariaDBAccount>();
+    account->Register(account);
+    account->SetCP(0);
+
+    std::shared_ptr<PersistentObject> obj = account;
+    EXPECT_TRUE(db.InsertSingleObject(obj));
+
+    EXPECT_TRUE(db.StartWriteBehind());
+    EXPECT_FALSE(db.StartWriteBehind());
+
+    // Repeated updates to the same object are written once.
+    for(uint32_t i = 1; i <= 50; i++)
+    {
+        account->SetCP(i);
+        db.QueueUpdate(account);
+    }
+
+    db.StopWriteBehind();
+
+    auto stats = db.GetWriteBehindStats();
+
+    EXPECT_EQ(stats.queueDepth, 0u);
+    EXPECT_EQ(stats.queued, 50u);
+    EXPECT_GE(stats.flushes, 1u);
+    EXPECT_EQ(stats.failures, 0u);
+    EXPECT_GE(stats.totalFlushLatency, stats.maxFlushLatency);
+
+    DatabaseBindUUID bind("UID", account->GetUUID());
+
+    auto loaded = std::dynamic_pointer_cast<MariaDBAccount>(
+        db.LoadSingleObject(typeid(MariaDBAccount).hash_code(), &bind));
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(loaded->GetCP(), 50u);
+
+    EXPECT_TRUE(db.Execute("DROP DATABASE IF EXISTS comp_hack_test;"));
+
+    EXPECT_TRUE(db.Close());
+    EXPECT_FALSE(db.IsOpen());
+}
+
+TEST(MariaDB, ConnectionPool)
+{
+    auto config = GetConfig();
+    config->SetMaxConnections(2);
+
+    DatabaseMariaDB db(config);
+
+    EXPECT_TRUE(db.Open());
+    EXPECT_TRUE(db.Setup());
+
+    // More threads than connections have to share the pool.
+    std::atomic<uint32_t> executed(0);
+    std::list<std::thread> threads;
+
+    for(int i = 0; i < 8; i++)
+    {
+        threads.push_back(std::thread([&]()
+        {
+            for(int j = 0; j < 25; j++)
+            {
+                if(db.Execute("SELECT 1;"))
+                {
+                    executed++;
+                }
+            }
+        }));
+    }
+
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(executed.load(), 200u);
+
+    auto stats = db.GetConnectionPoolStats();
+
+    EXPECT_LE(stats.open, 2u);
+    EXPECT_EQ(stats.inUse, 0u);
+    EXPECT_EQ(stats.timeouts, 0u);
+    EXPECT_GT(stats.fastCheckouts, 0u);
+
+    // Queued work still runs when the database is closed.
+    std::atomic<uint32_t> completed(0);
+
+    for(int i = 0; i < 10; i++)
+    {
+        EXPECT_TRUE(db.ExecuteAsync("SELECT 1;", [&](bool result)
+        {
+            if(result)
+            {
+                completed++;
+            }
+        }));
+    }
+
+    EXPECT_TRUE(db.Execute("DROP DATABASE IF EXISTS comp_hack_test;"));
+
+    EXPECT_TRUE(db.Close());
+    EXPECT_FALSE(db.IsOpen());
+
+    EXPECT_EQ(completed.load(), 10u);
+    EXPECT_EQ(db.GetConnectionPoolStats().asyncCompleted, 10u);
+    EXPECT_FALSE(db.SubmitAsync([](){}));
+
+    // Work submitted while the database closes either runs or is refused.
+    EXPECT_TRUE(db.Open());
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint32_t> accepted(0);
+    std::atomic<uint32_t> ran(0);
+
+    std::thread submitter([&]()
+    {
+        while(!stop)
+        {
+            if(db.SubmitAsync([&]() { ran++; }))
+            {
+                accepted++;
+            }
+        }
+    });
+
+    while(0 == accepted.load())
+    {
+        std::this_thread::yield();
+    }
+
+    EXPECT_TRUE(db.Close());
+
+    stop = true;
+    submitter.join();
+
+    EXPECT_EQ(ran.load(), accepted.load());
+}
+
 int main(int argc, char *argv[])
 {
     try
@@ -0,0 +1,153 @@
+/**
+ * @file libcomp/tests/MessageQueue.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the message queue classes.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <MessageQueue.h>
+
+// Standard C++11 Includes
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace libcomp;
+
+template<class Q>
+class MessageQueueTest : public ::testing::Test
+{
+};
+
+typedef ::testing::Types<LockingMessageQueue<int>,
+    LockFreeMessageQueue<int>> MessageQueueTypes;
+
+TYPED_TEST_CASE(MessageQueueTest, MessageQueueTypes);
+
+TYPED_TEST(MessageQueueTest, Order)
+{
+    TypeParam queue;
+
+    std::list<int> items = { 3, 4, 5 };
+
+    queue.Enqueue(1);
+    queue.Enqueue(2);
+    queue.Enqueue(items);
+
+    EXPECT_TRUE(items.empty());
+    EXPECT_EQ(queue.Dequeue(), 1);
+
+    std::list<int> messages;
+    queue.DequeueAll(messages);
+
+    EXPECT_EQ(messages, std::list<int>({ 2, 3, 4, 5 }));
+
+    messages.clear();
+    queue.DequeueAny(messages);
+
+    EXPECT_TRUE(messages.empty());
+}
+
+TYPED_TEST(MessageQueueTest, Wakeup)
+{
+    TypeParam queue;
+
+    std::thread producer([&queue]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        queue.Enqueue(7);
+    });
+
+    std::list<int> messages;
+    queue.DequeueAll(messages);
+
+    producer.join();
+
+    EXPECT_EQ(messages, std::list<int>({ 7 }));
+}
+
+TYPED_TEST(MessageQueueTest, MultipleProducers)
+{
+    const int PRODUCER_COUNT = 4;
+    const int MESSAGE_COUNT = 100000;
+
+    TypeParam queue;
+
+    std::vector<std::thread> producers;
+
+    for(int p = 0; p < PRODUCER_COUNT; ++p)
+    {
+        producers.emplace_back([&queue, p]()
+        {
+            for(int i = 0; i < MESSAGE_COUNT; ++i)
+            {
+                queue.Enqueue(p * MESSAGE_COUNT + i);
+            }
+        });
+    }
+
+    // Each producer's messages must come out in the order they were added.
+    std::vector<int> next(PRODUCER_COUNT, 0);
+    int received = 0;
+
+    while(received < PRODUCER_COUNT * MESSAGE_COUNT)
+    {
+        std::list<int> messages;
+        queue.DequeueAll(messages);
+
+        for(int value : messages)
+        {
+            int p = value / MESSAGE_COUNT;
+
+            ASSERT_EQ(value % MESSAGE_COUNT, next[(size_t)p]);
+            next[(size_t)p]++;
+        }
+
+        received += (int)messages.size();
+    }
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    EXPECT_EQ(received, PRODUCER_COUNT * MESSAGE_COUNT);
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
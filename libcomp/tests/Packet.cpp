@@ -29,6 +29,8 @@
 #include <PopIgnore.h>
 
 #include <Packet.h>
+#include <PacketBufferPool.h>
+#include <PacketException.h>
 
 using namespace libcomp;
 
@@ -74,6 +76,121 @@ TEST(Packet, MoveAssignment)
     EXPECT_EQ(String(&a.ReadArray(1)[0], 1), "z");
 }
 
+TEST(Packet, GrowBuffer)
+{
+    Packet p;
+    p.WriteU32Little(0x12345678);
+
+    // Small packets should not use a full size buffer.
+    EXPECT_EQ(p.Capacity(), PACKET_BUFFER_SMALL_SIZE);
+
+    // Grow the packet through each size class.
+    std::vector<char> data(PACKET_BUFFER_MEDIUM_SIZE, 'x');
+    p.WriteArray(data);
+
+    EXPECT_EQ(p.Capacity(), MAX_PACKET_SIZE);
+    EXPECT_EQ(p.Size(), PACKET_BUFFER_MEDIUM_SIZE + 4);
+
+    // Existing data must survive the move into the bigger buffer.
+    p.Rewind();
+
+    EXPECT_EQ(p.ReadU32Little(), 0x12345678);
+    EXPECT_EQ(p.ReadArray(PACKET_BUFFER_MEDIUM_SIZE), data);
+
+    // A copy only needs a buffer big enough for the data.
+    Packet small;
+    small.WriteArray("abc", 3);
+
+    Packet copy(small);
+
+    EXPECT_EQ(copy.Capacity(), PACKET_BUFFER_SMALL_SIZE);
+
+    // Growing past the max size must still fail.
+    p.End();
+
+    EXPECT_THROW(p.WriteBlank(MAX_PACKET_SIZE), PacketException);
+}
+
+TEST(Packet, BufferPoolReuse)
+{
+    auto before = PacketBufferPool::GetStats(
+        PacketBufferPool::SIZE_CLASS_MEDIUM);
+
+    // Allocate and free the same size class many times.
+    for(int i = 0; i < 1000; ++i)
+    {
+        Packet p;
+        p.WriteBlank(PACKET_BUFFER_MEDIUM_SIZE);
+    }
+
+    auto after = PacketBufferPool::GetStats(
+        PacketBufferPool::SIZE_CLASS_MEDIUM);
+
+    EXPECT_EQ(after.allocations - before.allocations, 1000);
+    EXPECT_LE(after.heapAllocations - before.heapAllocations, 1);
+    EXPECT_EQ(after.inUse, before.inUse);
+}
+
+TEST(Packet, CompressRoundTrip)
+{
+    std::vector<char> data;
+
+    for(int i = 0; i < 4096; ++i)
+    {
+        data.push_back((char)('a' + (i % 7)));
+    }
+
+    // Run it a few times so the reused zlib streams are tested too.
+    for(int level = -1; level <= 9; ++level)
+    {
+        Packet p;
+        p.WriteU32Little(0x12345678);
+        p.WriteArray(data);
+        p.Seek(4);
+
+        int32_t sz = p.Compress((int32_t)data.size(), level);
+
+        ASSERT_LT(0, sz);
+
+        if(0 == level)
+        {
+            // Stored blocks are bigger than the data so nothing changes.
+            EXPECT_EQ(p.Size(), data.size() + 4);
+
+            continue;
+        }
+
+        ASSERT_GT((int32_t)data.size(), sz);
+        EXPECT_EQ(p.Size(), (uint32_t)sz + 4);
+        EXPECT_EQ(p.Tell(), 4u);
+
+        EXPECT_EQ(p.Decompress(sz), (int32_t)data.size());
+        EXPECT_EQ(p.Size(), data.size() + 4);
+
+        // The data before the cursor must survive both buffer swaps.
+        p.Rewind();
+
+        EXPECT_EQ(p.ReadU32Little(), 0x12345678);
+        EXPECT_EQ(p.ReadArray((uint32_t)data.size()), data);
+    }
+
+    // Bad data must fail without breaking the stream for the next call.
+    Packet bad;
+    bad.WriteArray(data);
+    bad.Rewind();
+
+    EXPECT_GT(0, bad.Decompress(64));
+
+    Packet good;
+    good.WriteArray(data);
+    good.Rewind();
+
+    int32_t sz = good.Compress((int32_t)data.size());
+
+    ASSERT_LT(0, sz);
+    EXPECT_EQ(good.Decompress(sz), (int32_t)data.size());
+}
+
 int main(int argc, char *argv[])
 {
     try
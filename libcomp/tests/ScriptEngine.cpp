@@ -33,6 +33,7 @@
 #include <Log.h>
 #include <Packet.h>
 #include <ScriptEngine.h>
+#include <ScriptEnginePool.h>
 #include <TestObject.h>
 #include <TestObjectA.h>
 #include <TestObjectB.h>
@@ -117,6 +118,278 @@ TEST(ScriptEngine, EvalPrint)
     Log::GetSingletonPtr()->ClearHooks();
 }
 
+TEST(ScriptEngine, BytecodeCache)
+{
+    ScriptEngine::ClearBytecodeCache();
+
+    String source = "function TestFunction(a)\n"
+        "{\n"
+            "return a * 3;\n"
+        "}\n";
+
+    {
+        ScriptEngine engine;
+
+        EXPECT_TRUE(engine.Eval(source, "triple.nut"));
+        EXPECT_EQ(ScriptEngine::GetBytecodeCacheSize(), 1u);
+    }
+
+    // A new VM loads the cached bytecode.
+    ScriptEngine engine;
+
+    EXPECT_TRUE(engine.Eval(source, "triple.nut"));
+    EXPECT_EQ(ScriptEngine::GetBytecodeCacheSize(), 1u);
+
+    auto ret = Sqrat::RootTable(engine.GetVM()).GetFunction("TestFunction"
+        ).Evaluate<SQInteger>(5);
+
+    ASSERT_TRUE(ret);
+    EXPECT_EQ(*ret, 15);
+
+    // The name is part of the key.
+    EXPECT_TRUE(engine.Eval(source, "other.nut"));
+    EXPECT_EQ(ScriptEngine::GetBytecodeCacheSize(), 2u);
+
+    // Scripts that fail to compile are not cached.
+    EXPECT_FALSE(engine.Eval("1=2"));
+    EXPECT_EQ(ScriptEngine::GetBytecodeCacheSize(), 2u);
+
+    ScriptEngine::ClearBytecodeCache();
+
+    EXPECT_EQ(ScriptEngine::GetBytecodeCacheSize(), 0u);
+}
+
+TEST(ScriptEngine, EnginePool)
+{
+    auto pool = std::make_shared<ScriptEnginePool>([](ScriptEngine& engine)
+    {
+        engine.Using<objects::TestObject>();
+    }, 1);
+
+    pool->Warm(1);
+
+    auto stats = pool->GetStats();
+    EXPECT_EQ(stats.vmCount, 1u);
+    EXPECT_EQ(stats.idleCount, 1u);
+
+    HSQUIRRELVM vm;
+
+    {
+        auto engine = pool->Acquire();
+        vm = engine->GetVM();
+
+        EXPECT_EQ(pool->GetStats().idleCount, 0u);
+
+        EXPECT_TRUE(engine->Eval(
+            "Leaked <- TestObject();\n"
+            "function TestFunction() { return 1; }\n"
+            ));
+        EXPECT_FALSE(Sqrat::RootTable(vm).GetSlot("Leaked").IsNull());
+
+        engine->Using<objects::TestObjectA>();
+    }
+
+    // The engine is back in the pool without anything the script added.
+    stats = pool->GetStats();
+    EXPECT_EQ(stats.vmCount, 1u);
+    EXPECT_EQ(stats.idleCount, 1u);
+
+    {
+        auto engine = pool->Acquire();
+
+        EXPECT_EQ(engine->GetVM(), vm);
+        EXPECT_TRUE(Sqrat::RootTable(vm).GetSlot("Leaked").IsNull());
+        EXPECT_TRUE(Sqrat::RootTable(vm).GetSlot("TestFunction").IsNull());
+        EXPECT_TRUE(Sqrat::RootTable(vm).GetSlot("TestObjectA").IsNull());
+
+        // The setup bindings are still there and others can be bound again.
+        engine->Using<objects::TestObjectA>();
+
+        EXPECT_TRUE(engine->Eval(
+            "local t = TestObject();\n"
+            "local a = TestObjectA();\n"
+            ));
+
+        // A second engine is created as the pool is empty (and only one
+        // of them is kept).
+        auto other = pool->Acquire();
+
+        EXPECT_NE(other->GetVM(), vm);
+        EXPECT_EQ(pool->GetStats().vmCount, 2u);
+    }
+
+    stats = pool->GetStats();
+    EXPECT_EQ(stats.vmCount, 1u);
+    EXPECT_EQ(stats.idleCount, 1u);
+    EXPECT_EQ(stats.acquired, 3u);
+    EXPECT_EQ(stats.created, 1u);
+
+    // Threads share the root table of one engine.
+    {
+        auto threadA = pool->AcquireThread();
+        auto threadB = pool->AcquireThread();
+
+        EXPECT_TRUE(threadA->IsThread());
+        EXPECT_NE(threadA->GetVM(), threadB->GetVM());
+        EXPECT_EQ(pool->GetStats().threadCount, 2u);
+
+        EXPECT_TRUE(threadA->Eval("Shared <- TestObject();"));
+        EXPECT_TRUE(threadB->Eval(
+            "Shared.SetUnsigned8(7);\n"
+            "if(Shared.GetUnsigned8() != 7) throw \"bad value\";\n"
+            ));
+    }
+
+    EXPECT_EQ(pool->GetStats().threadCount, 0u);
+}
+
+TEST(ScriptEngine, Profiler)
+{
+    ScriptEngine::ClearProfile();
+
+    ScriptEngine engine;
+    engine.SetProfiling(true);
+
+    EXPECT_TRUE(engine.Eval(
+        "function Square(a) { return a * a; }\n"
+        "local total = 0;\n"
+        "for(local i = 0; i < 10; i++) { total += Square(i); }\n",
+        "square.nut"));
+
+    auto profile = ScriptEngine::GetProfile();
+
+    bool found = false;
+
+    for(auto& entry : profile)
+    {
+        if(0 == entry.first.find("Square (square.nut:"))
+        {
+            EXPECT_EQ(entry.second.calls, 10u);
+            EXPECT_GE(entry.second.microseconds,
+                entry.second.maxMicroseconds);
+
+            found = true;
+        }
+    }
+
+    EXPECT_TRUE(found);
+
+    // Calls made with the profiler disabled are not counted.
+    engine.SetProfiling(false);
+
+    EXPECT_TRUE(engine.Eval("Square(2);"));
+
+    for(auto& entry : ScriptEngine::GetProfile())
+    {
+        EXPECT_EQ(entry.second.calls, profile[entry.first].calls);
+    }
+
+    ScriptEngine::ClearProfile();
+
+    EXPECT_TRUE(ScriptEngine::GetProfile().empty());
+}
+
+TEST(ScriptEngine, CallBudget)
+{
+    int errorCount = 0;
+
+    Log::GetSingletonPtr()->AddLogHook(
+        [](LogComponent_t comp, Log::Level_t level, const String& msg,
+            void *pUserData)
+        {
+            (void)comp;
+            (void)msg;
+
+            if(Log::LOG_LEVEL_ERROR == level)
+            {
+                (*reinterpret_cast<int*>(pUserData))++;
+            }
+        }, &errorCount);
+
+    String source = "function Spin(count)\n"
+        "{\n"
+            "local i = 0;\n"
+            "while(count < 0 || i < count) { i++; }\n"
+            "return i;\n"
+        "}\n";
+
+    {
+        ScriptEngine engine;
+        engine.SetCallBudget(1000, 0);
+
+        EXPECT_TRUE(engine.Eval(source, "spin.nut"));
+
+        // Calls under the budget are fine.
+        EXPECT_TRUE(engine.Call([&]()
+        {
+            auto ret = Sqrat::RootTable(engine.GetVM()).GetFunction("Spin"
+                ).Evaluate<SQInteger>(10);
+
+            ASSERT_TRUE(ret);
+            EXPECT_EQ(*ret, 10);
+        }));
+        EXPECT_FALSE(engine.IsAborted());
+        EXPECT_EQ(errorCount, 0);
+
+        // An endless loop is aborted instead of hanging.
+        EXPECT_FALSE(engine.Eval("Spin(-1);"));
+        EXPECT_TRUE(engine.IsAborted());
+        EXPECT_NE(errorCount, 0);
+
+        // The engine can't be used again.
+        EXPECT_FALSE(engine.Eval("Spin(1);"));
+    }
+
+    {
+        ScriptEngine engine;
+        engine.SetCallBudget(0, 10000);
+
+        EXPECT_TRUE(engine.Eval(source, "spin.nut"));
+
+        EXPECT_FALSE(engine.Call([&]()
+        {
+            Sqrat::RootTable(engine.GetVM()).GetFunction("Spin"
+                ).Evaluate<SQInteger>(-1);
+        }));
+        EXPECT_TRUE(engine.IsAborted());
+    }
+
+    {
+        ScriptEngine engine;
+        engine.SetCallBudget(1000, 0);
+
+        EXPECT_TRUE(engine.Eval(source, "spin.nut"));
+
+        // Nothing would catch the abort outside of Eval or Call so the
+        // call is allowed to finish.
+        int errorsBefore = errorCount;
+
+        auto ret = Sqrat::RootTable(engine.GetVM()).GetFunction("Spin"
+            ).Evaluate<SQInteger>(5000);
+
+        ASSERT_TRUE(ret);
+        EXPECT_EQ(*ret, 5000);
+        EXPECT_FALSE(engine.IsAborted());
+        EXPECT_EQ(errorCount, errorsBefore);
+    }
+
+    // Aborted engines are not returned to a pool.
+    auto pool = std::make_shared<ScriptEnginePool>(nullptr, 1);
+
+    {
+        auto engine = pool->Acquire();
+        engine->SetCallBudget(1000, 0);
+
+        EXPECT_TRUE(engine->Eval(source, "spin.nut"));
+        EXPECT_FALSE(engine->Eval("Spin(-1);"));
+    }
+
+    EXPECT_EQ(pool->GetStats().vmCount, 0u);
+    EXPECT_EQ(pool->GetStats().idleCount, 0u);
+
+    Log::GetSingletonPtr()->ClearHooks();
+}
+
 TEST(ScriptEngine, ReadOnlyPacket)
 {
     String scriptMessages;
@@ -30,6 +30,9 @@
 
 #include <CString.h>
 
+// Standard C++11 Includes
+#include <limits>
+
 using namespace libcomp;
 
 TEST(String, Length)
@@ -267,6 +270,54 @@ TEST(String, ArgInt)
 {
     EXPECT_EQ("123", String("%1").Arg(123));
     EXPECT_EQ("0x00ff", String("0x%1").Arg(255, 4, 16, '0'));
+    EXPECT_EQ("-42", String("%1").Arg((int16_t)-42));
+    EXPECT_EQ("  -7", String("%1").Arg((int64_t)-7, 4));
+    EXPECT_EQ("ffff", String("%1").Arg((int16_t)-1, 0, 16));
+    EXPECT_EQ("ffffffff", String("%1").Arg((int32_t)-1, 0, 16));
+    EXPECT_EQ("777", String("%1").Arg((uint32_t)511, 0, 8));
+    EXPECT_EQ("-9223372036854775808", String("%1").Arg(
+        std::numeric_limits<int64_t>::min()));
+    EXPECT_EQ("18446744073709551615", String("%1").Arg(
+        std::numeric_limits<uint64_t>::max()));
+}
+
+TEST(String, Format)
+{
+    EXPECT_EQ("Arguments: a1, b2, c3", String::Format(
+        "Arguments: %2, %1, %3", "b2", "a1", "c3"));
+    EXPECT_EQ("a 5 a -1", String::Format("%1 %2 %1 %3", "a", 5, -1));
+    EXPECT_EQ("0x00ff", String::Format("0x%1", String("%1").Arg(
+        255, 4, 16, '0')));
+    EXPECT_EQ("none", String::Format("none"));
+
+    // Extra arguments are shifted down like they would be by Arg.
+    EXPECT_EQ("a %1", String::Format("%1 %3", "a", "b"));
+
+    // Values are not scanned for arguments.
+    EXPECT_EQ("%2 b", String::Format("%1 %2", "%2", "b"));
+
+    // The length is kept for multi-byte characters.
+    String s = String::Format("%1は%2", "今日", "月曜日");
+    EXPECT_EQ("今日は月曜日", s);
+    EXPECT_EQ(6u, s.Length());
+
+    bool reporting = String::IsReportingBadArguments();
+    String::SetBadArgumentReporting(false);
+    EXPECT_EQ("Argument 1 is missing: b",
+        String::Format("Argument 1 is missing: %2", "a", "b"));
+    String::SetBadArgumentReporting(reporting);
+}
+
+TEST(String, FormatMatchesArg)
+{
+    String format = "SELECT * FROM `%1` WHERE `%2` = %3 AND `%4` = '%5';";
+
+    for(int i : { -1, 0, 42, 1000000 })
+    {
+        EXPECT_EQ(format.Arg("character").Arg("uid").Arg(i).Arg(
+            "name").Arg("test"), String::Format(format, "character", "uid",
+            i, "name", "test"));
+    }
 }
 
 TEST(String, ToUpperLower)
@@ -364,6 +415,91 @@ TEST(String, At)
     EXPECT_EQ(s.At(0), 0x40);
 }
 
+TEST(String, CodePointIterator)
+{
+    String s = "@aµϢ←侩🂡🃵";
+
+    std::vector<String::CodePoint> codePoints;
+
+    for(auto it = s.CodePointBegin(); it != s.CodePointEnd(); ++it)
+    {
+        codePoints.push_back(*it);
+    }
+
+    EXPECT_EQ(codePoints, (std::vector<String::CodePoint>{ 0x40, 0x61,
+        0xB5, 0x3E2, 0x2190, 0x4FA9, 0x1F0A1, 0x1F0F5 }));
+
+    String empty;
+
+    EXPECT_TRUE(empty.CodePointBegin() == empty.CodePointEnd());
+
+    // Stray continuation bytes belong to the previous character.
+    String bad("\x80" "a\xBF" "b");
+
+    codePoints.clear();
+
+    for(auto it = bad.CodePointBegin(); it != bad.CodePointEnd(); ++it)
+    {
+        codePoints.push_back(*it);
+    }
+
+    EXPECT_EQ(codePoints.size(), bad.Length());
+    EXPECT_EQ(bad.At(1), 'b');
+
+    // Long ASCII strings index directly.
+    String ascii(1000, 'x');
+    ascii += "y";
+
+    EXPECT_EQ(ascii.At(1000), 'y');
+}
+
+TEST(String, Utf8Checks)
+{
+    EXPECT_TRUE(String().IsAscii());
+    EXPECT_TRUE(String("plain ASCII text that is over 16 bytes").IsAscii());
+    EXPECT_FALSE(String("plain ASCII text that is over 16 bytes é").IsAscii());
+    EXPECT_FALSE(String("\xCA\xD7").IsAscii());
+
+    EXPECT_TRUE(String("@aµϢ←侩🂡🃵").IsValidUtf8());
+    EXPECT_TRUE(String("plain ASCII text that is over 16 bytes").IsValidUtf8());
+    EXPECT_FALSE(String("\xCA\xD7").IsValidUtf8());
+    EXPECT_FALSE(String("\xC0\x80").IsValidUtf8());
+    EXPECT_FALSE(String("\xED\xA0\x80").IsValidUtf8());
+    EXPECT_FALSE(String("\xF4\x90\x80\x80").IsValidUtf8());
+    EXPECT_FALSE(String("a string that is long enough to be scanned\xE6").
+        IsValidUtf8());
+
+    // The length counts characters in long strings.
+    String s;
+
+    for(int i = 0; i < 100; ++i)
+    {
+        s += "aé侩🂡";
+    }
+
+    EXPECT_EQ(s.Length(), 400u);
+    EXPECT_EQ(String(s.ToUtf8()).Length(), 400u);
+}
+
+TEST(String, AppendCodePoint)
+{
+    String s;
+    s.Reserve(16);
+
+    s.AppendCodePoint(0x40).AppendCodePoint(0xB5).AppendCodePoint(
+        0x4FA9).AppendCodePoint(0x1F0F5);
+
+    EXPECT_EQ(s, "@µ侩🃵");
+    EXPECT_EQ(s.Length(), 4u);
+
+    // Shared data is not changed.
+    String copy = s;
+    copy.AppendCodePoint('!');
+
+    EXPECT_EQ(s, "@µ侩🃵");
+    EXPECT_EQ(copy, "@µ侩🃵!");
+}
+
 TEST(String, Replace)
 {
     String s = String("今日は月曜日です。初めまして。僕はオメガです。").Replace("は", "wa");
@@ -0,0 +1,245 @@
+/**
+ * @file libcomp/tests/TimerManager.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the TimerManager class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <TimerManager.h>
+
+// Standard C++11 Includes
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace libcomp;
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+/**
+ * Wait for a condition to be true or give up after a few seconds.
+ */
+template<typename Function>
+static bool WaitFor(Function f)
+{
+    auto timeout = std::chrono::steady_clock::now() +
+        std::chrono::seconds(5);
+
+    while(!f())
+    {
+        if(std::chrono::steady_clock::now() > timeout)
+        {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    return true;
+}
+
+TEST(TimerManager, Order)
+{
+    TimerManager timers;
+
+    std::mutex lock;
+    std::vector<int> order;
+    std::atomic<int> early(0);
+
+    // Leave time to add every event before the first one is due. Events
+    // that are already due run in the order they were added.
+    auto start = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(100);
+
+    // Add the events out of order. Some are far enough out to be
+    // cascaded down from the upper levels of the wheel.
+    for(int i = 0; i < 100; ++i)
+    {
+        int delay = (i * 37) % 100;
+        auto time = start + std::chrono::milliseconds(delay * 7);
+
+        timers.ScheduleEvent(time, [&lock, &order, &early](int d,
+            TimePoint t)
+        {
+            if(std::chrono::steady_clock::now() < t)
+            {
+                early++;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            order.push_back(d);
+        }, delay, time);
+    }
+
+    EXPECT_TRUE(WaitFor([&timers]()
+    {
+        return 0 == timers.GetEventCount();
+    }));
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    ASSERT_EQ(order.size(), 100u);
+    EXPECT_EQ(early, 0);
+
+    for(int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(order[(size_t)i], i);
+    }
+}
+
+TEST(TimerManager, Cancel)
+{
+    TimerManager timers;
+
+    std::atomic<int> count(0);
+    std::vector<TimerEvent*> events;
+
+    // Far enough out to be in the upper levels of the wheel.
+    auto time = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        events.push_back(timers.ScheduleEvent(time +
+            std::chrono::milliseconds(i), [&count]()
+        {
+            count++;
+        }));
+    }
+
+    for(size_t i = 0; i < events.size(); i += 2)
+    {
+        timers.CancelEvent(events[i]);
+    }
+
+    EXPECT_EQ(timers.GetEventCount(), 500u);
+
+    // Cancelling an event twice does nothing.
+    timers.CancelEvent(events[0]);
+
+    EXPECT_EQ(timers.GetEventCount(), 500u);
+
+    for(size_t i = 1; i < events.size(); i += 2)
+    {
+        timers.CancelEvent(events[i]);
+    }
+
+    EXPECT_EQ(timers.GetEventCount(), 0u);
+    EXPECT_EQ(count, 0);
+}
+
+TEST(TimerManager, Periodic)
+{
+    TimerManager timers;
+
+    std::atomic<int> count(0);
+
+    auto pEvent = timers.SchedulePeriodicEvent(
+        std::chrono::milliseconds(10), [&count]()
+    {
+        count++;
+    });
+
+    EXPECT_TRUE(WaitFor([&count]()
+    {
+        return 5 <= count;
+    }));
+
+    timers.CancelEvent(pEvent);
+
+    int cancelled = count;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // The event may have been running when it was cancelled.
+    EXPECT_LE(count, cancelled + 1);
+    EXPECT_EQ(timers.GetEventCount(), 0u);
+}
+
+TEST(TimerManager, MessageQueue)
+{
+    TimerManager timers;
+
+    auto queue = std::make_shared<MessageQueue<Message::Message*>>();
+    timers.SetMessageQueue(queue);
+
+    std::atomic<int> oneShot(0);
+    std::atomic<int> periodic(0);
+
+    timers.ScheduleEvent(std::chrono::steady_clock::now(), [&oneShot]()
+    {
+        oneShot++;
+    });
+
+    auto pEvent = timers.SchedulePeriodicEvent(
+        std::chrono::milliseconds(10), [&periodic]()
+    {
+        periodic++;
+    });
+
+    // Nothing runs until the messages are taken from the queue.
+    int received = 0;
+
+    while(4 > received)
+    {
+        std::list<Message::Message*> msgs;
+        queue->DequeueAll(msgs);
+
+        EXPECT_EQ(oneShot + periodic, received);
+
+        for(auto pMessage : msgs)
+        {
+            auto pExecute = dynamic_cast<Message::Execute*>(pMessage);
+
+            ASSERT_NE(pExecute, nullptr);
+
+            pExecute->Run();
+            received++;
+
+            delete pMessage;
+        }
+    }
+
+    timers.CancelEvent(pEvent);
+
+    EXPECT_EQ(oneShot, 1);
+    EXPECT_GE(periodic, 3);
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
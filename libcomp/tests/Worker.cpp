@@ -0,0 +1,235 @@
+/**
+ * @file libcomp/tests/Worker.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the Worker class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <Manager.h>
+#include <MessageShutdown.h>
+#include <Worker.h>
+
+// Standard C++11 Includes
+#include <array>
+
+using namespace libcomp;
+
+/**
+ * Message with a type chosen by the test.
+ */
+class TestMessage : public Message::Message
+{
+public:
+    explicit TestMessage(libcomp::Message::MessageType type) : mType(type)
+    {
+    }
+
+    libcomp::Message::MessageType GetType() const override
+    {
+        return mType;
+    }
+
+    String Dump() const override
+    {
+        return "Message: Test";
+    }
+
+private:
+    libcomp::Message::MessageType mType;
+};
+
+/**
+ * Manager that counts the messages it is given.
+ */
+class TestManager : public Manager
+{
+public:
+    TestManager(const std::list<Message::MessageType>& types,
+        bool result) : mTypes(types), mResult(result), mCount(0)
+    {
+    }
+
+    std::list<Message::MessageType> GetSupportedTypes() const override
+    {
+        return mTypes;
+    }
+
+    bool ProcessMessage(const Message::Message *pMessage) override
+    {
+        (void)pMessage;
+
+        mCount++;
+
+        return mResult;
+    }
+
+    std::list<Message::MessageType> mTypes;
+    bool mResult;
+    int mCount;
+};
+
+TEST(Worker, Dispatch)
+{
+    auto client = std::make_shared<TestManager>(
+        std::list<Message::MessageType>{
+            Message::MessageType::MESSAGE_TYPE_CLIENT }, true);
+    auto both = std::make_shared<TestManager>(
+        std::list<Message::MessageType>{
+            Message::MessageType::MESSAGE_TYPE_CLIENT,
+            Message::MessageType::MESSAGE_TYPE_CONNECTION }, false);
+
+    Worker worker;
+    worker.AddManager(client);
+    worker.AddManager(both);
+
+    auto queue = worker.GetMessageQueue();
+    int executed = 0;
+
+    queue->Enqueue(new TestMessage(Message::MessageType::MESSAGE_TYPE_CLIENT));
+    queue->Enqueue(new TestMessage(
+        Message::MessageType::MESSAGE_TYPE_CONNECTION));
+    queue->Enqueue(new TestMessage(Message::MessageType::MESSAGE_TYPE_PACKET));
+    worker.ExecuteInWorker([&executed]()
+    {
+        executed++;
+    });
+    queue->Enqueue(new Message::Shutdown);
+
+    // Anything after the shutdown is not handled.
+    queue->Enqueue(new TestMessage(Message::MessageType::MESSAGE_TYPE_CLIENT));
+
+    worker.Start("worker", true);
+
+    EXPECT_EQ(client->mCount, 1);
+    EXPECT_EQ(both->mCount, 2);
+    EXPECT_EQ(executed, 1);
+
+    // Managers can be changed when the worker is stopped.
+    worker.RemoveAllManagers();
+    worker.AddManager(client);
+
+    queue->Enqueue(new TestMessage(
+        Message::MessageType::MESSAGE_TYPE_CONNECTION));
+    queue->Enqueue(new TestMessage(Message::MessageType::MESSAGE_TYPE_CLIENT));
+    queue->Enqueue(new Message::Shutdown);
+
+    worker.Start("worker", true);
+
+    EXPECT_EQ(client->mCount, 2);
+    EXPECT_EQ(both->mCount, 2);
+}
+
+TEST(Worker, ExecuteClosure)
+{
+    auto tracker = std::make_shared<int>(0);
+    int result = 0;
+
+    // Small enough to be stored inside the message.
+    auto pSmall = new Message::ExecuteClosure([&result](
+        const std::shared_ptr<int>& value, int add)
+    {
+        result += *value + add;
+    }, tracker, 3);
+
+    // Too big to be stored inside the message.
+    std::array<int, 64> big;
+    big.fill(1);
+
+    auto pBig = new Message::ExecuteClosure([&result, big]()
+    {
+        for(int value : big)
+        {
+            result += value;
+        }
+    });
+
+    EXPECT_EQ(tracker.use_count(), 2);
+
+    // A message can run more than once (like a periodic timer event).
+    pSmall->Run();
+    pSmall->Run();
+    pBig->Run();
+
+    EXPECT_EQ(result, 70);
+
+    delete pSmall;
+    delete pBig;
+
+    EXPECT_EQ(tracker.use_count(), 1);
+}
+
+/**
+ * Run @em messageCount messages of the given execute message type on a
+ * worker and check each one ran.
+ */
+template<typename Execute_t>
+static void RunExecute(int messageCount)
+{
+    Worker worker;
+
+    auto queue = worker.GetMessageQueue();
+    auto value = std::make_shared<int>(0);
+
+    for(int i = 0; i < messageCount; ++i)
+    {
+        queue->Enqueue(new Execute_t([](const std::shared_ptr<int>& v,
+            int add)
+        {
+            *v += add;
+        }, value, 1));
+    }
+
+    queue->Enqueue(new Message::Shutdown);
+
+    worker.Start("worker", true);
+
+    EXPECT_EQ(*value, messageCount);
+    EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(Worker, ExecuteMessages)
+{
+    // Enough messages to refill and drain the closure block cache.
+    const int MESSAGE_COUNT = 1000;
+
+    RunExecute<Message::ExecuteClosure>(MESSAGE_COUNT);
+    RunExecute<Message::ExecuteImpl<
+        const std::shared_ptr<int>&, int>>(MESSAGE_COUNT);
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
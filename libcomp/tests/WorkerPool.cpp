@@ -0,0 +1,385 @@
+/**
+ * @file libcomp/tests/WorkerPool.cpp
+ * @ingroup libcomp
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Tests of the WorkerPool class.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <PushIgnore.h>
+#include <gtest/gtest.h>
+#include <PopIgnore.h>
+
+#include <Manager.h>
+#include <MessageConnectionClosed.h>
+#include <MessagePong.h>
+#include <Worker.h>
+#include <WorkerPool.h>
+
+// Standard C++11 Includes
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace libcomp;
+
+static const int MAILBOX_COUNT = 16;
+static const int MESSAGE_COUNT = 1000;
+static const int PRODUCER_COUNT = 8;
+
+/**
+ * Message that records which mailbox it was sent to.
+ */
+class TestMessage : public Message::Message
+{
+public:
+    TestMessage(int mailbox, int sequence, int workTime,
+        int producer = 0) : mMailbox(mailbox), mProducer(producer),
+        mSequence(sequence), mWorkTime(workTime)
+    {
+    }
+
+    libcomp::Message::MessageType GetType() const override
+    {
+        return libcomp::Message::MessageType::MESSAGE_TYPE_CLIENT;
+    }
+
+    String Dump() const override
+    {
+        return "Message: Test";
+    }
+
+    int mMailbox;
+    int mProducer;
+    int mSequence;
+    int mWorkTime;
+};
+
+/**
+ * Manager that checks the messages of each mailbox are handled one at a
+ * time and in the order each producer sent them.
+ */
+class TestManager : public Manager
+{
+public:
+    TestManager() : mHandled(0), mClosed(0), mPongs(0), mErrors(0)
+    {
+        for(int i = 0; i < MAILBOX_COUNT; ++i)
+        {
+            mRunning[i] = 0;
+
+            for(int p = 0; p < PRODUCER_COUNT; ++p)
+            {
+                mNextSequence[i][p] = 0;
+            }
+        }
+    }
+
+    std::list<Message::MessageType> GetSupportedTypes() const override
+    {
+        return { Message::MessageType::MESSAGE_TYPE_CLIENT,
+            Message::MessageType::MESSAGE_TYPE_CONNECTION };
+    }
+
+    bool ProcessMessage(const Message::Message *pMessage) override
+    {
+        auto pTest = dynamic_cast<const TestMessage*>(pMessage);
+
+        if(nullptr == pTest)
+        {
+            if(nullptr != dynamic_cast<const Message::Pong*>(pMessage))
+            {
+                mPongs++;
+            }
+            else
+            {
+                mClosed++;
+            }
+
+            return true;
+        }
+
+        int& nextSequence = mNextSequence[pTest->mMailbox][
+            pTest->mProducer];
+
+        if(0 != mRunning[pTest->mMailbox]++ ||
+            nextSequence != pTest->mSequence)
+        {
+            mErrors++;
+        }
+
+        nextSequence = pTest->mSequence + 1;
+
+        auto end = std::chrono::steady_clock::now() +
+            std::chrono::microseconds(pTest->mWorkTime);
+
+        while(std::chrono::steady_clock::now() < end)
+        {
+        }
+
+        mRunning[pTest->mMailbox]--;
+        mHandled++;
+
+        return true;
+    }
+
+    std::atomic<int> mRunning[MAILBOX_COUNT];
+    int mNextSequence[MAILBOX_COUNT][PRODUCER_COUNT];
+    std::atomic<int> mHandled;
+    std::atomic<int> mClosed;
+    std::atomic<int> mPongs;
+    std::atomic<int> mErrors;
+};
+
+TEST(WorkerPool, OrderAndSteal)
+{
+    auto pool = std::make_shared<WorkerPool>();
+    auto manager = std::make_shared<TestManager>();
+
+    std::vector<std::shared_ptr<Worker>> workers;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        auto worker = std::make_shared<Worker>();
+        worker->AddManager(manager);
+        pool->AddWorker(worker);
+        workers.push_back(worker);
+    }
+
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->Start(String("worker%1").Arg(i));
+    }
+
+    // Put every mailbox on the first worker so the others have to steal.
+    std::vector<std::shared_ptr<WorkerMailbox>> mailboxes;
+
+    for(int i = 0; i < MAILBOX_COUNT; ++i)
+    {
+        mailboxes.push_back(pool->CreateMailbox(workers.front()));
+    }
+
+    std::vector<std::thread> producers;
+
+    for(int p = 0; p < 4; ++p)
+    {
+        producers.emplace_back([&mailboxes, p]()
+        {
+            for(int i = 0; i < MESSAGE_COUNT; ++i)
+            {
+                for(int m = p; m < MAILBOX_COUNT; m += 4)
+                {
+                    // The first mailbox is a lot busier than the rest.
+                    mailboxes[(size_t)m]->Enqueue(new TestMessage(m, i,
+                        0 == m ? 50 : 0));
+                }
+            }
+        });
+    }
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    for(auto& mailbox : mailboxes)
+    {
+        // A pong is a connection message that is not a ConnectionMessage.
+        mailbox->Enqueue(new Message::Pong);
+        mailbox->Enqueue(new Message::ConnectionClosed(nullptr));
+    }
+
+    auto timeout = std::chrono::steady_clock::now() +
+        std::chrono::seconds(30);
+
+    while((MAILBOX_COUNT * MESSAGE_COUNT > manager->mHandled ||
+        MAILBOX_COUNT > manager->mClosed) &&
+        std::chrono::steady_clock::now() < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    EXPECT_EQ(manager->mHandled, MAILBOX_COUNT * MESSAGE_COUNT);
+    EXPECT_EQ(manager->mClosed, MAILBOX_COUNT);
+    EXPECT_EQ(manager->mPongs, MAILBOX_COUNT);
+    EXPECT_EQ(manager->mErrors, 0);
+    EXPECT_GT(pool->GetStealCount(), 0u);
+    EXPECT_EQ(pool->GetQueueDepth(), 0u);
+
+    for(auto& stats : pool->GetStats())
+    {
+        EXPECT_EQ(stats.mailboxes, 0u);
+        EXPECT_EQ(stats.queueDepth, 0u);
+    }
+
+    // The pool lets go of a mailbox once its connection is closed.
+    std::weak_ptr<WorkerMailbox> mailbox = mailboxes.front();
+    mailboxes.clear();
+
+    EXPECT_TRUE(mailbox.expired());
+
+    for(auto& worker : workers)
+    {
+        worker->Shutdown();
+    }
+
+    for(auto& worker : workers)
+    {
+        worker->Join();
+    }
+}
+
+TEST(WorkerPool, ConcurrentProducers)
+{
+    auto pool = std::make_shared<WorkerPool>();
+    auto manager = std::make_shared<TestManager>();
+
+    std::vector<std::shared_ptr<Worker>> workers;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        auto worker = std::make_shared<Worker>();
+        worker->AddManager(manager);
+        pool->AddWorker(worker);
+        workers.push_back(worker);
+    }
+
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->Start(String("worker%1").Arg(i));
+    }
+
+    // A few mailboxes with many producers each keeps the workers draining
+    // a mailbox while other producers are still adding to it.
+    static const int BUSY_MAILBOX_COUNT = 2;
+
+    std::vector<std::shared_ptr<WorkerMailbox>> mailboxes;
+
+    for(int i = 0; i < BUSY_MAILBOX_COUNT; ++i)
+    {
+        mailboxes.push_back(pool->CreateMailbox(nullptr));
+    }
+
+    // A message handled before it was counted shows up as a negative
+    // pending count.
+    std::atomic<bool> producing(true);
+    std::atomic<int> negativeCounts(0);
+
+    std::thread monitor([&]()
+    {
+        while(producing)
+        {
+            for(auto& mailbox : mailboxes)
+            {
+                if(0 > mailbox->GetPendingCount())
+                {
+                    negativeCounts++;
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> producers;
+
+    for(int p = 0; p < PRODUCER_COUNT; ++p)
+    {
+        producers.emplace_back([&mailboxes, p]()
+        {
+            for(int i = 0; i < MESSAGE_COUNT * 10; ++i)
+            {
+                for(int m = 0; m < BUSY_MAILBOX_COUNT; ++m)
+                {
+                    mailboxes[(size_t)m]->Enqueue(new TestMessage(m, i, 0,
+                        p));
+                }
+
+                if(0 == i % 64)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    int total = BUSY_MAILBOX_COUNT * PRODUCER_COUNT * MESSAGE_COUNT * 10;
+
+    auto timeout = std::chrono::steady_clock::now() +
+        std::chrono::seconds(30);
+
+    while(total > manager->mHandled &&
+        std::chrono::steady_clock::now() < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    producing = false;
+    monitor.join();
+
+    EXPECT_EQ(manager->mHandled, total);
+    EXPECT_EQ(manager->mErrors, 0);
+    EXPECT_EQ(negativeCounts, 0);
+
+    // Every message was counted exactly once.
+    for(auto& mailbox : mailboxes)
+    {
+        EXPECT_EQ(mailbox->GetPendingCount(), 0);
+
+        mailbox->Enqueue(new Message::ConnectionClosed(nullptr));
+    }
+
+    while(BUSY_MAILBOX_COUNT > manager->mClosed &&
+        std::chrono::steady_clock::now() < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    EXPECT_EQ(manager->mClosed, BUSY_MAILBOX_COUNT);
+
+    for(auto& worker : workers)
+    {
+        worker->Shutdown();
+    }
+
+    for(auto& worker : workers)
+    {
+        worker->Join();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+
+        return RUN_ALL_TESTS();
+    }
+    catch(...)
+    {
+        return EXIT_FAILURE;
+    }
+}
@@ -96,6 +96,9 @@ std::string GeneratorHeader::GenerateClass(const MetaObject& obj)
         << std::endl;
     ss << std::endl;
 
+    ss << Tab() << "virtual bool CanSave() const;" << std::endl;
+    ss << std::endl;
+
     ss << Tab() << "virtual bool Load(libcomp::ObjectInStream& stream);"
         << std::endl << std::endl;
     ss << Tab() << "virtual bool Save(libcomp::ObjectOutStream& stream) const;"
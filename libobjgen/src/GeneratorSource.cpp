@@ -230,6 +230,35 @@ std::string GeneratorSource::Generate(const MetaObject& obj)
     ss << "}" << std::endl;
     ss << std::endl;
 
+    // CanSave
+    ss << "bool " << obj.GetName() << "::CanSave() const" << std::endl;
+    ss << "{" << std::endl;
+    ss << Tab() << "bool status = " + GetBaseBooleanReturnValue(obj, "CanSave()") + ";" << std::endl;
+
+    for(auto it = obj.VariablesBegin(); it != obj.VariablesEnd(); ++it)
+    {
+        auto var = *it;
+
+        if(var->IsInherited()) continue;
+
+        std::string condition = var->GetCanSaveCondition(*this,
+            GetMemberName(var));
+
+        if(!condition.empty())
+        {
+            ss << std::endl;
+            ss << Tab() << "if(status && !(" << condition << "))" << std::endl;
+            ss << Tab() << "{" << std::endl;
+            ss << Tab(2) << "status = false;" << std::endl;
+            ss << Tab() << "}" << std::endl;
+        }
+    }
+
+    ss << std::endl;
+    ss << Tab() << "return status;" << std::endl;
+    ss << "}" << std::endl;
+    ss << std::endl;
+
     // Load (binary)
     ss << "bool " << obj.GetName()
         << "::Load(libcomp::ObjectInStream& stream)" << std::endl;
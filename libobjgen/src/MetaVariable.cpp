@@ -569,6 +569,15 @@ std::string MetaVariable::GetDatabaseLoadCode(const Generator& generator,
         replacements);
 }
 
+std::string MetaVariable::GetCanSaveCondition(const Generator& generator,
+    const std::string& name) const
+{
+    (void)generator;
+    (void)name;
+
+    return std::string();
+}
+
 std::string MetaVariable::GetInternalGetterCode(const Generator& generator,
     const std::string& name) const
 {
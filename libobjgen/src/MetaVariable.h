@@ -124,6 +124,8 @@ public:
     virtual std::string GetConstructValue() const = 0;
     virtual std::string GetValidCondition(const Generator& generator,
         const std::string& name, bool recursive = false) const = 0;
+    virtual std::string GetCanSaveCondition(const Generator& generator,
+        const std::string& name) const;
     virtual std::string GetLoadCode(const Generator& generator,
         const std::string& name, const std::string& stream) const = 0;
     virtual std::string GetSaveCode(const Generator& generator,
@@ -255,6 +255,29 @@ std::string MetaVariableArray::GetValidCondition(const Generator& generator,
     return code;
 }
 
+std::string MetaVariableArray::GetCanSaveCondition(const Generator& generator,
+    const std::string& name) const
+{
+    std::string code;
+
+    if(mElementType)
+    {
+        code = mElementType->GetCanSaveCondition(generator, "value");
+
+        if(!code.empty())
+        {
+            std::map<std::string, std::string> replacements;
+            replacements["@VAR_NAME@"] = name;
+            replacements["@VAR_VALID_CODE@"] = code;
+
+            code = generator.ParseTemplate(0, "VariableArrayValidCondition",
+                replacements);
+        }
+    }
+
+    return code;
+}
+
 std::string MetaVariableArray::GetLoadCode(const Generator& generator,
     const std::string& name, const std::string& stream) const
 {
@@ -183,6 +183,35 @@ std::string MetaVariableMap::GetValidCondition(const Generator& generator,
     return code;
 }
 
+std::string MetaVariableMap::GetCanSaveCondition(const Generator& generator,
+    const std::string& name) const
+{
+    std::string code;
+
+    if(mKeyElementType && mValueElementType)
+    {
+        std::string keyCode = mKeyElementType->GetCanSaveCondition(
+            generator, "value");
+        std::string valueCode = mValueElementType->GetCanSaveCondition(
+            generator, "value");
+
+        if(!keyCode.empty() || !valueCode.empty())
+        {
+            std::map<std::string, std::string> replacements;
+            replacements["@VAR_NAME@"] = name;
+            replacements["@VAR_KEY_VALID_CODE@"] = !keyCode.empty()
+                ? keyCode : "true";
+            replacements["@VAR_VALUE_VALID_CODE@"] = !valueCode.empty()
+                ? valueCode : "true";
+
+            code = generator.ParseTemplate(0, "VariableMapValidCondition",
+                replacements);
+        }
+    }
+
+    return code;
+}
+
 std::string MetaVariableMap::GetLoadCode(const Generator& generator,
     const std::string& name, const std::string& stream) const
 {
@@ -428,6 +428,24 @@ std::string MetaVariableReference::GetValidCondition(const Generator& generator,
     }
 }
 
+std::string MetaVariableReference::GetCanSaveCondition(
+    const Generator& generator, const std::string& name) const
+{
+    (void)generator;
+
+    // Only references saved with the object itself can fail to save.
+    if(!IsIndirect() && !mPersistentReference)
+    {
+        std::stringstream ss;
+        ss << "nullptr != " << name << " && " << name << "->CanSave()";
+        return ss.str();
+    }
+    else
+    {
+        return "";
+    }
+}
+
 std::string MetaVariableReference::GetLoadCode(const Generator& generator,
     const std::string& name, const std::string& stream) const
 {
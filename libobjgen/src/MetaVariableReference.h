@@ -92,6 +92,8 @@ public:
         const std::string& parentRef, size_t tabLevel) const;
     virtual std::string GetValidCondition(const Generator& generator,
         const std::string& name, bool recursive = false) const;
+    virtual std::string GetCanSaveCondition(const Generator& generator,
+        const std::string& name) const;
     virtual std::string GetDatabaseLoadCode(const Generator& generator,
         const std::string& name, size_t tabLevel = 1) const;
     virtual std::string GetLoadCode(const Generator& generator,
@@ -65,6 +65,8 @@ public:
     virtual std::string GetConstructValue() const;
     virtual std::string GetValidCondition(const Generator& generator,
         const std::string& name, bool recursive = false) const;
+    virtual std::string GetCanSaveCondition(const Generator& generator,
+        const std::string& name) const;
     virtual std::string GetLoadCode(const Generator& generator,
         const std::string& name, const std::string& stream) const;
     virtual std::string GetSaveCode(const Generator& generator,
@@ -515,6 +515,31 @@ std::string MetaVariableString::GetValidCondition(const Generator& generator,
     return ss.str();
 }
 
+std::string MetaVariableString::GetCanSaveCondition(
+    const Generator& generator, const std::string& name) const
+{
+    (void)generator;
+
+    std::stringstream ss;
+
+    // A fixed size string has to fit in its buffer (including the null
+    // terminator added when it is converted to another encoding).
+    if(0 != mSize)
+    {
+        if(Encoding_t::ENCODING_UTF8 != mEncoding)
+        {
+            ss << mSize << " > libcomp::Convert::SizeEncoded("
+                << EncodingToComp(mEncoding) << ", " << name << ")";
+        }
+        else
+        {
+            ss << mSize << " >= " << name << ".Size()";
+        }
+    }
+
+    return ss.str();
+}
+
 std::string MetaVariableString::GetLoadCode(const Generator& generator,
     const std::string& name, const std::string& stream) const
 {
@@ -117,6 +117,9 @@ IF(USE_COTIRE)
     INCLUDE(cotire)
 ENDIF(USE_COTIRE)
 
+# Use the lock-free message queue for the worker and log threads.
+OPTION(USE_LOCKFREE_MESSAGE_QUEUE "Use the lock-free message queue." OFF)
+
 # Option to disable build warnings/errors.
 OPTION(NO_WARNINGS "Disable the compiler warnings and errors." OFF)
 
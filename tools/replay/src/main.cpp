@@ -0,0 +1,817 @@
+/**
+ * @file tools/replay/src/main.cpp
+ * @ingroup tools
+ *
+ * @author COMP Omega <compomega@tutanota.com>
+ *
+ * @brief Utility to replay captured client traffic against a server.
+ *
+ * This file is part of the COMP_hack Library (libcomp).
+ *
+ * Copyright (C) 2012-2020 COMP_hack Team <compomega@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// libcomp Includes
+#include <ArgumentParser.h>
+#include <CaptureReader.h>
+#include <ChannelConnection.h>
+#include <Constants.h>
+#include <LobbyConnection.h>
+#include <Log.h>
+#include <MessageConnectionClosed.h>
+#include <MessageEncrypted.h>
+#include <MessagePacket.h>
+#include <MessageQueue.h>
+#include <MessageShutdown.h>
+#include <Packet.h>
+
+// Standard C++11 Includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace libcomp;
+
+namespace
+{
+
+/// Clock used to schedule packets and measure latency.
+typedef std::chrono::steady_clock ReplayClock;
+
+/**
+ * Options given on the command line.
+ */
+struct ReplayOptions
+{
+    /// Host of the server to replay against.
+    String host = "127.0.0.1";
+
+    /// Port of the server to replay against.
+    uint16_t port = 10666;
+
+    /// If the captures are of a channel server.
+    bool channel = false;
+
+    /// Playback speed (0 to send as fast as possible).
+    double speed = 1.0;
+
+    /// Seconds to wait for replies after the last packet is sent.
+    uint32_t waitTime = 5;
+
+    /// Capture files to replay.
+    std::vector<String> captures;
+};
+
+/**
+ * Parser for the command line options.
+ */
+class ReplayArgumentParser : public ArgumentParser
+{
+public:
+    /**
+     * Register the options.
+     */
+    ReplayArgumentParser();
+
+    /**
+     * Parse the command line and collect the capture files.
+     * @param argc Number of arguments.
+     * @param argv Arguments.
+     * @returns true if the command line is valid; false otherwise.
+     */
+    bool Parse(int argc, const char * const argv[]) override;
+
+    /**
+     * Get the parsed options.
+     * @returns Parsed options.
+     */
+    const ReplayOptions& GetOptions() const;
+
+private:
+    /// Parsed options.
+    ReplayOptions mOptions;
+};
+
+/**
+ * Client packet to send during the replay.
+ */
+struct ReplayFrame
+{
+    /// Captured packet.
+    CaptureReader::Record record;
+
+    /// Microseconds after the first client packet it was captured at.
+    uint64_t offset;
+
+    /// Number of commands the server sent before the next client packet.
+    uint32_t replies;
+};
+
+/**
+ * Client packet that is waiting for replies.
+ */
+struct PendingReply
+{
+    /// Time the packet was sent.
+    ReplayClock::time_point sent;
+
+    /// Number of replies left.
+    uint32_t replies;
+
+    /// If the first reply has been received.
+    bool answered;
+};
+
+/**
+ * Replay of a single capture over its own connection.
+ */
+struct ReplaySession
+{
+    /// Path to the capture file.
+    String path;
+
+    /// Reader for the capture file (the frames point into it).
+    CaptureReader reader;
+
+    /// Client packets to send.
+    std::vector<ReplayFrame> frames;
+
+    /// Connection to the server.
+    std::shared_ptr<EncryptedConnection> connection;
+
+    /// Commands of the packet being sent (only used by the sender).
+    std::vector<CaptureReader::Command> commands;
+
+    /// Decompression buffer (only used by the sender).
+    std::vector<char> scratch;
+
+    /// Lock for the members below (shared with the receiver).
+    std::mutex lock;
+
+    /// Set once the connection is encrypted.
+    bool encrypted = false;
+
+    /// Set once the connection is closed.
+    bool closed = false;
+
+    /// Packets waiting for replies.
+    std::deque<PendingReply> pending;
+
+    /// Number of commands received.
+    uint64_t receivedCommands = 0;
+
+    /// Number of bytes of command data received.
+    uint64_t receivedBytes = 0;
+
+    /// Number of commands received that no packet was waiting for.
+    uint64_t unexpectedCommands = 0;
+
+    /// Time from sending a packet to its first reply (microseconds).
+    std::vector<uint64_t> latencies;
+};
+
+/**
+ * Send a captured packet on a session.
+ * @param session Session to send on.
+ * @param frame Packet to send.
+ * @param options Replay options.
+ * @param bytes Incremented by the number of bytes of command data sent.
+ * @returns Number of commands sent.
+ */
+size_t SendFrame(ReplaySession& session, const ReplayFrame& frame,
+    const ReplayOptions& options, uint64_t& bytes)
+{
+    if(!CaptureReader::GetCommands(frame.record, options.channel,
+        session.commands, session.scratch))
+    {
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(session.lock);
+
+        if(session.closed)
+        {
+            return 0;
+        }
+
+        if(0 < frame.replies)
+        {
+            session.pending.push_back({ ReplayClock::now(), frame.replies,
+                false });
+        }
+    }
+
+    // Keep the commands together in a single packet like the client did.
+    for(auto& command : session.commands)
+    {
+        Packet packet;
+        packet.WriteU16Little(command.code);
+        packet.WriteArray(command.pData, command.size);
+
+        session.connection->QueuePacket(packet);
+
+        bytes += command.size;
+    }
+
+    session.connection->FlushOutgoing();
+
+    return session.commands.size();
+}
+
+/**
+ * Handle the messages from the connections until shutdown.
+ * @param messageQueue Queue the connections post messages to.
+ * @param sessions Sessions by connection.
+ * @param changedLock Lock for @em changed.
+ * @param changed Notified after each batch of messages.
+ */
+void ReceiveMessages(const std::shared_ptr<MessageQueue<
+    Message::Message*>>& messageQueue, const std::unordered_map<
+    TcpConnection*, ReplaySession*>& sessions, std::mutex& changedLock,
+    std::condition_variable& changed)
+{
+    bool running = true;
+
+    while(running)
+    {
+        std::list<Message::Message*> messages;
+        messageQueue->DequeueAll(messages);
+
+        auto now = ReplayClock::now();
+
+        for(auto pMessage : messages)
+        {
+            std::shared_ptr<TcpConnection> connection;
+
+            auto pPacket = dynamic_cast<Message::Packet*>(pMessage);
+            auto pEncrypted = dynamic_cast<Message::Encrypted*>(pMessage);
+            auto pClosed = dynamic_cast<Message::ConnectionClosed*>(
+                pMessage);
+
+            if(nullptr != pPacket)
+            {
+                connection = pPacket->GetConnection();
+            }
+            else if(nullptr != pEncrypted)
+            {
+                connection = pEncrypted->GetConnection();
+            }
+            else if(nullptr != pClosed)
+            {
+                connection = pClosed->GetConnection();
+            }
+            else if(nullptr != dynamic_cast<Message::Shutdown*>(pMessage))
+            {
+                running = false;
+            }
+
+            auto it = sessions.find(connection.get());
+
+            if(sessions.end() != it)
+            {
+                ReplaySession& session = *it->second;
+
+                std::lock_guard<std::mutex> guard(session.lock);
+
+                if(nullptr != pPacket)
+                {
+                    session.receivedCommands++;
+                    session.receivedBytes += pPacket->GetPacket().Size();
+
+                    if(session.pending.empty())
+                    {
+                        session.unexpectedCommands++;
+                    }
+                    else
+                    {
+                        PendingReply& reply = session.pending.front();
+
+                        if(!reply.answered)
+                        {
+                            reply.answered = true;
+
+                            session.latencies.push_back(static_cast<
+                                uint64_t>(std::chrono::duration_cast<
+                                std::chrono::microseconds>(now -
+                                reply.sent).count()));
+                        }
+
+                        if(0 == --reply.replies)
+                        {
+                            session.pending.pop_front();
+                        }
+                    }
+                }
+                else if(nullptr != pEncrypted)
+                {
+                    session.encrypted = true;
+                }
+                else if(nullptr != pClosed)
+                {
+                    session.closed = true;
+                }
+            }
+
+            delete pMessage;
+        }
+
+        {
+            // Take the lock so a waiting thread can't miss the change.
+            std::lock_guard<std::mutex> guard(changedLock);
+        }
+
+        changed.notify_all();
+    }
+}
+
+/**
+ * Load the client packets of a capture.
+ * @param session Session to load the capture for.
+ * @param channel If the capture is of a channel server.
+ * @returns true if the capture was loaded; false otherwise.
+ */
+bool LoadCapture(ReplaySession& session, bool channel)
+{
+    if(!session.reader.Open(session.path))
+    {
+        LogGeneralError([&]()
+        {
+            return String("Failed to open capture file: %1\n").Arg(
+                session.path);
+        });
+
+        return false;
+    }
+
+    CaptureReader::Record record;
+    uint64_t firstMicroTime = 0;
+
+    std::vector<CaptureReader::Command> commands;
+    std::vector<char> scratch;
+
+    while(session.reader.Next(record))
+    {
+        if(HACK_SOURCE_CLIENT == record.source)
+        {
+            if(session.frames.empty())
+            {
+                firstMicroTime = record.microTime;
+            }
+
+            session.frames.push_back({ record, record.microTime -
+                firstMicroTime, 0 });
+        }
+        else if(!session.frames.empty() && CaptureReader::GetCommands(
+            record, channel, commands, scratch))
+        {
+            session.frames.back().replies += static_cast<uint32_t>(
+                commands.size());
+        }
+    }
+
+    if(!session.reader.AtEnd())
+    {
+        LogGeneralWarning([&]()
+        {
+            return String("Capture file is truncated: %1\n").Arg(
+                session.path);
+        });
+    }
+
+    return true;
+}
+
+/**
+ * Get a percentile of a sorted list of latencies.
+ * @param latencies Sorted latencies.
+ * @param percentile Percentile to get.
+ * @returns Latency in milliseconds.
+ */
+double GetPercentile(const std::vector<uint64_t>& latencies,
+    double percentile)
+{
+    if(latencies.empty())
+    {
+        return 0.0;
+    }
+
+    size_t index = static_cast<size_t>(percentile / 100.0 *
+        static_cast<double>(latencies.size() - 1) + 0.5);
+
+    return static_cast<double>(latencies[index]) / 1000.0;
+}
+
+} // namespace
+
+ReplayArgumentParser::ReplayArgumentParser()
+{
+    RegisterArgument('H', "host", ArgumentType::REQUIRED, [this](
+        Argument *pArg, const String& arg) -> bool
+    {
+        (void)pArg;
+
+        mOptions.host = arg;
+
+        return true;
+    });
+
+    RegisterArgument('p', "port", ArgumentType::REQUIRED, [this](
+        Argument *pArg, const String& arg) -> bool
+    {
+        (void)pArg;
+
+        bool ok = false;
+
+        mOptions.port = arg.ToInteger<uint16_t>(&ok);
+
+        if(!ok)
+        {
+            LogGeneralError([&]()
+            {
+                return String("Invalid port %1\n").Arg(arg);
+            });
+        }
+
+        return ok;
+    });
+
+    RegisterArgument('c', "channel", ArgumentType::NONE, [this](
+        Argument *pArg, const String& arg) -> bool
+    {
+        (void)pArg;
+        (void)arg;
+
+        mOptions.channel = true;
+
+        return true;
+    });
+
+    RegisterArgument('s', "speed", ArgumentType::REQUIRED, [this](
+        Argument *pArg, const String& arg) -> bool
+    {
+        (void)pArg;
+
+        bool ok = false;
+
+        mOptions.speed = arg.ToDecimal<double>(&ok);
+
+        if(!ok || 0.0 > mOptions.speed)
+        {
+            LogGeneralError([&]()
+            {
+                return String("Invalid speed %1\n").Arg(arg);
+            });
+
+            ok = false;
+        }
+
+        return ok;
+    });
+
+    RegisterArgument('w', "wait", ArgumentType::REQUIRED, [this](
+        Argument *pArg, const String& arg) -> bool
+    {
+        (void)pArg;
+
+        bool ok = false;
+
+        mOptions.waitTime = arg.ToInteger<uint32_t>(&ok);
+
+        if(!ok)
+        {
+            LogGeneralError([&]()
+            {
+                return String("Invalid wait time %1\n").Arg(arg);
+            });
+        }
+
+        return ok;
+    });
+}
+
+bool ReplayArgumentParser::Parse(int argc, const char * const argv[])
+{
+    if(!ArgumentParser::Parse(argc, argv))
+    {
+        return false;
+    }
+
+    mOptions.captures = GetStandardArguments();
+
+    return !mOptions.captures.empty();
+}
+
+const ReplayOptions& ReplayArgumentParser::GetOptions() const
+{
+    return mOptions;
+}
+
+int main(int argc, char *argv[])
+{
+    Log::GetSingletonPtr()->AddStandardOutputHook();
+    Log::GetSingletonPtr()->SetLogLevel(LogComponent_t::Connection,
+        Log::LOG_LEVEL_WARNING);
+
+    ReplayArgumentParser parser;
+
+    if(!parser.Parse(argc, argv))
+    {
+        std::cerr << "USAGE: " << argv[0] << " [OPTIONS] CAPTURE..."
+            << std::endl << std::endl
+            << "Replays the client packets of .hack capture files against "
+            "a server. Each" << std::endl
+            << "capture is sent on its own connection." << std::endl
+            << std::endl
+            << "  -H, --host HOST  Server to connect to (default: "
+            "127.0.0.1)." << std::endl
+            << "  -p, --port PORT  Port to connect to (default: 10666)."
+            << std::endl
+            << "  -c, --channel    Captures are of a channel server."
+            << std::endl
+            << "  -s, --speed N    Send at N times the captured speed or "
+            "0 to send as" << std::endl
+            << "                   fast as possible (default: 1)."
+            << std::endl
+            << "  -w, --wait SEC   Time to wait for replies at the end "
+            "(default: 5)." << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    const ReplayOptions& options = parser.GetOptions();
+
+    // The service must outlive the connections of the sessions.
+    asio::io_service service;
+
+    std::vector<std::unique_ptr<ReplaySession>> sessions;
+
+    for(auto& path : options.captures)
+    {
+        std::unique_ptr<ReplaySession> session(new ReplaySession);
+        session->path = path;
+
+        if(!LoadCapture(*session, options.channel))
+        {
+            return EXIT_FAILURE;
+        }
+
+        sessions.push_back(std::move(session));
+    }
+
+    // Every client packet of every capture in the order to send them.
+    std::vector<std::pair<ReplaySession*, const ReplayFrame*>> schedule;
+
+    for(auto& session : sessions)
+    {
+        for(auto& frame : session->frames)
+        {
+            schedule.push_back(std::make_pair(session.get(), &frame));
+        }
+    }
+
+    std::stable_sort(schedule.begin(), schedule.end(), [](
+        const std::pair<ReplaySession*, const ReplayFrame*>& a,
+        const std::pair<ReplaySession*, const ReplayFrame*>& b)
+    {
+        return a.second->offset < b.second->offset;
+    });
+
+    std::unique_ptr<asio::io_service::work> work(
+        new asio::io_service::work(service));
+
+    std::thread serviceThread([&service]()
+    {
+        service.run();
+    });
+
+    auto messageQueue = std::make_shared<MessageQueue<Message::Message*>>();
+
+    std::unordered_map<TcpConnection*, ReplaySession*> connections;
+
+    for(auto& session : sessions)
+    {
+        if(options.channel)
+        {
+            session->connection = std::make_shared<ChannelConnection>(
+                service);
+        }
+        else
+        {
+            session->connection = std::make_shared<LobbyConnection>(
+                service);
+        }
+
+        session->connection->SetMessageQueue(messageQueue);
+        connections[session->connection.get()] = session.get();
+    }
+
+    std::mutex changedLock;
+    std::condition_variable changed;
+
+    std::thread receiveThread([&]()
+    {
+        ReceiveMessages(messageQueue, connections, changedLock, changed);
+    });
+
+    // Wait for every connection to be encrypted before starting.
+    for(auto& session : sessions)
+    {
+        if(!session->connection->Connect(options.host, options.port))
+        {
+            std::lock_guard<std::mutex> guard(session->lock);
+            session->closed = true;
+        }
+    }
+
+    size_t connected = 0;
+
+    {
+        std::unique_lock<std::mutex> uniqueLock(changedLock);
+
+        changed.wait_for(uniqueLock, std::chrono::seconds(10), [&]()
+        {
+            connected = 0;
+
+            for(auto& session : sessions)
+            {
+                std::lock_guard<std::mutex> guard(session->lock);
+
+                if(session->encrypted && !session->closed)
+                {
+                    connected++;
+                }
+            }
+
+            return connected == sessions.size();
+        });
+    }
+
+    if(connected != sessions.size())
+    {
+        // Nothing is sent on a connection that was not established.
+        for(auto& session : sessions)
+        {
+            std::lock_guard<std::mutex> guard(session->lock);
+
+            if(!session->encrypted)
+            {
+                session->closed = true;
+            }
+        }
+
+        LogGeneralWarning([&]()
+        {
+            return String("Only %1 of %2 connections to %3:%4 were "
+                "established.\n").Arg(connected).Arg(sessions.size()).Arg(
+                options.host).Arg(options.port);
+        });
+    }
+
+    uint64_t sentFrames = 0;
+    uint64_t sentCommands = 0;
+    uint64_t sentBytes = 0;
+
+    auto start = ReplayClock::now();
+
+    for(auto& item : schedule)
+    {
+        ReplaySession& session = *item.first;
+
+        if(0.0 < options.speed)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(
+                static_cast<int64_t>(static_cast<double>(
+                item.second->offset) / options.speed)));
+        }
+
+        size_t count = SendFrame(session, *item.second, options, sentBytes);
+
+        if(0 < count)
+        {
+            sentFrames++;
+            sentCommands += count;
+        }
+    }
+
+    auto sendEnd = ReplayClock::now();
+
+    // Give the server time to answer the last packets.
+    {
+        std::unique_lock<std::mutex> uniqueLock(changedLock);
+
+        changed.wait_for(uniqueLock, std::chrono::seconds(options.waitTime),
+            [&]()
+        {
+            for(auto& session : sessions)
+            {
+                std::lock_guard<std::mutex> guard(session->lock);
+
+                if(!session->closed && !session->pending.empty())
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        });
+    }
+
+    auto end = ReplayClock::now();
+
+    for(auto& session : sessions)
+    {
+        session->connection->Close();
+    }
+
+    messageQueue->Enqueue(new Message::Shutdown);
+    receiveThread.join();
+
+    work.reset();
+    service.stop();
+    serviceThread.join();
+
+    uint64_t receivedCommands = 0;
+    uint64_t receivedBytes = 0;
+    uint64_t unexpectedCommands = 0;
+    uint64_t unanswered = 0;
+    std::vector<uint64_t> latencies;
+
+    for(auto& session : sessions)
+    {
+        receivedCommands += session->receivedCommands;
+        receivedBytes += session->receivedBytes;
+        unexpectedCommands += session->unexpectedCommands;
+
+        for(auto& reply : session->pending)
+        {
+            if(!reply.answered)
+            {
+                unanswered++;
+            }
+        }
+
+        latencies.insert(latencies.end(), session->latencies.begin(),
+            session->latencies.end());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    double sendSeconds = std::chrono::duration<double>(
+        sendEnd - start).count();
+    double totalSeconds = std::chrono::duration<double>(
+        end - start).count();
+
+    if(0.0 >= sendSeconds)
+    {
+        sendSeconds = 1e-9;
+    }
+
+    double frameRate = static_cast<double>(sentFrames) / sendSeconds;
+    double commandRate = static_cast<double>(sentCommands) / sendSeconds;
+    double byteRate = static_cast<double>(sentBytes) / sendSeconds;
+
+    std::cout << std::fixed << std::setprecision(3)
+        << "Connections:   " << connected << " of " << sessions.size()
+        << std::endl
+        << "Send time:     " << sendSeconds << " s" << std::endl
+        << "Total time:    " << totalSeconds << " s" << std::endl
+        << "Sent:          " << sentFrames << " packets, " << sentCommands
+        << " commands, " << sentBytes << " bytes" << std::endl
+        << "Received:      " << receivedCommands << " commands, "
+        << receivedBytes << " bytes (" << unexpectedCommands
+        << " unexpected)" << std::endl
+        << "Send rate:     " << frameRate << " packets/s, " << commandRate
+        << " commands/s, " << byteRate / 1048576.0 << " MiB/s" << std::endl
+        << "Replies:       " << latencies.size() << " answered, "
+        << unanswered << " unanswered" << std::endl
+        << "Latency (ms):  p50 " << GetPercentile(latencies, 50.0)
+        << ", p90 " << GetPercentile(latencies, 90.0)
+        << ", p99 " << GetPercentile(latencies, 99.0)
+        << ", p99.9 " << GetPercentile(latencies, 99.9)
+        << ", max " << GetPercentile(latencies, 100.0) << std::endl;
+
+    return 0 < connected ? EXIT_SUCCESS : EXIT_FAILURE;
+}